@@ -3,6 +3,9 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
+#include "trace.h"
+#include "bench.h"
 
 // Meta-level structures and definitions
 typedef enum {
@@ -28,6 +31,7 @@ typedef struct {
 // Adaptation policies
 typedef struct {
     char* name;
+    char* metric;               // The condition sees this metric's newest sample
     bool (*condition)(void*);
     void (*action)(void*);
     int priority;
@@ -50,8 +54,11 @@ typedef struct {
     size_t policy_count;
     MonitoringData* monitoring_data;
     size_t monitoring_data_count;
+    int resource_units;         // Replicas sharing the load, which the policies scale
 } SystemState;
 
+#define MAX_RESOURCE_UNITS 8
+
 // Initialize system state
 SystemState* init_system_state() {
     SystemState* state = (SystemState*)malloc(sizeof(SystemState));
@@ -63,6 +70,7 @@ SystemState* init_system_state() {
     state->policy_count = 0;
     state->monitoring_data = NULL;
     state->monitoring_data_count = 0;
+    state->resource_units = 1;
     return state;
 }
 
@@ -91,6 +99,10 @@ typedef struct {
     SystemState* system_state;
     void (*collect_metrics)(void*);
     void (*analyze_metrics)(void*);
+    uint64_t last_wall_ns;      // Clocks at the previous collection
+    uint64_t last_cpu_ns;
+    uint64_t latency_ns;        // Request latencies since then
+    uint64_t latency_count;
 } MonitoringEngine;
 
 // Policy management
@@ -100,15 +112,33 @@ void add_policy(SystemState* state, AdaptationPolicy policy) {
     state->policies[state->policy_count++] = policy;
 }
 
+TRACE_COUNTER_DEFINE(check_counter, "policy_checks");
+TRACE_COUNTER_DEFINE(adapt_counter, "adaptations");
+TRACE_COUNTER_DEFINE(scale_counter, "resource_scalings");
+
 // Example adaptation policies
 bool high_load_condition(void* data) {
     MonitoringData* md = (MonitoringData*)data;
     return md->value > 0.8; // 80% threshold
 }
 
+bool low_load_condition(void* data) {
+    MonitoringData* md = (MonitoringData*)data;
+    return md->value < 0.2;
+}
+
 void scale_resources(void* data) {
-    // Implement resource scaling logic
-    printf("Scaling resources due to high load\n");
+    SystemState* state = (SystemState*)data;
+    if (state->resource_units < MAX_RESOURCE_UNITS) state->resource_units++;
+    TRACE_COUNT(scale_counter, 1);
+    TRACE_INSTANT("scale_resources", state->resource_units);
+}
+
+void release_resources(void* data) {
+    SystemState* state = (SystemState*)data;
+    if (state->resource_units > 1) state->resource_units--;
+    TRACE_COUNT(scale_counter, 1);
+    TRACE_INSTANT("release_resources", state->resource_units);
 }
 
 // Reflective operations
@@ -121,36 +151,83 @@ void* get_meta_object(SystemState* state, char* name) {
     return NULL;
 }
 
+// Newest sample of a metric, or NULL before the first one
+MonitoringData* latest_metric(SystemState* state, const char* metric) {
+    for (size_t i = state->monitoring_data_count; i > 0; i--) {
+        if (strcmp(state->monitoring_data[i - 1].metric_name, metric) == 0) {
+            return &state->monitoring_data[i - 1];
+        }
+    }
+    return NULL;
+}
+
 // Dynamic adaptation implementation
 void adapt_system(AdaptationManager* manager) {
     SystemState* state = manager->system_state;
     
     for (size_t i = 0; i < state->policy_count; i++) {
         AdaptationPolicy* policy = &state->policies[i];
+        MonitoringData* sample = latest_metric(state, policy->metric);
         
-        // Check each policy's condition
-        if (policy->condition(state->monitoring_data)) {
+        // Check each policy's condition against current data
+        TRACE_COUNT(check_counter, 1);
+        if (sample && policy->condition(sample)) {
             // Execute adaptation action
+            TRACE_BEGIN(policy->name);
             policy->action(state);
-            printf("Executed adaptation policy: %s\n", policy->name);
+            TRACE_END(policy->name);
+            TRACE_COUNT(adapt_counter, 1);
         }
     }
 }
 
 // Monitoring implementation
-void collect_system_metrics(MonitoringEngine* engine) {
-    SystemState* state = engine->system_state;
-    MonitoringData new_data = {
-        .timestamp = 123456789, // Should be actual timestamp
-        .metric_name = "cpu_usage",
-        .value = 0.85 // Example value
-    };
-    
-    // Add to monitoring data
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void record_metric(SystemState* state, uint64_t timestamp, char* name, double value) {
     state->monitoring_data = realloc(state->monitoring_data,
                                    (state->monitoring_data_count + 1) * 
                                    sizeof(MonitoringData));
-    state->monitoring_data[state->monitoring_data_count++] = new_data;
+    state->monitoring_data[state->monitoring_data_count++] =
+        (MonitoringData){ .timestamp = timestamp, .metric_name = name, .value = value };
+}
+
+// Start the measurement interval the first collection reports on
+void start_monitoring(MonitoringEngine* engine) {
+    engine->last_wall_ns = clock_ns(CLOCK_MONOTONIC);
+    engine->last_cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    engine->latency_ns = engine->latency_count = 0;
+}
+
+// One request's latency, reported as a mean at the next collection
+void record_latency(MonitoringEngine* engine, uint64_t ns) {
+    engine->latency_ns += ns;
+    engine->latency_count++;
+}
+
+// cpu_usage is the CPU time the process used over the interval as a
+// share of the interval, so 1.0 is one CPU kept busy
+void collect_system_metrics(MonitoringEngine* engine) {
+    SystemState* state = engine->system_state;
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    uint64_t cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t wall = now - engine->last_wall_ns;
+    
+    if (wall > 0) {
+        record_metric(state, now, "cpu_usage",
+                      (double)(cpu - engine->last_cpu_ns) / wall);
+    }
+    if (engine->latency_count > 0) {
+        record_metric(state, now, "request_latency_us",
+                      engine->latency_ns / 1000.0 / engine->latency_count);
+    }
+    engine->last_wall_ns = now;
+    engine->last_cpu_ns = cpu;
+    engine->latency_ns = engine->latency_count = 0;
 }
 
 // Reflection utilities
@@ -165,6 +242,34 @@ void* invoke_method(void* object, char* method_name, void* args) {
     return NULL;
 }
 
+// Simulated service: one request is REQUEST_NS of CPU, a period lasts
+// PERIOD_NS and the rest of it is idle
+#define REQUEST_NS 100000ull
+#define PERIOD_NS 20000000ull
+
+static void serve_request(MonitoringEngine* engine) {
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    uint64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    while (clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start < REQUEST_NS) {}
+    record_latency(engine, clock_ns(CLOCK_MONOTONIC) - start);
+}
+
+// Serve a period's demand, given in CPUs; the units share it, so this
+// process, one of them, does demand / resource_units of the work
+static void run_period(MonitoringEngine* engine, double demand) {
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    uint64_t requests = (uint64_t)(demand / engine->system_state->resource_units *
+                                   PERIOD_NS / REQUEST_NS);
+    for (uint64_t i = 0; i < requests; i++) serve_request(engine);
+    
+    uint64_t elapsed = clock_ns(CLOCK_MONOTONIC) - start;
+    if (elapsed < PERIOD_NS) {
+        uint64_t idle = PERIOD_NS - elapsed;
+        struct timespec ts = { .tv_sec = idle / 1000000000ull, .tv_nsec = idle % 1000000000ull };
+        nanosleep(&ts, NULL);
+    }
+}
+
 // Example adaptation scenario
 void example_adaptive_scenario() {
     // Initialize system
@@ -184,26 +289,44 @@ void example_adaptive_scenario() {
         .analyze_metrics = NULL
     };
     
-    // Define adaptation policy
+    // Define adaptation policies
     AdaptationPolicy policy = {
         .name = "high_load_scaling",
+        .metric = "cpu_usage",
         .condition = high_load_condition,
         .action = scale_resources,
         .priority = 1
     };
+    AdaptationPolicy release = {
+        .name = "low_load_release",
+        .metric = "cpu_usage",
+        .condition = low_load_condition,
+        .action = release_resources,
+        .priority = 2
+    };
     
-    // Add policy to system
+    // Add policies to system
     add_policy(state, policy);
+    add_policy(state, release);
     
-    // Simulate system operation
-    for (int i = 0; i < 5; i++) {
+    // Simulate system operation under a load that rises and falls
+    static const double demand[] = { 0.5, 0.9, 1.7, 1.7, 1.2, 0.3, 0.3 };
+    start_monitoring(&engine);
+    for (int i = 0; i < (int)(sizeof(demand) / sizeof(demand[0])); i++) {
+        run_period(&engine, demand[i]);
+        
         // Collect metrics
         collect_system_metrics(&engine);
+        MonitoringData* cpu = latest_metric(state, "cpu_usage");
+        MonitoringData* latency = latest_metric(state, "request_latency_us");
         
         // Perform adaptation if needed
+        int units = state->resource_units;
         adapt_system(&manager);
         
-        printf("System iteration %d completed\n", i);
+        printf("System iteration %d completed: demand %.1f, cpu_usage %.2f, "
+               "latency %.0f us, units %d -> %d\n", i, demand[i], cpu ? cpu->value : 0.0,
+               latency ? latency->value : 0.0, units, state->resource_units);
     }
     
     // Cleanup
@@ -214,7 +337,45 @@ void example_adaptive_scenario() {
     free(state);
 }
 
-int main() {
+// Cross-model benchmark suite (bench.h). Adaptation has none of the
+// kernel workloads; what it costs is one monitoring and policy cycle.
+static uint64_t bench_adaptation_cycle(void* ctx, uint32_t n) {
+    AdaptationManager* manager = ctx;
+    SystemState* state = manager->system_state;
+    MonitoringEngine engine = { .system_state = state };
+    
+    start_monitoring(&engine);
+    state->monitoring_data_count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        record_latency(&engine, REQUEST_NS);
+        collect_system_metrics(&engine);
+        adapt_system(manager);
+    }
+    return n;
+}
+
+int run_benchmark_suite(void) {
+    SystemState* state = init_system_state();
+    AdaptationManager manager = { .system_state = state };
+    add_policy(state, (AdaptationPolicy){ .name = "high_load_scaling", .metric = "cpu_usage",
+                                          .condition = high_load_condition,
+                                          .action = scale_resources, .priority = 1 });
+    add_policy(state, (AdaptationPolicy){ .name = "low_load_release", .metric = "cpu_usage",
+                                          .condition = low_load_condition,
+                                          .action = release_resources, .priority = 2 });
+    
+    bench_begin("adaptive");
+    bench_run("adaptation_cycle", "collect_adapt", bench_adaptation_cycle, &manager, 100000);
+    free(state->policies);
+    free(state->monitoring_data);
+    free(state);
+    return bench_end();
+}
+
+// "bench" runs only the benchmark suite
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) return run_benchmark_suite();
     example_adaptive_scenario();
+    trace_report();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,266 @@
+/* Benchmark harness shared by the kernel models.
+ *
+ * Every model that supports them runs the same workloads, so the numbers
+ * can be compared across architectures:
+ *
+ *   context_switch    switching from one thread of control to another
+ *   ipc_roundtrip     a request to another process and its reply
+ *   page_alloc_free   allocating one page and giving it back
+ *   syscall_dispatch  entering the kernel for one call and returning
+ *   resource_check    one protection or ownership check
+ *
+ * A workload is a function that performs n operations and returns how
+ * many it did, 0 on failure. bench_run() times it in batches, each sized
+ * so that it runs for about BENCH_SAMPLE_NS, so the clock read is
+ * amortised. The warmup batches are discarded, and the percentiles are
+ * taken over the per-operation means of the remaining batches.
+ *
+ * The environment controls a run:
+ *   BENCH_SAMPLES    batches measured per workload (default 30)
+ *   BENCH_WARMUP     batches discarded first (default 3)
+ *   BENCH_FILE       append one JSON object per result to this file; runs
+ *                    of every model into one file give the comparison
+ *   BENCH_BASELINE   a BENCH_FILE from an earlier run; a median more than
+ *                    BENCH_TOLERANCE percent (default 10) above the
+ *                    baseline's is a regression, and bench_end() fails
+ *
+ * Header-only for the same reason as trace.h: each model builds from its
+ * one source file.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"  // For trace_clock_ns
+
+#define BENCH_CONTEXT_SWITCH "context_switch"
+#define BENCH_IPC_ROUNDTRIP "ipc_roundtrip"
+#define BENCH_PAGE_ALLOC_FREE "page_alloc_free"
+#define BENCH_SYSCALL_DISPATCH "syscall_dispatch"
+#define BENCH_RESOURCE_CHECK "resource_check"
+
+#define BENCH_SAMPLE_NS 1000000ull  // Target time per batch
+#define BENCH_MAX_SAMPLES 1000
+#define BENCH_MAX_RESULTS 64
+
+typedef uint64_t (*bench_fn_t)(void* ctx, uint32_t n);
+
+typedef struct {
+    const char* workload;
+    const char* variant;        // How this model does it
+    uint32_t batch;             // Operations per batch
+    uint32_t samples;
+    double min, p50, p90, p99, max, mean, stddev;  // ns per operation
+    double baseline;            // Baseline median, 0 if none
+    bool regressed;
+} bench_result_t;
+
+typedef struct {
+    const char* model;
+    uint32_t samples;
+    uint32_t warmup;
+    double tolerance;           // Allowed slowdown over the baseline, 0.1 = 10%
+    FILE* json;
+    const char* baseline_path;
+    uint32_t result_count;
+    uint32_t failures;
+    bench_result_t results[BENCH_MAX_RESULTS];
+    double times[BENCH_MAX_SAMPLES];
+} bench_state_t;
+
+static bench_state_t bench_state;
+
+static inline uint32_t bench_env(const char* name, uint32_t fallback, uint32_t limit) {
+    const char* value = getenv(name);
+    long n = value ? strtol(value, NULL, 10) : 0;
+    if (n <= 0) return fallback;
+    return n > (long)limit ? limit : (uint32_t)n;
+}
+
+static inline int bench_compare(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values, 0 < p <= 1
+static inline double bench_percentile(const double* sorted, uint32_t count, double p) {
+    uint32_t rank = (uint32_t)(p * count);
+    if (rank < p * count || rank == 0) rank++;
+    return sorted[rank - 1];
+}
+
+// Newton's method, so the models need not link libm
+static inline double bench_sqrt(double x) {
+    double r = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 64 && x > 0.0; i++) r = 0.5 * (r + x / r);
+    return x > 0.0 ? r : 0.0;
+}
+
+/* Baseline */
+
+// Numeric field of one of our JSON lines, or -1
+static inline double bench_json_number(const char* line, const char* key) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char* p = strstr(line, pattern);
+    return p ? strtod(p + strlen(pattern), NULL) : -1.0;
+}
+
+static inline bool bench_json_matches(const char* line, const char* key, const char* value) {
+    char pattern[160];
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"%s\"", key, value);
+    return strstr(line, pattern) != NULL;
+}
+
+// Median the baseline file recorded for this result, or 0. The last
+// matching line wins, so a file that runs append to keeps working.
+static inline double bench_baseline_p50(const bench_result_t* r) {
+    FILE* f = bench_state.baseline_path ? fopen(bench_state.baseline_path, "r") : NULL;
+    if (!f) return 0.0;
+    char line[1024];
+    double p50 = 0.0;
+    while (fgets(line, sizeof(line), f)) {
+        if (bench_json_matches(line, "model", bench_state.model) &&
+            bench_json_matches(line, "workload", r->workload) &&
+            bench_json_matches(line, "variant", r->variant)) {
+            double value = bench_json_number(line, "p50_ns");
+            if (value > 0) p50 = value;
+        }
+    }
+    fclose(f);
+    return p50;
+}
+
+/* Running */
+
+static inline void bench_begin(const char* model) {
+    bench_state.model = model;
+    bench_state.samples = bench_env("BENCH_SAMPLES", 30, BENCH_MAX_SAMPLES);
+    bench_state.warmup = bench_env("BENCH_WARMUP", 3, BENCH_MAX_SAMPLES);
+    bench_state.tolerance = bench_env("BENCH_TOLERANCE", 10, 1000) / 100.0;
+    bench_state.baseline_path = getenv("BENCH_BASELINE");
+    bench_state.result_count = bench_state.failures = 0;
+    bench_state.json = NULL;
+
+    const char* path = getenv("BENCH_FILE");
+    if (path && !(bench_state.json = fopen(path, "a"))) {
+        printf("Cannot open %s, results go to the table only\n", path);
+    }
+
+    printf("%s: %u batches of ~%llu ms after %u warmup, ns per operation\n",
+           model, bench_state.samples, BENCH_SAMPLE_NS / 1000000, bench_state.warmup);
+    printf("%-17s %-18s %9s %9s %9s %9s %9s %9s\n", "workload", "variant",
+           "batch", "min", "p50", "p90", "p99", "max");
+}
+
+// Operations per batch: grow n until one call takes BENCH_SAMPLE_NS,
+// at most 16x a step and up to max_batch. 0 if the workload failed.
+static inline uint32_t bench_calibrate(bench_fn_t fn, void* ctx, uint32_t max_batch) {
+    uint32_t n = 1;
+    for (;;) {
+        uint64_t start = trace_clock_ns();
+        uint64_t ops = fn(ctx, n);
+        uint64_t elapsed = trace_clock_ns() - start;
+        if (!ops) return 0;
+        if (elapsed >= BENCH_SAMPLE_NS || n >= max_batch) return n;
+        uint64_t next = elapsed ? n * BENCH_SAMPLE_NS / elapsed + 1 : (uint64_t)n * 16;
+        if (next > (uint64_t)n * 16) next = (uint64_t)n * 16;
+        n = next > max_batch ? max_batch : (uint32_t)next;
+    }
+}
+
+static inline void bench_emit(const bench_result_t* r) {
+    printf("%-17s %-18s %9u %9.1f %9.1f %9.1f %9.1f %9.1f", r->workload, r->variant,
+           r->batch, r->min, r->p50, r->p90, r->p99, r->max);
+    if (r->baseline > 0) {
+        printf("  %+.1f%% vs baseline%s", 100.0 * (r->p50 / r->baseline - 1.0),
+               r->regressed ? " REGRESSION" : "");
+    }
+    printf("\n");
+    if (bench_state.json) {
+        fprintf(bench_state.json,
+                "{\"model\":\"%s\",\"workload\":\"%s\",\"variant\":\"%s\",\"batch\":%u,"
+                "\"samples\":%u,\"min_ns\":%.2f,\"p50_ns\":%.2f,\"p90_ns\":%.2f,"
+                "\"p99_ns\":%.2f,\"max_ns\":%.2f,\"mean_ns\":%.2f,\"stddev_ns\":%.2f",
+                bench_state.model, r->workload, r->variant, r->batch, r->samples,
+                r->min, r->p50, r->p90, r->p99, r->max, r->mean, r->stddev);
+        if (r->baseline > 0) {
+            fprintf(bench_state.json, ",\"baseline_p50_ns\":%.2f,\"regressed\":%s",
+                    r->baseline, r->regressed ? "true" : "false");
+        }
+        fprintf(bench_state.json, "}\n");
+    }
+}
+
+// Measure one workload and record the result. max_batch caps the
+// operations per call, for workloads whose state cannot grow unbounded.
+static inline bool bench_run(const char* workload, const char* variant,
+                             bench_fn_t fn, void* ctx, uint32_t max_batch) {
+    uint32_t batch = bench_calibrate(fn, ctx, max_batch ? max_batch : UINT32_MAX);
+    bool ok = batch != 0;
+    for (uint32_t i = 0; ok && i < bench_state.warmup; i++) ok = fn(ctx, batch) != 0;
+
+    uint32_t count = 0;
+    while (ok && count < bench_state.samples) {
+        uint64_t start = trace_clock_ns();
+        uint64_t ops = fn(ctx, batch);
+        uint64_t elapsed = trace_clock_ns() - start;
+        ok = ops != 0;
+        if (ok) bench_state.times[count++] = (double)elapsed / ops;
+    }
+    if (!ok || bench_state.result_count == BENCH_MAX_RESULTS) {
+        printf("%-17s %-18s failed\n", workload, variant);
+        bench_state.failures++;
+        return false;
+    }
+
+    double* t = bench_state.times;
+    double sum = 0.0, squares = 0.0;
+    for (uint32_t i = 0; i < count; i++) sum += t[i];
+    double mean = sum / count;
+    for (uint32_t i = 0; i < count; i++) squares += (t[i] - mean) * (t[i] - mean);
+    qsort(t, count, sizeof(double), bench_compare);
+
+    bench_result_t* r = &bench_state.results[bench_state.result_count++];
+    *r = (bench_result_t){
+        .workload = workload, .variant = variant, .batch = batch, .samples = count,
+        .min = t[0], .p50 = bench_percentile(t, count, 0.5),
+        .p90 = bench_percentile(t, count, 0.9), .p99 = bench_percentile(t, count, 0.99),
+        .max = t[count - 1], .mean = mean, .stddev = bench_sqrt(squares / count),
+    };
+    r->baseline = bench_baseline_p50(r);
+    r->regressed = r->baseline > 0 && r->p50 > r->baseline * (1.0 + bench_state.tolerance);
+    bench_emit(r);
+    return true;
+}
+
+// Median of a recorded result, or 0; for models that derive one number
+// from others
+static inline double bench_result_p50(const char* workload, const char* variant) {
+    for (uint32_t i = 0; i < bench_state.result_count; i++) {
+        const bench_result_t* r = &bench_state.results[i];
+        if (strcmp(r->workload, workload) == 0 && strcmp(r->variant, variant) == 0) return r->p50;
+    }
+    return 0.0;
+}
+
+// Finish the run; the exit status for main, nonzero on any failure or
+// regression
+static inline int bench_end(void) {
+    uint32_t regressions = 0;
+    for (uint32_t i = 0; i < bench_state.result_count; i++) {
+        regressions += bench_state.results[i].regressed;
+    }
+    if (bench_state.json) fclose(bench_state.json);
+    bench_state.json = NULL;
+    if (regressions || bench_state.failures) {
+        printf("%u regression(s), %u failure(s)\n", regressions, bench_state.failures);
+    }
+    return regressions || bench_state.failures ? 1 : 0;
+}
+
+#endif /* BENCH_H */
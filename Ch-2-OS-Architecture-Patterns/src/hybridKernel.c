@@ -1,12 +1,29 @@
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "trace.h"
+#include "bench.h"
 
 // Constants
 #define PAGE_SIZE 4096
-#define MAX_MESSAGES 100
+#define MAX_MESSAGES 64         // Per mailbox, at most 256
+#define MAX_PROCESSES 64        // PIDs index the mailbox table
 #define MAX_PROCESS_NAME 32
+#define CACHE_LINE_SIZE 64
+#define ANY_SENDER 0            // Sender id matching every message
+#define RECEIVE_SPIN_LIMIT 16   // Yields before a blocked receiver sleeps
+#define LATENCY_SAMPLE 64       // Sends per mailbox per latency sample
+
+// IPC status codes. The IPC path reports errors only through these.
+#define IPC_OK 0
+#define IPC_ERROR -1            // NULL message or no such process
+#define IPC_FULL -2             // Receiver's mailbox is full
+#define IPC_EMPTY -3            // Nothing to receive
 
 // Process Management Structures
 typedef struct process {
@@ -28,27 +45,88 @@ typedef struct message {
     uint8_t data[256];
 } message_t;
 
+// Per-process mailbox. Messages sit in slots; order holds slot numbers
+// in arrival order, so a selective receive can take one from the middle
+// by shifting a few bytes instead of whole messages. Each mailbox has its
+// own lock and its own cache lines, so traffic to different receivers
+// never contends.
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;
+    pthread_cond_t arrived;          // Signalled when a message is queued
+    bool open;                       // The PID belongs to a live process
+    uint32_t head;                   // Index in order of the oldest message
+    uint32_t count;                  // Messages queued
+    uint32_t waiters;                // Receivers blocked on arrived
+    uint32_t free_count;
+    uint8_t order[MAX_MESSAGES];     // Ring of slot numbers, oldest first
+    uint8_t free_slots[MAX_MESSAGES];
+    uint32_t sent;                   // Messages queued, for sampling
+    uint64_t sent_at[MAX_MESSAGES];  // Trace clock at send by slot, 0 if unsampled
+    message_t* slots;
+} mailbox_t;
+
 // Global Variables
 static process_t* process_list = NULL;
 static uint32_t next_pid = 1;
 static page_t* free_pages = NULL;
-static message_t message_queue[MAX_MESSAGES];
-static uint32_t queue_head = 0, queue_tail = 0;
+static mailbox_t mailboxes[MAX_PROCESSES];
+
+// With big_kernel_lock set every mailbox is guarded by kernel_lock, as
+// one kernel-wide queue would be; the benchmark compares the two
+static bool big_kernel_lock = false;
+static pthread_mutex_t kernel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline pthread_mutex_t* mailbox_lock(mailbox_t* mb) {
+    return big_kernel_lock ? &kernel_lock : &mb->lock;
+}
+
+static bool mailbox_open(uint32_t pid) {
+    mailbox_t* mb = &mailboxes[pid];
+    mb->slots = malloc(MAX_MESSAGES * sizeof(message_t));
+    if (!mb->slots) return false;
+    pthread_mutex_init(&mb->lock, NULL);
+    pthread_cond_init(&mb->arrived, NULL);
+    mb->head = mb->count = mb->waiters = 0;
+    mb->free_count = MAX_MESSAGES;
+    for (uint32_t i = 0; i < MAX_MESSAGES; i++) mb->free_slots[i] = (uint8_t)(MAX_MESSAGES - 1 - i);
+    mb->open = true;
+    return true;
+}
+
+static void mailbox_close(uint32_t pid) {
+    mailbox_t* mb = &mailboxes[pid];
+    if (!mb->open) return;
+    mb->open = false;
+    pthread_cond_destroy(&mb->arrived);
+    pthread_mutex_destroy(&mb->lock);
+    free(mb->slots);
+    mb->slots = NULL;
+}
 
 // Process Management Functions
-process_t* create_process(const char* name) {
+static process_t* process_alloc(const char* name) {
+    if (next_pid >= MAX_PROCESSES) return NULL;
     process_t* process = malloc(sizeof(process_t));
-    if (!process) {
-        printf("Failed to allocate process\n");
+    if (!process) return NULL;
+    if (!mailbox_open(next_pid)) {
+        free(process);
         return NULL;
     }
-    
+
     process->pid = next_pid++;
     strncpy(process->name, name, MAX_PROCESS_NAME - 1);
     process->name[MAX_PROCESS_NAME - 1] = '\0';
     process->next = process_list;
     process_list = process;
-    
+    return process;
+}
+
+process_t* create_process(const char* name) {
+    process_t* process = process_alloc(name);
+    if (!process) {
+        printf("Failed to allocate process\n");
+        return NULL;
+    }
     printf("Created process: %s (PID: %u)\n", process->name, process->pid);
     return process;
 }
@@ -62,12 +140,16 @@ void schedule_process(process_t* process) {
 }
 
 // Memory Management Functions
+TRACE_COUNTER_DEFINE(reused_counter, "pages_reused");
+TRACE_COUNTER_DEFINE(new_page_counter, "pages_allocated_new");
+TRACE_COUNTER_DEFINE(freed_counter, "pages_freed");
+
 page_t* allocate_page(void) {
     if (free_pages) {
         page_t* page = free_pages;
         free_pages = free_pages->next;
         memset(page->data, 0, PAGE_SIZE);
-        printf("Allocated page from free list\n");
+        TRACE_COUNT(reused_counter, 1);
         return page;
     }
     
@@ -79,7 +161,7 @@ page_t* allocate_page(void) {
     
     memset(new_page->data, 0, PAGE_SIZE);
     new_page->next = NULL;
-    printf("Allocated new page\n");
+    TRACE_COUNT(new_page_counter, 1);
     return new_page;
 }
 
@@ -91,42 +173,170 @@ void free_page(page_t* page) {
     
     page->next = free_pages;
     free_pages = page;
-    printf("Page freed and added to free list\n");
+    TRACE_COUNT(freed_counter, 1);
 }
 
 // Inter-Process Communication Functions
-int send_message(message_t* msg) {
-    if (!msg) {
-        printf("Cannot send NULL message\n");
-        return -1;
+
+// Latency is sampled per mailbox, under its lock, so receivers on
+// different mailboxes do not contend on the histogram
+TRACE_HISTOGRAM_DEFINE(latency_hist, "ipc_latency_sampled");
+TRACE_HISTOGRAM_DEFINE(sleep_hist, "receiver_sleep");
+TRACE_COUNTER_DEFINE(full_counter, "sends_refused_full");
+TRACE_COUNTER_DEFINE(sleep_counter, "receiver_sleeps");
+
+// Mailbox of a live process, or NULL
+static inline mailbox_t* mailbox_of(uint32_t pid) {
+    if (pid >= MAX_PROCESSES || !mailboxes[pid].open) return NULL;
+    return &mailboxes[pid];
+}
+
+// Queue a copy of msg; the caller holds the mailbox lock
+static inline int mailbox_put(mailbox_t* mb, const message_t* msg) {
+    if (mb->count == MAX_MESSAGES) return IPC_FULL;
+    uint8_t slot = mb->free_slots[--mb->free_count];
+    mb->slots[slot] = *msg;
+    mb->sent_at[slot] = mb->sent++ % LATENCY_SAMPLE == 0 ? TRACE_CLOCK() : 0;
+    mb->order[(mb->head + mb->count++) % MAX_MESSAGES] = slot;
+    return IPC_OK;
+}
+
+// Copy out and remove the message at position i in arrival order,
+// closing the gap; the caller holds the mailbox lock
+static inline void mailbox_take(mailbox_t* mb, uint32_t i, message_t* out) {
+    uint8_t slot = mb->order[(mb->head + i) % MAX_MESSAGES];
+    *out = mb->slots[slot];
+    if (mb->sent_at[slot]) TRACE_HIST(latency_hist, TRACE_CLOCK() - mb->sent_at[slot]);
+    mb->free_slots[mb->free_count++] = slot;
+    if (i == 0) {
+        mb->head = (mb->head + 1) % MAX_MESSAGES;
+    } else {
+        for (uint32_t j = i + 1; j < mb->count; j++) {
+            mb->order[(mb->head + j - 1) % MAX_MESSAGES] = mb->order[(mb->head + j) % MAX_MESSAGES];
+        }
     }
-    
-    if ((queue_tail + 1) % MAX_MESSAGES == queue_head) {
-        printf("Message queue is full\n");
-        return -1;
+    mb->count--;
+}
+
+// Position of the oldest message from sender, or -1
+static inline int mailbox_find(const mailbox_t* mb, uint32_t sender_id) {
+    if (sender_id == ANY_SENDER) return mb->count ? 0 : -1;
+    for (uint32_t i = 0; i < mb->count; i++) {
+        if (mb->slots[mb->order[(mb->head + i) % MAX_MESSAGES]].sender_id == sender_id) return (int)i;
     }
-    
-    message_queue[queue_tail] = *msg;
-    queue_tail = (queue_tail + 1) % MAX_MESSAGES;
-    printf("Message sent from PID %u to PID %u\n", msg->sender_id, msg->receiver_id);
-    return 0;
+    return -1;
 }
 
-message_t* receive_message(uint32_t receiver_id) {
-    if (queue_head == queue_tail) {
-        printf("Message queue is empty\n");
-        return NULL;
+static inline void mailbox_notify(mailbox_t* mb) {
+    // A selective receiver may not want this message, so with several
+    // waiting every one of them has to look
+    if (mb->waiters == 1) pthread_cond_signal(&mb->arrived);
+    else if (mb->waiters) pthread_cond_broadcast(&mb->arrived);
+}
+
+// Wait with the mailbox lock held for a send to arrive. The first few
+// times it only yields, so senders get to run and a busy receiver drains
+// batches rather than sleeping and being woken for every message.
+static void mailbox_wait(mailbox_t* mb, pthread_mutex_t* lock, uint32_t spins) {
+    if (spins < RECEIVE_SPIN_LIMIT) {
+        pthread_mutex_unlock(lock);
+        sched_yield();
+        pthread_mutex_lock(lock);
+        return;
     }
-    
-    message_t* msg = &message_queue[queue_head];
-    if (msg->receiver_id != receiver_id) {
-        printf("No messages for PID %u\n", receiver_id);
-        return NULL;
+    TRACE_COUNT(sleep_counter, 1);
+    TRACE_BEGIN("mailbox sleep");
+    uint64_t start = TRACE_CLOCK();
+    mb->waiters++;
+    pthread_cond_wait(&mb->arrived, lock);
+    mb->waiters--;
+    TRACE_HIST(sleep_hist, TRACE_CLOCK() - start);
+    TRACE_END("mailbox sleep");
+}
+
+// Copy msg into its receiver's mailbox. Returns IPC_OK, IPC_FULL or
+// IPC_ERROR; nothing is logged.
+int send_message(const message_t* msg) {
+    if (!msg) return IPC_ERROR;
+    mailbox_t* mb = mailbox_of(msg->receiver_id);
+    if (!mb) return IPC_ERROR;
+
+    pthread_mutex_lock(mailbox_lock(mb));
+    int status = mailbox_put(mb, msg);
+    if (status == IPC_OK) mailbox_notify(mb);
+    pthread_mutex_unlock(mailbox_lock(mb));
+    if (status == IPC_FULL) TRACE_COUNT(full_counter, 1);
+    return status;
+}
+
+// Send msgs in order, taking each receiver's lock once per run of
+// messages to it. Returns how many were queued; it stops at the first
+// that fails.
+uint32_t send_messages(const message_t* msgs, uint32_t count) {
+    uint32_t sent = 0;
+    while (sent < count) {
+        mailbox_t* mb = mailbox_of(msgs[sent].receiver_id);
+        if (!mb) break;
+        uint32_t run = sent;
+        pthread_mutex_lock(mailbox_lock(mb));
+        while (run < count && msgs[run].receiver_id == msgs[sent].receiver_id &&
+               mailbox_put(mb, &msgs[run]) == IPC_OK) {
+            run++;
+        }
+        if (run > sent) mailbox_notify(mb);
+        pthread_mutex_unlock(mailbox_lock(mb));
+        bool stalled = run < count && msgs[run].receiver_id == msgs[sent].receiver_id;
+        sent = run;
+        if (stalled) {
+            TRACE_COUNT(full_counter, 1);
+            break;  // Mailbox full
+        }
     }
-    
-    queue_head = (queue_head + 1) % MAX_MESSAGES;
-    printf("Message received by PID %u\n", receiver_id);
-    return msg;
+    return sent;
+}
+
+// Take the oldest message from sender_id (ANY_SENDER for any) out of
+// receiver_id's mailbox into out. Other messages are left where they are,
+// so one that nobody is asking for never holds the rest up. With block
+// set it waits for a match; otherwise it returns IPC_EMPTY.
+int receive_message_from(uint32_t receiver_id, uint32_t sender_id, message_t* out, bool block) {
+    mailbox_t* mb = mailbox_of(receiver_id);
+    if (!mb || !out) return IPC_ERROR;
+
+    pthread_mutex_t* lock = mailbox_lock(mb);
+    pthread_mutex_lock(lock);
+    int i;
+    for (uint32_t spins = 0; (i = mailbox_find(mb, sender_id)) < 0 && block; spins++) {
+        mailbox_wait(mb, lock, spins);
+    }
+    if (i >= 0) mailbox_take(mb, (uint32_t)i, out);
+    pthread_mutex_unlock(lock);
+    return i >= 0 ? IPC_OK : IPC_EMPTY;
+}
+
+// Receive the oldest message for receiver_id without blocking. The
+// message is copied out, so later sends cannot overwrite it.
+int receive_message(uint32_t receiver_id, message_t* out) {
+    return receive_message_from(receiver_id, ANY_SENDER, out, false);
+}
+
+// Drain up to max messages under one lock acquisition. With block set it
+// waits until at least one has arrived. Returns the number received.
+uint32_t receive_messages(uint32_t receiver_id, message_t* out, uint32_t max, bool block) {
+    mailbox_t* mb = mailbox_of(receiver_id);
+    if (!mb || !out) return 0;
+
+    pthread_mutex_t* lock = mailbox_lock(mb);
+    pthread_mutex_lock(lock);
+    for (uint32_t spins = 0; mb->count == 0 && block && max; spins++) {
+        mailbox_wait(mb, lock, spins);
+    }
+    uint32_t n = 0;
+    while (n < max && mb->count) {
+        mailbox_take(mb, 0, &out[n++]);
+    }
+    pthread_mutex_unlock(lock);
+    return n;
 }
 
 // Clean up function to free allocated memory
@@ -135,6 +345,7 @@ void cleanup(void) {
     while (process_list) {
         process_t* temp = process_list;
         process_list = process_list->next;
+        mailbox_close(temp->pid);
         free(temp);
     }
     
@@ -146,13 +357,223 @@ void cleanup(void) {
     }
 }
 
-int main(void) {
+/* IPC throughput benchmark: sender threads stream messages to receiver
+ * threads, each sender spreading its messages evenly over every
+ * receiver. Receivers block until messages arrive and check that each
+ * sender's messages reach them in order. */
+#define IPC_BENCH_MESSAGES 1000000  // Per run, over all senders
+#define IPC_BENCH_MAX_THREADS 8
+#define IPC_BENCH_MAX_BATCH 16
+
+typedef struct {
+    uint32_t pid;
+    const uint32_t* peers;   // Receiver PIDs, for a sender
+    uint32_t peer_count;
+    uint32_t messages;       // To send or to receive
+    uint32_t batch;
+    bool in_order;
+    pthread_t thread;
+} ipc_bench_thread_t;
+
+static void* ipc_bench_sender(void* arg) {
+    ipc_bench_thread_t* t = arg;
+    message_t msgs[IPC_BENCH_MAX_BATCH];
+    trace_thread_name("ipc_sender");
+    for (uint32_t seq = 0; seq < t->messages; seq += t->batch) {
+        uint32_t receiver = t->peers[(seq / t->batch) % t->peer_count];
+        for (uint32_t i = 0; i < t->batch; i++) {
+            msgs[i].sender_id = t->pid;
+            msgs[i].receiver_id = receiver;
+            uint32_t n = seq + i;
+            memcpy(msgs[i].data, &n, sizeof(n));
+        }
+        if (t->batch == 1) {
+            while (send_message(&msgs[0]) == IPC_FULL) sched_yield();
+            continue;
+        }
+        for (uint32_t sent = 0; sent < t->batch; ) {
+            sent += send_messages(&msgs[sent], t->batch - sent);
+            if (sent < t->batch) sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void* ipc_bench_receiver(void* arg) {
+    ipc_bench_thread_t* t = arg;
+    message_t msgs[IPC_BENCH_MAX_BATCH];
+    int64_t last[MAX_PROCESSES];
+    trace_thread_name("ipc_receiver");
+    for (uint32_t i = 0; i < MAX_PROCESSES; i++) last[i] = -1;
+    t->in_order = true;
+    for (uint32_t received = 0; received < t->messages; ) {
+        uint32_t n = 1;
+        if (t->batch == 1) receive_message_from(t->pid, ANY_SENDER, &msgs[0], true);
+        else n = receive_messages(t->pid, msgs, t->batch, true);
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t seq;
+            memcpy(&seq, msgs[i].data, sizeof(seq));
+            if ((int64_t)seq <= last[msgs[i].sender_id]) t->in_order = false;
+            last[msgs[i].sender_id] = seq;
+        }
+        received += n;
+    }
+    return NULL;
+}
+
+// One run; returns messages per second, or 0 if any arrived out of order
+static double ipc_bench_run(process_t** senders, uint32_t sender_count,
+                            process_t** receivers, uint32_t receiver_count, uint32_t batch) {
+    ipc_bench_thread_t s[IPC_BENCH_MAX_THREADS], r[IPC_BENCH_MAX_THREADS];
+    uint32_t peers[IPC_BENCH_MAX_THREADS];
+    uint32_t chunk = batch * receiver_count;
+    uint32_t per_sender = IPC_BENCH_MESSAGES / sender_count / chunk * chunk;
+
+    for (uint32_t i = 0; i < receiver_count; i++) {
+        peers[i] = receivers[i]->pid;
+        r[i] = (ipc_bench_thread_t){ .pid = receivers[i]->pid, .batch = batch,
+                                     .messages = per_sender / receiver_count * sender_count };
+    }
+    for (uint32_t i = 0; i < sender_count; i++) {
+        s[i] = (ipc_bench_thread_t){ .pid = senders[i]->pid, .peers = peers,
+                                     .peer_count = receiver_count, .messages = per_sender, .batch = batch };
+    }
+
+    uint64_t start = trace_clock_ns();
+    for (uint32_t i = 0; i < receiver_count; i++) pthread_create(&r[i].thread, NULL, ipc_bench_receiver, &r[i]);
+    for (uint32_t i = 0; i < sender_count; i++) pthread_create(&s[i].thread, NULL, ipc_bench_sender, &s[i]);
+    for (uint32_t i = 0; i < sender_count; i++) pthread_join(s[i].thread, NULL);
+    bool in_order = true;
+    for (uint32_t i = 0; i < receiver_count; i++) {
+        pthread_join(r[i].thread, NULL);
+        in_order &= r[i].in_order;
+    }
+    double seconds = (trace_clock_ns() - start) / 1e9;
+    return in_order ? per_sender * sender_count / seconds : 0.0;
+}
+
+void benchmark_ipc(void) {
+    static const uint32_t shapes[][2] = { {1, 1}, {4, 4}, {8, 8}, {8, 1} };
+    static const uint32_t batches[] = { 1, IPC_BENCH_MAX_BATCH };
+    process_t* senders[IPC_BENCH_MAX_THREADS];
+    process_t* receivers[IPC_BENCH_MAX_THREADS];
+    for (uint32_t i = 0; i < IPC_BENCH_MAX_THREADS; i++) {
+        senders[i] = process_alloc("ipc_sender");
+        receivers[i] = process_alloc("ipc_receiver");
+        if (!senders[i] || !receivers[i]) {
+            printf("Failed to allocate benchmark processes\n");
+            return;
+        }
+    }
+
+    printf("%-8s %-10s %-6s %16s %16s\n", "senders", "receivers", "batch",
+           "kernel lock M/s", "mailbox lock M/s");
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+            double rate[2];
+            for (int mode = 0; mode < 2; mode++) {
+                big_kernel_lock = mode == 0;
+                rate[mode] = ipc_bench_run(senders, shapes[i][0], receivers, shapes[i][1], batches[b]);
+            }
+            big_kernel_lock = false;
+            printf("%-8u %-10u %-6u %16.2f %16.2f%s\n", shapes[i][0], shapes[i][1], batches[b],
+                   rate[0] / 1e6, rate[1] / 1e6, rate[0] && rate[1] ? "" : "  (out of order!)");
+        }
+    }
+}
+
+/* Cross-model benchmark suite: the bench.h workloads on this kernel */
+typedef struct {
+    uint32_t client;
+    uint32_t server;
+    pthread_t thread;
+} bench_peer_t;
+
+#define BENCH_STOP 0xFFFFFFFFu  // Echo server exits on this payload
+
+static uint64_t bench_page(void* ctx, uint32_t n) {
+    (void)ctx;
+    for (uint32_t i = 0; i < n; i++) {
+        page_t* page = allocate_page();
+        if (!page) return 0;
+        free_page(page);
+    }
+    return n;
+}
+
+// Request and reply through both mailboxes, all on one thread
+static uint64_t bench_local_roundtrip(void* ctx, uint32_t n) {
+    bench_peer_t* peer = ctx;
+    message_t msg = { .sender_id = peer->client, .receiver_id = peer->server };
+    message_t in;
+    for (uint32_t i = 0; i < n; i++) {
+        if (send_message(&msg) != IPC_OK || receive_message(peer->server, &in) != IPC_OK) return 0;
+        message_t reply = { .sender_id = peer->server, .receiver_id = peer->client };
+        if (send_message(&reply) != IPC_OK || receive_message(peer->client, &in) != IPC_OK) return 0;
+    }
+    return n;
+}
+
+static void* bench_echo_server(void* arg) {
+    bench_peer_t* peer = arg;
+    message_t in;
+    for (;;) {
+        receive_message_from(peer->server, ANY_SENDER, &in, true);
+        uint32_t tag;
+        memcpy(&tag, in.data, sizeof(tag));
+        if (tag == BENCH_STOP) return NULL;
+        message_t reply = { .sender_id = peer->server, .receiver_id = in.sender_id };
+        while (send_message(&reply) == IPC_FULL) sched_yield();
+    }
+}
+
+static uint64_t bench_remote_roundtrip(void* ctx, uint32_t n) {
+    bench_peer_t* peer = ctx;
+    message_t msg = { .sender_id = peer->client, .receiver_id = peer->server };
+    message_t in;
+    for (uint32_t i = 0; i < n; i++) {
+        memcpy(msg.data, &i, sizeof(i));
+        if (send_message(&msg) != IPC_OK) return 0;
+        receive_message_from(peer->client, peer->server, &in, true);
+    }
+    return n;
+}
+
+int run_benchmark_suite(void) {
+    process_t* client = process_alloc("bench_client");
+    process_t* server = process_alloc("bench_server");
+    if (!client || !server) return 1;
+    bench_peer_t peer = { .client = client->pid, .server = server->pid };
+
+    bench_begin("hybrid");
+    bench_run(BENCH_PAGE_ALLOC_FREE, "free_list", bench_page, NULL, 0);
+    bench_run(BENCH_IPC_ROUNDTRIP, "same_thread", bench_local_roundtrip, &peer, 0);
+    big_kernel_lock = true;
+    bench_run(BENCH_IPC_ROUNDTRIP, "same_thread_bkl", bench_local_roundtrip, &peer, 0);
+    big_kernel_lock = false;
+    if (pthread_create(&peer.thread, NULL, bench_echo_server, &peer) == 0) {
+        bench_run(BENCH_IPC_ROUNDTRIP, "cross_thread", bench_remote_roundtrip, &peer, 0);
+        message_t stop = { .sender_id = peer.client, .receiver_id = peer.server };
+        uint32_t tag = BENCH_STOP;
+        memcpy(stop.data, &tag, sizeof(tag));
+        send_message(&stop);
+        pthread_join(peer.thread, NULL);
+    }
+    int status = bench_end();
+    cleanup();
+    return status;
+}
+
+/* "bench" runs only the benchmark suite */
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) return run_benchmark_suite();
     printf("Starting kernel simulation...\n\n");
     
     // Test process creation
     printf("=== Process Management Test ===\n");
     process_t* p1 = create_process("Process1");
     process_t* p2 = create_process("Process2");
+    process_t* p3 = create_process("Process3");
     
     if (p1 && p2) {
         schedule_process(p1);
@@ -165,6 +586,7 @@ int main(void) {
     page_t* page2 = allocate_page();
     
     if (page1 && page2) {
+        printf("Allocated two pages\n");
         // Write some test patterns to pages
         memset(page1->data, 0xAA, 64);
         memset(page2->data, 0xBB, 64);
@@ -173,22 +595,42 @@ int main(void) {
         // Free pages
         free_page(page1);
         free_page(page2);
+        printf("Pages freed to the free list\n");
     }
     
     printf("\n=== IPC Test ===\n");
-    // Test IPC
-    message_t msg = {
-        .sender_id = 1,
-        .receiver_id = 2
+    // Test IPC: PID 2 has two messages queued ahead of PID 3's
+    message_t msgs[3] = {
+        { .sender_id = 1, .receiver_id = 2 },
+        { .sender_id = p3 ? p3->pid : 3, .receiver_id = 2 },
+        { .sender_id = 1, .receiver_id = p3 ? p3->pid : 3 }
     };
-    strncpy((char*)msg.data, "Hello, Process 2!", 256);
-    
-    if (send_message(&msg) == 0) {
-        message_t* received = receive_message(2);
-        if (received) {
-            printf("Message content: %s\n", received->data);
-        }
+    strncpy((char*)msgs[0].data, "Hello, Process 2!", 256);
+    strncpy((char*)msgs[1].data, "Process 3 says hi", 256);
+    strncpy((char*)msgs[2].data, "Hello, Process 3!", 256);
+    uint32_t sent = send_messages(msgs, 3);
+    for (uint32_t i = 0; i < sent; i++) {
+        printf("Message sent from PID %u to PID %u\n", msgs[i].sender_id, msgs[i].receiver_id);
+    }
+
+    message_t received;
+    if (receive_message(msgs[2].receiver_id, &received) == IPC_OK) {
+        printf("PID %u received: %s\n", received.receiver_id, received.data);
+    }
+    // Selective receive: the newer message from PID 3 first
+    if (receive_message_from(2, msgs[1].sender_id, &received, false) == IPC_OK) {
+        printf("PID 2 received from PID %u: %s\n", received.sender_id, received.data);
     }
+    while (receive_message(2, &received) == IPC_OK) {
+        printf("PID 2 received from PID %u: %s\n", received.sender_id, received.data);
+    }
+    printf("No more messages for PID 2\n");
+
+    printf("\n=== IPC Throughput Benchmark ===\n");
+    benchmark_ipc();
+    
+    printf("\n=== Trace Metrics ===\n");
+    trace_report();
     
     // Clean up
     printf("\n=== Cleanup ===\n");
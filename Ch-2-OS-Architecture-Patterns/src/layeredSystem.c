@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include "trace.h"
+#include "bench.h"
 
 // Layer 6: User Interface Layer
 typedef struct {
@@ -50,6 +53,22 @@ typedef struct {
     void (*cleanup)(void);
 } LayerInterface;
 
+// Requests each layer handled; layer_trace also records one event per request
+TRACE_COUNTER_DEFINE(ui_counter, "ui_requests");
+TRACE_COUNTER_DEFINE(program_counter, "program_requests");
+TRACE_COUNTER_DEFINE(io_counter, "io_requests");
+TRACE_COUNTER_DEFINE(memory_counter, "memory_requests");
+TRACE_COUNTER_DEFINE(process_counter, "process_requests");
+TRACE_COUNTER_DEFINE(hardware_counter, "hardware_requests");
+bool layer_trace = true;
+
+#define LAYER_TRACE(counter, name, arg) do { \
+    if (layer_trace) {                       \
+        TRACE_COUNT(counter, 1);             \
+        TRACE_INSTANT(name, arg);            \
+    }                                        \
+} while (0)
+
 // Layer 6: User Interface Layer Implementation
 void ui_layer_init(void) {
     printf("Initializing User Interface Layer\n");
@@ -57,7 +76,7 @@ void ui_layer_init(void) {
 
 int ui_layer_process(void* request) {
     UIRequest* req = (UIRequest*)request;
-    printf("Processing UI request: %s\n", req->command);
+    LAYER_TRACE(ui_counter, "ui_request", req->status);
     return 0;
 }
 
@@ -72,8 +91,7 @@ void program_layer_init(void) {
 
 int program_layer_process(void* request) {
     ProcessInfo* info = (ProcessInfo*)request;
-    printf("Executing program: %s with PID: %d\n", 
-           info->program_name, info->process_id);
+    LAYER_TRACE(program_counter, "execute_program", info->process_id);
     return 0;
 }
 
@@ -88,7 +106,7 @@ void io_layer_init(void) {
 
 int io_layer_process(void* request) {
     IORequest* req = (IORequest*)request;
-    printf("Processing I/O request for device %d\n", req->device_id);
+    LAYER_TRACE(io_counter, "io_request", req->device_id);
     return 0;
 }
 
@@ -103,7 +121,7 @@ void memory_layer_init(void) {
 
 int memory_layer_process(void* request) {
     MemoryBlock* block = (MemoryBlock*)request;
-    printf("Processing memory request for size: %zu\n", block->size);
+    LAYER_TRACE(memory_counter, "memory_request", block->size);
     return 0;
 }
 
@@ -118,7 +136,7 @@ void process_layer_init(void) {
 
 int process_layer_process(void* request) {
     ProcessControl* proc = (ProcessControl*)request;
-    printf("Processing request for PID: %d\n", proc->pid);
+    LAYER_TRACE(process_counter, "process_request", proc->pid);
     return 0;
 }
 
@@ -133,7 +151,7 @@ void hardware_layer_init(void) {
 
 int hardware_layer_process(void* request) {
     HardwareRequest* req = (HardwareRequest*)request;
-    printf("Processing hardware interrupt: %d\n", req->interrupt_number);
+    LAYER_TRACE(hardware_counter, "hardware_interrupt", req->interrupt_number);
     return 0;
 }
 
@@ -165,8 +183,72 @@ void cleanup_system(void) {
     }
 }
 
-// Example usage
-int main() {
+// Cross-model benchmark suite (bench.h). A request enters at the top
+// layer and is handed down through the layers[] table, so depth_d pays d
+// indirect crossings; the slope over the depths is the cost of one layer.
+#define LAYER_COUNT (sizeof(layers) / sizeof(LayerInterface))
+
+typedef struct {
+    void* requests[LAYER_COUNT];  // Each layer's own request, by index
+    uint32_t depth;
+} bench_descent_t;
+
+static uint64_t bench_descend(void* ctx, uint32_t n) {
+    bench_descent_t* d = ctx;
+    for (uint32_t i = 0; i < n; i++) {
+        for (uint32_t l = LAYER_COUNT; l > LAYER_COUNT - d->depth; l--) {
+            if (layers[l - 1].process_request(d->requests[l - 1]) != 0) return 0;
+        }
+    }
+    return n;
+}
+
+// The same six layers with the table taken out, for comparison
+static uint64_t bench_direct(void* ctx, uint32_t n) {
+    bench_descent_t* d = ctx;
+    for (uint32_t i = 0; i < n; i++) {
+        int status = ui_layer_process(d->requests[5]) | program_layer_process(d->requests[4]) |
+                     io_layer_process(d->requests[3]) | memory_layer_process(d->requests[2]) |
+                     process_layer_process(d->requests[1]) | hardware_layer_process(d->requests[0]);
+        if (status != 0) return 0;
+    }
+    return n;
+}
+
+int run_benchmark_suite(void) {
+    static const char* depth_names[LAYER_COUNT] = {
+        "depth_1", "depth_2", "depth_3", "depth_4", "depth_5", "depth_6"
+    };
+    HardwareRequest hw_req = {1, NULL};
+    ProcessControl proc_req = {1001, 1, NULL};
+    MemoryBlock mem_req = {NULL, 1024, 0};
+    IORequest io_req = {2, NULL, 512};
+    ProcessInfo prog_req = {1001, "test_program", 1};
+    UIRequest ui_req = {"EXECUTE", NULL, 0};
+    bench_descent_t d = {
+        {&hw_req, &proc_req, &mem_req, &io_req, &prog_req, &ui_req}, LAYER_COUNT
+    };
+
+    layer_trace = false;
+    bench_begin("layered");
+    bench_run(BENCH_SYSCALL_DISPATCH, "ui_to_hardware", bench_descend, &d, 0);
+    for (d.depth = 1; d.depth <= LAYER_COUNT; d.depth++) {
+        bench_run("layer_crossing", depth_names[d.depth - 1], bench_descend, &d, 0);
+    }
+    bench_run("layer_crossing", "direct_calls", bench_direct, &d, 0);
+
+    double top = bench_result_p50("layer_crossing", "depth_1");
+    double bottom = bench_result_p50("layer_crossing", depth_names[LAYER_COUNT - 1]);
+    if (top > 0 && bottom > 0) {
+        printf("Per layer crossing: %.2f ns\n", (bottom - top) / (LAYER_COUNT - 1));
+    }
+    return bench_end();
+}
+
+// Example usage; "bench" runs only the benchmark suite
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) return run_benchmark_suite();
+
     // Initialize all layers
     init_system();
     
@@ -188,6 +270,7 @@ int main() {
     
     // Cleanup all layers
     cleanup_system();
-    
+
+    trace_report();
     return 0;
 }
\ No newline at end of file
@@ -1,19 +1,35 @@
+#define _GNU_SOURCE  // For pthread_setaffinity_np
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "trace.h"
+#include "bench.h"
 
 /* Constants */
 #define MAX_QUEUE_SIZE 100
 #define MAX_CHANNELS 10
 #define MAX_PROCESSES 50
+#define CHANNEL_CAPACITY 128  // Slots per channel, power of two
+#define CACHE_LINE_SIZE 64
+#define CHANNEL_SPIN_LIMIT 200  // Polls before a receiver sleeps
 
 /* Process States */
 #define PROCESS_READY 1
 #define PROCESS_WAITING 2
 #define PROCESS_RUNNING 3
+#define PROCESS_CALL_WAIT 4  // Blocked in ipc_call until the server replies
 
 /* System Call Numbers */
 #define SYSCALL_SEND_MESSAGE 1
@@ -24,31 +40,101 @@
 #define TIMER_INTERRUPT 1
 #define IPC_INTERRUPT 2
 
-/* Message Structure for IPC */
+/* Message Structure for IPC: a full-size buffer for building and
+ * copying out messages. Queued messages take only header + size bytes. */
 typedef struct {
     uint32_t sender_id;
     uint32_t message_type;
     uint32_t size;
-    char data[256];  // Fixed size data buffer for simplicity
+    uint32_t grant;  // Grant id of an attached memory region, 0 if none
+    char data[256];  // Largest inline payload; bulk data goes by grant
 } message_t;
 
+#define MESSAGE_HEADER_SIZE offsetof(message_t, data)
+#define MESSAGE_INLINE_MAX sizeof(((message_t*)0)->data)
+
+/* A message as stored in a mailbox: the same header, then size bytes */
+typedef struct {
+    uint32_t sender_id;
+    uint32_t message_type;
+    uint32_t size;
+    uint32_t grant;
+    char data[];
+} ipc_msg_t;
+
+_Static_assert(sizeof(ipc_msg_t) == MESSAGE_HEADER_SIZE, "header layouts differ");
+
+/* Mailbox arena: records are packed back to back in a byte ring that is
+ * allocated on the first delivery. A filler record covers the unused
+ * end of the ring when a record has to wrap to the start; its size is a
+ * payload size like any other record's. */
+#define MAILBOX_ARENA_SIZE 16384
+#define MSG_ALIGN 16
+#define MSG_FILLER UINT32_MAX  // message_type of a filler record
+#define MSG_CALL (UINT32_MAX - 1)  // ipc_call queued for a busy server; data holds its regs
+
+_Static_assert(MESSAGE_HEADER_SIZE <= MSG_ALIGN, "a filler header must fit any gap");
+
+/* Short message for the call/reply fast path, passed the way L4 passes
+ * message registers: copied straight between the two PCBs */
+#define IPC_SHORT_WORDS 4
+
+typedef struct {
+    uint32_t label;   // Operation on call, status on reply
+    uint32_t length;  // Words in use
+    uint64_t words[IPC_SHORT_WORDS];
+} ipc_regs_t;
+
+#define IPC_REGS_SIZE(regs) (offsetof(ipc_regs_t, words) + (regs)->length * sizeof(uint64_t))
+
+/* IPC Channel: bounded lock-free queue of messages. Each slot carries a
+ * sequence number telling producers and the consumer whose turn it is.
+ * SPSC channels claim slots with a plain store, MPSC channels with a
+ * CAS on tail; there is always exactly one consumer. */
+typedef enum {
+    CHANNEL_SPSC,  // Point-to-point link
+    CHANNEL_MPSC   // Server inbox shared by many clients
+} channel_kind_t;
+
+typedef struct {
+    _Atomic uint32_t sequence;
+    message_t message;
+} channel_slot_t;
+
+typedef struct {
+    // Producer and consumer indices live on separate cache lines
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t tail;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t head;
+    // Wakeup state: an event counter the idle consumer futex-waits on
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t event;
+    _Atomic uint32_t sleeping;
+    _Alignas(CACHE_LINE_SIZE) channel_kind_t kind;
+    uint32_t capacity;
+    uint32_t mask;
+    channel_slot_t* slots;
+} ipc_channel_t;
+
 /* Process Control Block */
 typedef struct process {
     uint32_t pid;
     uint32_t state;
-    message_t message_queue[MAX_QUEUE_SIZE];
-    uint32_t queue_size;
+    char* mailbox;          // Arena of ipc_msg_t records, NULL until used
+    uint32_t mbox_head;     // Offset of the oldest record
+    uint32_t mbox_tail;     // Offset of the next free byte
+    uint32_t mbox_used;     // Bytes held, fillers included
+    uint32_t mbox_reserved; // Payload bytes set aside by reserve_message
+    uint32_t queue_size;    // Messages queued
     struct process* next;
     char name[32];  // Added name for better debugging
+    ipc_channel_t* inbox;  // MPSC inbox for servers running on threads
+    pthread_t thread;
+    bool has_thread;
+    // Synchronous call/reply state
+    ipc_regs_t regs;
+    struct process* caller;  // Client awaiting this server's reply
+    void (*serve)(struct process* self, ipc_regs_t* regs);
 } process_t;
 
-/* IPC Channel */
-typedef struct {
-    message_t messages[MAX_QUEUE_SIZE];
-    uint32_t capacity;
-    uint32_t count;
-} ipc_channel_t;
-
 /* System Parameters */
 typedef struct {
     char* process_name;
@@ -64,8 +150,25 @@ typedef struct {
 /* Global State */
 process_t* process_list = NULL;
 process_t* current_process = NULL;
-ipc_channel_t* channels = NULL;
+ipc_channel_t* channels[MAX_CHANNELS];
+uint32_t channel_count = 0;
 uint32_t next_pid = 1;
+bool ipc_trace = true;  // Trace every send/receive and switch (off for benchmarks)
+
+TRACE_COUNTER_DEFINE(send_counter, "messages_sent");
+TRACE_COUNTER_DEFINE(wait_counter, "receive_waits");
+TRACE_COUNTER_DEFINE(switch_counter, "scheduler_switches");
+TRACE_COUNTER_DEFINE(served_counter, "server_requests");
+TRACE_VALUE_HISTOGRAM_DEFINE(size_hist, "message_bytes");
+TRACE_HISTOGRAM_DEFINE(call_hist, "ipc_call_fast_path");
+
+/* Call/reply statistics */
+struct {
+    uint64_t fast_calls;         // Delivered by direct switch
+    uint64_t slow_calls;         // Fell back to the message queue
+    uint64_t direct_switches;    // CPU handed over without the scheduler
+    uint64_t scheduler_switches; // Picks made by schedule_next_process
+} ipc_stats;
 
 /* Function Declarations */
 void schedule_next_process(void);
@@ -74,72 +177,379 @@ void setup_interrupt_handlers(void);
 void enable_interrupts(void);
 void print_process_status(void);
 
+/* Futex-style wait/wake on a 32-bit word, with a polling fallback */
+static void channel_wait(_Atomic uint32_t* word, uint32_t expected) {
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#else
+    while (atomic_load_explicit(word, memory_order_acquire) == expected) {
+        sched_yield();
+    }
+#endif
+}
+
+static void channel_wake(_Atomic uint32_t* word) {
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
 /* Initialize IPC Channel */
-ipc_channel_t* create_ipc_channel(uint32_t capacity) {
+ipc_channel_t* create_ipc_channel(uint32_t capacity, channel_kind_t kind) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        printf("Channel capacity must be a power of two\n");
+        return NULL;
+    }
+    if (channel_count >= MAX_CHANNELS) {
+        printf("Too many IPC channels\n");
+        return NULL;
+    }
+
     printf("Creating IPC channel with capacity: %u\n", capacity);
-    ipc_channel_t* channel = malloc(sizeof(ipc_channel_t));
-    if (!channel) {
+    ipc_channel_t* channel = aligned_alloc(CACHE_LINE_SIZE, sizeof(ipc_channel_t));
+    channel_slot_t* slots = malloc(capacity * sizeof(channel_slot_t));
+    if (!channel || !slots) {
         printf("Failed to allocate IPC channel\n");
+        free(channel);
+        free(slots);
         return NULL;
     }
+
+    channel->kind = kind;
     channel->capacity = capacity;
-    channel->count = 0;
+    channel->mask = capacity - 1;
+    channel->slots = slots;
+    atomic_init(&channel->head, 0);
+    atomic_init(&channel->tail, 0);
+    atomic_init(&channel->event, 0);
+    atomic_init(&channel->sleeping, 0);
+    for (uint32_t i = 0; i < capacity; i++) {
+        atomic_init(&slots[i].sequence, i);
+    }
+
+    channels[channel_count++] = channel;
     return channel;
 }
 
-/* Send Message */
+void destroy_ipc_channel(ipc_channel_t* channel) {
+    if (!channel) return;
+    for (uint32_t i = 0; i < channel_count; i++) {
+        if (channels[i] == channel) {
+            channels[i] = channels[--channel_count];
+            break;
+        }
+    }
+    free(channel->slots);
+    free(channel);
+}
+
+/* Enqueue without blocking; false if the channel is full */
+bool channel_try_send(ipc_channel_t* channel, const message_t* message) {
+    uint32_t pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+    channel_slot_t* slot;
+
+    for (;;) {
+        slot = &channel->slots[pos & channel->mask];
+        uint32_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff < 0) return false;  // Consumer has not freed this slot yet
+        if (diff > 0) {
+            pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+            continue;
+        }
+        if (channel->kind == CHANNEL_SPSC) {
+            atomic_store_explicit(&channel->tail, pos + 1, memory_order_relaxed);
+            break;
+        }
+        if (atomic_compare_exchange_weak_explicit(&channel->tail, &pos, pos + 1,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+            break;
+    }
+
+    memcpy(&slot->message, message, MESSAGE_HEADER_SIZE + message->size);
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+    // Only pay for a wakeup when the consumer has gone to sleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&channel->sleeping, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&channel->event, 1, memory_order_release);
+        channel_wake(&channel->event);
+    }
+    return true;
+}
+
+/* Enqueue, yielding while the channel is full */
+void channel_send(ipc_channel_t* channel, const message_t* message) {
+    while (!channel_try_send(channel, message)) {
+        sched_yield();
+    }
+}
+
+/* Dequeue without blocking; only the channel's single consumer may call */
+bool channel_try_receive(ipc_channel_t* channel, message_t* out) {
+    uint32_t pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    channel_slot_t* slot = &channel->slots[pos & channel->mask];
+    uint32_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if ((int32_t)(seq - (pos + 1)) < 0) return false;
+
+    memcpy(out, &slot->message, MESSAGE_HEADER_SIZE + slot->message.size);
+    atomic_store_explicit(&slot->sequence, pos + channel->capacity,
+                          memory_order_release);
+    atomic_store_explicit(&channel->head, pos + 1, memory_order_relaxed);
+    return true;
+}
+
+/* Dequeue, spinning briefly and then sleeping until a sender wakes us */
+void channel_receive(ipc_channel_t* channel, message_t* out) {
+    for (;;) {
+        for (int spin = 0; spin < CHANNEL_SPIN_LIMIT; spin++) {
+            if (channel_try_receive(channel, out)) return;
+        }
+
+        uint32_t key = atomic_load_explicit(&channel->event, memory_order_acquire);
+        atomic_store_explicit(&channel->sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (channel_try_receive(channel, out)) {
+            atomic_store_explicit(&channel->sleeping, 0, memory_order_relaxed);
+            return;
+        }
+        channel_wait(&channel->event, key);
+        atomic_store_explicit(&channel->sleeping, 0, memory_order_relaxed);
+    }
+}
+
+/* Grant table: an owner lends a region of its memory to one other
+ * process, which maps it instead of receiving a copy. Everything here
+ * shares one address space, so mapping is a permission check that
+ * hands back the owner's pointer. */
+#define MAX_GRANTS 32
+
+typedef struct {
+    bool in_use;
+    bool writable;
+    bool mapped;
+    uint32_t refs;  // Owner and grantee each hold one
+    uint32_t owner_pid;
+    uint32_t grantee_pid;
+    void* base;
+    size_t length;
+} grant_t;
+
+grant_t grant_table[MAX_GRANTS + 1];  // Id 0 means "no grant"
+
+uint32_t grant_create(process_t* owner, process_t* grantee,
+                      void* base, size_t length, bool writable) {
+    if (!owner || !grantee || !base || length == 0) return 0;
+    for (uint32_t id = 1; id <= MAX_GRANTS; id++) {
+        grant_t* g = &grant_table[id];
+        if (g->in_use) continue;
+        *g = (grant_t){ .in_use = true, .writable = writable, .refs = 2,
+                        .owner_pid = owner->pid, .grantee_pid = grantee->pid,
+                        .base = base, .length = length };
+        return id;
+    }
+    printf("Grant table full\n");
+    return 0;
+}
+
+static void grant_put(grant_t* g) {
+    if (--g->refs == 0) g->in_use = false;
+}
+
+static void* grant_map_access(process_t* process, uint32_t id, bool write, size_t* length) {
+    if (!process || id == 0 || id > MAX_GRANTS) return NULL;
+    grant_t* g = &grant_table[id];
+    if (!g->in_use || g->grantee_pid != process->pid || g->mapped) return NULL;
+    if (write && !g->writable) return NULL;
+    g->mapped = true;
+    if (length) *length = g->length;
+    return g->base;
+}
+
+/* Map a grant into the grantee for reading; NULL if it is not theirs to
+ * map */
+const void* grant_map(process_t* process, uint32_t id, size_t* length) {
+    return grant_map_access(process, id, false, length);
+}
+
+/* Map a grant for writing; NULL as for grant_map, or if it is read-only */
+void* grant_map_writable(process_t* process, uint32_t id, size_t* length) {
+    return grant_map_access(process, id, true, length);
+}
+
+/* Grantee is finished with the region */
+int grant_unmap(process_t* process, uint32_t id) {
+    if (!process || id == 0 || id > MAX_GRANTS) return -1;
+    grant_t* g = &grant_table[id];
+    if (!g->in_use || g->grantee_pid != process->pid || !g->mapped) return -1;
+    g->mapped = false;
+    grant_put(g);
+    return 0;
+}
+
+/* Owner drops its handle; the entry is recycled once the grantee unmaps */
+int grant_release(process_t* owner, uint32_t id) {
+    if (!owner || id == 0 || id > MAX_GRANTS) return -1;
+    grant_t* g = &grant_table[id];
+    if (!g->in_use || g->owner_pid != owner->pid) return -1;
+    g->owner_pid = 0;
+    grant_put(g);
+    return 0;
+}
+
+/* Bytes a record takes in the arena, header included */
+static inline uint32_t msg_record_size(uint32_t size) {
+    return (uint32_t)((MESSAGE_HEADER_SIZE + size + MSG_ALIGN - 1) & ~(MSG_ALIGN - 1));
+}
+
+static inline ipc_msg_t* msg_at(process_t* p, uint32_t offset) {
+    return (ipc_msg_t*)(p->mailbox + offset);
+}
+
+/* Zero-copy send, step 1: carve space for a size-byte payload out of the
+ * receiver's arena so the sender can build the message in place */
+ipc_msg_t* reserve_message(process_t* receiver, uint32_t size) {
+    if (!receiver || receiver->queue_size >= MAX_QUEUE_SIZE ||
+        size > MESSAGE_INLINE_MAX) {
+        return NULL;
+    }
+    if (!receiver->mailbox) {
+        receiver->mailbox = aligned_alloc(MSG_ALIGN, MAILBOX_ARENA_SIZE);
+        if (!receiver->mailbox) return NULL;
+    }
+
+    uint32_t need = msg_record_size(size);
+    uint32_t head = receiver->mbox_head;
+    uint32_t tail = receiver->mbox_tail;
+
+    if (receiver->mbox_used == 0) {
+        receiver->mbox_head = receiver->mbox_tail = 0;
+    } else if (tail > head) {
+        if (need > MAILBOX_ARENA_SIZE - tail) {
+            if (need > head) return NULL;
+            // Cover the end of the ring with a filler and wrap
+            ipc_msg_t* filler = msg_at(receiver, tail);
+            filler->message_type = MSG_FILLER;
+            filler->size = MAILBOX_ARENA_SIZE - tail - MESSAGE_HEADER_SIZE;
+            receiver->mbox_used += MAILBOX_ARENA_SIZE - tail;
+            receiver->mbox_tail = 0;
+        }
+    } else if (need > head - tail) {
+        return NULL;
+    }
+
+    receiver->mbox_reserved = size;
+    ipc_msg_t* slot = msg_at(receiver, receiver->mbox_tail);
+    slot->size = size;
+    slot->grant = 0;
+    return slot;
+}
+
+/* Zero-copy send, step 2: publish the reserved record */
+int commit_message(process_t* sender, process_t* receiver) {
+    if (!sender || !receiver || !receiver->mailbox ||
+        receiver->queue_size >= MAX_QUEUE_SIZE) {
+        return -1;
+    }
+
+    ipc_msg_t* slot = msg_at(receiver, receiver->mbox_tail);
+    if (slot->size > receiver->mbox_reserved) return -1;
+    uint32_t need = msg_record_size(slot->size);
+
+    slot->sender_id = sender->pid;
+    receiver->mbox_tail += need;
+    if (receiver->mbox_tail == MAILBOX_ARENA_SIZE) receiver->mbox_tail = 0;
+    receiver->mbox_used += need;
+    receiver->mbox_reserved = 0;
+    receiver->queue_size++;
+
+    if (receiver->state == PROCESS_WAITING) {
+        if (ipc_trace) TRACE_INSTANT("wake", receiver->pid);
+        receiver->state = PROCESS_READY;
+    }
+    return 0;
+}
+
+/* Send Message: copies the header and only `size` bytes of payload */
 int send_message(process_t* sender, process_t* receiver, message_t* message) {
     if (!sender || !receiver || !message) {
         printf("Invalid parameters in send_message\n");
         return -1;
     }
+    if (message->size > MESSAGE_INLINE_MAX) {
+        printf("Message too large: %u bytes\n", message->size);
+        return -1;
+    }
 
-    printf("Sending message from PID %u to PID %u\n", sender->pid, receiver->pid);
+    if (ipc_trace) {
+        TRACE_COUNT(send_counter, 1);
+        TRACE_HIST(size_hist, message->size);
+        TRACE_INSTANT("send", receiver->pid);
+    }
 
-    if (receiver->queue_size >= MAX_QUEUE_SIZE) {
+    ipc_msg_t* slot = reserve_message(receiver, message->size);
+    if (!slot) {
         printf("Receiver's queue is full\n");
         return -1;
     }
 
-    memcpy(&receiver->message_queue[receiver->queue_size], message, sizeof(message_t));
-    receiver->queue_size++;
+    memcpy(slot, message, MESSAGE_HEADER_SIZE + message->size);
+    return commit_message(sender, receiver);
+}
 
-    if (receiver->state == PROCESS_WAITING) {
-        printf("Waking up receiver process\n");
-        receiver->state = PROCESS_READY;
+/* The record at the head of a non-empty mailbox, past any filler */
+static ipc_msg_t* mailbox_head(process_t* receiver) {
+    ipc_msg_t* msg = msg_at(receiver, receiver->mbox_head);
+    if (msg->message_type == MSG_FILLER) {
+        receiver->mbox_used -= msg_record_size(msg->size);
+        receiver->mbox_head = 0;
+        msg = msg_at(receiver, 0);
     }
-
-    return 0;
+    return msg;
 }
 
-/* Receive Message */
-message_t* receive_message(process_t* receiver) {
+/* Receive Message: returns the oldest message in place, without a
+ * copy. It stays valid, and stays at the head, until release_message. */
+ipc_msg_t* receive_message(process_t* receiver) {
     if (!receiver) {
         printf("Invalid receiver in receive_message\n");
         return NULL;
     }
 
-    printf("Process %u attempting to receive message. Queue size: %u\n", 
-           receiver->pid, receiver->queue_size);
+    if (ipc_trace) TRACE_INSTANT("receive", receiver->queue_size);
 
     if (receiver->queue_size == 0) {
-        printf("No messages available, process going to wait state\n");
+        if (ipc_trace) TRACE_COUNT(wait_counter, 1);
         receiver->state = PROCESS_WAITING;
         schedule_next_process();
         return NULL;
     }
 
-    static message_t msg;  // Static to avoid returning stack address
-    memcpy(&msg, &receiver->message_queue[0], sizeof(message_t));
+    return mailbox_head(receiver);
+}
 
-    // Shift queue
-    for (uint32_t i = 0; i < receiver->queue_size - 1; i++) {
-        receiver->message_queue[i] = receiver->message_queue[i + 1];
+/* Hand the record returned by receive_message back to the arena */
+void release_message(process_t* receiver) {
+    if (!receiver || receiver->queue_size == 0) return;
+    uint32_t need = msg_record_size(mailbox_head(receiver)->size);
+    receiver->mbox_head += need;
+    if (receiver->mbox_head == MAILBOX_ARENA_SIZE) receiver->mbox_head = 0;
+    receiver->mbox_used -= need;
+    if (--receiver->queue_size == 0) {
+        receiver->mbox_head = receiver->mbox_tail = receiver->mbox_used = 0;
     }
-    receiver->queue_size--;
+}
 
-    printf("Message received successfully\n");
-    return &msg;
+/* Copying receive into a caller-owned buffer; reentrant */
+int receive_message_copy(process_t* receiver, message_t* out) {
+    ipc_msg_t* msg = receive_message(receiver);
+    if (!msg || !out) return -1;
+    memcpy(out, msg, MESSAGE_HEADER_SIZE + msg->size);
+    release_message(receiver);
+    return 0;
 }
 
 /* Process Creation */
@@ -157,7 +567,14 @@ process_t* create_user_process(create_process_params* params) {
 
     process->pid = next_pid++;
     process->state = PROCESS_READY;
+    process->mailbox = NULL;
+    process->mbox_head = process->mbox_tail = 0;
+    process->mbox_used = process->mbox_reserved = 0;
     process->queue_size = 0;
+    process->inbox = NULL;
+    process->has_thread = false;
+    process->caller = NULL;
+    process->serve = NULL;
     strncpy(process->name, params->process_name, sizeof(process->name) - 1);
     process->name[sizeof(process->name) - 1] = '\0';
 
@@ -182,9 +599,115 @@ void schedule_next_process(void) {
     if (!current_process) {
         current_process = process_list;
     }
+    ipc_stats.scheduler_switches++;
+
+    if (ipc_trace) {
+        TRACE_COUNT(switch_counter, 1);
+        TRACE_INSTANT("schedule", current_process->pid);
+    }
+}
+
+/* Hand the CPU straight to a process that IPC just made runnable */
+static inline void direct_switch(process_t* next) {
+    next->state = PROCESS_RUNNING;
+    current_process = next;
+    ipc_stats.direct_switches++;
+}
+
+static process_t* process_by_pid(uint32_t pid) {
+    for (process_t* p = process_list; p; p = p->next) {
+        if (p->pid == pid) return p;
+    }
+    return NULL;
+}
+
+/* Take a call that was queued while the server was busy into its
+ * registers, if one is at the head of its mailbox */
+static bool ipc_take_queued_call(process_t* server) {
+    if (!server->serve || server->queue_size == 0) return false;
+    ipc_msg_t* msg = mailbox_head(server);
+    if (msg->message_type != MSG_CALL) return false;
+    memcpy(&server->regs, msg->data, msg->size);
+    server->caller = process_by_pid(msg->sender_id);
+    release_message(server);
+    return true;
+}
+
+/* Server side of the fast path: answer the current caller, serve any
+ * calls queued meanwhile, then switch directly back to the first caller
+ * and wait for the next call. Callers answered from the queue become
+ * ready. */
+int ipc_reply_and_wait(process_t* server, const ipc_regs_t* reply) {
+    if (!server || !reply || reply->length > IPC_SHORT_WORDS) return -1;
+
+    process_t* first = NULL;
+    for (;;) {
+        process_t* client = server->caller;
+        server->caller = NULL;
+        if (client && client->state == PROCESS_CALL_WAIT) {
+            memcpy(&client->regs, reply, IPC_REGS_SIZE(reply));
+            if (first) client->state = PROCESS_READY;
+            else first = client;
+        }
+        if (!ipc_take_queued_call(server)) break;
+        server->serve(server, &server->regs);
+        reply = &server->regs;
+    }
+
+    server->state = PROCESS_WAITING;
+    if (first) direct_switch(first);
+    return 0;
+}
+
+/* Make a server callable: its handler runs between reply_and_wait calls */
+void ipc_register_server(process_t* server,
+                         void (*serve)(process_t* self, ipc_regs_t* regs)) {
+    server->serve = serve;
+    server->state = PROCESS_WAITING;
+}
+
+/* Synchronous RPC. When the server is waiting for a call, the request is
+ * copied into its registers and the CPU passes to it directly, and the
+ * reply comes back into regs the same way. Otherwise the request is
+ * queued in the server's mailbox as a MSG_CALL and 1 is returned: the
+ * client stays in PROCESS_CALL_WAIT until the server's next
+ * ipc_reply_and_wait puts the reply in client->regs. */
+int ipc_call(process_t* client, process_t* server, ipc_regs_t* regs) {
+    if (!client || !server || !regs || regs->length > IPC_SHORT_WORDS) {
+        printf("Invalid parameters in ipc_call\n");
+        return -1;
+    }
+
+    if (server->state == PROCESS_WAITING && server->serve && !server->caller) {
+        ipc_stats.fast_calls++;
+        uint64_t start = 0;
+        if (ipc_trace) {
+            TRACE_BEGIN("ipc_call");
+            start = TRACE_CLOCK();
+        }
+        memcpy(&server->regs, regs, IPC_REGS_SIZE(regs));
+        server->caller = client;
+        client->state = PROCESS_CALL_WAIT;
+        direct_switch(server);
+
+        server->serve(server, &server->regs);
+        ipc_reply_and_wait(server, &server->regs);
+
+        memcpy(regs, &client->regs, IPC_REGS_SIZE(&client->regs));
+        if (ipc_trace) {
+            TRACE_HIST(call_hist, TRACE_CLOCK() - start);
+            TRACE_END("ipc_call");
+        }
+        return 0;
+    }
 
-    printf("Scheduled process: %s (PID: %u)\n", 
-           current_process->name, current_process->pid);
+    ipc_stats.slow_calls++;
+    message_t msg = { .message_type = MSG_CALL, .size = IPC_REGS_SIZE(regs) };
+    memcpy(msg.data, regs, msg.size);
+    if (send_message(client, server, &msg) != 0) return -1;
+    client->state = PROCESS_CALL_WAIT;
+    schedule_next_process();
+    return 1;
 }
 
 /* Print current system status */
@@ -200,16 +723,147 @@ void print_process_status(void) {
     printf("==================\n\n");
 }
 
-/* Main Kernel Initialization */
-void init_microkernel(void) {
-    printf("Initializing microkernel...\n");
+/* Threaded System Servers */
+
+/* Server request types */
+#define SERVER_REQUEST 1
+#define SERVER_REPLY 2
+#define SERVER_SHUTDOWN 3
+
+/* Reply links from each server back to each client, indexed by pid */
+ipc_channel_t* reply_channels[MAX_PROCESSES + 1];
+
+process_t* find_process(const char* name) {
+    for (process_t* p = process_list; p; p = p->next) {
+        if (strcmp(p->name, name) == 0) return p;
+    }
+    return NULL;
+}
+
+/* Server main loop: block on the inbox, answer on the client's link */
+static void* server_thread(void* arg) {
+    process_t* server = arg;
+    message_t request;
+    trace_thread_name(server->name);
+
+    for (;;) {
+        channel_receive(server->inbox, &request);
+        if (request.message_type == SERVER_SHUTDOWN) break;
+        TRACE_COUNT(served_counter, 1);
+        TRACE_BEGIN("serve");
+
+        message_t reply = { .sender_id = server->pid, .message_type = SERVER_REPLY };
+        reply.size = (uint32_t)snprintf(reply.data, sizeof(reply.data), "%s: %.*s",
+                                        server->name, (int)request.size, request.data) + 1;
+        if (reply.size > sizeof(reply.data)) reply.size = sizeof(reply.data);
+
+        ipc_channel_t* link = request.sender_id <= MAX_PROCESSES ?
+                              reply_channels[request.sender_id] : NULL;
+        if (link) channel_send(link, &reply);
+        TRACE_END("serve");
+    }
+    return NULL;
+}
+
+/* Give a server an MPSC inbox and its own thread */
+bool start_server(process_t* server) {
+    server->inbox = create_ipc_channel(CHANNEL_CAPACITY, CHANNEL_MPSC);
+    if (!server->inbox) return false;
+    if (pthread_create(&server->thread, NULL, server_thread, server) != 0) {
+        printf("Failed to start server thread for %s\n", server->name);
+        return false;
+    }
+    server->has_thread = true;
+    printf("Server %s running on its own thread\n", server->name);
+    return true;
+}
+
+/* Open an SPSC reply link so a client can talk to the servers */
+bool connect_client(process_t* client) {
+    if (client->pid > MAX_PROCESSES) return false;
+    if (!reply_channels[client->pid]) {
+        reply_channels[client->pid] = create_ipc_channel(CHANNEL_CAPACITY, CHANNEL_SPSC);
+    }
+    return reply_channels[client->pid] != NULL;
+}
+
+/* Synchronous request over the threaded servers' channels */
+int server_request(process_t* client, process_t* server,
+                   const char* payload, message_t* reply) {
+    if (!server->inbox || !reply_channels[client->pid]) return -1;
 
-    // Initialize IPC channels
-    channels = create_ipc_channel(MAX_CHANNELS);
-    if (!channels) {
-        printf("Failed to initialize IPC channels\n");
+    message_t request = { .sender_id = client->pid, .message_type = SERVER_REQUEST };
+    request.size = (uint32_t)strlen(payload) + 1;
+    if (request.size > sizeof(request.data)) return -1;
+    memcpy(request.data, payload, request.size);
+
+    channel_send(server->inbox, &request);
+    channel_receive(reply_channels[client->pid], reply);
+    return 0;
+}
+
+void shutdown_servers(void) {
+    message_t stop = { .message_type = SERVER_SHUTDOWN, .size = 0 };
+    for (process_t* p = process_list; p; p = p->next) {
+        if (!p->has_thread) continue;
+        channel_send(p->inbox, &stop);
+        pthread_join(p->thread, NULL);
+        p->has_thread = false;
+        destroy_ipc_channel(p->inbox);
+        p->inbox = NULL;
+    }
+    for (uint32_t pid = 0; pid <= MAX_PROCESSES; pid++) {
+        destroy_ipc_channel(reply_channels[pid]);
+        reply_channels[pid] = NULL;
+    }
+}
+
+/* file_server call handler: block number in, byte offset and length out */
+#define FS_BLOCK_SIZE 4096
+#define FS_LOOKUP_BLOCK 1
+
+static void file_server_serve(process_t* self, ipc_regs_t* regs) {
+    (void)self;
+    if (regs->label != FS_LOOKUP_BLOCK || regs->length < 1) {
+        regs->label = 1;  // Error
+        regs->length = 0;
         return;
     }
+    regs->words[0] *= FS_BLOCK_SIZE;
+    regs->words[1] = FS_BLOCK_SIZE;
+    regs->label = 0;
+    regs->length = 2;
+}
+
+/* file_server reads: short reads are copied into the reply, longer ones
+ * are granted to the client as a read-only window of the file cache */
+#define FS_READ_REPLY 2
+#define FILE_CACHE_SIZE (256 * 1024)
+
+static char file_cache[FILE_CACHE_SIZE];
+
+int file_server_read(process_t* server, process_t* client,
+                     size_t offset, size_t length) {
+    if (!server || !client || offset > FILE_CACHE_SIZE ||
+        length > FILE_CACHE_SIZE - offset) {
+        return -1;
+    }
+
+    message_t reply = { .message_type = FS_READ_REPLY };
+    if (length <= MESSAGE_INLINE_MAX) {
+        reply.size = (uint32_t)length;
+        memcpy(reply.data, file_cache + offset, length);
+    } else {
+        reply.grant = grant_create(server, client, file_cache + offset, length, false);
+        if (!reply.grant) return -1;
+        grant_release(server, reply.grant);  // Freed once the client unmaps
+    }
+    return send_message(server, client, &reply);
+}
+
+/* Main Kernel Initialization */
+void init_microkernel(void) {
+    printf("Initializing microkernel...\n");
 
     // Create initial system processes
     create_process_params params[] = {
@@ -219,10 +873,19 @@ void init_microkernel(void) {
     };
 
     for (int i = 0; i < 3; i++) {
-        if (!create_user_process(&params[i])) {
+        process_t* server = create_user_process(&params[i]);
+        if (!server) {
             printf("Failed to create system process: %s\n", params[i].process_name);
             return;
         }
+        if (!start_server(server)) {
+            printf("Failed to initialize IPC channels\n");
+            return;
+        }
+    }
+    ipc_register_server(find_process("file_server"), file_server_serve);
+    for (size_t i = 0; i < FILE_CACHE_SIZE; i++) {
+        file_cache[i] = (char)('a' + i % 26);
     }
 
     printf("Microkernel initialization complete\n");
@@ -256,21 +919,462 @@ void test_microkernel(void) {
     }
 
     // Receive and verify message
-    message_t* received_msg = receive_message(test_process);
+    ipc_msg_t* received_msg = receive_message(test_process);
     if (!received_msg) {
         printf("Test failed: Could not receive message\n");
         return;
     }
 
     printf("Test message received: %s\n", received_msg->data);
+    release_message(test_process);
+
+    // Zero-copy path: build the message directly in the receiver's ring
+    ipc_msg_t* slot = reserve_message(test_process, sizeof("zero-copy"));
+    if (!slot) {
+        printf("Test failed: Could not reserve a zero-copy message\n");
+        return;
+    }
+    slot->message_type = 2;
+    memcpy(slot->data, "zero-copy", slot->size);
+    commit_message(process_list, test_process);
+
+    message_t copy;
+    if (receive_message_copy(test_process, &copy) != 0) {
+        printf("Test failed: Could not receive zero-copy message\n");
+        return;
+    }
+    printf("Test message received: %s\n", copy.data);
+
+    // Threaded servers: request/reply over lock-free channels
+    message_t reply;
+    if (!connect_client(test_process) ||
+        server_request(test_process, find_process("file_server"),
+                       "read /etc/motd", &reply) != 0) {
+        printf("Test failed: No reply from file_server\n");
+        return;
+    }
+    printf("Server reply: %s\n", reply.data);
+
+    // Synchronous call with a direct switch to the waiting file_server
+    ipc_regs_t regs = { .label = FS_LOOKUP_BLOCK, .length = 1, .words = { 3 } };
+    if (ipc_call(test_process, find_process("file_server"), &regs) != 0 ||
+        regs.label != 0) {
+        printf("Test failed: file_server call failed\n");
+        return;
+    }
+    printf("Call reply: block 3 at offset %llu, %llu bytes\n",
+           (unsigned long long)regs.words[0], (unsigned long long)regs.words[1]);
+
+    // The same call while file_server is busy: queued, then served when
+    // the server next waits
+    process_t* fs = find_process("file_server");
+    ipc_regs_t queued = { .label = FS_LOOKUP_BLOCK, .length = 1, .words = { 5 } };
+    ipc_regs_t idle = { 0 };
+    fs->state = PROCESS_RUNNING;
+    if (ipc_call(test_process, fs, &queued) != 1 ||
+        ipc_reply_and_wait(fs, &idle) != 0 ||
+        test_process->state == PROCESS_CALL_WAIT || test_process->regs.label != 0) {
+        printf("Test failed: queued file_server call was not answered\n");
+        return;
+    }
+    printf("Queued call reply: block 5 at offset %llu\n",
+           (unsigned long long)test_process->regs.words[0]);
+
+    // Bulk read: file_server grants a region instead of copying it
+    if (file_server_read(fs, test_process, 4096, 65536) != 0) {
+        printf("Test failed: file_server read failed\n");
+        return;
+    }
+    ipc_msg_t* read_reply = receive_message(test_process);
+    if (read_reply && grant_map_writable(test_process, read_reply->grant, NULL)) {
+        printf("Test failed: read-only grant mapped for writing\n");
+        return;
+    }
+    size_t length = 0;
+    const char* region = read_reply ? grant_map(test_process, read_reply->grant, &length) : NULL;
+    if (!region) {
+        printf("Test failed: Could not map file_server grant\n");
+        return;
+    }
+    printf("Mapped grant %u: %zu bytes starting \"%.8s\"\n",
+           read_reply->grant, length, region);
+    grant_unmap(test_process, read_reply->grant);
+    release_message(test_process);
     printf("Tests completed successfully\n");
 }
 
-int main(void) {
+/* IPC benchmark: send/receive cost with the queue held at various
+ * depths, against the original receive that shifted the whole queue */
+#define IPC_BENCH_OPS 1000000
+
+/* Original queue: fixed-size slots, shifted down on every receive */
+static message_t legacy_queue[MAX_QUEUE_SIZE];
+static uint32_t legacy_size;
+
+static void shift_receive(message_t* out) {
+    memcpy(out, &legacy_queue[0], sizeof(message_t));
+    for (uint32_t i = 0; i < legacy_size - 1; i++) {
+        legacy_queue[i] = legacy_queue[i + 1];
+    }
+    legacy_size--;
+}
+
+void benchmark_ipc(void) {
+    static const uint32_t depths[] = { 1, 10, 50, MAX_QUEUE_SIZE - 1 };
+    create_process_params params = {"ipc_bench", 1, NULL};
+    process_t* sender = process_list;
+    process_t* receiver = create_user_process(&params);
+    if (!sender || !receiver) return;
+
+    message_t msg = { .message_type = 1, .size = 4 };
+    memcpy(msg.data, "ping", 4);
+    message_t out;
+    ipc_trace = false;
+
+    printf("%-8s %14s %14s %14s\n", "depth", "shift ns/op", "ring ns/op", "zero-copy ns/op");
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        double ns[3];
+        for (int mode = 0; mode < 3; mode++) {
+            // Fill to depth - 1, then each op adds one and removes one
+            while (receiver->queue_size > 0) receive_message_copy(receiver, &out);
+            legacy_size = 0;
+            for (uint32_t i = 0; i + 1 < depths[d]; i++) {
+                if (mode == 0) {
+                    legacy_queue[legacy_size++] = msg;
+                } else {
+                    send_message(sender, receiver, &msg);
+                }
+            }
+
+            uint64_t start = trace_clock_ns();
+            for (int op = 0; op < IPC_BENCH_OPS; op++) {
+                if (mode == 0) {
+                    // Original layout: append at queue_size, shift on receive
+                    memcpy(&legacy_queue[legacy_size], &msg, sizeof(message_t));
+                    legacy_size++;
+                    shift_receive(&out);
+                } else if (mode == 1) {
+                    send_message(sender, receiver, &msg);
+                    receive_message_copy(receiver, &out);
+                } else {
+                    ipc_msg_t* slot = reserve_message(receiver, 4);
+                    if (!slot) {
+                        printf("Receiver's queue is full\n");
+                        break;
+                    }
+                    slot->message_type = 1;
+                    memcpy(slot->data, "ping", 4);
+                    commit_message(sender, receiver);
+                    ipc_msg_t* in = receive_message(receiver);
+                    (void)in;
+                    release_message(receiver);
+                }
+            }
+            ns[mode] = (double)(trace_clock_ns() - start) / IPC_BENCH_OPS;
+        }
+        printf("%-8u %14.1f %14.1f %14.1f\n", depths[d], ns[0], ns[1], ns[2]);
+    }
+
+    while (receiver->queue_size > 0) receive_message_copy(receiver, &out);
+    ipc_trace = true;
+}
+
+/* Bulk transfer benchmark: moving a file_server read to a client as a
+ * stream of full-size messages copied through the mailbox, against a
+ * single reply carrying a grant. The first round of each is checksummed
+ * to check both deliver the same bytes. */
+#define BULK_BENCH_ROUNDS 2000
+
+static uint64_t checksum(const char* data, size_t length) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < length; i++) sum += (unsigned char)data[i];
+    return sum;
+}
+
+void benchmark_bulk(void) {
+    static const size_t sizes[] = { 4096, 65536, FILE_CACHE_SIZE };
+    static char buffer[FILE_CACHE_SIZE];
+    create_process_params params = {"bulk_bench", 1, NULL};
+    process_t* client = create_user_process(&params);
+    process_t* server = find_process("file_server");
+    if (!client || !server) return;
+    ipc_trace = false;
+
+    printf("%-10s %14s %14s\n", "bytes", "copy MB/s", "grant MB/s");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t length = sizes[s];
+        uint64_t sum_copy = 0, sum_grant = 0;
+
+        uint64_t start = trace_clock_ns();
+        for (int round = 0; round < BULK_BENCH_ROUNDS; round++) {
+            for (size_t off = 0; off < length; off += MESSAGE_INLINE_MAX) {
+                file_server_read(server, client, off, MESSAGE_INLINE_MAX);
+                ipc_msg_t* msg = receive_message(client);
+                memcpy(buffer + off, msg->data, msg->size);
+                release_message(client);
+            }
+            if (round == 0) sum_copy = checksum(buffer, length);
+        }
+        double copy_ns = (double)(trace_clock_ns() - start);
+
+        start = trace_clock_ns();
+        for (int round = 0; round < BULK_BENCH_ROUNDS; round++) {
+            file_server_read(server, client, 0, length);
+            ipc_msg_t* msg = receive_message(client);
+            const char* region = grant_map(client, msg->grant, NULL);
+            if (round == 0) sum_grant = checksum(region, length);
+            grant_unmap(client, msg->grant);
+            release_message(client);
+        }
+        double grant_ns = (double)(trace_clock_ns() - start);
+
+        if (sum_copy != sum_grant) printf("Checksum mismatch\n");
+        double bytes = (double)length * BULK_BENCH_ROUNDS;
+        printf("%-10zu %14.0f %14.0f\n", length,
+               bytes * 1e3 / copy_ns, bytes * 1e3 / grant_ns);
+    }
+    ipc_trace = true;
+
+    uint32_t total = 0, with_mailbox = 0;
+    for (process_t* p = process_list; p; p = p->next) {
+        total++;
+        if (p->mailbox) with_mailbox++;
+    }
+    printf("process_t is %zu bytes (about %zu with the old inline queue); "
+           "%u of %u processes have a %d-byte mailbox arena\n",
+           sizeof(process_t), sizeof(process_t) + MAX_QUEUE_SIZE * sizeof(message_t),
+           with_mailbox, total, MAILBOX_ARENA_SIZE);
+}
+
+/* RPC benchmark: round trips to file_server through ipc_call against the
+ * same exchange done with send_message, receive_message and the
+ * round-robin scheduler */
+#define RPC_BENCH_ROUNDS 1000000
+
+// One send/receive round trip, with the scheduler choosing who runs next
+static void rpc_send_receive_once(process_t* client, process_t* server, uint64_t i) {
+    message_t request = { .message_type = FS_LOOKUP_BLOCK, .size = sizeof(uint64_t) };
+    message_t in, out;
+    memcpy(request.data, &i, sizeof(i));
+    send_message(client, server, &request);
+    client->state = PROCESS_WAITING;
+    while (current_process != server) schedule_next_process();
+
+    receive_message_copy(server, &in);
+    ipc_regs_t regs = { .label = in.message_type, .length = 1 };
+    memcpy(regs.words, in.data, sizeof(uint64_t));
+    file_server_serve(server, &regs);
+    message_t reply = { .message_type = regs.label,
+                        .size = regs.length * sizeof(uint64_t) };
+    memcpy(reply.data, regs.words, reply.size);
+    send_message(server, client, &reply);
+    server->state = PROCESS_WAITING;
+    while (current_process != client) schedule_next_process();
+    receive_message_copy(client, &out);
+}
+
+void benchmark_rpc(void) {
+    create_process_params params = {"rpc_bench", 1, NULL};
+    process_t* client = create_user_process(&params);
+    process_t* server = find_process("file_server");
+    if (!client || !server) return;
+    ipc_trace = false;
+
+    // Send/receive path, with the scheduler choosing who runs next
+    uint64_t picks = ipc_stats.scheduler_switches;
+    uint64_t start = trace_clock_ns();
+    for (uint64_t i = 0; i < RPC_BENCH_ROUNDS; i++) {
+        rpc_send_receive_once(client, server, i);
+    }
+    double slow_ns = (double)(trace_clock_ns() - start) / RPC_BENCH_ROUNDS;
+    double picks_per_rt = (double)(ipc_stats.scheduler_switches - picks) / RPC_BENCH_ROUNDS;
+
+    // call/reply_and_wait with direct switches
+    uint64_t fast = ipc_stats.fast_calls;
+    start = trace_clock_ns();
+    for (uint64_t i = 0; i < RPC_BENCH_ROUNDS; i++) {
+        ipc_regs_t regs = { .label = FS_LOOKUP_BLOCK, .length = 1, .words = { i } };
+        ipc_call(client, server, &regs);
+    }
+    double fast_ns = (double)(trace_clock_ns() - start) / RPC_BENCH_ROUNDS;
+    ipc_trace = true;
+
+    printf("send/receive:  %6.1f ns round trip, %5.1f M round trips/s, "
+           "%.1f scheduler picks each\n", slow_ns, 1e3 / slow_ns, picks_per_rt);
+    printf("call/reply:    %6.1f ns round trip, %5.1f M round trips/s, "
+           "%llu direct calls\n", fast_ns, 1e3 / fast_ns,
+           (unsigned long long)(ipc_stats.fast_calls - fast));
+    printf("Totals: %llu fast calls, %llu slow calls, %llu direct switches, "
+           "%llu scheduler switches\n",
+           (unsigned long long)ipc_stats.fast_calls,
+           (unsigned long long)ipc_stats.slow_calls,
+           (unsigned long long)ipc_stats.direct_switches,
+           (unsigned long long)ipc_stats.scheduler_switches);
+}
+
+/* Cross-thread channel benchmark: request/reply round trips against a
+ * server thread, and one-way streaming through SPSC and MPSC channels */
+#define CHANNEL_BENCH_ROUNDS 100000
+#define CHANNEL_BENCH_STREAM 500000
+#define CHANNEL_BENCH_PRODUCERS 3
+
+typedef struct {
+    ipc_channel_t* channel;
+    uint32_t count;
+} stream_producer_t;
+
+static void pin_to_cpu(int cpu) {
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % sysconf(_SC_NPROCESSORS_ONLN), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+static void* stream_producer(void* arg) {
+    stream_producer_t* producer = arg;
+    message_t msg = { .message_type = SERVER_REQUEST, .size = 8 };
+    pin_to_cpu(1);
+    for (uint32_t i = 0; i < producer->count; i++) {
+        memcpy(msg.data, &i, sizeof(i));
+        channel_send(producer->channel, &msg);
+    }
+    return NULL;
+}
+
+static double stream_messages(channel_kind_t kind, int producers) {
+    ipc_channel_t* channel = create_ipc_channel(CHANNEL_CAPACITY, kind);
+    if (!channel) return 0.0;
+    pthread_t threads[CHANNEL_BENCH_PRODUCERS];
+    stream_producer_t args[CHANNEL_BENCH_PRODUCERS];
+    uint32_t per_producer = CHANNEL_BENCH_STREAM / producers;
+
+    uint64_t start = trace_clock_ns();
+    for (int i = 0; i < producers; i++) {
+        args[i] = (stream_producer_t){ channel, per_producer };
+        pthread_create(&threads[i], NULL, stream_producer, &args[i]);
+    }
+    message_t msg;
+    for (uint32_t i = 0; i < per_producer * producers; i++) {
+        channel_receive(channel, &msg);
+    }
+    double elapsed = (double)(trace_clock_ns() - start);
+    for (int i = 0; i < producers; i++) pthread_join(threads[i], NULL);
+
+    destroy_ipc_channel(channel);
+    return per_producer * producers * 1e3 / elapsed;
+}
+
+void benchmark_channels(void) {
+    create_process_params params = {"channel_bench", 1, NULL};
+    process_t* client = create_user_process(&params);
+    process_t* server = find_process("device_driver");
+    if (!client || !server || !connect_client(client)) return;
+    pin_to_cpu(0);
+
+    message_t reply;
+    uint64_t start = trace_clock_ns();
+    for (int i = 0; i < CHANNEL_BENCH_ROUNDS; i++) {
+        server_request(client, server, "ping", &reply);
+    }
+    double rtt_ns = (double)(trace_clock_ns() - start) / CHANNEL_BENCH_ROUNDS;
+    printf("Ping-pong with %s: %.0f ns round trip, %.0f round trips/s\n", 
+           server->name, rtt_ns, 1e9 / rtt_ns);
+
+    printf("SPSC stream, 1 producer: %.1f M msgs/s\n", 
+           stream_messages(CHANNEL_SPSC, 1));
+    for (int producers = 1; producers <= CHANNEL_BENCH_PRODUCERS; producers++) {
+        printf("MPSC stream, %d producer(s): %.1f M msgs/s\n", 
+               producers, stream_messages(CHANNEL_MPSC, producers));
+    }
+}
+
+/* Cross-model benchmark suite: the bench.h workloads on this kernel */
+typedef struct {
+    process_t* client;
+    process_t* server;
+} bench_pair_t;
+
+static uint64_t bench_schedule(void* ctx, uint32_t n) {
+    (void)ctx;
+    uint64_t before = ipc_stats.scheduler_switches;
+    for (uint32_t i = 0; i < n; i++) schedule_next_process();
+    return ipc_stats.scheduler_switches - before;
+}
+
+static uint64_t bench_call(void* ctx, uint32_t n) {
+    bench_pair_t* pair = ctx;
+    for (uint32_t i = 0; i < n; i++) {
+        ipc_regs_t regs = { .label = FS_LOOKUP_BLOCK, .length = 1, .words = { i } };
+        if (ipc_call(pair->client, pair->server, &regs) != 0) return 0;
+    }
+    return n;
+}
+
+// The benchmark_rpc exchange over send_message and the scheduler
+static uint64_t bench_send_receive(void* ctx, uint32_t n) {
+    bench_pair_t* pair = ctx;
+    for (uint32_t i = 0; i < n; i++) rpc_send_receive_once(pair->client, pair->server, i);
+    return n;
+}
+
+static uint64_t bench_channel(void* ctx, uint32_t n) {
+    bench_pair_t* pair = ctx;
+    message_t reply;
+    for (uint32_t i = 0; i < n; i++) {
+        if (server_request(pair->client, pair->server, "ping", &reply) != 0) return 0;
+    }
+    return n;
+}
+
+int run_benchmark_suite(void) {
+    create_process_params params = {"bench_client", 1, NULL};
+    process_t* client = create_user_process(&params);
+    bench_pair_t local = { client, find_process("file_server") };
+    bench_pair_t remote = { client, find_process("device_driver") };
+    if (!client || !local.server || !remote.server || !connect_client(client)) return 1;
+    ipc_trace = false;
+
+    bench_begin("microkernel");
+    bench_run(BENCH_CONTEXT_SWITCH, "round_robin", bench_schedule, NULL, 0);
+    bench_run(BENCH_IPC_ROUNDTRIP, "call_reply", bench_call, &local, 0);
+    bench_run(BENCH_IPC_ROUNDTRIP, "send_receive", bench_send_receive, &local, 0);
+    bench_run(BENCH_IPC_ROUNDTRIP, "server_thread", bench_channel, &remote, 0);
+    ipc_trace = true;
+    return bench_end();
+}
+
+/* "bench" runs only the benchmark suite */
+int main(int argc, char** argv) {
     printf("Starting microkernel system...\n");
     
     init_microkernel();
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        int status = run_benchmark_suite();
+        shutdown_servers();
+        return status;
+    }
     test_microkernel();
     
+    printf("\nRunning IPC benchmark...\n");
+    benchmark_ipc();
+    
+    printf("\nRunning bulk transfer benchmark...\n");
+    benchmark_bulk();
+    
+    printf("\nRunning RPC benchmark...\n");
+    benchmark_rpc();
+    
+    printf("\nRunning channel benchmark...\n");
+    benchmark_channels();
+    
+    shutdown_servers();
+    
+    printf("\nTrace metrics (benchmarks run untraced, except server threads):\n");
+    trace_report();
+    
     return 0;
 }
@@ -4,11 +4,22 @@
 #include <stdio.h>      // For print functions
 #include <stdlib.h>     // For malloc and free
 #include <string.h>     // For memory operations
+#include <time.h>       // For benchmark timing
+#include <pthread.h>    // For the page pool lock and benchmark threads
+#include <errno.h>      // For system call error codes
+#include <unistd.h>     // For getppid, used to model the kernel entry trap
+#include "trace.h"      // For trace events, counters and histograms
+#include "bench.h"      // For the cross-model benchmark suite
 
 /* System call numbers - Used to identify different system services */
 #define SYS_ALLOCATE_MEMORY 1    // Memory allocation request
 #define SYS_CREATE_PROCESS  2    // Process creation request
 #define SYS_READ_FILE      3     // File read request
+#define SYS_RING_ENTER     4     // Process a batch from a syscall ring
+#define NR_SYSCALLS        5
+
+/* Syscall ring configuration */
+#define RING_ENTRIES       64    // Submission/completion slots, power of two
 
 /* Interrupt numbers - Hardware interrupt identifiers */
 #define TIMER_INTERRUPT     32   // Regular timer tick
@@ -18,22 +29,50 @@
 /* Memory configuration */
 #define PAGE_SIZE          4096  // Size of each memory page
 #define TOTAL_MEMORY_PAGES 1024  // Total number of pages in system
+#define MAX_ORDER          10    // Largest block is 2^MAX_ORDER pages
+#define PCP_CAPACITY       64    // Pages held by each per-CPU cache
+#define PCP_BATCH          32    // Pages moved per refill or drain
+
+/* Scheduler configuration */
+#define TICK_NS            1000000ull  // Simulated time per timer interrupt
+#define SCHED_GRANULARITY_NS 1000000ull  // Lead needed before preempting
+#define NICE_0_WEIGHT      1024        // Load weight of a nice-0 process
+
+/* Page flags */
+#define PAGE_FLAG_FREE     0x1   // Head of a block on a free list
 
 /* Memory Management Structures */
 typedef struct page {
     uint32_t flags;              // Page flags (free, used, etc.)
     uint32_t ref_count;          // Reference counter for shared pages
-    struct page* next;           // Next page in free list
-    uint8_t data[PAGE_SIZE];     // Actual page data
-} page_t;
+    uint32_t order;              // Block order, valid on a block's head page
+    struct page* next;           // Next block in free list
+    struct page* prev;           // Previous block in free list
+} page_t;                        // Descriptor only; data lives in memory[]
 
 typedef struct {
-    page_t* free_pages;          // List of free pages
+    page_t* free_area[MAX_ORDER + 1];  // Free blocks per order
+    uint32_t free_count[MAX_ORDER + 1];
     uint32_t total_pages;        // Total pages in system
     uint32_t used_pages;         // Currently used pages
-    page_t* all_pages;           // Array of all pages
+    page_t* all_pages;           // Dense descriptor array, one per page
+    uint8_t* memory;             // Page frames, PAGE_SIZE aligned
+    pthread_mutex_t lock;        // Protects the buddy free lists
+    bool pcp_enabled;            // Serve order-0 requests from per-CPU caches
+    bool tracing;                // Trace each allocation (off for benchmarks)
 } memory_manager_t;
 
+/* Per-CPU (here per-thread) magazine of free order-0 pages. The owning
+ * thread pops and pushes without locking; only refill and drain take
+ * the global lock, and they move PCP_BATCH pages at a time. */
+typedef struct {
+    memory_manager_t* owner;     // Pool the cached pages came from
+    uint32_t count;
+    page_t* pages[PCP_CAPACITY];
+} page_cache_t;
+
+static _Thread_local page_cache_t page_cache;
+
 /* Process Management Structures */
 typedef enum {
     PROCESS_READY,
@@ -42,18 +81,48 @@ typedef enum {
     PROCESS_TERMINATED
 } process_state_t;
 
+/* Red-black tree node, embedded in each process */
+typedef struct rb_node {
+    struct rb_node* left;
+    struct rb_node* right;
+    struct rb_node* parent;
+    bool red;
+} rb_node_t;
+
 typedef struct process {
     uint32_t pid;                // Process ID
     process_state_t state;       // Current process state
     uint32_t* stack_pointer;     // Current stack pointer
     uint32_t* page_directory;    // Page directory for virtual memory
     struct process* next;        // Next process in list
+    rb_node_t run_node;          // Position in the run queue while READY
+    uint32_t weight;             // Load weight derived from nice value
+    uint64_t vruntime;           // Weighted CPU time received (ns)
+    uint64_t runtime;            // Actual CPU time received (ns)
+    uint64_t ready_since;        // Clock when it last became READY
+    uint64_t total_wait;         // Time spent READY but not running
+    uint64_t max_latency;        // Longest single wait for the CPU
+    uint32_t dispatches;         // Times it was given the CPU
 } process_t;
 
+/* CFS-style run queue: READY processes ordered by vruntime in a
+ * red-black tree, with the leftmost (next to run) node cached */
+typedef struct {
+    rb_node_t nil;               // Sentinel shared by all leaves
+    rb_node_t* root;
+    rb_node_t* leftmost;
+    uint32_t nr_ready;
+    uint64_t min_vruntime;       // Floor for newly woken processes
+    uint64_t clock;              // Simulated time (ns)
+} run_queue_t;
+
 typedef struct {
     process_t* current_process;   // Currently running process
     process_t* process_list;     // List of all processes
     uint32_t next_pid;           // Next available process ID
+    run_queue_t rq;              // READY processes
+    uint32_t context_switches;
+    bool tracing;                // Trace each switch (off for benchmarks)
 } process_manager_t;
 
 /* File System Structures */
@@ -62,6 +131,7 @@ typedef struct {
     uint32_t size;              // File size
     uint32_t permissions;       // Access permissions
     uint32_t inode;            // File system inode number
+    uint8_t* data;             // File contents
 } file_t;
 
 typedef struct {
@@ -75,17 +145,112 @@ typedef struct {
     process_manager_t* process_manager;
     filesystem_t* filesystem;
     bool interrupts_enabled;
+    uint64_t kernel_entries;     // Traps into the kernel
+    uint64_t syscalls_handled;   // System calls executed
+    bool tracing;                // Trace each system call
 } kernel_t;
 
+/* System call argument structures */
+typedef struct {
+    uint32_t order;              // Allocate 2^order contiguous pages
+} sys_allocate_memory_args_t;
+
+typedef struct {
+    int nice;                    // Scheduling priority of the new process
+} sys_create_process_args_t;
+
+typedef struct {
+    const char* name;            // File to read
+    void* buffer;                // Destination
+    uint32_t size;               // Bytes requested
+    uint32_t offset;             // Starting offset in the file
+} sys_read_file_args_t;
+
+/* Submission queue entry: one system call and its arguments */
+typedef struct {
+    uint32_t syscall_number;
+    uint64_t user_data;          // Copied to the completion untouched
+    union {
+        sys_allocate_memory_args_t allocate_memory;
+        sys_create_process_args_t create_process;
+        sys_read_file_args_t read_file;
+    } args;
+} sqe_t;
+
+/* Completion queue entry */
+typedef struct {
+    uint64_t user_data;
+    int64_t result;              // Return value, or a negative errno
+} cqe_t;
+
+/* io_uring-style shared rings. The caller produces at sq_tail and
+ * consumes at cq_head; the kernel consumes at sq_head and produces at
+ * cq_tail. Indices run freely and are masked on access. */
+typedef struct {
+    sqe_t sq[RING_ENTRIES];
+    cqe_t cq[RING_ENTRIES];
+    uint32_t sq_head, sq_tail;
+    uint32_t cq_head, cq_tail;
+    uint64_t cq_overflow;        // Submissions left queued for lack of CQ room
+} syscall_ring_t;
+
+typedef struct {
+    syscall_ring_t* ring;
+} sys_ring_enter_args_t;
+
+typedef int64_t (*syscall_fn_t)(void* args);
+
 /* Global kernel instance */
 kernel_t kernel;
 
+/* Trace counters and histograms, reported at exit */
+TRACE_COUNTER_DEFINE(alloc_counter, "pages_allocated");
+TRACE_COUNTER_DEFINE(free_counter, "pages_freed");
+TRACE_COUNTER_DEFINE(switch_counter, "context_switches");
+TRACE_COUNTER_DEFINE(syscall_counter, "syscalls");
+TRACE_COUNTER_DEFINE(interrupt_counter, "interrupts");
+TRACE_HISTOGRAM_DEFINE(alloc_hist, "page_allocation");
+TRACE_HISTOGRAM_DEFINE(syscall_hist, "syscall_dispatch");
+
 /* Function declarations */
 void switch_context(process_t* old, process_t* new);
+void schedule_next_process(process_manager_t* pm);
 void setup_interrupt_handlers(void);
 void enable_interrupts(void);
 
 /* Memory Management Implementation */
+
+/* Buddy allocator: blocks of 2^order pages, each aligned to its size.
+ * A block's buddy is found by flipping bit `order` of its page index,
+ * and freed blocks merge with free buddies back up to MAX_ORDER. */
+static inline uint32_t page_index(memory_manager_t* mm, page_t* page) {
+    return (uint32_t)(page - mm->all_pages);
+}
+
+static inline void* page_address(memory_manager_t* mm, page_t* page) {
+    return mm->memory + (size_t)page_index(mm, page) * PAGE_SIZE;
+}
+
+static void free_area_push(memory_manager_t* mm, page_t* page, uint32_t order) {
+    page->flags = PAGE_FLAG_FREE;
+    page->order = order;
+    page->prev = NULL;
+    page->next = mm->free_area[order];
+    if (page->next) page->next->prev = page;
+    mm->free_area[order] = page;
+    mm->free_count[order]++;
+}
+
+static void free_area_remove(memory_manager_t* mm, page_t* page, uint32_t order) {
+    if (page->prev) page->prev->next = page->next;
+    else mm->free_area[order] = page->next;
+    if (page->next) page->next->prev = page->prev;
+    page->next = NULL;
+    page->prev = NULL;
+    page->flags = 0;
+    mm->free_count[order]--;
+}
+
 memory_manager_t* init_memory_manager(void) {
     memory_manager_t* mm = malloc(sizeof(memory_manager_t));
     if (!mm) {
@@ -93,66 +258,443 @@ memory_manager_t* init_memory_manager(void) {
         return NULL;
     }
 
-    // Allocate all pages
-    mm->all_pages = malloc(sizeof(page_t) * TOTAL_MEMORY_PAGES);
-    if (!mm->all_pages) {
+    // Allocate page descriptors and page frames separately
+    mm->all_pages = calloc(TOTAL_MEMORY_PAGES, sizeof(page_t));
+    mm->memory = aligned_alloc(PAGE_SIZE, (size_t)TOTAL_MEMORY_PAGES * PAGE_SIZE);
+    if (!mm->all_pages || !mm->memory) {
         printf("Failed to allocate pages\n");
+        free(mm->all_pages);
+        free(mm->memory);
         free(mm);
         return NULL;
     }
 
-    // Initialize free list
-    mm->free_pages = &mm->all_pages[0];
     mm->total_pages = TOTAL_MEMORY_PAGES;
     mm->used_pages = 0;
+    mm->pcp_enabled = true;
+    mm->tracing = true;
+    pthread_mutex_init(&mm->lock, NULL);
+    for (uint32_t order = 0; order <= MAX_ORDER; order++) {
+        mm->free_area[order] = NULL;
+        mm->free_count[order] = 0;
+    }
 
-    // Link all pages in free list
-    for (uint32_t i = 0; i < TOTAL_MEMORY_PAGES - 1; i++) {
-        mm->all_pages[i].next = &mm->all_pages[i + 1];
-        mm->all_pages[i].ref_count = 0;
-        mm->all_pages[i].flags = 0;
+    // Seed the free lists with the largest aligned blocks that fit
+    uint32_t index = 0;
+    while (index < TOTAL_MEMORY_PAGES) {
+        uint32_t order = MAX_ORDER;
+        while ((index & ((1u << order) - 1)) != 0 ||
+               index + (1u << order) > TOTAL_MEMORY_PAGES)
+            order--;
+        free_area_push(mm, &mm->all_pages[index], order);
+        index += 1u << order;
     }
-    mm->all_pages[TOTAL_MEMORY_PAGES - 1].next = NULL;
 
     printf("Memory manager initialized with %u pages\n", TOTAL_MEMORY_PAGES);
     return mm;
 }
 
+/* Core buddy operations; the caller holds mm->lock */
+static page_t* buddy_alloc(memory_manager_t* mm, uint32_t order) {
+    // Find the smallest free block that is large enough
+    uint32_t current = order;
+    while (current <= MAX_ORDER && !mm->free_area[current]) current++;
+    if (current > MAX_ORDER) return NULL;
+
+    page_t* page = mm->free_area[current];
+    free_area_remove(mm, page, current);
+
+    // Split it, returning the upper halves to the lower orders
+    while (current > order) {
+        current--;
+        free_area_push(mm, page + (1u << current), current);
+    }
+
+    page->order = order;
+    mm->used_pages += 1u << order;
+    return page;
+}
+
+static void buddy_free(memory_manager_t* mm, page_t* page) {
+    uint32_t index = page_index(mm, page);
+    uint32_t order = page->order;
+    mm->used_pages -= 1u << order;
+
+    while (order < MAX_ORDER) {
+        uint32_t buddy_index = index ^ (1u << order);
+        if (buddy_index >= mm->total_pages) break;
+        page_t* buddy = &mm->all_pages[buddy_index];
+        if (!(buddy->flags & PAGE_FLAG_FREE) || buddy->order != order) break;
+
+        free_area_remove(mm, buddy, order);
+        index &= ~(1u << order);
+        order++;
+    }
+    free_area_push(mm, &mm->all_pages[index], order);
+}
+
+/* Refill an empty per-CPU cache with up to PCP_BATCH pages */
+static void page_cache_refill(memory_manager_t* mm, page_cache_t* pcp) {
+    pthread_mutex_lock(&mm->lock);
+    while (pcp->count < PCP_BATCH) {
+        page_t* page = buddy_alloc(mm, 0);
+        if (!page) break;
+        pcp->pages[pcp->count++] = page;
+    }
+    pthread_mutex_unlock(&mm->lock);
+}
+
+/* Return the oldest `count` cached pages to the buddy allocator */
+static void page_cache_release(memory_manager_t* mm, page_cache_t* pcp,
+                               uint32_t count) {
+    if (count > pcp->count) count = pcp->count;
+    pthread_mutex_lock(&mm->lock);
+    for (uint32_t i = 0; i < count; i++) {
+        buddy_free(mm, pcp->pages[i]);
+    }
+    pthread_mutex_unlock(&mm->lock);
+    memmove(pcp->pages, pcp->pages + count,
+            (pcp->count - count) * sizeof(page_t*));
+    pcp->count -= count;
+}
+
+/* Flush the calling thread's cache; threads call this before exiting */
+void page_cache_drain(memory_manager_t* mm) {
+    if (page_cache.owner == mm) {
+        page_cache_release(mm, &page_cache, page_cache.count);
+    }
+}
+
+/* Allocate 2^order physically contiguous pages from the global pool */
+void* allocate_pages(memory_manager_t* mm, uint32_t order) {
+    if (!mm || order > MAX_ORDER) return NULL;
+
+    uint64_t start = mm->tracing ? TRACE_CLOCK() : 0;
+    pthread_mutex_lock(&mm->lock);
+    page_t* page = buddy_alloc(mm, order);
+    pthread_mutex_unlock(&mm->lock);
+    if (!page) {
+        printf("Memory allocation failed: No free block of order %u\n", order);
+        return NULL;
+    }
+
+    page->ref_count = 1;
+    void* addr = page_address(mm, page);
+    if (mm->tracing) {
+        TRACE_HIST(alloc_hist, TRACE_CLOCK() - start);
+        TRACE_COUNT(alloc_counter, 1u << order);
+        TRACE_INSTANT("allocate pages", order);
+    }
+    return addr;
+}
+
+/* Allocate one page, from this thread's cache when possible */
 void* allocate_page(memory_manager_t* mm) {
-    if (!mm || !mm->free_pages) {
+    if (!mm) return NULL;
+    if (!mm->pcp_enabled) return allocate_pages(mm, 0);
+
+    uint64_t start = mm->tracing ? TRACE_CLOCK() : 0;
+    page_cache_t* pcp = &page_cache;
+    if (pcp->owner != mm) {
+        if (pcp->owner) page_cache_drain(pcp->owner);
+        pcp->owner = mm;
+    }
+    if (pcp->count == 0) page_cache_refill(mm, pcp);
+    if (pcp->count == 0) {
         printf("Memory allocation failed: No free pages\n");
         return NULL;
     }
-    
-    page_t* page = mm->free_pages;
-    mm->free_pages = page->next;
-    mm->used_pages++;
-    
+
+    page_t* page = pcp->pages[--pcp->count];
     page->ref_count = 1;
-    page->flags = 0;
-    page->next = NULL;
-    
-    printf("Allocated page at %p\n", (void*)page);
-    return page;
+    void* addr = page_address(mm, page);
+    if (mm->tracing) {
+        TRACE_HIST(alloc_hist, TRACE_CLOCK() - start);
+        TRACE_COUNT(alloc_counter, 1);
+        TRACE_INSTANT("allocate page", 0);
+    }
+    return addr;
 }
 
+/* Drop a reference; the last one frees the block. Single pages go back
+ * to this thread's cache, larger blocks merge with their buddies. */
 void free_page(memory_manager_t* mm, void* page_addr) {
     if (!mm || !page_addr) return;
 
-    page_t* page = (page_t*)page_addr;
-    
-    if (page->ref_count > 0) {
-        page->ref_count--;
-        if (page->ref_count == 0) {
-            page->next = mm->free_pages;
-            mm->free_pages = page;
-            mm->used_pages--;
-            printf("Freed page at %p\n", (void*)page);
+    uintptr_t offset = (uintptr_t)page_addr - (uintptr_t)mm->memory;
+    if ((uint8_t*)page_addr < mm->memory || offset % PAGE_SIZE != 0 ||
+        offset / PAGE_SIZE >= mm->total_pages) {
+        printf("Free failed: %p is not a page address\n", page_addr);
+        return;
+    }
+
+    page_t* page = &mm->all_pages[offset / PAGE_SIZE];
+    if (page->ref_count == 0 || (page->flags & PAGE_FLAG_FREE)) return;
+    if (__atomic_sub_fetch(&page->ref_count, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+    if (mm->tracing) {
+        TRACE_COUNT(free_counter, 1u << page->order);
+        TRACE_INSTANT("free pages", page->order);
+    }
+
+    page_cache_t* pcp = &page_cache;
+    if (mm->pcp_enabled && page->order == 0 && pcp->owner == mm) {
+        if (pcp->count == PCP_CAPACITY) {
+            page_cache_release(mm, pcp, PCP_BATCH);
         }
+        pcp->pages[pcp->count++] = page;
+        return;
     }
+
+    pthread_mutex_lock(&mm->lock);
+    buddy_free(mm, page);
+    pthread_mutex_unlock(&mm->lock);
+}
+
+/* Largest order that can currently be allocated, or -1 if none */
+int largest_free_order(memory_manager_t* mm) {
+    for (int order = MAX_ORDER; order >= 0; order--) {
+        if (mm->free_area[order]) return order;
+    }
+    return -1;
 }
 
 /* Process Management Implementation */
+
+/* Nice value to load weight, as in Linux: each step is ~1.25x */
+static const uint32_t nice_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,   335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+
+#define rb_process(node) \
+    ((process_t*)((char*)(node) - offsetof(process_t, run_node)))
+
+/* Order by vruntime, then pid, so equal vruntimes run in creation order */
+static bool rb_less(rb_node_t* a, rb_node_t* b) {
+    process_t* pa = rb_process(a);
+    process_t* pb = rb_process(b);
+    if (pa->vruntime != pb->vruntime) return pa->vruntime < pb->vruntime;
+    return pa->pid < pb->pid;
+}
+
+static void rb_rotate_left(run_queue_t* rq, rb_node_t* x) {
+    rb_node_t* y = x->right;
+    x->right = y->left;
+    if (y->left != &rq->nil) y->left->parent = x;
+    y->parent = x->parent;
+    if (x->parent == &rq->nil) rq->root = y;
+    else if (x == x->parent->left) x->parent->left = y;
+    else x->parent->right = y;
+    y->left = x;
+    x->parent = y;
+}
+
+static void rb_rotate_right(run_queue_t* rq, rb_node_t* x) {
+    rb_node_t* y = x->left;
+    x->left = y->right;
+    if (y->right != &rq->nil) y->right->parent = x;
+    y->parent = x->parent;
+    if (x->parent == &rq->nil) rq->root = y;
+    else if (x == x->parent->right) x->parent->right = y;
+    else x->parent->left = y;
+    y->right = x;
+    x->parent = y;
+}
+
+static rb_node_t* rb_minimum(run_queue_t* rq, rb_node_t* node) {
+    while (node->left != &rq->nil) node = node->left;
+    return node;
+}
+
+static void rb_insert(run_queue_t* rq, rb_node_t* z) {
+    rb_node_t* parent = &rq->nil;
+    rb_node_t* cur = rq->root;
+    bool leftmost = true;
+
+    while (cur != &rq->nil) {
+        parent = cur;
+        if (rb_less(z, cur)) {
+            cur = cur->left;
+        } else {
+            cur = cur->right;
+            leftmost = false;
+        }
+    }
+    z->parent = parent;
+    z->left = z->right = &rq->nil;
+    z->red = true;
+    if (parent == &rq->nil) rq->root = z;
+    else if (rb_less(z, parent)) parent->left = z;
+    else parent->right = z;
+    if (leftmost) rq->leftmost = z;
+
+    // Restore red-black properties
+    while (z->parent->red) {
+        rb_node_t* gp = z->parent->parent;
+        if (z->parent == gp->left) {
+            rb_node_t* uncle = gp->right;
+            if (uncle->red) {
+                z->parent->red = false;
+                uncle->red = false;
+                gp->red = true;
+                z = gp;
+            } else {
+                if (z == z->parent->right) {
+                    z = z->parent;
+                    rb_rotate_left(rq, z);
+                }
+                z->parent->red = false;
+                z->parent->parent->red = true;
+                rb_rotate_right(rq, z->parent->parent);
+            }
+        } else {
+            rb_node_t* uncle = gp->left;
+            if (uncle->red) {
+                z->parent->red = false;
+                uncle->red = false;
+                gp->red = true;
+                z = gp;
+            } else {
+                if (z == z->parent->left) {
+                    z = z->parent;
+                    rb_rotate_right(rq, z);
+                }
+                z->parent->red = false;
+                z->parent->parent->red = true;
+                rb_rotate_left(rq, z->parent->parent);
+            }
+        }
+    }
+    rq->root->red = false;
+}
+
+static void rb_transplant(run_queue_t* rq, rb_node_t* u, rb_node_t* v) {
+    if (u->parent == &rq->nil) rq->root = v;
+    else if (u == u->parent->left) u->parent->left = v;
+    else u->parent->right = v;
+    v->parent = u->parent;
+}
+
+static void rb_erase(run_queue_t* rq, rb_node_t* z) {
+    if (rq->leftmost == z) {
+        rq->leftmost = z->right != &rq->nil ? rb_minimum(rq, z->right)
+                                            : z->parent;
+        if (rq->leftmost == &rq->nil) rq->leftmost = NULL;
+    }
+
+    rb_node_t* y = z;
+    rb_node_t* x;
+    bool y_was_red = y->red;
+    if (z->left == &rq->nil) {
+        x = z->right;
+        rb_transplant(rq, z, z->right);
+    } else if (z->right == &rq->nil) {
+        x = z->left;
+        rb_transplant(rq, z, z->left);
+    } else {
+        y = rb_minimum(rq, z->right);
+        y_was_red = y->red;
+        x = y->right;
+        if (y->parent == z) {
+            x->parent = y;
+        } else {
+            rb_transplant(rq, y, y->right);
+            y->right = z->right;
+            y->right->parent = y;
+        }
+        rb_transplant(rq, z, y);
+        y->left = z->left;
+        y->left->parent = y;
+        y->red = z->red;
+    }
+    if (y_was_red) return;
+
+    // Removed a black node: push the extra black up or rebalance
+    while (x != rq->root && !x->red) {
+        if (x == x->parent->left) {
+            rb_node_t* w = x->parent->right;
+            if (w->red) {
+                w->red = false;
+                x->parent->red = true;
+                rb_rotate_left(rq, x->parent);
+                w = x->parent->right;
+            }
+            if (!w->left->red && !w->right->red) {
+                w->red = true;
+                x = x->parent;
+            } else {
+                if (!w->right->red) {
+                    w->left->red = false;
+                    w->red = true;
+                    rb_rotate_right(rq, w);
+                    w = x->parent->right;
+                }
+                w->red = x->parent->red;
+                x->parent->red = false;
+                w->right->red = false;
+                rb_rotate_left(rq, x->parent);
+                x = rq->root;
+            }
+        } else {
+            rb_node_t* w = x->parent->left;
+            if (w->red) {
+                w->red = false;
+                x->parent->red = true;
+                rb_rotate_right(rq, x->parent);
+                w = x->parent->left;
+            }
+            if (!w->right->red && !w->left->red) {
+                w->red = true;
+                x = x->parent;
+            } else {
+                if (!w->left->red) {
+                    w->right->red = false;
+                    w->red = true;
+                    rb_rotate_left(rq, w);
+                    w = x->parent->left;
+                }
+                w->red = x->parent->red;
+                x->parent->red = false;
+                w->left->red = false;
+                rb_rotate_right(rq, x->parent);
+                x = rq->root;
+            }
+        }
+    }
+    x->red = false;
+}
+
+static void run_queue_init(run_queue_t* rq) {
+    rq->nil.left = rq->nil.right = rq->nil.parent = &rq->nil;
+    rq->nil.red = false;
+    rq->root = &rq->nil;
+    rq->leftmost = NULL;
+    rq->nr_ready = 0;
+    rq->min_vruntime = 0;
+    rq->clock = 0;
+}
+
+/* Make a process READY and queue it. Sleepers are placed no earlier
+ * than min_vruntime so they cannot hoard CPU after a long block. */
+static void enqueue_process(process_manager_t* pm, process_t* process) {
+    run_queue_t* rq = &pm->rq;
+    if (process->vruntime < rq->min_vruntime) {
+        process->vruntime = rq->min_vruntime;
+    }
+    process->state = PROCESS_READY;
+    process->ready_since = rq->clock;
+    rb_insert(rq, &process->run_node);
+    rq->nr_ready++;
+}
+
+static void dequeue_process(process_manager_t* pm, process_t* process) {
+    rb_erase(&pm->rq, &process->run_node);
+    pm->rq.nr_ready--;
+}
+
 process_manager_t* init_process_manager(void) {
     process_manager_t* pm = malloc(sizeof(process_manager_t));
     if (!pm) {
@@ -163,6 +705,9 @@ process_manager_t* init_process_manager(void) {
     pm->current_process = NULL;
     pm->process_list = NULL;
     pm->next_pid = 1;
+    pm->context_switches = 0;
+    pm->tracing = true;
+    run_queue_init(&pm->rq);
 
     printf("Process manager initialized\n");
     return pm;
@@ -178,81 +723,319 @@ process_t* create_process(process_manager_t* pm) {
     }
     
     process->pid = pm->next_pid++;
-    process->state = PROCESS_READY;
     process->stack_pointer = NULL;
     process->page_directory = NULL;
+    process->weight = NICE_0_WEIGHT;
+    process->vruntime = 0;
+    process->runtime = 0;
+    process->total_wait = 0;
+    process->max_latency = 0;
+    process->dispatches = 0;
     
     // Add to process list
     process->next = pm->process_list;
     pm->process_list = process;
+    enqueue_process(pm, process);
     
-    printf("Created process with PID %u\n", process->pid);
+    if (pm->tracing) TRACE_INSTANT("create process", process->pid);
     return process;
 }
 
+/* Set a process's nice value (-20..19); lower nice gets more CPU */
+void set_process_nice(process_manager_t* pm, process_t* process, int nice) {
+    (void)pm;  // The tree is keyed on vruntime, so no re-queue is needed
+    if (nice < -20) nice = -20;
+    if (nice > 19) nice = 19;
+    process->weight = nice_to_weight[nice + 20];
+}
+
+/* Take a process off the CPU or run queue until wake_process() */
+void block_process(process_manager_t* pm, process_t* process) {
+    if (process->state == PROCESS_READY) dequeue_process(pm, process);
+    process->state = PROCESS_BLOCKED;
+    if (pm->current_process == process) {
+        schedule_next_process(pm);  // Not RUNNING, so not requeued
+    }
+}
+
+void wake_process(process_manager_t* pm, process_t* process) {
+    if (process->state == PROCESS_BLOCKED) enqueue_process(pm, process);
+}
+
+void terminate_process(process_manager_t* pm, process_t* process) {
+    if (process->state == PROCESS_READY) dequeue_process(pm, process);
+    process->state = PROCESS_TERMINATED;
+    if (pm->current_process == process) {
+        schedule_next_process(pm);  // Not RUNNING, so not requeued
+    }
+}
+
+/* Hand the CPU to the READY process with the smallest vruntime. A
+ * still-running current process goes back into the run queue first; one
+ * that blocked or exited is only switched away from. */
 void schedule_next_process(process_manager_t* pm) {
-    if (!pm || !pm->current_process) {
-        printf("No processes to schedule\n");
+    if (!pm) return;
+
+    process_t* current = pm->current_process;
+    if (current && current->state == PROCESS_RUNNING) {
+        enqueue_process(pm, current);
+    }
+
+    if (!pm->rq.leftmost) {
+        pm->current_process = NULL;
+        if (pm->tracing) TRACE_INSTANT("idle", 0);
         return;
     }
 
-    process_t* current = pm->current_process;
+    process_t* next = rb_process(pm->rq.leftmost);
+    dequeue_process(pm, next);
+    next->state = PROCESS_RUNNING;
+    pm->current_process = next;
+
+    uint64_t latency = pm->rq.clock - next->ready_since;
+    next->total_wait += latency;
+    if (latency > next->max_latency) next->max_latency = latency;
+    next->dispatches++;
     
-    // Simple round-robin scheduling
-    if (current->next) {
-        pm->current_process = current->next;
-    } else {
-        pm->current_process = pm->process_list;
+    if (current && current != next) {
+        pm->context_switches++;
+        if (pm->tracing) {
+            TRACE_COUNT(switch_counter, 1);
+            TRACE_INSTANT("switch", next->pid);
+        }
+        switch_context(current, next);
+    } else if (!current && pm->tracing) {
+        TRACE_INSTANT("dispatch", next->pid);
+    }
+}
+
+/* Timer path: charge the running process for one tick and preempt it
+ * once it is a full granularity ahead of the leftmost READY process */
+void scheduler_tick(process_manager_t* pm) {
+    run_queue_t* rq = &pm->rq;
+    rq->clock += TICK_NS;
+
+    process_t* current = pm->current_process;
+    if (!current) {
+        schedule_next_process(pm);
+        return;
+    }
+
+    current->runtime += TICK_NS;
+    current->vruntime += TICK_NS * NICE_0_WEIGHT / current->weight;
+
+    // min_vruntime only moves forward
+    uint64_t floor = current->vruntime;
+    if (rq->leftmost && rb_process(rq->leftmost)->vruntime < floor) {
+        floor = rb_process(rq->leftmost)->vruntime;
+    }
+    if (floor > rq->min_vruntime) rq->min_vruntime = floor;
+
+    if (rq->leftmost &&
+        current->vruntime >= rb_process(rq->leftmost)->vruntime +
+                             SCHED_GRANULARITY_NS) {
+        schedule_next_process(pm);
+    }
+}
+
+/* Per-process scheduling statistics */
+void print_scheduler_stats(process_manager_t* pm) {
+    printf("%-5s %-10s %12s %12s %12s %10s\n", 
+           "PID", "state", "runtime ms", "wait ms", "max lat ms", "dispatches");
+    static const char* state_names[] = { "READY", "RUNNING", "BLOCKED", "TERMINATED" };
+    for (process_t* p = pm->process_list; p; p = p->next) {
+        printf("%-5u %-10s %12.1f %12.1f %12.1f %10u\n", p->pid,
+               state_names[p->state], p->runtime / 1e6, p->total_wait / 1e6,
+               p->max_latency / 1e6, p->dispatches);
     }
-    
-    printf("Switching from process %u to process %u\n", 
-           current->pid, pm->current_process->pid);
-    
-    switch_context(current, pm->current_process);
 }
 
 /* Context Switching (Dummy implementation) */
 void switch_context(process_t* old, process_t* new) {
-    printf("Switching context from process %u to %u\n", old->pid, new->pid);
+    // Register state would be saved into old and restored from new here;
+    // schedule_next_process already logs the switch
+    (void)old;
+    (void)new;
 }
 
-/* System Call Handler */
-void handle_system_call(uint32_t syscall_number, void* params) {
-    printf("Handling system call %u\n", syscall_number);
-    
-    switch (syscall_number) {
-        case SYS_ALLOCATE_MEMORY:
-            printf("Memory allocation system call\n");
-            break;
-        case SYS_CREATE_PROCESS:
-            printf("Process creation system call\n");
-            break;
-        case SYS_READ_FILE:
-            printf("File read system call\n");
-            break;
-        default:
-            printf("Unknown system call %u\n", syscall_number);
+/* System Call Implementations */
+int64_t sys_allocate_memory(void* params) {
+    sys_allocate_memory_args_t* args = params;
+    if (!args || args->order > MAX_ORDER) return -EINVAL;
+
+    void* block = args->order == 0 ? allocate_page(kernel.memory_manager)
+                                   : allocate_pages(kernel.memory_manager,
+                                                    args->order);
+    return block ? (int64_t)(uintptr_t)block : -ENOMEM;
+}
+
+int64_t sys_create_process(void* params) {
+    sys_create_process_args_t* args = params;
+    if (!args) return -EINVAL;
+
+    process_t* process = create_process(kernel.process_manager);
+    if (!process) return -ENOMEM;
+    set_process_nice(kernel.process_manager, process, args->nice);
+    return process->pid;
+}
+
+int64_t sys_read_file(void* params) {
+    sys_read_file_args_t* args = params;
+    if (!args || !args->name || !args->buffer) return -EINVAL;
+
+    filesystem_t* fs = kernel.filesystem;
+    for (uint32_t i = 0; i < fs->total_files; i++) {
+        file_t* file = &fs->root_directory[i];
+        if (strcmp(file->name, args->name) != 0) continue;
+
+        if (args->offset >= file->size) return 0;
+        uint32_t count = file->size - args->offset;
+        if (count > args->size) count = args->size;
+        memcpy(args->buffer, file->data + args->offset, count);
+        return count;
+    }
+    return -ENOENT;
+}
+
+int64_t sys_ring_enter(void* params);
+
+/* System call table, indexed by system call number */
+static const syscall_fn_t syscall_table[NR_SYSCALLS] = {
+    [SYS_ALLOCATE_MEMORY] = sys_allocate_memory,
+    [SYS_CREATE_PROCESS]  = sys_create_process,
+    [SYS_READ_FILE]       = sys_read_file,
+    [SYS_RING_ENTER]      = sys_ring_enter,
+};
+
+/* Run one system call from inside the kernel */
+static int64_t dispatch_system_call(uint32_t syscall_number, void* params) {
+    if (syscall_number >= NR_SYSCALLS || !syscall_table[syscall_number]) {
+        if (kernel.tracing) TRACE_INSTANT("unknown syscall", syscall_number);
+        return -ENOSYS;
+    }
+    kernel.syscalls_handled++;
+    return syscall_table[syscall_number](params);
+}
+
+/* Model the user/kernel mode switch with a real trap on the host */
+static void kernel_enter(void) {
+    kernel.kernel_entries++;
+    (void)getppid();
+}
+
+/* System Call Handler: one kernel entry per call */
+int64_t handle_system_call(uint32_t syscall_number, void* params) {
+    kernel_enter();
+    if (!kernel.tracing) return dispatch_system_call(syscall_number, params);
+    TRACE_COUNT(syscall_counter, 1);
+    TRACE_BEGIN("syscall");
+    uint64_t start = TRACE_CLOCK();
+    int64_t result = dispatch_system_call(syscall_number, params);
+    TRACE_HIST(syscall_hist, TRACE_CLOCK() - start);
+    TRACE_END("syscall");
+    return result;
+}
+
+/* Syscall Ring Interface */
+void syscall_ring_init(syscall_ring_t* ring) {
+    memset(ring, 0, sizeof(*ring));
+}
+
+/* Next free submission slot, or NULL if the ring is full */
+sqe_t* ring_get_sqe(syscall_ring_t* ring) {
+    uint32_t head = __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_tail - head == RING_ENTRIES) return NULL;
+    return &ring->sq[ring->sq_tail & (RING_ENTRIES - 1)];
+}
+
+/* Publish the slot returned by ring_get_sqe */
+void ring_commit_sqe(syscall_ring_t* ring) {
+    __atomic_store_n(&ring->sq_tail, ring->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Enter the kernel once for everything queued; returns how many ran */
+int64_t ring_submit(syscall_ring_t* ring) {
+    sys_ring_enter_args_t args = { ring };
+    return handle_system_call(SYS_RING_ENTER, &args);
+}
+
+/* Oldest unread completion, or NULL if none */
+cqe_t* ring_peek_cqe(syscall_ring_t* ring) {
+    uint32_t tail = __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (ring->cq_head == tail) return NULL;
+    return &ring->cq[ring->cq_head & (RING_ENTRIES - 1)];
+}
+
+void ring_cqe_seen(syscall_ring_t* ring) {
+    __atomic_store_n(&ring->cq_head, ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* Kernel side: drain submissions while there is completion space */
+int64_t sys_ring_enter(void* params) {
+    sys_ring_enter_args_t* args = params;
+    if (!args || !args->ring) return -EINVAL;
+    syscall_ring_t* ring = args->ring;
+
+    uint32_t tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+    uint32_t cq_head = __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+    int64_t done = 0;
+
+    while (ring->sq_head != tail) {
+        if (ring->cq_tail - cq_head == RING_ENTRIES) {
+            ring->cq_overflow++;
             break;
+        }
+        sqe_t* sqe = &ring->sq[ring->sq_head & (RING_ENTRIES - 1)];
+        cqe_t* cqe = &ring->cq[ring->cq_tail & (RING_ENTRIES - 1)];
+
+        // A nested ring enter would recurse, so refuse it
+        cqe->result = sqe->syscall_number == SYS_RING_ENTER ? -EINVAL :
+                      dispatch_system_call(sqe->syscall_number, &sqe->args);
+        cqe->user_data = sqe->user_data;
+
+        __atomic_store_n(&ring->cq_tail, ring->cq_tail + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&ring->sq_head, ring->sq_head + 1, __ATOMIC_RELEASE);
+        done++;
     }
+    return done;
+}
+
+/* Simple in-memory file creation for the root directory */
+bool create_file(filesystem_t* fs, const char* name,
+                 const void* contents, uint32_t size) {
+    file_t* files = realloc(fs->root_directory,
+                            (fs->total_files + 1) * sizeof(file_t));
+    if (!files) return false;
+    fs->root_directory = files;
+
+    file_t* file = &files[fs->total_files];
+    file->data = malloc(size);
+    if (!file->data) return false;
+
+    memset(file->name, 0, sizeof(file->name));
+    strncpy(file->name, name, sizeof(file->name) - 1);
+    memcpy(file->data, contents, size);
+    file->size = size;
+    file->permissions = 0644;
+    file->inode = fs->total_files + 1;
+    fs->total_files++;
+    return true;
 }
 
 /* Interrupt Handler */
 void interrupt_handler(uint32_t interrupt_number) {
-    printf("Handling interrupt %u\n", interrupt_number);
+    TRACE_COUNT(interrupt_counter, 1);
+    TRACE_INSTANT("interrupt", interrupt_number);
     
     switch (interrupt_number) {
         case TIMER_INTERRUPT:
-            printf("Timer interrupt\n");
-            schedule_next_process(kernel.process_manager);
+            scheduler_tick(kernel.process_manager);
             break;
         case KEYBOARD_INTERRUPT:
-            printf("Keyboard interrupt\n");
-            break;
         case PAGE_FAULT:
-            printf("Page fault\n");
             break;
         default:
-            printf("Unknown interrupt %u\n", interrupt_number);
+            TRACE_INSTANT("unknown interrupt", interrupt_number);
             break;
     }
 }
@@ -269,9 +1052,10 @@ void enable_interrupts(void) {
 /* Kernel cleanup */
 void cleanup_kernel(void) {
     if (kernel.memory_manager) {
-        if (kernel.memory_manager->all_pages) {
-            free(kernel.memory_manager->all_pages);
-        }
+        page_cache_drain(kernel.memory_manager);
+        pthread_mutex_destroy(&kernel.memory_manager->lock);
+        free(kernel.memory_manager->all_pages);
+        free(kernel.memory_manager->memory);
         free(kernel.memory_manager);
     }
 
@@ -286,6 +1070,10 @@ void cleanup_kernel(void) {
     }
 
     if (kernel.filesystem) {
+        for (uint32_t i = 0; i < kernel.filesystem->total_files; i++) {
+            free(kernel.filesystem->root_directory[i].data);
+        }
+        free(kernel.filesystem->root_directory);
         free(kernel.filesystem);
     }
 }
@@ -293,6 +1081,9 @@ void cleanup_kernel(void) {
 /* Kernel Initialization */
 bool init_kernel(void) {
     printf("Initializing kernel...\n");
+    kernel.tracing = true;
+    kernel.kernel_entries = 0;
+    kernel.syscalls_handled = 0;
     
     // Initialize memory management
     kernel.memory_manager = init_memory_manager();
@@ -309,6 +1100,11 @@ bool init_kernel(void) {
     kernel.filesystem->root_directory = NULL;
     kernel.filesystem->total_files = 0;
     
+    static const char motd[] = "Welcome to the monolithic kernel\n";
+    if (!create_file(kernel.filesystem, "motd", motd, sizeof(motd) - 1)) {
+        return false;
+    }
+    
     printf("File system initialized\n");
     
     // Set up interrupt handlers
@@ -322,14 +1118,443 @@ bool init_kernel(void) {
     return true;
 }
 
-/* Main function for testing */
-int main(void) {
+/* Page Allocator Benchmark */
+
+/* The original allocator for comparison: one singly linked free list
+ * threaded through the pages themselves, metadata inline with data */
+typedef struct legacy_page {
+    uint32_t flags;
+    uint32_t ref_count;
+    struct legacy_page* next;
+    uint8_t data[PAGE_SIZE];
+} legacy_page_t;
+
+typedef struct {
+    legacy_page_t* free_pages;
+    legacy_page_t* all_pages;
+} legacy_memory_t;
+
+static bool legacy_init(legacy_memory_t* lm) {
+    lm->all_pages = malloc(sizeof(legacy_page_t) * TOTAL_MEMORY_PAGES);
+    if (!lm->all_pages) return false;
+    for (uint32_t i = 0; i < TOTAL_MEMORY_PAGES; i++) {
+        lm->all_pages[i].next = i + 1 < TOTAL_MEMORY_PAGES ?
+                                &lm->all_pages[i + 1] : NULL;
+        lm->all_pages[i].ref_count = 0;
+        lm->all_pages[i].flags = 0;
+    }
+    lm->free_pages = &lm->all_pages[0];
+    return true;
+}
+
+static legacy_page_t* legacy_allocate(legacy_memory_t* lm) {
+    legacy_page_t* page = lm->free_pages;
+    if (!page) return NULL;
+    lm->free_pages = page->next;
+    page->ref_count = 1;
+    page->next = NULL;
+    return page;
+}
+
+static void legacy_free(legacy_memory_t* lm, legacy_page_t* page) {
+    if (--page->ref_count == 0) {
+        page->next = lm->free_pages;
+        lm->free_pages = page;
+    }
+}
+
+/* Longest run of physically adjacent free pages */
+static uint32_t longest_free_run(const bool* in_use, uint32_t count) {
+    uint32_t best = 0, run = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        run = in_use[i] ? 0 : run + 1;
+        if (run > best) best = run;
+    }
+    return best;
+}
+
+static uint32_t bench_random(uint32_t* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+#define BENCH_ROUNDS     2000
+#define BENCH_BATCH      256
+#define BENCH_CHURN_OPS  200000
+
+void benchmark_page_allocators(memory_manager_t* mm) {
+    legacy_memory_t lm;
+    if (!legacy_init(&lm)) {
+        printf("Benchmark setup failed\n");
+        return;
+    }
+    bool saved_tracing = mm->tracing;
+    mm->tracing = false;
+
+    static void* held[TOTAL_MEMORY_PAGES];
+    static bool in_use[TOTAL_MEMORY_PAGES];
+
+    // 1. Single-page throughput: allocate a batch, free it, repeat
+    uint64_t start = trace_clock_ns();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < BENCH_BATCH; i++) held[i] = legacy_allocate(&lm);
+        for (int i = 0; i < BENCH_BATCH; i++) legacy_free(&lm, held[i]);
+    }
+    double legacy_ns = (double)(trace_clock_ns() - start) /
+                       (2.0 * BENCH_ROUNDS * BENCH_BATCH);
+
+    bool saved_pcp = mm->pcp_enabled;
+    double buddy_ns[2];
+    for (int pcp = 0; pcp < 2; pcp++) {
+        mm->pcp_enabled = pcp;
+        start = trace_clock_ns();
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            for (int i = 0; i < BENCH_BATCH; i++) held[i] = allocate_page(mm);
+            for (int i = 0; i < BENCH_BATCH; i++) free_page(mm, held[i]);
+        }
+        buddy_ns[pcp] = (double)(trace_clock_ns() - start) /
+                        (2.0 * BENCH_ROUNDS * BENCH_BATCH);
+        page_cache_drain(mm);
+    }
+
+    printf("Single-page alloc/free: free list %.1f ns/op, buddy %.1f ns/op, "
+           "buddy + per-CPU cache %.1f ns/op\n", 
+           legacy_ns, buddy_ns[0], buddy_ns[1]);
+
+    // The layout comparisons below look at the buddy pool itself, so
+    // keep pages out of the per-CPU cache
+    mm->pcp_enabled = false;
+
+    // 2. Fragmentation: identical random churn of single pages, then
+    //    measure the largest physically contiguous free region left
+    uint32_t seed = 42, held_count = 0;
+    for (int op = 0; op < BENCH_CHURN_OPS; op++) {
+        // Allocation gets less likely as occupancy grows, settling near half
+        if (bench_random(&seed) % TOTAL_MEMORY_PAGES >= held_count) {
+            held[held_count++] = legacy_allocate(&lm);
+        } else {
+            uint32_t victim = bench_random(&seed) % held_count;
+            legacy_free(&lm, held[victim]);
+            held[victim] = held[--held_count];
+        }
+    }
+    memset(in_use, 0, sizeof(in_use));
+    for (uint32_t i = 0; i < held_count; i++) {
+        in_use[(legacy_page_t*)held[i] - lm.all_pages] = true;
+    }
+    uint32_t legacy_run = longest_free_run(in_use, TOTAL_MEMORY_PAGES);
+    uint32_t legacy_held = held_count;
+    for (uint32_t i = 0; i < held_count; i++) legacy_free(&lm, held[i]);
+
+    seed = 42;
+    held_count = 0;
+    for (int op = 0; op < BENCH_CHURN_OPS; op++) {
+        // Allocation gets less likely as occupancy grows, settling near half
+        if (bench_random(&seed) % TOTAL_MEMORY_PAGES >= held_count) {
+            held[held_count++] = allocate_page(mm);
+        } else {
+            uint32_t victim = bench_random(&seed) % held_count;
+            free_page(mm, held[victim]);
+            held[victim] = held[--held_count];
+        }
+    }
+    memset(in_use, 0, sizeof(in_use));
+    for (uint32_t i = 0; i < held_count; i++) {
+        in_use[((uint8_t*)held[i] - mm->memory) / PAGE_SIZE] = true;
+    }
+    uint32_t buddy_run = longest_free_run(in_use, TOTAL_MEMORY_PAGES);
+    int buddy_order = largest_free_order(mm);
+
+    printf("After %d random ops (%u/%u pages held): longest contiguous free run "
+           "free list %u pages, buddy %u pages (largest block order %d)\n", 
+           BENCH_CHURN_OPS, legacy_held, TOTAL_MEMORY_PAGES,
+           legacy_run, buddy_run, buddy_order);
+    for (uint32_t i = 0; i < held_count; i++) free_page(mm, held[i]);
+
+    // 3. Multi-page requests under churn, settling near 3/4 occupancy;
+    //    the free list cannot serve these at all
+    uint32_t granted = 0, requested = 0;
+    held_count = 0;
+    seed = 7;
+    for (int op = 0; op < BENCH_CHURN_OPS; op++) {
+        if (bench_random(&seed) % TOTAL_MEMORY_PAGES >= mm->used_pages * 4 / 3) {
+            requested++;
+            void* block = allocate_pages(mm, bench_random(&seed) % 4);
+            if (block) {
+                held[held_count++] = block;
+                granted++;
+            }
+        } else if (held_count > 0) {
+            uint32_t victim = bench_random(&seed) % held_count;
+            free_page(mm, held[victim]);
+            held[victim] = held[--held_count];
+        }
+    }
+    for (uint32_t i = 0; i < held_count; i++) free_page(mm, held[i]);
+    printf("Mixed order 0-3 requests: %u/%u granted by buddy, "
+           "%u pages in use after release\n", 
+           granted, requested, mm->used_pages);
+
+    free(lm.all_pages);
+    mm->pcp_enabled = saved_pcp;
+    mm->tracing = saved_tracing;
+}
+
+/* Multithreaded scaling: every thread allocates and frees small batches
+ * of single pages, with and without the per-CPU caches */
+#define SCALING_MAX_THREADS 8
+#define SCALING_BATCH       16
+#define SCALING_ROUNDS      20000
+
+typedef struct {
+    memory_manager_t* mm;
+    uint64_t ops;
+} scaling_worker_t;
+
+static void* scaling_worker(void* arg) {
+    scaling_worker_t* worker = arg;
+    void* held[SCALING_BATCH];
+
+    for (int r = 0; r < SCALING_ROUNDS; r++) {
+        int count = 0;
+        for (int i = 0; i < SCALING_BATCH; i++) {
+            held[count] = allocate_page(worker->mm);
+            if (held[count]) count++;
+        }
+        for (int i = 0; i < count; i++) free_page(worker->mm, held[i]);
+        worker->ops += 2 * count;
+    }
+    page_cache_drain(worker->mm);
+    return NULL;
+}
+
+void benchmark_page_scaling(memory_manager_t* mm) {
+    bool saved_tracing = mm->tracing;
+    bool saved_pcp = mm->pcp_enabled;
+    mm->tracing = false;
+
+    printf("%-8s %18s %18s\n", "threads", "global lock Mops/s", "per-CPU Mops/s");
+    for (int threads = 1; threads <= SCALING_MAX_THREADS; threads *= 2) {
+        double mops[2];
+        for (int pcp = 0; pcp < 2; pcp++) {
+            pthread_t tids[SCALING_MAX_THREADS];
+            scaling_worker_t workers[SCALING_MAX_THREADS];
+            mm->pcp_enabled = pcp;
+
+            uint64_t start = trace_clock_ns();
+            for (int t = 0; t < threads; t++) {
+                workers[t].mm = mm;
+                workers[t].ops = 0;
+                pthread_create(&tids[t], NULL, scaling_worker, &workers[t]);
+            }
+            uint64_t ops = 0;
+            for (int t = 0; t < threads; t++) {
+                pthread_join(tids[t], NULL);
+                ops += workers[t].ops;
+            }
+            mops[pcp] = ops * 1000.0 / (double)(trace_clock_ns() - start);
+        }
+        printf("%-8d %18.1f %18.1f\n", threads, mops[0], mops[1]);
+    }
+
+    mm->pcp_enabled = saved_pcp;
+    mm->tracing = saved_tracing;
+}
+
+/* Scheduler benchmark: thousands of processes with mixed nice values,
+ * some blocking and waking every tick, timed per scheduler tick */
+#define SCHED_BENCH_TICKS 200000
+
+void benchmark_scheduler(void) {
+    static const uint32_t sizes[] = { 1024, 4096, 16384 };
+    printf("%-10s %12s %14s %14s\n", 
+           "processes", "ns/tick", "avg wait ms", "max lat ms");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        process_manager_t* pm = init_process_manager();
+        if (!pm) return;
+        pm->tracing = false;
+
+        process_t** procs = malloc(sizes[s] * sizeof(process_t*));
+        for (uint32_t i = 0; i < sizes[s]; i++) {
+            procs[i] = create_process(pm);
+            set_process_nice(pm, procs[i], (int)(i % 5) - 2);
+        }
+        schedule_next_process(pm);
+
+        uint32_t seed = 1;
+        uint64_t start = trace_clock_ns();
+        for (int t = 0; t < SCHED_BENCH_TICKS; t++) {
+            scheduler_tick(pm);
+            // Every few ticks the running process blocks and another wakes
+            if (bench_random(&seed) % 8 == 0 && pm->current_process) {
+                block_process(pm, pm->current_process);
+            }
+            wake_process(pm, procs[bench_random(&seed) % sizes[s]]);
+        }
+        double ns_per_tick = (double)(trace_clock_ns() - start) / SCHED_BENCH_TICKS;
+
+        uint64_t wait = 0, dispatches = 0, max_latency = 0;
+        for (uint32_t i = 0; i < sizes[s]; i++) {
+            wait += procs[i]->total_wait;
+            dispatches += procs[i]->dispatches;
+            if (procs[i]->max_latency > max_latency) {
+                max_latency = procs[i]->max_latency;
+            }
+        }
+        printf("%-10u %12.1f %14.1f %14.1f\n", sizes[s], ns_per_tick,
+               dispatches ? wait / 1e6 / dispatches : 0.0, max_latency / 1e6);
+
+        for (uint32_t i = 0; i < sizes[s]; i++) free(procs[i]);
+        free(procs);
+        free(pm);
+    }
+}
+
+/* System call benchmark: the same reads issued one trap per call and
+ * through the ring in batches of RING_ENTRIES */
+#define SYSCALL_BENCH_CALLS 200000
+
+void benchmark_syscalls(void) {
+    bool saved_tracing = kernel.tracing;
+    kernel.tracing = false;
+
+    char buffer[32];
+    sys_read_file_args_t read_args = { "motd", buffer, sizeof(buffer), 0 };
+
+    uint64_t entries = kernel.kernel_entries;
+    uint64_t start = trace_clock_ns();
+    for (int i = 0; i < SYSCALL_BENCH_CALLS; i++) {
+        handle_system_call(SYS_READ_FILE, &read_args);
+    }
+    double direct_ns = (double)(trace_clock_ns() - start) / SYSCALL_BENCH_CALLS;
+    uint64_t direct_entries = kernel.kernel_entries - entries;
+
+    static syscall_ring_t ring;
+    syscall_ring_init(&ring);
+    entries = kernel.kernel_entries;
+    start = trace_clock_ns();
+    int submitted = 0, reaped = 0;
+    while (reaped < SYSCALL_BENCH_CALLS) {
+        sqe_t* sqe;
+        while (submitted < SYSCALL_BENCH_CALLS && (sqe = ring_get_sqe(&ring))) {
+            sqe->syscall_number = SYS_READ_FILE;
+            sqe->user_data = submitted++;
+            sqe->args.read_file = read_args;
+            ring_commit_sqe(&ring);
+        }
+        ring_submit(&ring);
+        for (cqe_t* cqe; (cqe = ring_peek_cqe(&ring)); ring_cqe_seen(&ring)) {
+            reaped++;
+        }
+    }
+    double ring_ns = (double)(trace_clock_ns() - start) / SYSCALL_BENCH_CALLS;
+    uint64_t ring_entries = kernel.kernel_entries - entries;
+
+    printf("Per-call dispatch: %.1f ns/call (%llu kernel entries)\n", 
+           direct_ns, (unsigned long long)direct_entries);
+    printf("Batched ring:      %.1f ns/call (%llu kernel entries)\n", 
+           ring_ns, (unsigned long long)ring_entries);
+
+    kernel.tracing = saved_tracing;
+}
+
+/* Cross-model benchmark suite: the bench.h workloads on this kernel */
+static uint64_t bench_switch(void* ctx, uint32_t n) {
+    process_manager_t* pm = ctx;
+    uint32_t before = pm->context_switches;
+    for (uint32_t i = 0; i < n; i++) {
+        // Yield: the running process gives up a full granularity
+        pm->current_process->vruntime += SCHED_GRANULARITY_NS;
+        schedule_next_process(pm);
+    }
+    return pm->context_switches - before;
+}
+
+static uint64_t bench_page(void* ctx, uint32_t n) {
+    memory_manager_t* mm = ctx;
+    for (uint32_t i = 0; i < n; i++) {
+        void* page = allocate_page(mm);
+        if (!page) return 0;
+        free_page(mm, page);
+    }
+    return n;
+}
+
+static uint64_t bench_syscall(void* ctx, uint32_t n) {
+    sys_read_file_args_t* args = ctx;
+    for (uint32_t i = 0; i < n; i++) {
+        if (handle_system_call(SYS_READ_FILE, args) < 0) return 0;
+    }
+    return n;
+}
+
+static uint64_t bench_syscall_ring(void* ctx, uint32_t n) {
+    static syscall_ring_t ring;
+    syscall_ring_init(&ring);
+    uint32_t submitted = 0, reaped = 0;
+    while (reaped < n) {
+        sqe_t* sqe;
+        while (submitted < n && (sqe = ring_get_sqe(&ring))) {
+            sqe->syscall_number = SYS_READ_FILE;
+            sqe->user_data = submitted++;
+            sqe->args.read_file = *(sys_read_file_args_t*)ctx;
+            ring_commit_sqe(&ring);
+        }
+        ring_submit(&ring);
+        for (cqe_t* cqe; (cqe = ring_peek_cqe(&ring)); ring_cqe_seen(&ring)) {
+            if (cqe->result < 0) return 0;
+            reaped++;
+        }
+    }
+    return n;
+}
+
+int run_benchmark_suite(void) {
+    process_manager_t* pm = init_process_manager();
+    if (!pm) return 1;
+    pm->tracing = kernel.tracing = kernel.memory_manager->tracing = false;
+    create_process(pm);
+    create_process(pm);
+    schedule_next_process(pm);
+
+    char buffer[32];
+    sys_read_file_args_t read_args = { "motd", buffer, sizeof(buffer), 0 };
+    memory_manager_t* mm = kernel.memory_manager;
+    bool saved_pcp = mm->pcp_enabled;
+
+    bench_begin("monolithic");
+    bench_run(BENCH_CONTEXT_SWITCH, "cfs_yield", bench_switch, pm, 0);
+    mm->pcp_enabled = true;
+    bench_run(BENCH_PAGE_ALLOC_FREE, "buddy_pcp", bench_page, mm, 0);
+    mm->pcp_enabled = false;
+    bench_run(BENCH_PAGE_ALLOC_FREE, "buddy", bench_page, mm, 0);
+    mm->pcp_enabled = saved_pcp;
+    bench_run(BENCH_SYSCALL_DISPATCH, "trap", bench_syscall, &read_args, 0);
+    bench_run(BENCH_SYSCALL_DISPATCH, "ring_batched", bench_syscall_ring, &read_args, 0);
+
+    while (pm->process_list) {
+        process_t* next = pm->process_list->next;
+        free(pm->process_list);
+        pm->process_list = next;
+    }
+    free(pm);
+    return bench_end();
+}
+
+/* Main function for testing; "bench" runs only the benchmark suite */
+int main(int argc, char** argv) {
     // Initialize the kernel
     if (!init_kernel()) {
         printf("Kernel initialization failed\n");
         cleanup_kernel();
         return 1;
     }
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        int status = run_benchmark_suite();
+        cleanup_kernel();
+        return status;
+    }
     
     // Create test processes
     printf("\nCreating test processes...\n");
@@ -347,14 +1572,43 @@ int main(void) {
         return 1;
     }
 
-    // Set current process
-    kernel.process_manager->current_process = p1;
+    // Dispatch the first process
+    schedule_next_process(kernel.process_manager);
     
     // Test system calls
     printf("\nTesting system calls...\n");
-    handle_system_call(SYS_ALLOCATE_MEMORY, NULL);
-    handle_system_call(SYS_CREATE_PROCESS, NULL);
-    handle_system_call(SYS_READ_FILE, NULL);
+    sys_allocate_memory_args_t alloc_args = { .order = 1 };
+    int64_t result = handle_system_call(SYS_ALLOCATE_MEMORY, &alloc_args);
+    printf("SYS_ALLOCATE_MEMORY returned %p\n", (void*)(uintptr_t)result);
+    free_page(kernel.memory_manager, (void*)(uintptr_t)result);
+
+    sys_create_process_args_t create_args = { .nice = 0 };
+    printf("SYS_CREATE_PROCESS returned PID %lld\n", 
+           (long long)handle_system_call(SYS_CREATE_PROCESS, &create_args));
+
+    char buffer[64] = { 0 };
+    sys_read_file_args_t read_args = { "motd", buffer, sizeof(buffer) - 1, 0 };
+    printf("SYS_READ_FILE returned %lld: %s", 
+           (long long)handle_system_call(SYS_READ_FILE, &read_args), buffer);
+    printf("Unknown system call returned %lld\n", 
+           (long long)handle_system_call(99, NULL));
+
+    // Batch the same kind of work through the syscall ring
+    static syscall_ring_t ring;
+    syscall_ring_init(&ring);
+    for (uint64_t i = 0; i < 3; i++) {
+        sqe_t* sqe = ring_get_sqe(&ring);
+        sqe->syscall_number = SYS_READ_FILE;
+        sqe->user_data = i;
+        sqe->args.read_file = (sys_read_file_args_t){ "motd", buffer, 7, i * 8 };
+        ring_commit_sqe(&ring);
+    }
+    printf("Ring submitted %lld calls in one kernel entry\n", 
+           (long long)ring_submit(&ring));
+    for (cqe_t* cqe; (cqe = ring_peek_cqe(&ring)); ring_cqe_seen(&ring)) {
+        printf("Completion %llu: result %lld\n", 
+               (unsigned long long)cqe->user_data, (long long)cqe->result);
+    }
     
     // Test interrupts
     printf("\nTesting interrupts...\n");
@@ -362,6 +1616,32 @@ int main(void) {
     interrupt_handler(KEYBOARD_INTERRUPT);
     interrupt_handler(PAGE_FAULT);
     
+    printf("\nScheduler statistics:\n");
+    print_scheduler_stats(kernel.process_manager);
+    
+    // Test multi-page allocation and buddy coalescing
+    printf("\nTesting page allocator...\n");
+    void* single = allocate_page(kernel.memory_manager);
+    void* block = allocate_pages(kernel.memory_manager, 3);
+    free_page(kernel.memory_manager, single);
+    free_page(kernel.memory_manager, block);
+    page_cache_drain(kernel.memory_manager);  // Let cached pages coalesce
+    printf("Largest free block after release: order %d\n", 
+           largest_free_order(kernel.memory_manager));
+    
+    printf("\nRunning page allocator benchmark...\n");
+    benchmark_page_allocators(kernel.memory_manager);
+    benchmark_page_scaling(kernel.memory_manager);
+    
+    printf("\nRunning scheduler benchmark...\n");
+    benchmark_scheduler();
+    
+    printf("\nRunning system call benchmark...\n");
+    benchmark_syscalls();
+    
+    printf("\nTrace metrics (benchmarks run untraced):\n");
+    trace_report();
+    
     // Cleanup
     cleanup_kernel();
     return 0;
@@ -3,285 +3,913 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
+#include "trace.h"
+#include "bench.h"
+
+// Tasks run on their own stacks. x86-64 and AArch64 ELF targets use the
+// hand-written switch below; anything else falls back to ucontext.
+#ifndef RTOS_ASM_SWITCH
+#if defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+#define RTOS_ASM_SWITCH 1
+#else
+#define RTOS_ASM_SWITCH 0
+#endif
+#endif
+
+#if !RTOS_ASM_SWITCH
+#include <ucontext.h>
+#endif
 
 #define MAX_TASKS 32
 #define MAX_PRIORITY 32
 #define TICK_RATE_MS 1
-#define TASK_STACK_SIZE 1024
+#define TASK_STACK_SIZE 16384  // Task bodies call printf on these stacks
+#define TICKLESS_IDLE 1  // Skip ticks in one step while every task is blocked
+#define CACHE_LINE_SIZE 64
+#define NO_TASK UINT32_MAX
+#define SWITCH_BENCH_ROUNDS 100000
 
 // Task states
 typedef enum {
     TASK_READY,
     TASK_RUNNING,
     TASK_BLOCKED,
-    TASK_SUSPENDED
+    TASK_SUSPENDED,
+    TASK_UNUSED  // Pool slot on the free list
 } TaskState;
 
-// Task control block
-typedef struct {
+// Saved execution context: the stack pointer for the asm switch (all
+// other callee-saved state lives on the task's stack), or a ucontext
+#if RTOS_ASM_SWITCH
+typedef uintptr_t TaskContext;
+#else
+typedef ucontext_t TaskContext;
+#endif
+
+// Scheduling policies
+typedef enum {
+    POLICY_FIXED_PRIORITY,  // Priorities as given to rtos_create_task
+    POLICY_RATE_MONOTONIC,  // Shorter period => higher priority
+    POLICY_EDF              // Earliest absolute deadline first
+} SchedPolicyType;
+
+// Task control block: only the fields the scheduler and timers touch,
+// so the pool stays dense and a slot spans two cache lines
+typedef struct TCB {
     uint32_t id;
     void (*function)(void*);
     void* parameters;
     uint32_t priority;
     uint32_t deadline;
     uint32_t period;
-    uintptr_t stack_pointer;  // Fixed: Using uintptr_t for pointer storage
+    uintptr_t stack_pointer;  // Saved SP while switched out (asm switch)
     TaskState state;
     uint32_t blocked_tick;
     uint32_t timeout;
+    struct TCB* ready_next;  // Links in the per-priority ready list
+    struct TCB* ready_prev;
+    struct TCB* timer_next;  // Links in the timeout delta list
+    struct TCB* timer_prev;
+    uint32_t timer_delta;  // Ticks after timer_prev expires
+    uint32_t wcet;  // Worst-case execution ticks per job (0 = unanalysed)
+    uint32_t release_tick;  // Release time of the current job
+    uint32_t abs_deadline;  // Absolute deadline of the current job
+    uint32_t job_exec_ticks;  // Ticks the current job has executed
+    bool release_pending;  // Blocked until the next period starts
+    uint32_t edf_index;  // Slot in the EDF ready heap
+} __attribute__((aligned(CACHE_LINE_SIZE))) TCB;
+
+// Cold per-task data: names and statistics, read for reporting only
+typedef struct {
     char name[32];  // Added: Task name for better debugging
     uint32_t run_count;  // Added: Track number of times task has run
-} TCB;
+    uint32_t jobs_completed;
+    uint32_t deadline_misses;
+    uint32_t response_max;
+    uint64_t response_total;
+} TaskInfo;
+
+// Pluggable scheduling policy. The ready structure behind enqueue/peek
+// belongs to the policy; the kernel only sees the best READY task.
+typedef struct {
+    const char* name;
+    void (*enqueue)(TCB* task, bool at_head);
+    void (*dequeue)(TCB* task);
+    TCB* (*peek)(void);
+    bool (*preempts)(const TCB* candidate, const TCB* current);
+    bool (*admit)(TCB* const* set, uint32_t count);
+} SchedPolicy;
 
 // RTOS kernel structure
 typedef struct {
-    TCB* tasks[MAX_TASKS];
+    TCB tasks[MAX_TASKS];  // Contiguous TCB pool, indexed by task id
+    TaskInfo info[MAX_TASKS];  // Cold half of each task, same index
+    uint32_t free_slots[MAX_TASKS];  // Stack of unused pool indices
+    uint32_t free_count;
     uint32_t num_tasks;
     uint32_t current_task;
     uint32_t tick_count;
     bool scheduler_running;
     uint32_t total_switches;  // Added: Track total context switches
+    TCB* ready_head[MAX_PRIORITY];  // FIFO of READY tasks per priority
+    TCB* ready_tail[MAX_PRIORITY];
+    uint32_t ready_bitmap;  // Bit p set <=> ready_head[p] is non-empty
+    TCB* timer_head;  // Blocked tasks ordered by wakeup tick
+    uint32_t idle_ticks;  // Ticks skipped in tickless idle
+    uint32_t idle_entries;  // Number of tickless idle periods
+    const SchedPolicy* policy;
+    TCB* edf_heap[MAX_TASKS];  // READY tasks ordered by abs_deadline
+    uint32_t edf_size;
+    TaskContext scheduler_context;  // Where tasks switch back to
+    bool in_task;  // Executing on a task stack rather than the kernel's
+    double switch_ns;  // Measured cost of one context switch
 } RTOS_Kernel;
 
+_Static_assert(MAX_PRIORITY <= 32, "ready_bitmap holds one bit per priority");
+
 // Global kernel instance
 static RTOS_Kernel kernel;
 
-// Priority queue for task scheduling
-typedef struct {
-    TCB* tasks[MAX_TASKS];
-    uint32_t size;
-} PriorityQueue;
+// Task stacks, carved from one arena at init instead of malloc'd
+static uint8_t stack_arena[MAX_TASKS][TASK_STACK_SIZE]
+    __attribute__((aligned(CACHE_LINE_SIZE)));
 
-// Initialize priority queue
-void priority_queue_init(PriorityQueue* queue) {
-    queue->size = 0;
+static inline TaskInfo* task_info(const TCB* task) {
+    return &kernel.info[task->id];
 }
 
-// Insert task into priority queue
-void priority_queue_insert(PriorityQueue* queue, TCB* task) {
-    uint32_t i = queue->size++;
-    
+// Scheduler events go to the trace rings instead of stdout
+TRACE_COUNTER_DEFINE(switch_counter, "context_switches");
+TRACE_COUNTER_DEFINE(preempt_counter, "preemptions");
+TRACE_COUNTER_DEFINE(release_counter, "job_releases");
+TRACE_COUNTER_DEFINE(miss_counter, "deadline_misses");
+TRACE_HISTOGRAM_DEFINE(tick_hist, "tick_handler");
+TRACE_VALUE_HISTOGRAM_DEFINE(response_hist, "job_response_ticks");
+
+static inline void note_switch(const TCB* next) {
+    kernel.total_switches++;
+    TRACE_COUNT(switch_counter, 1);
+    TRACE_INSTANT("switch", next->id);
+}
+
+#if RTOS_ASM_SWITCH
+// void rtos_context_switch(uintptr_t* save_sp, uintptr_t load_sp)
+// Push the callee-saved registers, store SP, load the other SP and pop
+// its registers; the final ret lands wherever that context left off.
+#if defined(__x86_64__)
+__asm__(
+    ".pushsection .text\n"
+    ".globl rtos_context_switch\n"
+    ".type rtos_context_switch, @function\n"
+    "rtos_context_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size rtos_context_switch, .-rtos_context_switch\n"
+    ".popsection\n");
+#define SWITCH_FRAME_WORDS 8   // 6 registers, return address, padding
+#define SWITCH_FRAME_RET 6
+#elif defined(__aarch64__)
+__asm__(
+    ".pushsection .text\n"
+    ".globl rtos_context_switch\n"
+    ".type rtos_context_switch, %function\n"
+    "rtos_context_switch:\n"
+    "    sub sp, sp, #176\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #176\n"
+    "    ret\n"
+    ".size rtos_context_switch, .-rtos_context_switch\n"
+    ".popsection\n");
+#define SWITCH_FRAME_WORDS 22  // x19-x30 and d8-d15, 16-byte aligned
+#define SWITCH_FRAME_RET 11    // x30 slot
+#endif
+
+void rtos_context_switch(uintptr_t* save_sp, uintptr_t load_sp);
+
+// Build a frame that the switch will "return" into at entry. The
+// resulting SP leaves the ABI-required alignment at function entry.
+void context_init(TaskContext* ctx, uint8_t* stack, size_t size,
+                  void (*entry)(void)) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uintptr_t* frame = (uintptr_t*)top - SWITCH_FRAME_WORDS;
+    memset(frame, 0, SWITCH_FRAME_WORDS * sizeof(uintptr_t));
+    frame[SWITCH_FRAME_RET] = (uintptr_t)entry;
+    *ctx = (uintptr_t)frame;
+}
+
+static inline void context_swap(TaskContext* save, TaskContext* load) {
+    rtos_context_switch(save, *load);
+}
+
+// The asm switch keeps each task's SP in its TCB
+static inline TaskContext* task_context(TCB* task) {
+    return &task->stack_pointer;
+}
+#else
+static ucontext_t task_contexts[MAX_TASKS];
+
+void context_init(TaskContext* ctx, uint8_t* stack, size_t size,
+                  void (*entry)(void)) {
+    getcontext(ctx);
+    ctx->uc_stack.ss_sp = stack;
+    ctx->uc_stack.ss_size = size;
+    ctx->uc_link = NULL;
+    makecontext(ctx, entry, 0);
+}
+
+static inline void context_swap(TaskContext* save, TaskContext* load) {
+    swapcontext(save, load);
+}
+
+static inline TaskContext* task_context(TCB* task) {
+    return &task_contexts[task->id];
+}
+#endif
+
+// Currently running (or last dispatched) task, NULL if none
+TCB* rtos_current_task(void) {
+    if (kernel.current_task == NO_TASK) return NULL;
+    TCB* task = &kernel.tasks[kernel.current_task];
+    return task->state == TASK_UNUSED ? NULL : task;
+}
+
+// Append (or push to the front of) a task's priority list
+void ready_queue_insert(TCB* task, bool at_head) {
+    uint32_t prio = task->priority;
+
+    task->ready_next = NULL;
+    task->ready_prev = NULL;
+    if (!kernel.ready_head[prio]) {
+        kernel.ready_head[prio] = task;
+        kernel.ready_tail[prio] = task;
+    } else if (at_head) {
+        task->ready_next = kernel.ready_head[prio];
+        kernel.ready_head[prio]->ready_prev = task;
+        kernel.ready_head[prio] = task;
+    } else {
+        task->ready_prev = kernel.ready_tail[prio];
+        kernel.ready_tail[prio]->ready_next = task;
+        kernel.ready_tail[prio] = task;
+    }
+    kernel.ready_bitmap |= 1u << prio;
+}
+
+// Unlink a task from its priority list
+void ready_queue_remove(TCB* task) {
+    uint32_t prio = task->priority;
+
+    if (task->ready_prev)
+        task->ready_prev->ready_next = task->ready_next;
+    else
+        kernel.ready_head[prio] = task->ready_next;
+
+    if (task->ready_next)
+        task->ready_next->ready_prev = task->ready_prev;
+    else
+        kernel.ready_tail[prio] = task->ready_prev;
+
+    task->ready_next = NULL;
+    task->ready_prev = NULL;
+    if (!kernel.ready_head[prio])
+        kernel.ready_bitmap &= ~(1u << prio);
+}
+
+// Highest priority with a READY task, or -1 when nothing is ready.
+// Higher numbers mean higher priority, so this is a find-last-set.
+int ready_queue_highest_priority(void) {
+    if (kernel.ready_bitmap == 0) return -1;
+    return 31 - __builtin_clz(kernel.ready_bitmap);
+}
+
+// EDF ready heap: binary min-heap on abs_deadline, with each task
+// remembering its slot so it can be removed in O(log N)
+static void edf_heap_place(uint32_t i, TCB* task) {
+    kernel.edf_heap[i] = task;
+    task->edf_index = i;
+}
+
+static void edf_heap_sift_up(uint32_t i) {
+    TCB* task = kernel.edf_heap[i];
     while (i > 0) {
         uint32_t parent = (i - 1) / 2;
-        if (queue->tasks[parent]->priority >= task->priority &&
-            queue->tasks[parent]->deadline <= task->deadline)
+        if (kernel.edf_heap[parent]->abs_deadline <= task->abs_deadline)
             break;
-            
-        queue->tasks[i] = queue->tasks[parent];
+        edf_heap_place(i, kernel.edf_heap[parent]);
         i = parent;
     }
-    
-    queue->tasks[i] = task;
+    edf_heap_place(i, task);
 }
 
-// Extract highest priority task
-TCB* priority_queue_extract(PriorityQueue* queue) {
-    if (queue->size == 0) return NULL;
-    
-    TCB* result = queue->tasks[0];
-    TCB* last = queue->tasks[--queue->size];
-    
-    uint32_t i = 0;
-    while (i * 2 + 1 < queue->size) {
-        uint32_t left = i * 2 + 1;
-        uint32_t right = left + 1;
-        uint32_t highest_priority = left;
-        
-        if (right < queue->size && 
-            (queue->tasks[right]->priority > queue->tasks[left]->priority ||
-             (queue->tasks[right]->priority == queue->tasks[left]->priority &&
-              queue->tasks[right]->deadline < queue->tasks[left]->deadline)))
-            highest_priority = right;
-            
-        if (last->priority > queue->tasks[highest_priority]->priority ||
-            (last->priority == queue->tasks[highest_priority]->priority &&
-             last->deadline <= queue->tasks[highest_priority]->deadline))
+static void edf_heap_sift_down(uint32_t i) {
+    TCB* task = kernel.edf_heap[i];
+    while (i * 2 + 1 < kernel.edf_size) {
+        uint32_t child = i * 2 + 1;
+        if (child + 1 < kernel.edf_size &&
+            kernel.edf_heap[child + 1]->abs_deadline <
+            kernel.edf_heap[child]->abs_deadline)
+            child++;
+        if (task->abs_deadline <= kernel.edf_heap[child]->abs_deadline)
             break;
-            
-        queue->tasks[i] = queue->tasks[highest_priority];
-        i = highest_priority;
+        edf_heap_place(i, kernel.edf_heap[child]);
+        i = child;
+    }
+    edf_heap_place(i, task);
+}
+
+void edf_heap_insert(TCB* task, bool at_head) {
+    (void)at_head;  // Deadline order alone decides
+    edf_heap_place(kernel.edf_size++, task);
+    edf_heap_sift_up(task->edf_index);
+}
+
+void edf_heap_remove(TCB* task) {
+    uint32_t i = task->edf_index;
+    TCB* last = kernel.edf_heap[--kernel.edf_size];
+    if (last == task) return;
+
+    edf_heap_place(i, last);
+    edf_heap_sift_up(i);
+    edf_heap_sift_down(last->edf_index);
+}
+
+TCB* edf_heap_peek(void) {
+    return kernel.edf_size ? kernel.edf_heap[0] : NULL;
+}
+
+bool edf_preempts(const TCB* candidate, const TCB* current) {
+    return candidate->abs_deadline < current->abs_deadline;
+}
+
+TCB* ready_queue_peek(void) {
+    int prio = ready_queue_highest_priority();
+    return prio < 0 ? NULL : kernel.ready_head[prio];
+}
+
+bool priority_preempts(const TCB* candidate, const TCB* current) {
+    return candidate->priority > current->priority;
+}
+
+// Only periodic tasks with a known WCET take part in the analysis
+static bool task_is_analysed(const TCB* task) {
+    return task->period > 0 && task->wcet > 0;
+}
+
+static uint32_t task_relative_deadline(const TCB* task) {
+    return task->deadline ? task->deadline : task->period;
+}
+
+// Does task j delay task i under fixed-priority scheduling? Ties count
+// as interference, which keeps the test safe for FIFO order within a level.
+static bool interferes(const TCB* j, const TCB* i, bool by_period) {
+    if (by_period) return j->period <= i->period;
+    return j->priority >= i->priority;
+}
+
+// Response-time analysis: iterate R = C_i + sum ceil(R / T_j) * C_j over
+// higher-priority tasks until it converges or passes the deadline
+static bool response_time_test(TCB* const* set, uint32_t count, bool by_period) {
+    for (uint32_t i = 0; i < count; i++) {
+        const TCB* task = set[i];
+        if (!task_is_analysed(task)) continue;
+
+        uint32_t limit = task_relative_deadline(task);
+        uint64_t response = task->wcet;
+        uint64_t previous = 0;
+        while (response != previous && response <= limit) {
+            previous = response;
+            response = task->wcet;
+            for (uint32_t j = 0; j < count; j++) {
+                const TCB* other = set[j];
+                if (j == i || !task_is_analysed(other) ||
+                    !interferes(other, task, by_period))
+                    continue;
+                response += ((previous + other->period - 1) / other->period) *
+                            other->wcet;
+            }
+        }
+
+        if (response > limit) {
+            printf("Admission: '%s' worst-case response %llu > deadline %d\n", 
+                   task_info(task)->name, (unsigned long long)response, limit);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool fixed_priority_admit(TCB* const* set, uint32_t count) {
+    return response_time_test(set, count, false);
+}
+
+bool rate_monotonic_admit(TCB* const* set, uint32_t count) {
+    return response_time_test(set, count, true);
+}
+
+// EDF density test: sum C_i / min(D_i, T_i) <= 1, exact when D_i == T_i
+bool edf_admit(TCB* const* set, uint32_t count) {
+    double density = 0.0;
+    for (uint32_t i = 0; i < count; i++) {
+        const TCB* task = set[i];
+        if (!task_is_analysed(task)) continue;
+        uint32_t window = task_relative_deadline(task);
+        if (window > task->period) window = task->period;
+        density += (double)task->wcet / window;
+    }
+    if (density > 1.0) {
+        printf("Admission: EDF density %.3f exceeds 1.0\n", density);
+        return false;
+    }
+    return true;
+}
+
+static const SchedPolicy sched_policies[] = {
+    [POLICY_FIXED_PRIORITY] = { "fixed-priority", ready_queue_insert,
+        ready_queue_remove, ready_queue_peek, priority_preempts,
+        fixed_priority_admit },
+    [POLICY_RATE_MONOTONIC] = { "rate-monotonic", ready_queue_insert,
+        ready_queue_remove, ready_queue_peek, priority_preempts,
+        rate_monotonic_admit },
+    [POLICY_EDF] = { "earliest-deadline-first", edf_heap_insert,
+        edf_heap_remove, edf_heap_peek, edf_preempts, edf_admit },
+};
+
+// Move a task to READY and queue it for dispatch
+void task_make_ready(TCB* task, bool at_head) {
+    task->state = TASK_READY;
+    kernel.policy->enqueue(task, at_head);
+}
+
+// Start a new job of a periodic task at its nominal release time
+void job_release(TCB* task, uint32_t release) {
+    task->release_tick = release;
+    task->abs_deadline = task->deadline ? release + task->deadline : UINT32_MAX;
+    task->job_exec_ticks = 0;
+    task->release_pending = false;
+}
+
+// Record response time and deadline outcome of the finished job
+void job_complete(TCB* task) {
+    TaskInfo* info = task_info(task);
+    uint32_t response = kernel.tick_count - task->release_tick;
+
+    info->jobs_completed++;
+    info->response_total += response;
+    if (response > info->response_max) info->response_max = response;
+    TRACE_HIST(response_hist, response);
+    if (kernel.tick_count > task->abs_deadline) {
+        info->deadline_misses++;
+        TRACE_COUNT(miss_counter, 1);
+        TRACE_INSTANT("deadline miss", task->id);
+    }
+}
+
+// Rate-monotonic: rank distinct periods, shortest gets the top level
+static void rate_monotonic_assign(void) {
+    for (uint32_t i = 0; i < MAX_TASKS; i++) {
+        TCB* task = &kernel.tasks[i];
+        if (task->state == TASK_UNUSED) continue;
+        uint32_t rank = 0;
+        for (uint32_t j = 0; j < MAX_TASKS; j++) {
+            TCB* other = &kernel.tasks[j];
+            if (other->state == TASK_UNUSED) continue;
+            if (other->period && (other->period < task->period || !task->period)) {
+                bool counted = false;
+                for (uint32_t k = 0; k < j; k++) {
+                    if (kernel.tasks[k].state != TASK_UNUSED &&
+                        kernel.tasks[k].period == other->period) {
+                        counted = true;
+                        break;
+                    }
+                }
+                if (!counted) rank++;
+            }
+        }
+
+        uint32_t prio = rank < MAX_PRIORITY ? MAX_PRIORITY - 1 - rank : 0;
+        if (prio == task->priority) continue;
+        if (task->state == TASK_READY) {
+            ready_queue_remove(task);
+            task->priority = prio;
+            ready_queue_insert(task, false);
+        } else {
+            task->priority = prio;
+        }
+    }
+}
+
+// Select the scheduling policy; only allowed before tasks exist
+bool rtos_set_policy(SchedPolicyType type) {
+    if (kernel.num_tasks > 0) {
+        printf("Error: Policy must be chosen before creating tasks\n");
+        return false;
+    }
+    kernel.policy = &sched_policies[type];
+    printf("Scheduling policy: %s\n", kernel.policy->name);
+    return true;
+}
+
+// Timeout delta list: each entry stores its wakeup relative to the entry
+// before it, so a tick only decrements the head and pops what reaches 0
+void timer_list_insert(TCB* task, uint32_t ticks) {
+    TCB* prev = NULL;
+    TCB* cur = kernel.timer_head;
+
+    // A zero timeout still waits for the next tick, as the scan did
+    if (ticks == 0) ticks = 1;
+
+    while (cur && cur->timer_delta <= ticks) {
+        ticks -= cur->timer_delta;
+        prev = cur;
+        cur = cur->timer_next;
+    }
+
+    task->timer_delta = ticks;
+    task->timer_prev = prev;
+    task->timer_next = cur;
+    if (cur) {
+        cur->timer_delta -= ticks;
+        cur->timer_prev = task;
+    }
+    if (prev)
+        prev->timer_next = task;
+    else
+        kernel.timer_head = task;
+}
+
+// Cancel a pending timeout, handing its delta to the successor
+void timer_list_remove(TCB* task) {
+    if (task->timer_next) {
+        task->timer_next->timer_delta += task->timer_delta;
+        task->timer_next->timer_prev = task->timer_prev;
+    }
+    if (task->timer_prev)
+        task->timer_prev->timer_next = task->timer_next;
+    else if (kernel.timer_head == task)
+        kernel.timer_head = task->timer_next;
+
+    task->timer_next = NULL;
+    task->timer_prev = NULL;
+    task->timer_delta = 0;
+}
+
+// Advance the timeout list by one tick and wake every expired task
+void timer_list_tick(void) {
+    TCB* task = kernel.timer_head;
+    if (!task) return;
+
+    task->timer_delta--;
+    while (task && task->timer_delta == 0) {
+        TCB* next = task->timer_next;
+        kernel.timer_head = next;
+        if (next) next->timer_prev = NULL;
+        task->timer_next = NULL;
+
+        if (task->release_pending) {
+            job_release(task, task->release_tick + task->period);
+            TRACE_COUNT(release_counter, 1);
+            TRACE_INSTANT("release", task->id);
+        } else {
+            TRACE_INSTANT("unblock", task->id);
+        }
+        task_make_ready(task, false);
+        task = next;
     }
-    
-    if (queue->size > 0)
-        queue->tasks[i] = last;
-        
-    return result;
 }
 
 // Initialize RTOS kernel
 void rtos_init(void) {
     kernel.num_tasks = 0;
-    kernel.current_task = 0;
+    kernel.current_task = NO_TASK;
     kernel.tick_count = 0;
     kernel.scheduler_running = false;
     kernel.total_switches = 0;
     
-    for (int i = 0; i < MAX_TASKS; i++) {
-        kernel.tasks[i] = NULL;
+    kernel.ready_bitmap = 0;
+    kernel.timer_head = NULL;
+    kernel.idle_ticks = 0;
+    kernel.idle_entries = 0;
+    kernel.policy = &sched_policies[POLICY_FIXED_PRIORITY];
+    kernel.edf_size = 0;
+    
+    // Every pool slot starts free, lowest index on top, each with
+    // its stack slice of the arena
+    kernel.free_count = 0;
+    for (int i = MAX_TASKS - 1; i >= 0; i--) {
+        kernel.tasks[i].id = i;
+        kernel.tasks[i].state = TASK_UNUSED;
+        kernel.tasks[i].stack_pointer = (uintptr_t)stack_arena[i];
+        kernel.free_slots[kernel.free_count++] = i;
+    }
+    for (int i = 0; i < MAX_PRIORITY; i++) {
+        kernel.ready_head[i] = NULL;
+        kernel.ready_tail[i] = NULL;
     }
     
     printf("RTOS Kernel initialized\n");
 }
 
+void task_entry(void);
+
 // Create new task with name
 int rtos_create_task(const char* name, 
                      void (*function)(void*), 
                      void* parameters,
                      uint32_t priority,
                      uint32_t deadline,
-                     uint32_t period) {
-    if (kernel.num_tasks >= MAX_TASKS) {
+                     uint32_t period,
+                     uint32_t wcet) {
+    if (kernel.free_count == 0) {
         printf("Error: Maximum task limit reached\n");
         return -1;
     }
-        
-    TCB* new_task = (TCB*)malloc(sizeof(TCB));
-    if (!new_task) {
-        printf("Error: Failed to allocate TCB\n");
+
+    if (priority >= MAX_PRIORITY) {
+        printf("Error: Priority %d out of range (0-%d)\n", 
+               priority, MAX_PRIORITY - 1);
         return -1;
     }
+    
+    // Take a slot off the free list; it keeps its id and stack
+    uint32_t slot = kernel.free_slots[--kernel.free_count];
+    TCB* new_task = &kernel.tasks[slot];
+    TaskInfo* info = &kernel.info[slot];
         
-    new_task->id = kernel.num_tasks;
     new_task->function = function;
     new_task->parameters = parameters;
     new_task->priority = priority;
     new_task->deadline = deadline;
     new_task->period = period;
-    new_task->state = TASK_READY;
     new_task->blocked_tick = 0;
     new_task->timeout = 0;
-    new_task->run_count = 0;
-    strncpy(new_task->name, name, sizeof(new_task->name) - 1);
-    new_task->name[sizeof(new_task->name) - 1] = '\0';
-    
-    // Allocate task stack
-    void* stack = malloc(TASK_STACK_SIZE);
-    if (!stack) {
-        printf("Error: Failed to allocate stack for task %s\n", name);
-        free(new_task);
+    new_task->timer_next = NULL;
+    new_task->timer_prev = NULL;
+    new_task->timer_delta = 0;
+    new_task->wcet = wcet;
+    job_release(new_task, kernel.tick_count);
+    memset(info, 0, sizeof(*info));
+    strncpy(info->name, name, sizeof(info->name) - 1);
+
+    // Admission control: the task set including the newcomer must pass
+    // the policy's schedulability test before the slot is committed
+    TCB* task_set[MAX_TASKS];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < MAX_TASKS; i++) {
+        if (kernel.tasks[i].state != TASK_UNUSED) {
+            task_set[count++] = &kernel.tasks[i];
+        }
+    }
+    task_set[count++] = new_task;
+    if (!kernel.policy->admit(task_set, count)) {
+        printf("Error: Task '%s' rejected, set would not be schedulable\n", 
+               name);
+        kernel.free_slots[kernel.free_count++] = slot;
         return -1;
     }
-    new_task->stack_pointer = (uintptr_t)stack;
     
-    kernel.tasks[kernel.num_tasks++] = new_task;
+    kernel.num_tasks++;
+    context_init(task_context(new_task), stack_arena[slot], TASK_STACK_SIZE,
+                 task_entry);
+    task_make_ready(new_task, false);
+    if (kernel.policy == &sched_policies[POLICY_RATE_MONOTONIC]) {
+        rate_monotonic_assign();
+    }
     printf("Task '%s' created with ID %d, Priority %d\n", 
-           name, new_task->id, priority);
+           name, new_task->id, new_task->priority);
     return new_task->id;
 }
 
-// Schedule next task
-TCB* schedule_next_task(void) {
-    static PriorityQueue ready_queue;
-    priority_queue_init(&ready_queue);
-    
-    // Add all ready tasks to priority queue
-    for (uint32_t i = 0; i < kernel.num_tasks; i++) {
-        TCB* task = kernel.tasks[i];
-        if (task->state == TASK_READY) {
-            priority_queue_insert(&ready_queue, task);
-        }
+// Delete a task and return its slot to the pool
+bool rtos_delete_task(uint32_t id) {
+    if (id >= MAX_TASKS || kernel.tasks[id].state == TASK_UNUSED) {
+        printf("Error: No task with ID %d\n", id);
+        return false;
     }
-    
-    // Get highest priority task
-    TCB* next_task = priority_queue_extract(&ready_queue);
-    if (next_task) {
-        next_task->state = TASK_RUNNING;
-        kernel.current_task = next_task->id;
+
+    TCB* task = &kernel.tasks[id];
+    if (task->state == TASK_READY) {
+        kernel.policy->dequeue(task);
+    } else if (task->state == TASK_BLOCKED) {
+        timer_list_remove(task);
+    }
+    bool self = kernel.in_task && kernel.current_task == id;
+    if (kernel.current_task == id) kernel.current_task = NO_TASK;
+
+    task->state = TASK_UNUSED;
+    kernel.free_slots[kernel.free_count++] = id;
+    kernel.num_tasks--;
+
+    // A task deleting itself leaves its stack for good
+    if (self) {
+        kernel.in_task = false;
+        context_swap(task_context(task), &kernel.scheduler_context);
     }
+    return true;
+}
+
+// Schedule next task: dequeue the policy's best READY task
+TCB* schedule_next_task(void) {
+    TCB* next_task = kernel.policy->peek();
+    if (!next_task) return NULL;
+    
+    kernel.policy->dequeue(next_task);
+    next_task->state = TASK_RUNNING;
+    kernel.current_task = next_task->id;
     
     return next_task;
 }
 
-// Simulate task execution (for demonstration)
-void simulate_task_execution(TCB* task) {
-    task->run_count++;
+// First code a task runs on its own stack. Returning from the task
+// function deletes the task.
+void task_entry(void) {
+    TCB* task = rtos_current_task();
     task->function(task->parameters);
+    printf("[Tick %d] Task '%s' exited\n", 
+           kernel.tick_count, task_info(task)->name);
+    rtos_delete_task(task->id);
+}
+
+// Give the CPU back to the kernel from inside a task
+static void switch_to_kernel(TCB* task) {
+    kernel.in_task = false;
+    context_swap(task_context(task), &kernel.scheduler_context);
+}
+
+// Execute a task on its own stack until it yields, blocks or exits
+void simulate_task_execution(TCB* task) {
+    task_info(task)->run_count++;
+    task->job_exec_ticks++;
+    kernel.in_task = true;
+    TRACE_BEGIN(task_info(task)->name);
+    context_swap(&kernel.scheduler_context, task_context(task));
+    TRACE_END(task_info(task)->name);
+}
+
+// Dispatch loop for one tick: run the chosen task, and whenever it
+// blocks or exits hand the rest of the tick to the next READY task.
+// Runs on the kernel stack, so block/switch chains never nest.
+static void run_tasks(TCB* next) {
+    while (next) {
+        simulate_task_execution(next);
+        if (next->state == TASK_RUNNING) break;  // Used up the tick
+
+        next = schedule_next_task();
+        if (next) note_switch(next);
+    }
+}
+
+// Called by a task when it has done one tick of work
+void rtos_yield_tick(void) {
+    TCB* current = rtos_current_task();
+    if (current && kernel.in_task) switch_to_kernel(current);
 }
 
 // System tick handler
 void rtos_tick_handler(void) {
     kernel.tick_count++;
+    TRACE_VALUE("tick", kernel.tick_count);
     
-    // Print tick information every 100 ticks
-    if (kernel.tick_count % 100 == 0) {
-        printf("\n[Tick %d] System Status:\n", kernel.tick_count);
-        printf("Total context switches: %d\n", kernel.total_switches);
-    }
-    
-    // Check blocked tasks
-    for (uint32_t i = 0; i < kernel.num_tasks; i++) {
-        TCB* task = kernel.tasks[i];
-        if (task->state == TASK_BLOCKED) {
-            if (kernel.tick_count - task->blocked_tick >= task->timeout) {
-                printf("[Tick %d] Task '%s' unblocked\n", 
-                       kernel.tick_count, task->name);
-                task->state = TASK_READY;
-            }
-        }
-    }
+    // Wake only the blocked tasks whose timeout expires this tick
+    timer_list_tick();
     
     // Check if we need to preempt current task
-    TCB* current = kernel.tasks[kernel.current_task];
+    TCB* current = rtos_current_task();
     if (current && current->state == TASK_RUNNING) {
-        bool should_preempt = false;
-        
-        // Check if any higher priority task is ready
-        for (uint32_t i = 0; i < kernel.num_tasks; i++) {
-            TCB* task = kernel.tasks[i];
-            if (task->state == TASK_READY && task->priority > current->priority) {
-                should_preempt = true;
-                break;
-            }
-        }
+        // Check if the policy prefers a READY task over the current one
+        TCB* best = kernel.policy->peek();
+        bool should_preempt = best && kernel.policy->preempts(best, current);
         
         if (should_preempt) {
-            printf("[Tick %d] Preempting task '%s'\n", 
-                   kernel.tick_count, current->name);
-            current->state = TASK_READY;
+            TRACE_COUNT(preempt_counter, 1);
+            TRACE_INSTANT("preempt", current->id);
+            // A preempted task resumes before its peers at the same level
+            task_make_ready(current, true);
             TCB* next = schedule_next_task();
             if (next) {
-                kernel.total_switches++;
-                printf("[Tick %d] Switching from '%s' to '%s'\n", 
-                       kernel.tick_count, current->name, next->name);
-                simulate_task_execution(next);
+                note_switch(next);
+                run_tasks(next);
             }
         } else {
             // Continue executing current task
-            simulate_task_execution(current);
+            run_tasks(current);
         }
     } else {
         // No task running, schedule next task
         TCB* next = schedule_next_task();
         if (next) {
-            kernel.total_switches++;
-            printf("[Tick %d] Starting task '%s'\n", 
-                   kernel.tick_count, next->name);
-            simulate_task_execution(next);
+            note_switch(next);
+            run_tasks(next);
         }
     }
 }
 
-// Block current task
+// True when no task is running or ready, so ticks until the next
+// timeout would only advance tick_count
+bool rtos_is_idle(void) {
+    TCB* current = rtos_current_task();
+    if (current && current->state == TASK_RUNNING) return false;
+    return kernel.policy->peek() == NULL;
+}
+
+// Ticks until the earliest blocked task wakes, or UINT32_MAX if none
+uint32_t rtos_next_wakeup(void) {
+    return kernel.timer_head ? kernel.timer_head->timer_delta : UINT32_MAX;
+}
+
+// Advance time by up to max_ticks without running the tick handler,
+// stopping one tick short of the next wakeup so that tick is processed
+// normally. Returns the number of ticks skipped.
+uint32_t rtos_tickless_idle(uint32_t max_ticks) {
+    uint32_t skip = rtos_next_wakeup();
+    if (skip != UINT32_MAX) skip--;
+    if (skip > max_ticks) skip = max_ticks;
+    if (skip == 0) return 0;
+
+    kernel.tick_count += skip;
+    if (kernel.timer_head) kernel.timer_head->timer_delta -= skip;
+    kernel.idle_ticks += skip;
+    kernel.idle_entries++;
+    return skip;
+}
+
+// Run the system for a number of ticks, jumping over idle stretches
+// when TICKLESS_IDLE is enabled
+void rtos_run(uint32_t ticks) {
+    uint32_t end = kernel.tick_count + ticks;
+
+    while (kernel.tick_count < end) {
+#if TICKLESS_IDLE
+        if (rtos_is_idle()) {
+            rtos_tickless_idle(end - kernel.tick_count - 1);
+        }
+#endif
+        TRACE_TIMED(tick_hist, rtos_tick_handler());
+    }
+}
+
+// Block current task and switch back to the kernel, which picks the
+// next task; returns once the timeout has expired and it runs again
 void rtos_block_task(uint32_t timeout) {
-    TCB* current = kernel.tasks[kernel.current_task];
-    if (current) {
-        printf("[Tick %d] Task '%s' blocking for %d ticks\n", 
-               kernel.tick_count, current->name, timeout);
+    TCB* current = rtos_current_task();
+    if (current && kernel.in_task) {
+        TRACE_INSTANT("block", timeout);
         current->state = TASK_BLOCKED;
         current->blocked_tick = kernel.tick_count;
         current->timeout = timeout;
-        
-        // Schedule next task
-        TCB* next = schedule_next_task();
-        if (next) {
-            kernel.total_switches++;
-            printf("[Tick %d] Switching from '%s' (blocked) to '%s'\n", 
-                   kernel.tick_count, current->name, next->name);
-            simulate_task_execution(next);
-        }
+        timer_list_insert(current, timeout);
+        switch_to_kernel(current);
     }
 }
 
+// Finish the current job of a periodic task and sleep until its next
+// release. A job that overran its period is released on the next tick.
+void rtos_wait_next_period(void) {
+    TCB* current = rtos_current_task();
+    if (!current || current->period == 0) return;
+
+    job_complete(current);
+    uint32_t next_release = current->release_tick + current->period;
+    uint32_t wait = next_release > kernel.tick_count ?
+                    next_release - kernel.tick_count : 0;
+    current->release_pending = true;
+    rtos_block_task(wait);
+}
+
 // Start RTOS scheduler
 void rtos_start(void) {
     printf("\nStarting RTOS Scheduler\n");
@@ -292,64 +920,122 @@ void rtos_start(void) {
     TCB* first_task = schedule_next_task();
     if (first_task) {
         printf("[Tick %d] Starting first task '%s'\n", 
-               kernel.tick_count, first_task->name);
-        simulate_task_execution(first_task);
+               kernel.tick_count, task_info(first_task)->name);
+        run_tasks(first_task);
     }
 }
 
-// Example task functions
-void task1(void* params) {
-    TCB* task = kernel.tasks[kernel.current_task];
-    printf("[Tick %d] Task '%s' running (execution #%d)\n", 
-           kernel.tick_count, task->name, task->run_count);
-    rtos_block_task(100);
+// Context switch microbenchmark: bounce between the kernel and a bare
+// context that does nothing but switch straight back
+static TaskContext bench_context;
+static uint8_t bench_stack[TASK_STACK_SIZE]
+    __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static void bench_entry(void) {
+    for (;;) {
+        context_swap(&bench_context, &kernel.scheduler_context);
+    }
 }
 
-void task2(void* params) {
-    TCB* task = kernel.tasks[kernel.current_task];
-    printf("[Tick %d] Task '%s' running (execution #%d)\n", 
-           kernel.tick_count, task->name, task->run_count);
-    rtos_block_task(200);
+// Measure the cost of one switch (half a round trip) in nanoseconds
+double rtos_measure_switch_cost(uint32_t rounds) {
+    context_init(&bench_context, bench_stack, sizeof(bench_stack), bench_entry);
+    context_swap(&kernel.scheduler_context, &bench_context);  // Warm up
+
+    uint64_t start = trace_clock_ns();
+    for (uint32_t i = 0; i < rounds; i++) {
+        context_swap(&kernel.scheduler_context, &bench_context);
+    }
+    uint64_t elapsed = trace_clock_ns() - start;
+
+    kernel.switch_ns = (double)elapsed / (2.0 * rounds);
+    return kernel.switch_ns;
+}
+
+// Cross-model benchmark suite (bench.h): the same bounce, timed in batches
+static uint64_t bench_switch(void* ctx, uint32_t n) {
+    (void)ctx;
+    for (uint32_t i = 0; i < n; i++) {
+        context_swap(&kernel.scheduler_context, &bench_context);
+    }
+    return 2ull * n;
+}
+
+int run_benchmark_suite(void) {
+    context_init(&bench_context, bench_stack, sizeof(bench_stack), bench_entry);
+    bench_begin("rtos");
+    bench_run(BENCH_CONTEXT_SWITCH, RTOS_ASM_SWITCH ? "asm_swap" : "ucontext",
+              bench_switch, NULL, 0);
+    return bench_end();
 }
 
-void task3(void* params) {
-    TCB* task = kernel.tasks[kernel.current_task];
-    printf("[Tick %d] Task '%s' running (execution #%d)\n", 
-           kernel.tick_count, task->name, task->run_count);
-    rtos_block_task(150);
+// Example periodic task: one long-running body on its own stack. Each
+// dispatch is one tick of work, and a job ends once it has used its WCET.
+void periodic_task(void* params) {
+    (void)params;
+    TCB* task = rtos_current_task();
+    for (;;) {
+        TRACE_INSTANT("job start", task_info(task)->run_count);
+        while (task->job_exec_ticks < task->wcet) {
+            rtos_yield_tick();
+        }
+        rtos_wait_next_period();
+    }
 }
 
 // Example usage
-int main() {
+int main(int argc, char** argv) {
     rtos_init();
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) return run_benchmark_suite();
     
-    // Create tasks with names and different priorities
-    rtos_create_task("LowPriorityTask", task1, NULL, 1, 1000, 1000);
-    rtos_create_task("HighPriorityTask", task2, NULL, 3, 2000, 2000);
-    rtos_create_task("MediumPriorityTask", task3, NULL, 2, 1500, 1500);
+    // Optional policy argument: fp (default), rm or edf, or bench for the
+    // benchmark suite alone
+    SchedPolicyType policy = POLICY_FIXED_PRIORITY;
+    if (argc > 1 && strcmp(argv[1], "rm") == 0) policy = POLICY_RATE_MONOTONIC;
+    if (argc > 1 && strcmp(argv[1], "edf") == 0) policy = POLICY_EDF;
+    rtos_set_policy(policy);
+    
+    // Create periodic tasks: priority, deadline, period, WCET
+    rtos_create_task("LowPriorityTask", periodic_task, NULL, 1, 100, 100, 20);
+    rtos_create_task("HighPriorityTask", periodic_task, NULL, 3, 200, 200, 30);
+    rtos_create_task("MediumPriorityTask", periodic_task, NULL, 2, 150, 150, 25);
+    
+    // This one would push utilization past 100% and must be refused
+    rtos_create_task("OverloadTask", periodic_task, NULL, 4, 100, 100, 60);
     
     // Start scheduler
     rtos_start();
     
     // Simulate tick interrupts
     printf("\nSimulating system ticks...\n");
-    for (int i = 0; i < 500; i++) {
-        rtos_tick_handler();
-    }
+    rtos_run(500);
     
     // Print final statistics
     printf("\nFinal System Statistics:\n");
     printf("----------------------\n");
     printf("Total ticks: %d\n", kernel.tick_count);
     printf("Total context switches: %d\n", kernel.total_switches);
+    printf("Context switch cost: %.1f ns (%s, %d round trips)\n", 
+           rtos_measure_switch_cost(SWITCH_BENCH_ROUNDS),
+           RTOS_ASM_SWITCH ? "asm switch" : "ucontext", SWITCH_BENCH_ROUNDS);
+    printf("Idle ticks skipped: %d (in %d tickless periods)\n", 
+           kernel.idle_ticks, kernel.idle_entries);
+    trace_report();
     
-    for (uint32_t i = 0; i < kernel.num_tasks; i++) {
-        TCB* task = kernel.tasks[i];
-        printf("Task '%s': Ran %d times\n", task->name, task->run_count);
+    for (uint32_t i = 0; i < MAX_TASKS; i++) {
+        TCB* task = &kernel.tasks[i];
+        if (task->state == TASK_UNUSED) continue;
+        TaskInfo* info = task_info(task);
+        printf("Task '%s': Ran %d times, %d jobs, %d deadline misses, "
+               "response avg %.1f / max %d ticks\n", 
+               info->name, info->run_count, info->jobs_completed,
+               info->deadline_misses,
+               info->jobs_completed ?
+               (double)info->response_total / info->jobs_completed : 0.0,
+               info->response_max);
         
         // Cleanup
-        free((void*)task->stack_pointer);
-        free(task);
+        rtos_delete_task(task->id);
     }
     
     return 0;
@@ -0,0 +1,326 @@
+/* Lightweight tracing and metrics shared by the kernel models.
+ *
+ * Trace points append fixed-size binary events to a ring owned by the
+ * calling thread, so recording one is a timestamp read and a few stores:
+ * no locks, no formatting, no system calls. When a ring fills, the oldest
+ * events are overwritten. trace_dump_json() writes every ring out in the
+ * Chrome trace event format, which chrome://tracing and ui.perfetto.dev
+ * both open.
+ *
+ * Counters and histograms are named statics that register themselves
+ * before main, so trace_print_metrics() can list them and the program can
+ * read them at any time. Histograms have power-of-two buckets, so a
+ * record is one bit scan and an atomic add.
+ *
+ * Everything here is header-only, so each model still builds from its
+ * one source file. Build with -DTRACE_ENABLED=0 to compile out every
+ * trace point, counter update and histogram record.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+#define TRACE_RING_SIZE 16384   // Events per thread, power of two
+#define TRACE_HIST_BUCKETS 64   // Bucket i holds values in [2^(i-1), 2^i)
+
+typedef struct {
+    uint64_t ts;                // trace_now() ticks
+    const char* name;           // A string literal
+    uint64_t arg;
+    char phase;                 // Chrome phase: B, E, i or C
+} trace_event_t;
+
+typedef struct trace_ring {
+    _Atomic uint64_t head;      // Events ever written; only the owner writes
+    uint32_t tid;
+    const char* thread_name;
+    struct trace_ring* next;
+    trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+typedef struct trace_counter {
+    const char* name;
+    _Atomic uint64_t value;
+    struct trace_counter* next;
+} trace_counter_t;
+
+typedef struct trace_histogram {
+    const char* name;
+    bool ticks;                 // Values are trace_now() ticks, shown as ns
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[TRACE_HIST_BUCKETS];
+    struct trace_histogram* next;
+} trace_histogram_t;
+
+// Registries; a program need not use all of them
+#define TRACE_UNUSED __attribute__((unused))
+static TRACE_UNUSED _Atomic(trace_ring_t*) trace_rings;
+static TRACE_UNUSED _Atomic(trace_counter_t*) trace_counters;
+static TRACE_UNUSED _Atomic(trace_histogram_t*) trace_histograms;
+static TRACE_UNUSED _Atomic uint32_t trace_next_tid;
+static TRACE_UNUSED __thread trace_ring_t* trace_self;
+static uint64_t trace_epoch_ticks, trace_epoch_ns;
+
+// Monotonic nanoseconds: the wall clock the models and bench.h all time by
+static inline uint64_t trace_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Timestamp source: the TSC on x86, the monotonic clock elsewhere
+static inline uint64_t trace_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return trace_clock_ns();
+#endif
+}
+
+__attribute__((constructor)) static void trace_init_epoch(void) {
+    trace_epoch_ns = trace_clock_ns();
+    trace_epoch_ticks = trace_now();
+}
+
+// Ticks per nanosecond, calibrated over the time since startup
+static inline double trace_ticks_per_ns(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ns = trace_clock_ns() - trace_epoch_ns;
+    uint64_t ticks = trace_now() - trace_epoch_ticks;
+    return ns ? (double)ticks / ns : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+/* Registration */
+
+#define TRACE_COUNTER_DEFINE(var, label)                                            \
+    static trace_counter_t var = { .name = label };                                  \
+    __attribute__((constructor)) static void var##_register(void) {                  \
+        var.next = atomic_load(&trace_counters);                                     \
+        while (!atomic_compare_exchange_weak(&trace_counters, &var.next, &var)) {}   \
+    }
+
+// A histogram of durations measured in trace_now() ticks
+#define TRACE_HISTOGRAM_DEFINE(var, label)                                          \
+    static trace_histogram_t var = { .name = label, .ticks = true };                 \
+    __attribute__((constructor)) static void var##_register(void) {                  \
+        var.next = atomic_load(&trace_histograms);                                   \
+        while (!atomic_compare_exchange_weak(&trace_histograms, &var.next, &var)) {} \
+    }
+
+// A histogram of plain values such as sizes or queue depths
+#define TRACE_VALUE_HISTOGRAM_DEFINE(var, label)                                    \
+    static trace_histogram_t var = { .name = label };                                \
+    __attribute__((constructor)) static void var##_register(void) {                  \
+        var.next = atomic_load(&trace_histograms);                                   \
+        while (!atomic_compare_exchange_weak(&trace_histograms, &var.next, &var)) {} \
+    }
+
+/* Recording */
+
+static inline trace_ring_t* trace_ring_create(void) {
+    trace_ring_t* ring = calloc(1, sizeof(trace_ring_t));
+    if (!ring) return NULL;
+    ring->tid = atomic_fetch_add(&trace_next_tid, 1) + 1;
+    ring->next = atomic_load(&trace_rings);
+    while (!atomic_compare_exchange_weak(&trace_rings, &ring->next, ring)) {}
+    trace_self = ring;
+    return ring;
+}
+
+static inline void trace_emit(char phase, const char* name, uint64_t arg) {
+    trace_ring_t* ring = trace_self ? trace_self : trace_ring_create();
+    if (!ring) return;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    trace_event_t* e = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    e->ts = trace_now();
+    e->name = name;
+    e->arg = arg;
+    e->phase = phase;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Label the calling thread's track in the exported trace
+static inline void trace_thread_name(const char* name) {
+    trace_ring_t* ring = trace_self ? trace_self : trace_ring_create();
+    if (ring) ring->thread_name = name;
+}
+
+static inline void trace_hist_record(trace_histogram_t* h, uint64_t value) {
+    uint32_t bucket = value ? 64 - __builtin_clzll(value) : 0;
+    if (bucket >= TRACE_HIST_BUCKETS) bucket = TRACE_HIST_BUCKETS - 1;
+    atomic_fetch_add_explicit(&h->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(&h->max, &max, value,
+                                                  memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+#if TRACE_ENABLED
+#define TRACE_BEGIN(name) trace_emit('B', name, 0)
+#define TRACE_END(name) trace_emit('E', name, 0)
+#define TRACE_INSTANT(name, arg) trace_emit('i', name, (uint64_t)(arg))
+#define TRACE_VALUE(name, value) trace_emit('C', name, (uint64_t)(value))
+#define TRACE_COUNT(counter, n) \
+    atomic_fetch_add_explicit(&(counter).value, (uint64_t)(n), memory_order_relaxed)
+#define TRACE_HIST(hist, value) trace_hist_record(&(hist), (uint64_t)(value))
+#define TRACE_CLOCK() trace_now()
+// Time a statement into a ticks histogram
+#define TRACE_TIMED(hist, stmt)                        \
+    do {                                               \
+        uint64_t trace_start_ = trace_now();           \
+        stmt;                                          \
+        trace_hist_record(&(hist), trace_now() - trace_start_); \
+    } while (0)
+#else
+// sizeof keeps the arguments used without evaluating them
+#define TRACE_BEGIN(name) ((void)sizeof(name))
+#define TRACE_END(name) ((void)sizeof(name))
+#define TRACE_INSTANT(name, arg) ((void)sizeof(arg))
+#define TRACE_VALUE(name, value) ((void)sizeof(value))
+#define TRACE_COUNT(counter, n) ((void)sizeof(n))
+#define TRACE_HIST(hist, value) ((void)sizeof(value))
+#define TRACE_CLOCK() ((uint64_t)0)
+#define TRACE_TIMED(hist, stmt) do { stmt; } while (0)
+#endif
+
+/* Queries */
+
+static inline uint64_t trace_counter_read(const trace_counter_t* c) {
+    return atomic_load_explicit(&c->value, memory_order_relaxed);
+}
+
+// Scale a histogram value for display: ticks become nanoseconds
+static inline double trace_hist_scale(const trace_histogram_t* h, double value) {
+    return h->ticks ? value / trace_ticks_per_ns() : value;
+}
+
+static inline double trace_hist_mean(const trace_histogram_t* h) {
+    uint64_t count = atomic_load(&h->count);
+    return count ? trace_hist_scale(h, (double)atomic_load(&h->sum) / count) : 0.0;
+}
+
+// Upper bound of the bucket holding the p-th percentile (0 < p <= 1),
+// capped at the largest value seen
+static inline double trace_hist_percentile(const trace_histogram_t* h, double p) {
+    uint64_t count = atomic_load(&h->count), seen = 0;
+    if (!count) return 0.0;
+    uint64_t rank = (uint64_t)(p * count + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t max = atomic_load(&h->max);
+    for (uint32_t i = 0; i < TRACE_HIST_BUCKETS; i++) {
+        seen += atomic_load(&h->buckets[i]);
+        if (seen >= rank) {
+            uint64_t bound = i == 0 ? 0 : (1ull << i) - 1;
+            return trace_hist_scale(h, (double)(bound < max ? bound : max));
+        }
+    }
+    return trace_hist_scale(h, (double)max);
+}
+
+static inline void trace_print_metrics(void) {
+#if TRACE_ENABLED
+    trace_counter_t* counters = atomic_load(&trace_counters);
+    trace_histogram_t* hists = atomic_load(&trace_histograms);
+    if (counters) printf("%-28s %14s\n", "counter", "value");
+    for (trace_counter_t* c = counters; c; c = c->next) {
+        printf("%-28s %14llu\n", c->name, (unsigned long long)trace_counter_read(c));
+    }
+    if (hists) {
+        printf("%-28s %10s %10s %10s %10s %10s\n", "histogram", "count", "mean", "p50", "p99", "max");
+    }
+    for (trace_histogram_t* h = hists; h; h = h->next) {
+        printf("%-28s %10llu %10.1f %10.1f %10.1f %10.1f%s\n", h->name,
+               (unsigned long long)atomic_load(&h->count), trace_hist_mean(h),
+               trace_hist_percentile(h, 0.5), trace_hist_percentile(h, 0.99),
+               trace_hist_scale(h, (double)atomic_load(&h->max)), h->ticks ? " ns" : "");
+    }
+#else
+    printf("Tracing compiled out (TRACE_ENABLED=0)\n");
+#endif
+}
+
+/* Export */
+
+static inline void trace_json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        if ((unsigned char)*s >= 0x20) fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// Write every thread's events to path as Chrome trace JSON. Threads
+// should be quiet while it runs; events recorded meanwhile may be torn.
+static inline bool trace_dump_json(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    double ticks_per_us = trace_ticks_per_ns() * 1000.0;
+    bool first = true;
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (trace_ring_t* ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t start = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        if (ring->thread_name) {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                    first ? "" : ",\n", ring->tid);
+            trace_json_string(f, ring->thread_name);
+            fprintf(f, "}}");
+            first = false;
+        }
+        for (uint64_t i = start; i < head; i++) {
+            const trace_event_t* e = &ring->events[i & (TRACE_RING_SIZE - 1)];
+            fprintf(f, "%s{\"name\":", first ? "" : ",\n");
+            trace_json_string(f, e->name);
+            fprintf(f, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", e->phase,
+                    (double)(e->ts - trace_epoch_ticks) / ticks_per_us, ring->tid);
+            if (e->phase == 'i') fprintf(f, ",\"s\":\"t\",\"args\":{\"arg\":%llu}", (unsigned long long)e->arg);
+            if (e->phase == 'C') fprintf(f, ",\"args\":{\"value\":%llu}", (unsigned long long)e->arg);
+            fputc('}', f);
+            first = false;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
+
+// End-of-run report: the metrics, and the trace when TRACE_FILE names a
+// file to write it to
+static inline void trace_report(void) {
+    trace_print_metrics();
+#if TRACE_ENABLED
+    const char* path = getenv("TRACE_FILE");
+    if (path) {
+        uint64_t events = 0;
+        for (trace_ring_t* ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+            uint64_t head = atomic_load(&ring->head);
+            events += head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+        }
+        if (trace_dump_json(path)) printf("Wrote %llu trace events to %s\n", (unsigned long long)events, path);
+        else printf("Failed to write trace to %s\n", path);
+    }
+#endif
+}
+
+#endif /* TRACE_H */
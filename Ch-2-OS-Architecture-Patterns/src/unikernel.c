@@ -1,54 +1,182 @@
+#define _GNU_SOURCE  // recvmmsg/sendmmsg
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "trace.h"
+#include "bench.h"
+#ifdef __linux__
+#include <net/if.h>
+#include <linux/if_tun.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#endif
 
 // Memory management structures
 #define PAGE_SIZE 4096
-#define HEAP_SIZE (1024 * 1024) // 1MB heap
+#define HEAP_SIZE (4 * 1024 * 1024) // 4MB heap, packet pool included
+
+#define HEAP_PAGES (HEAP_SIZE / PAGE_SIZE)
+#define NUM_SIZE_CLASSES 14
+#define SMALL_MAX 2048   // Larger requests get whole pages
+#define SPAN_LISTS 64    // Free spans by page count; the last holds longer ones
+#define NO_PAGE UINT32_MAX
+
+enum { PAGE_FREE, PAGE_SMALL, PAGE_LARGE };
+
+// Per-page metadata, kept outside the heap. Spans (runs of pages that
+// are free or hold one large block) record their state and length on
+// their first and last page so neighbours can be coalesced in O(1).
+typedef struct {
+    uint8_t state;
+    uint8_t size_class;   // Small pages
+    uint16_t in_use;      // Small pages: live objects
+    uint16_t carved;      // Small pages: objects cut from the untouched tail
+    uint32_t span_pages;
+    uint32_t next;        // Free span list, or the class's partial pages
+    uint32_t prev;
+    void* free_list;      // Small pages: freed objects
+} PageInfo;
 
 typedef struct {
     void* heap_start;
-    void* heap_current;
     void* heap_end;
-    size_t total_allocated;
+    size_t total_allocated;  // Bytes handed out over the heap's lifetime
+    size_t live_bytes;       // Bytes in blocks currently allocated
+    size_t peak_bytes;
+    uint32_t pages_in_use;
+    uint32_t peak_pages;
+    PageInfo pages[HEAP_PAGES];
+    uint32_t span_free[SPAN_LISTS];
+    uint64_t span_bitmap;    // Non-empty span_free lists
+    uint32_t partial[NUM_SIZE_CLASSES];  // Pages with a free object
 } MemoryManager;
 
 // Network stack structures
 #define MAX_PACKETS 256
 #define PACKET_SIZE 1514
 
+#define L2_HEADER_SIZE 42  // Ethernet + IPv4 + UDP, no options
+
+// Where a packet came from, so the reply can go back there
+typedef struct {
+    struct sockaddr_storage addr;  // Datagram backends
+    socklen_t addr_len;
+    int conn_fd;                   // Stream backend, -1 otherwise
+    uint8_t l2_header[L2_HEADER_SIZE];  // Frame backends: request headers
+} PacketPeer;
+
+// Packet buffer: a fixed-size slot in the pool. The peer travels with
+// the buffer, so a reply can be written into the request's buffer.
+#define PKT_BUF_COUNT (2 * MAX_PACKETS + 64)
+
+typedef struct {
+    PacketPeer peer;
+    uint8_t data[PACKET_SIZE + 1];  // Room to NUL-terminate a full packet
+} __attribute__((aligned(64))) PacketBuf;
+
+// Ring descriptor: the buffer and the bytes in it that are in use
 typedef struct {
-    uint8_t data[PACKET_SIZE];
-    size_t length;
-} Packet;
+    PacketBuf* buf;
+    uint16_t offset;  // Payload start; frame backends keep headers in front
+    uint16_t length;  // Bytes from data[0], headers included
+    uint16_t flags;
+} PacketDesc;
+
+#define PKT_CLOSE 0x1  // Stream backends: last reply, close after sending
+
+typedef struct {
+    PacketBuf* free_list[PKT_BUF_COUNT];
+    uint32_t free_count;
+} PacketPool;
+
+struct NetDriver;
 
 typedef struct {
-    Packet rx_ring[MAX_PACKETS];
-    Packet tx_ring[MAX_PACKETS];
+    struct NetDriver* driver;  // Device that fills rx_ring and drains tx_ring
+    PacketPool pool;
+    PacketDesc rx_ring[MAX_PACKETS];  // Slots keep their buffer posted
+    PacketDesc tx_ring[MAX_PACKETS];
     uint32_t rx_head;
     uint32_t rx_tail;
     uint32_t tx_head;
     uint32_t tx_tail;
+    uint64_t copies;  // Payload memcpys on the send path
 } NetworkQueue;
 
+// Network driver layer. A backend moves whole batches between its
+// device and the rings: rx_batch fills the free run of rx_ring, tx_batch
+// drains the queued run of tx_ring. Each exposes pollfds so the main
+// loop can sleep until the device is readable.
+#define NET_MAX_FDS 64
+#define NET_BATCH 64
+
+typedef struct NetDriver {
+    const char* name;
+    size_t header_space;  // Bytes reserved ahead of each TX payload
+    bool needs_peer;      // Replies must be addressed
+    int (*open)(struct NetDriver* drv, const char* arg);
+    int (*rx_batch)(struct NetDriver* drv, NetworkQueue* nq);
+    int (*tx_batch)(struct NetDriver* drv, NetworkQueue* nq);
+    void (*encap)(struct NetDriver* drv, PacketDesc* pkt);
+    void (*close)(struct NetDriver* drv);
+
+    int fd;
+    uint16_t port;
+    struct pollfd pfds[NET_MAX_FDS];
+    nfds_t npfds;
+    bool busy_poll;
+    bool trace;
+
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+    uint64_t rx_calls;  // Syscalls that moved RX packets
+    uint64_t tx_calls;
+    uint64_t dropped;
+} NetDriver;
+
 // Event system
 #define MAX_EVENTS 32
 
+#define NO_DEADLINE UINT64_MAX
+
 typedef void (*EventHandler)(void* data);
 
+// Handle returned by add_event: slot + 1 in the low bits, the slot's
+// generation above, so a stale handle never cancels a reused slot.
+// 0 is never a valid handle.
+typedef uint32_t EventHandle;
+
 typedef struct {
     EventHandler handler;
     void* data;
     uint64_t trigger_time;
+    uint64_t seq;         // Insertion order, breaks trigger_time ties
+    uint32_t heap_index;  // Position in the heap while active
+    uint16_t generation;
     bool active;
 } Event;
 
+// Timer queue: a binary min-heap of slot indices keyed on trigger time,
+// with free slots kept on a stack for reuse
 typedef struct {
     Event events[MAX_EVENTS];
-    uint32_t event_count;
+    uint32_t heap[MAX_EVENTS];
+    uint32_t heap_size;
+    uint32_t free_slots[MAX_EVENTS];
+    uint32_t free_count;
+    uint64_t next_seq;
     uint64_t current_time;
 } EventSystem;
 
@@ -57,153 +185,1568 @@ typedef struct {
     MemoryManager mm;
     NetworkQueue net_queue;
     EventSystem events;
+    NetDriver driver;
     bool running;
 } Unikernel;
 
-// Memory management functions
+// Memory management functions. Small requests are rounded to a size
+// class and served from pages dedicated to that class, each with its
+// own free list; large ones take a span of whole pages. Both allocate
+// and free in O(1), so a long-running server reuses what it frees.
+static const uint16_t class_size[NUM_SIZE_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+static uint8_t class_index[SMALL_MAX / 16 + 1];  // (size + 15) / 16 -> class
+
+static inline void* page_addr(MemoryManager* mm, uint32_t page) {
+    return (uint8_t*)mm->heap_start + (size_t)page * PAGE_SIZE;
+}
+
+static inline uint32_t page_of(MemoryManager* mm, const void* ptr) {
+    return (uint32_t)(((const uint8_t*)ptr - (uint8_t*)mm->heap_start) / PAGE_SIZE);
+}
+
+static inline uint32_t span_list(uint32_t pages) {
+    return pages < SPAN_LISTS - 1 ? pages : SPAN_LISTS - 1;
+}
+
+// Mark a span's boundary pages
+static void span_mark(MemoryManager* mm, uint32_t first, uint32_t pages, uint8_t state) {
+    PageInfo* head = &mm->pages[first];
+    PageInfo* tail = &mm->pages[first + pages - 1];
+    head->state = tail->state = state;
+    head->span_pages = tail->span_pages = pages;
+}
+
+static void span_push(MemoryManager* mm, uint32_t first, uint32_t pages) {
+    uint32_t list = span_list(pages);
+    span_mark(mm, first, pages, PAGE_FREE);
+    mm->pages[first].prev = NO_PAGE;
+    mm->pages[first].next = mm->span_free[list];
+    if (mm->span_free[list] != NO_PAGE) mm->pages[mm->span_free[list]].prev = first;
+    mm->span_free[list] = first;
+    mm->span_bitmap |= 1ull << list;
+}
+
+static void span_unlink(MemoryManager* mm, uint32_t first) {
+    PageInfo* pi = &mm->pages[first];
+    uint32_t list = span_list(pi->span_pages);
+    if (pi->prev != NO_PAGE) mm->pages[pi->prev].next = pi->next;
+    else mm->span_free[list] = pi->next;
+    if (pi->next != NO_PAGE) mm->pages[pi->next].prev = pi->prev;
+    if (mm->span_free[list] == NO_PAGE) mm->span_bitmap &= ~(1ull << list);
+}
+
+// Take `pages` contiguous pages: the smallest exact-size list that can
+// serve it, first fit only among the long spans of the last list
+static uint32_t span_alloc(MemoryManager* mm, uint32_t pages) {
+    uint64_t candidates = mm->span_bitmap & (~0ull << span_list(pages));
+    uint32_t first = NO_PAGE;
+    while (candidates && first == NO_PAGE) {
+        uint32_t list = (uint32_t)__builtin_ctzll(candidates);
+        candidates &= candidates - 1;
+        for (uint32_t p = mm->span_free[list]; p != NO_PAGE; p = mm->pages[p].next) {
+            if (mm->pages[p].span_pages >= pages) {
+                first = p;
+                break;
+            }
+            if (list < SPAN_LISTS - 1) break;
+        }
+    }
+    if (first == NO_PAGE) return NO_PAGE;
+
+    uint32_t have = mm->pages[first].span_pages;
+    span_unlink(mm, first);
+    if (have > pages) {
+        span_push(mm, first + pages, have - pages);
+    }
+    mm->pages_in_use += pages;
+    if (mm->pages_in_use > mm->peak_pages) mm->peak_pages = mm->pages_in_use;
+    return first;
+}
+
+// Return a span, merging it with free neighbours
+static void span_release(MemoryManager* mm, uint32_t first, uint32_t pages) {
+    mm->pages_in_use -= pages;
+    if (first > 0 && mm->pages[first - 1].state == PAGE_FREE) {
+        uint32_t prev_pages = mm->pages[first - 1].span_pages;
+        first -= prev_pages;
+        pages += prev_pages;
+        span_unlink(mm, first);
+    }
+    uint32_t after = first + pages;
+    if (after < HEAP_PAGES && mm->pages[after].state == PAGE_FREE) {
+        pages += mm->pages[after].span_pages;
+        span_unlink(mm, after);
+    }
+    span_push(mm, first, pages);
+}
+
+static void partial_push(MemoryManager* mm, uint8_t c, uint32_t page) {
+    mm->pages[page].prev = NO_PAGE;
+    mm->pages[page].next = mm->partial[c];
+    if (mm->partial[c] != NO_PAGE) mm->pages[mm->partial[c]].prev = page;
+    mm->partial[c] = page;
+}
+
+static void partial_unlink(MemoryManager* mm, uint8_t c, uint32_t page) {
+    PageInfo* pi = &mm->pages[page];
+    if (pi->prev != NO_PAGE) mm->pages[pi->prev].next = pi->next;
+    else mm->partial[c] = pi->next;
+    if (pi->next != NO_PAGE) mm->pages[pi->next].prev = pi->prev;
+}
+
 void init_memory_manager(MemoryManager* mm) {
     static uint8_t heap[HEAP_SIZE] __attribute__((aligned(PAGE_SIZE)));
     mm->heap_start = heap;
-    mm->heap_current = heap;
     mm->heap_end = heap + HEAP_SIZE;
     mm->total_allocated = 0;
+    mm->live_bytes = mm->peak_bytes = 0;
+    mm->pages_in_use = mm->peak_pages = 0;
+    memset(mm->pages, 0, sizeof(mm->pages));
+
+    for (uint32_t i = 0; i < SPAN_LISTS; i++) mm->span_free[i] = NO_PAGE;
+    for (uint32_t c = 0; c < NUM_SIZE_CLASSES; c++) mm->partial[c] = NO_PAGE;
+    mm->span_bitmap = 0;
+    mm->pages_in_use = HEAP_PAGES;  // span_release takes them back out
+    span_release(mm, 0, HEAP_PAGES);
+
+    for (uint32_t i = 0, c = 0; i <= SMALL_MAX / 16; i++) {
+        while (class_size[c] < i * 16) c++;
+        class_index[i] = (uint8_t)c;
+    }
 }
 
 void* allocate(MemoryManager* mm, size_t size) {
-    size = (size + 7) & ~7; // 8-byte alignment
+    if (size == 0) size = 1;
+    
+    if (size > SMALL_MAX) {
+        uint32_t pages = (uint32_t)((size + PAGE_SIZE - 1) / PAGE_SIZE);
+        uint32_t first = span_alloc(mm, pages);
+        if (first == NO_PAGE) {
+            return NULL; // Out of memory
+        }
+        span_mark(mm, first, pages, PAGE_LARGE);
+        size = (size_t)pages * PAGE_SIZE;
+        mm->total_allocated += size;
+        mm->live_bytes += size;
+        if (mm->live_bytes > mm->peak_bytes) mm->peak_bytes = mm->live_bytes;
+        return page_addr(mm, first);
+    }
     
-    if (mm->heap_current + size > mm->heap_end) {
-        return NULL; // Out of memory
+    uint8_t c = class_index[(size + 15) / 16];
+    uint32_t page = mm->partial[c];
+    if (page == NO_PAGE) {
+        page = span_alloc(mm, 1);
+        if (page == NO_PAGE) {
+            return NULL; // Out of memory
+        }
+        PageInfo* fresh = &mm->pages[page];
+        span_mark(mm, page, 1, PAGE_SMALL);
+        fresh->size_class = c;
+        fresh->in_use = fresh->carved = 0;
+        fresh->free_list = NULL;
+        partial_push(mm, c, page);
     }
     
-    void* ptr = mm->heap_current;
-    mm->heap_current += size;
-    mm->total_allocated += size;
+    PageInfo* pi = &mm->pages[page];
+    void* ptr = pi->free_list;
+    if (ptr) {
+        pi->free_list = *(void**)ptr;
+    } else {
+        ptr = (uint8_t*)page_addr(mm, page) + (size_t)pi->carved++ * class_size[c];
+    }
+    if (++pi->in_use == PAGE_SIZE / class_size[c]) {
+        partial_unlink(mm, c, page);  // Full
+    }
+    mm->total_allocated += class_size[c];
+    mm->live_bytes += class_size[c];
+    if (mm->live_bytes > mm->peak_bytes) mm->peak_bytes = mm->live_bytes;
     return ptr;
 }
 
+void deallocate(MemoryManager* mm, void* ptr) {
+    if (!ptr || ptr < mm->heap_start || ptr >= mm->heap_end) {
+        return;
+    }
+    uint32_t page = page_of(mm, ptr);
+    PageInfo* pi = &mm->pages[page];
+    
+    if (pi->state == PAGE_LARGE) {
+        mm->live_bytes -= (size_t)pi->span_pages * PAGE_SIZE;
+        span_release(mm, page, pi->span_pages);
+        return;
+    }
+    if (pi->state != PAGE_SMALL) {
+        return; // Not an allocated block
+    }
+    
+    uint8_t c = pi->size_class;
+    bool was_full = pi->in_use == PAGE_SIZE / class_size[c];
+    *(void**)ptr = pi->free_list;
+    pi->free_list = ptr;
+    pi->in_use--;
+    mm->live_bytes -= class_size[c];
+    
+    if (was_full) {
+        partial_push(mm, c, page);
+    }
+    // Give empty pages back, keeping one per class to avoid thrashing
+    if (pi->in_use == 0 && !(mm->partial[c] == page && pi->next == NO_PAGE)) {
+        partial_unlink(mm, c, page);
+        span_release(mm, page, 1);
+    }
+}
+
+void print_memory_stats(const MemoryManager* mm) {
+    size_t held = (size_t)mm->pages_in_use * PAGE_SIZE;
+    printf("Memory: %zu live bytes (peak %zu), %u of %u pages in use (peak %u), "
+           "%zu allocated in total, %.1f%% fragmentation\n",
+           mm->live_bytes, mm->peak_bytes, mm->pages_in_use, HEAP_PAGES,
+           mm->peak_pages, mm->total_allocated,
+           held ? 100.0 * (double)(held - mm->live_bytes) / (double)held : 0.0);
+}
+
+// Per-request arena: bump allocation out of heap chunks. arena_reset
+// drops everything at once, keeping the first chunk for the next request.
+#define ARENA_CHUNK_SIZE (16 * 1024)
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;  // Older chunk
+    size_t size;
+} ArenaChunk;
+
+typedef struct {
+    MemoryManager* mm;
+    ArenaChunk* chunks;  // Newest first
+    uint8_t* ptr;
+    uint8_t* end;
+} Arena;
+
+void arena_init(Arena* arena, MemoryManager* mm) {
+    arena->mm = mm;
+    arena->chunks = NULL;
+    arena->ptr = arena->end = NULL;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    if (!arena->ptr || (size_t)(arena->end - arena->ptr) < size) {
+        size_t chunk_size = sizeof(ArenaChunk) + size;
+        if (chunk_size < ARENA_CHUNK_SIZE) chunk_size = ARENA_CHUNK_SIZE;
+        ArenaChunk* chunk = allocate(arena->mm, chunk_size);
+        if (!chunk) return NULL;
+        chunk->next = arena->chunks;
+        chunk->size = chunk_size;
+        arena->chunks = chunk;
+        arena->ptr = (uint8_t*)chunk + ((sizeof(ArenaChunk) + 15) & ~(size_t)15);
+        arena->end = (uint8_t*)chunk + chunk_size;
+    }
+    void* ptr = arena->ptr;
+    arena->ptr += size;
+    return ptr;
+}
+
+void arena_reset(Arena* arena) {
+    ArenaChunk* chunk = arena->chunks;
+    if (!chunk) return;
+    while (chunk->next) {
+        ArenaChunk* older = chunk->next;
+        deallocate(arena->mm, chunk);
+        chunk = older;
+    }
+    arena->chunks = chunk;
+    arena->ptr = (uint8_t*)chunk + ((sizeof(ArenaChunk) + 15) & ~(size_t)15);
+    arena->end = (uint8_t*)chunk + chunk->size;
+}
+
+// Packet pool: buffers carved from the heap once, recycled LIFO so the
+// next packet lands in a cache-warm buffer
+static PacketBuf* pkt_alloc(NetworkQueue* nq) {
+    PacketPool* pool = &nq->pool;
+    return pool->free_count ? pool->free_list[--pool->free_count] : NULL;
+}
+
+static void pkt_free(NetworkQueue* nq, PacketBuf* buf) {
+    nq->pool.free_list[nq->pool.free_count++] = buf;
+}
+
+// Make sure an RX slot has a buffer posted for the device to fill
+static PacketBuf* rx_post(NetworkQueue* nq, uint32_t slot) {
+    PacketDesc* desc = &nq->rx_ring[slot];
+    if (!desc->buf) desc->buf = pkt_alloc(nq);
+    return desc->buf;
+}
+
 // Network functions
-void init_network_queue(NetworkQueue* nq) {
+bool init_network_queue(NetworkQueue* nq, NetDriver* driver, MemoryManager* mm) {
+    nq->driver = driver;
     nq->rx_head = 0;
     nq->rx_tail = 0;
     nq->tx_head = 0;
     nq->tx_tail = 0;
-}
+    nq->copies = 0;
+    memset(nq->rx_ring, 0, sizeof(nq->rx_ring));
+    memset(nq->tx_ring, 0, sizeof(nq->tx_ring));
 
-bool network_send_packet(NetworkQueue* nq, const void* data, size_t length) {
-    if (length > PACKET_SIZE) {
+    PacketBuf* bufs = allocate(mm, PKT_BUF_COUNT * sizeof(PacketBuf));
+    if (!bufs) {
         return false;
     }
-    
+    nq->pool.free_count = 0;
+    for (uint32_t i = PKT_BUF_COUNT; i-- > 0; ) {
+        pkt_free(nq, &bufs[i]);
+    }
+    return true;
+}
+
+// Queue a filled buffer for transmission; the ring takes ownership
+bool network_send_buffer(NetworkQueue* nq, PacketDesc* pkt) {
+    NetDriver* drv = nq->driver;
     uint32_t next_head = (nq->tx_head + 1) % MAX_PACKETS;
     if (next_head == nq->tx_tail) {
-        return false; // Queue full
+        drv->tx_batch(drv, nq);  // Ring full: push a batch out first
+        if (next_head == nq->tx_tail) {
+            drv->dropped++;
+            pkt_free(nq, pkt->buf);
+            return false; // Queue full
+        }
     }
     
-    memcpy(nq->tx_ring[nq->tx_head].data, data, length);
-    nq->tx_ring[nq->tx_head].length = length;
+    if (drv->encap) {
+        drv->encap(drv, pkt);
+    }
+    nq->tx_ring[nq->tx_head] = *pkt;
     nq->tx_head = next_head;
+    return true;
+}
+
+// Copying send for data that is not already in a packet buffer
+bool network_send_packet(NetworkQueue* nq, const void* data, size_t length,
+                         const PacketPeer* peer) {
+    NetDriver* drv = nq->driver;
+    if (length + drv->header_space > PACKET_SIZE) {
+        return false;
+    }
+    if (!peer && drv->needs_peer) {
+        return false; // Nowhere to send it
+    }
     
-    printf("Network Packet Sent (%zu bytes): %.*s\n", 
-           length, (int)length, (const char*)data);
+    PacketBuf* buf = pkt_alloc(nq);
+    if (!buf) {
+        drv->dropped++;
+        return false;
+    }
+    memcpy(buf->data + drv->header_space, data, length);
+    nq->copies++;
+    if (peer) {
+        buf->peer = *peer;
+    } else {
+        buf->peer.addr_len = 0;
+        buf->peer.conn_fd = -1;
+    }
     
-    return true;
+    PacketDesc pkt = { buf, (uint16_t)drv->header_space,
+                       (uint16_t)(drv->header_space + length), 0 };
+    return network_send_buffer(nq, &pkt);
 }
 
+// Stands in for the device: writes a packet into the next posted buffer
 void simulate_receive_packet(NetworkQueue* nq, const char* data) {
     size_t length = strlen(data);
     uint32_t next_head = (nq->rx_head + 1) % MAX_PACKETS;
     
     if (next_head != nq->rx_tail && length < PACKET_SIZE) {
-        memcpy(nq->rx_ring[nq->rx_head].data, data, length);
-        nq->rx_ring[nq->rx_head].length = length;
+        PacketBuf* buf = rx_post(nq, nq->rx_head);
+        if (!buf) return;
+        memcpy(buf->data, data, length);
+        buf->peer.addr_len = 0;
+        buf->peer.conn_fd = -1;
+        nq->rx_ring[nq->rx_head].offset = 0;
+        nq->rx_ring[nq->rx_head].length = (uint16_t)length;
         nq->rx_head = next_head;
     }
 }
 
-bool network_receive_packet(NetworkQueue* nq, void* data, size_t* length) {
+// Take the oldest received packet out of the ring. The caller owns the
+// buffer and must pass it to network_send_buffer or network_release.
+bool network_receive_packet(NetworkQueue* nq, PacketDesc* pkt) {
     if (nq->rx_head == nq->rx_tail) {
         return false; // No packets
     }
     
-    memcpy(data, nq->rx_ring[nq->rx_tail].data, nq->rx_ring[nq->rx_tail].length);
-    *length = nq->rx_ring[nq->rx_tail].length;
+    *pkt = nq->rx_ring[nq->rx_tail];
+    nq->rx_ring[nq->rx_tail].buf = NULL;  // Reposted on the next receive
     nq->rx_tail = (nq->rx_tail + 1) % MAX_PACKETS;
     
     return true;
 }
 
+void network_release(NetworkQueue* nq, PacketDesc* pkt) {
+    pkt_free(nq, pkt->buf);
+    pkt->buf = NULL;
+}
+
+// Longest run of free RX slots starting at rx_head, without wrapping
+static uint32_t rx_free_run(const NetworkQueue* nq) {
+    uint32_t limit = nq->rx_tail > nq->rx_head ? nq->rx_tail - 1 :
+                     (nq->rx_tail == 0 ? MAX_PACKETS - 1 : MAX_PACKETS);
+    return limit - nq->rx_head;
+}
+
+// Longest run of queued TX packets starting at tx_tail, without wrapping
+static uint32_t tx_queued_run(const NetworkQueue* nq) {
+    return nq->tx_head >= nq->tx_tail ? nq->tx_head - nq->tx_tail
+                                      : MAX_PACKETS - nq->tx_tail;
+}
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Simulated backend: packets come from simulate_receive_packet and
+// transmitted ones are logged
+static int sim_open(NetDriver* drv, const char* arg) {
+    (void)arg;
+    drv->npfds = 0;
+    return 0;
+}
+
+static int sim_rx_batch(NetDriver* drv, NetworkQueue* nq) {
+    (void)drv; (void)nq;
+    return 0;
+}
+
+// Responses waiting in the TX ring, counted by status line
+static int sim_count_responses(NetworkQueue* nq) {
+    int responses = 0;
+    for (uint32_t i = nq->tx_tail; i != nq->tx_head; i = (i + 1) % MAX_PACKETS) {
+        const PacketDesc* pkt = &nq->tx_ring[i];
+        const char* p = (const char*)pkt->buf->data + pkt->offset;
+        const char* end = (const char*)pkt->buf->data + pkt->length;
+        while ((p = memmem(p, (size_t)(end - p), "HTTP/1.1 ", 9)) != NULL) {
+            responses++;
+            p += 9;
+        }
+    }
+    return responses;
+}
+
+static int sim_tx_batch(NetDriver* drv, NetworkQueue* nq) {
+    int sent = 0;
+    while (nq->tx_tail != nq->tx_head) {
+        PacketDesc* pkt = &nq->tx_ring[nq->tx_tail];
+        size_t length = pkt->length - pkt->offset;
+        if (drv->trace) {
+            printf("Network Packet Sent (%zu bytes): %.*s\n", 
+                   length, (int)length, (const char*)pkt->buf->data + pkt->offset);
+        }
+        pkt_free(nq, pkt->buf);
+        nq->tx_tail = (nq->tx_tail + 1) % MAX_PACKETS;
+        sent++;
+    }
+    drv->tx_packets += sent;
+    return sent;
+}
+
+// Datagram batches for any socket backend: one recvmmsg/sendmmsg moves
+// up to NET_BATCH packets straight between the socket and the ring
+static int mmsg_rx_batch(NetDriver* drv, NetworkQueue* nq, int fd, size_t offset) {
+    struct mmsghdr msgs[NET_BATCH];
+    struct iovec iov[NET_BATCH];
+    uint32_t n = rx_free_run(nq);
+    if (n > NET_BATCH) n = NET_BATCH;
+
+    for (uint32_t i = 0; i < n; i++) {
+        PacketBuf* buf = rx_post(nq, nq->rx_head + i);
+        if (!buf) {
+            n = i;  // Pool exhausted: receive what we have room for
+            break;
+        }
+        iov[i].iov_base = buf->data;
+        iov[i].iov_len = PACKET_SIZE;
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &buf->peer.addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(buf->peer.addr);
+    }
+    if (n == 0) return 0;
+
+    int got = recvmmsg(fd, msgs, n, MSG_DONTWAIT, NULL);
+    if (got <= 0) return 0;
+    drv->rx_calls++;
+
+    for (int i = 0; i < got; i++) {
+        PacketDesc* pkt = &nq->rx_ring[nq->rx_head + i];
+        pkt->length = (uint16_t)msgs[i].msg_len;
+        pkt->offset = (uint16_t)offset;
+        pkt->buf->peer.addr_len = msgs[i].msg_hdr.msg_namelen;
+        pkt->buf->peer.conn_fd = -1;
+    }
+    return got;
+}
+
+static int mmsg_tx_batch(NetDriver* drv, NetworkQueue* nq, int fd, bool addressed) {
+    int total = 0;
+    uint32_t n;
+    while ((n = tx_queued_run(nq)) > 0) {
+        struct mmsghdr msgs[NET_BATCH];
+        struct iovec iov[NET_BATCH];
+        if (n > NET_BATCH) n = NET_BATCH;
+
+        for (uint32_t i = 0; i < n; i++) {
+            PacketDesc* pkt = &nq->tx_ring[nq->tx_tail + i];
+            iov[i].iov_base = pkt->buf->data;
+            iov[i].iov_len = pkt->length;
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            if (addressed) {
+                msgs[i].msg_hdr.msg_name = &pkt->buf->peer.addr;
+                msgs[i].msg_hdr.msg_namelen = pkt->buf->peer.addr_len;
+            }
+        }
+
+        int sent = sendmmsg(fd, msgs, n, MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            sent = 1;  // Drop the packet that failed and carry on
+            drv->dropped++;
+        } else {
+            drv->tx_calls++;
+            drv->tx_packets += sent;
+        }
+        for (int i = 0; i < sent; i++) {
+            pkt_free(nq, nq->tx_ring[nq->tx_tail + i].buf);
+        }
+        nq->tx_tail = (nq->tx_tail + sent) % MAX_PACKETS;
+        total += sent;
+    }
+    return total;
+}
+
+// UDP backend: the server listens on a datagram socket
+static int udp_open(NetDriver* drv, const char* arg) {
+    drv->port = (uint16_t)atoi(arg ? arg : "8080");
+    drv->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (drv->fd < 0) return -1;
+
+    int size = 4 * 1024 * 1024;
+    setsockopt(drv->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(drv->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+#ifdef SO_BUSY_POLL
+    if (drv->busy_poll) {
+        int usecs = 50;
+        setsockopt(drv->fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+    }
+#endif
+
+    struct sockaddr_in addr = { .sin_family = AF_INET,
+                                .sin_port = htons(drv->port),
+                                .sin_addr.s_addr = htonl(INADDR_ANY) };
+    if (bind(drv->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(drv->fd);
+        return -1;
+    }
+    set_nonblocking(drv->fd);
+    drv->pfds[0] = (struct pollfd){ .fd = drv->fd, .events = POLLIN };
+    drv->npfds = 1;
+    return 0;
+}
+
+static int udp_rx_batch(NetDriver* drv, NetworkQueue* nq) {
+    int total = 0, got;
+    while ((got = mmsg_rx_batch(drv, nq, drv->fd, 0)) > 0) {
+        nq->rx_head = (nq->rx_head + got) % MAX_PACKETS;
+        total += got;
+    }
+    drv->rx_packets += total;
+    return total;
+}
+
+static int udp_tx_batch(NetDriver* drv, NetworkQueue* nq) {
+    return mmsg_tx_batch(drv, nq, drv->fd, true);
+}
+
+static void fd_close(NetDriver* drv) {
+    for (nfds_t i = 0; i < drv->npfds; i++) {
+        close(drv->pfds[i].fd);
+    }
+    drv->npfds = 0;
+}
+
+// TCP backend: a listening socket plus one pollfd per connection. A
+// stream has no message boundaries for recvmmsg to batch on, so each
+// readable connection costs one read and each reply one write.
+static int tcp_open(NetDriver* drv, const char* arg) {
+    drv->port = (uint16_t)atoi(arg ? arg : "8080");
+    drv->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (drv->fd < 0) return -1;
+
+    int on = 1;
+    setsockopt(drv->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr = { .sin_family = AF_INET,
+                                .sin_port = htons(drv->port),
+                                .sin_addr.s_addr = htonl(INADDR_ANY) };
+    if (bind(drv->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(drv->fd, 128) < 0) {
+        close(drv->fd);
+        return -1;
+    }
+    set_nonblocking(drv->fd);
+    drv->pfds[0] = (struct pollfd){ .fd = drv->fd, .events = POLLIN };
+    drv->npfds = 1;
+    return 0;
+}
+
+static int tcp_rx_batch(NetDriver* drv, NetworkQueue* nq) {
+    int total = 0;
+
+    // Accept everything pending while there are pollfds to hold it
+    int conn;
+    while (drv->npfds < NET_MAX_FDS && (conn = accept(drv->fd, NULL, NULL)) >= 0) {
+        set_nonblocking(conn);
+        drv->pfds[drv->npfds++] = (struct pollfd){ .fd = conn, .events = POLLIN };
+    }
+
+    // No new requests while replies wait for a full socket to drain
+    if (nq->tx_tail != nq->tx_head) return 0;
+
+    for (nfds_t i = 1; i < drv->npfds; i++) {
+        if (!drv->busy_poll && !(drv->pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+        PacketBuf* buf = rx_free_run(nq) ? rx_post(nq, nq->rx_head) : NULL;
+        if (!buf) break;
+
+        ssize_t got = read(drv->pfds[i].fd, buf->data, PACKET_SIZE);
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+        if (got < 0) got = 0;
+        if (got == 0) {
+            // Peer closed: drop the connection. The empty packet queued
+            // below tells the HTTP layer to forget the connection.
+            close(drv->pfds[i].fd);
+            buf->peer.conn_fd = drv->pfds[i].fd;
+            drv->pfds[i--] = drv->pfds[--drv->npfds];
+        } else {
+            drv->rx_calls++;
+            buf->peer.conn_fd = drv->pfds[i].fd;
+        }
+        nq->rx_ring[nq->rx_head].length = (uint16_t)got;
+        nq->rx_ring[nq->rx_head].offset = 0;
+        nq->rx_ring[nq->rx_head].flags = 0;
+        buf->peer.addr_len = 0;
+        nq->rx_head = (nq->rx_head + 1) % MAX_PACKETS;
+        total++;
+    }
+    drv->rx_packets += total;
+    return total;
+}
+
+// What poll waits for on the connections: requests, or while blocked_fd
+// holds up the TX ring, only for it to become writable
+static void tcp_poll_for(NetDriver* drv, int blocked_fd) {
+    for (nfds_t i = 1; i < drv->npfds; i++) {
+        drv->pfds[i].events = blocked_fd < 0 ? POLLIN
+                            : drv->pfds[i].fd == blocked_fd ? POLLOUT : 0;
+    }
+}
+
+// A reply the socket takes only part of stays at tx_tail with its offset
+// advanced, and the ring waits for the socket to drain
+static int tcp_tx_batch(NetDriver* drv, NetworkQueue* nq) {
+    int total = 0;
+    while (nq->tx_tail != nq->tx_head) {
+        PacketDesc* pkt = &nq->tx_ring[nq->tx_tail];
+        int fd = pkt->buf->peer.conn_fd;
+        ssize_t sent = send(fd, pkt->buf->data + pkt->offset,
+                            (size_t)(pkt->length - pkt->offset), MSG_NOSIGNAL);
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            tcp_poll_for(drv, fd);
+            return total;
+        }
+        if (sent < 0) {
+            drv->dropped++;
+        } else {
+            drv->tx_calls++;
+            pkt->offset += (uint16_t)sent;
+            if (pkt->offset < pkt->length) {
+                tcp_poll_for(drv, fd);
+                return total;
+            }
+            drv->tx_packets++;
+        }
+        if (pkt->flags & PKT_CLOSE) {
+            shutdown(fd, SHUT_WR);  // Peer's EOF closes it
+        }
+        pkt_free(nq, pkt->buf);
+        nq->tx_tail = (nq->tx_tail + 1) % MAX_PACKETS;
+        total++;
+    }
+    tcp_poll_for(drv, -1);
+    return total;
+}
+
+#ifdef __linux__
+// Frame backends speak just enough IPv4/UDP to serve one port: frames
+// for it are decapsulated, replies reuse the request's headers reversed
+static uint16_t ip_checksum(const uint8_t* header, size_t length) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < length; i += 2) {
+        sum += (uint32_t)(header[i] << 8 | header[i + 1]);
+    }
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+// Payload offset of a UDP frame for our port, or 0 if it is not one
+static size_t l2_decap(const NetDriver* drv, PacketDesc* pkt) {
+    const uint8_t* f = pkt->buf->data;
+    if (pkt->length < L2_HEADER_SIZE) return 0;
+    if (f[12] != 0x08 || f[13] != 0x00) return 0;     // IPv4
+    if (f[14] != 0x45 || f[23] != IPPROTO_UDP) return 0;  // No options, UDP
+    if ((f[36] << 8 | f[37]) != drv->port) return 0;
+
+    size_t udp_len = (size_t)(f[38] << 8 | f[39]);
+    if (udp_len < 8 || 34 + udp_len > pkt->length) return 0;
+    pkt->length = (uint16_t)(34 + udp_len);  // Trim Ethernet padding
+    memcpy(pkt->buf->peer.l2_header, f, L2_HEADER_SIZE);
+    pkt->buf->peer.conn_fd = -1;
+    return L2_HEADER_SIZE;
+}
+
+static void l2_encap(NetDriver* drv, PacketDesc* pkt) {
+    (void)drv;
+    const uint8_t* req = pkt->buf->peer.l2_header;
+    uint8_t* f = pkt->buf->data;
+    size_t udp_len = pkt->length - 34;
+
+    memcpy(f, req + 6, 6);        // Destination MAC = request source
+    memcpy(f + 6, req, 6);        // Source MAC = request destination
+    f[12] = 0x08; f[13] = 0x00;
+    f[14] = 0x45; f[15] = 0;
+    f[16] = (uint8_t)((20 + udp_len) >> 8); f[17] = (uint8_t)(20 + udp_len);
+    f[18] = f[19] = 0;            // Id
+    f[20] = 0x40; f[21] = 0;      // Don't fragment
+    f[22] = 64; f[23] = IPPROTO_UDP;
+    f[24] = f[25] = 0;
+    memcpy(f + 26, req + 30, 4);  // Swap IP addresses
+    memcpy(f + 30, req + 26, 4);
+    uint16_t csum = ip_checksum(f + 14, 20);
+    f[24] = (uint8_t)(csum >> 8); f[25] = (uint8_t)csum;
+    memcpy(f + 34, req + 36, 2);  // Swap ports
+    memcpy(f + 36, req + 34, 2);
+    f[38] = (uint8_t)(udp_len >> 8); f[39] = (uint8_t)udp_len;
+    f[40] = f[41] = 0;            // No UDP checksum
+}
+
+// Keep the decapsulated frames, swapping those for other hosts to the
+// end of the batch where their buffers stay posted for reuse
+static int l2_accept_frames(NetDriver* drv, NetworkQueue* nq, int got) {
+    int kept = 0;
+    for (int i = 0; i < got; i++) {
+        PacketDesc* pkt = &nq->rx_ring[nq->rx_head + i];
+        size_t offset = l2_decap(drv, pkt);
+        if (!offset) continue;
+        pkt->offset = (uint16_t)offset;
+        if (kept != i) {
+            PacketDesc tmp = nq->rx_ring[nq->rx_head + kept];
+            nq->rx_ring[nq->rx_head + kept] = *pkt;
+            *pkt = tmp;
+        }
+        kept++;
+    }
+    nq->rx_head = (nq->rx_head + kept) % MAX_PACKETS;
+    drv->rx_packets += kept;
+    return kept;
+}
+
+// AF_PACKET backend: raw frames on an interface, batched with mmsg
+static int packet_open(NetDriver* drv, const char* arg) {
+    const char* ifname = arg ? arg : "lo";
+    const char* colon = strchr(ifname, ':');
+    char name[IFNAMSIZ] = {0};
+    size_t len = colon ? (size_t)(colon - ifname) : strlen(ifname);
+    if (len >= IFNAMSIZ) return -1;
+    memcpy(name, ifname, len);
+    drv->port = (uint16_t)(colon ? atoi(colon + 1) : 8080);
+
+    drv->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+    if (drv->fd < 0) return -1;
+    struct sockaddr_ll addr = { .sll_family = AF_PACKET,
+                                .sll_protocol = htons(ETH_P_IP),
+                                .sll_ifindex = (int)if_nametoindex(name) };
+    if (addr.sll_ifindex == 0 ||
+        bind(drv->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(drv->fd);
+        return -1;
+    }
+    int ignore = 1;  // Don't read back our own transmissions
+    setsockopt(drv->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore));
+    set_nonblocking(drv->fd);
+    drv->pfds[0] = (struct pollfd){ .fd = drv->fd, .events = POLLIN };
+    drv->npfds = 1;
+    return 0;
+}
+
+static int packet_rx_batch(NetDriver* drv, NetworkQueue* nq) {
+    int total = 0, got;
+    while ((got = mmsg_rx_batch(drv, nq, drv->fd, 0)) > 0) {
+        total += l2_accept_frames(drv, nq, got);
+    }
+    return total;
+}
+
+static int packet_tx_batch(NetDriver* drv, NetworkQueue* nq) {
+    return mmsg_tx_batch(drv, nq, drv->fd, false);
+}
+
+// TAP backend: a virtual Ethernet device. The tun fd has no mmsg
+// support, so frames are read and written one per syscall.
+static int tap_open(NetDriver* drv, const char* arg) {
+    const char* ifname = arg ? arg : "uk0";
+    const char* colon = strchr(ifname, ':');
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    size_t len = colon ? (size_t)(colon - ifname) : strlen(ifname);
+    if (len >= IFNAMSIZ) return -1;
+    memcpy(ifr.ifr_name, ifname, len);
+    drv->port = (uint16_t)(colon ? atoi(colon + 1) : 8080);
+
+    drv->fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+    if (drv->fd < 0) return -1;
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    if (ioctl(drv->fd, TUNSETIFF, &ifr) < 0) {
+        close(drv->fd);
+        return -1;
+    }
+    drv->pfds[0] = (struct pollfd){ .fd = drv->fd, .events = POLLIN };
+    drv->npfds = 1;
+    return 0;
+}
+
+static int tap_rx_batch(NetDriver* drv, NetworkQueue* nq) {
+    int total = 0;
+    uint32_t n;
+    while ((n = rx_free_run(nq)) > 0) {
+        int got = 0;
+        for (; got < (int)n && got < NET_BATCH; got++) {
+            PacketBuf* buf = rx_post(nq, nq->rx_head + got);
+            if (!buf) break;
+            ssize_t len = read(drv->fd, buf->data, PACKET_SIZE);
+            if (len <= 0) break;
+            drv->rx_calls++;
+            nq->rx_ring[nq->rx_head + got].length = (uint16_t)len;
+        }
+        if (got == 0) break;
+        total += l2_accept_frames(drv, nq, got);
+    }
+    return total;
+}
+
+static int tap_tx_batch(NetDriver* drv, NetworkQueue* nq) {
+    int total = 0;
+    while (nq->tx_tail != nq->tx_head) {
+        PacketDesc* pkt = &nq->tx_ring[nq->tx_tail];
+        if (write(drv->fd, pkt->buf->data, pkt->length) < 0) {
+            if (errno == EAGAIN) break;
+            drv->dropped++;
+        } else {
+            drv->tx_calls++;
+            drv->tx_packets++;
+        }
+        pkt_free(nq, pkt->buf);
+        nq->tx_tail = (nq->tx_tail + 1) % MAX_PACKETS;
+        total++;
+    }
+    return total;
+}
+#endif
+
+static void no_close(NetDriver* drv) {
+    (void)drv;
+}
+
+static const NetDriver net_drivers[] = {
+    { .name = "sim", .open = sim_open, .rx_batch = sim_rx_batch,
+      .tx_batch = sim_tx_batch, .close = no_close },
+    { .name = "udp", .needs_peer = true, .open = udp_open, .rx_batch = udp_rx_batch,
+      .tx_batch = udp_tx_batch, .close = fd_close },
+    { .name = "tcp", .needs_peer = true, .open = tcp_open, .rx_batch = tcp_rx_batch,
+      .tx_batch = tcp_tx_batch, .close = fd_close },
+#ifdef __linux__
+    { .name = "packet", .header_space = L2_HEADER_SIZE, .needs_peer = true,
+      .open = packet_open, .rx_batch = packet_rx_batch, .tx_batch = packet_tx_batch,
+      .encap = l2_encap, .close = fd_close },
+    { .name = "tap", .header_space = L2_HEADER_SIZE, .needs_peer = true,
+      .open = tap_open, .rx_batch = tap_rx_batch, .tx_batch = tap_tx_batch,
+      .encap = l2_encap, .close = fd_close },
+#endif
+};
+
+const NetDriver* find_net_driver(const char* name) {
+    for (size_t i = 0; i < sizeof(net_drivers) / sizeof(net_drivers[0]); i++) {
+        if (strcmp(net_drivers[i].name, name) == 0) return &net_drivers[i];
+    }
+    return NULL;
+}
+
 // Event system functions
 void init_event_system(EventSystem* es) {
-    es->event_count = 0;
     es->current_time = 0;
+    es->heap_size = 0;
+    es->next_seq = 0;
     memset(es->events, 0, sizeof(es->events));
+    es->free_count = 0;
+    for (uint32_t i = MAX_EVENTS; i-- > 0; ) {
+        es->free_slots[es->free_count++] = i;
+    }
 }
 
-bool add_event(EventSystem* es, EventHandler handler, void* data, uint64_t delay) {
-    if (es->event_count >= MAX_EVENTS) {
-        return false;
+static inline bool event_before(const EventSystem* es, uint32_t a, uint32_t b) {
+    const Event* ea = &es->events[a];
+    const Event* eb = &es->events[b];
+    return ea->trigger_time < eb->trigger_time ||
+           (ea->trigger_time == eb->trigger_time && ea->seq < eb->seq);
+}
+
+static inline void heap_place(EventSystem* es, uint32_t pos, uint32_t slot) {
+    es->heap[pos] = slot;
+    es->events[slot].heap_index = pos;
+}
+
+static void heap_sift_up(EventSystem* es, uint32_t pos) {
+    uint32_t slot = es->heap[pos];
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) / 2;
+        if (!event_before(es, slot, es->heap[parent])) break;
+        heap_place(es, pos, es->heap[parent]);
+        pos = parent;
+    }
+    heap_place(es, pos, slot);
+}
+
+static void heap_sift_down(EventSystem* es, uint32_t pos) {
+    uint32_t slot = es->heap[pos];
+    for (;;) {
+        uint32_t child = 2 * pos + 1;
+        if (child >= es->heap_size) break;
+        if (child + 1 < es->heap_size && event_before(es, es->heap[child + 1], es->heap[child])) {
+            child++;
+        }
+        if (!event_before(es, es->heap[child], slot)) break;
+        heap_place(es, pos, es->heap[child]);
+        pos = child;
+    }
+    heap_place(es, pos, slot);
+}
+
+// Take a slot out of the heap and return it to the free stack
+static void event_remove(EventSystem* es, uint32_t slot) {
+    Event* event = &es->events[slot];
+    uint32_t pos = event->heap_index;
+    uint32_t last = es->heap[--es->heap_size];
+    if (pos < es->heap_size) {
+        heap_place(es, pos, last);
+        heap_sift_up(es, pos);
+        heap_sift_down(es, es->events[last].heap_index);
+    }
+    event->active = false;
+    event->generation++;
+    es->free_slots[es->free_count++] = slot;
+}
+
+EventHandle add_event(EventSystem* es, EventHandler handler, void* data, uint64_t delay) {
+    if (es->free_count == 0) {
+        return 0;
     }
     
-    Event* event = &es->events[es->event_count++];
+    uint32_t slot = es->free_slots[--es->free_count];
+    Event* event = &es->events[slot];
     event->handler = handler;
     event->data = data;
     event->trigger_time = es->current_time + delay;
+    event->seq = es->next_seq++;
     event->active = true;
+
+    heap_place(es, es->heap_size++, slot);
+    heap_sift_up(es, event->heap_index);
     
+    return ((EventHandle)event->generation << 16) | (slot + 1);
+}
+
+bool cancel_event(EventSystem* es, EventHandle handle) {
+    uint32_t slot = (handle & 0xffff) - 1;
+    if (handle == 0 || slot >= MAX_EVENTS) return false;
+    Event* event = &es->events[slot];
+    if (!event->active || event->generation != (uint16_t)(handle >> 16)) {
+        return false;
+    }
+    event_remove(es, slot);
     return true;
 }
 
-void process_events(EventSystem* es) {
-    es->current_time++;
-    
-    for (uint32_t i = 0; i < es->event_count; i++) {
-        Event* event = &es->events[i];
-        if (event->active && event->trigger_time <= es->current_time) {
-            event->handler(event->data);
-            event->active = false;
+// Tick at which the earliest event fires, NO_DEADLINE if none is pending
+uint64_t next_event_deadline(const EventSystem* es) {
+    return es->heap_size ? es->events[es->heap[0]].trigger_time : NO_DEADLINE;
+}
+
+// Move the clock to `now`, firing only the events that have come due.
+// Each handler sees current_time at its own deadline, so periodic
+// events re-armed from a handler keep their phase after a long idle.
+void advance_events(EventSystem* es, uint64_t now) {
+    while (es->heap_size > 0) {
+        uint32_t slot = es->heap[0];
+        Event* event = &es->events[slot];
+        if (event->trigger_time > now) break;
+
+        EventHandler handler = event->handler;
+        void* data = event->data;
+        if (event->trigger_time > es->current_time) {
+            es->current_time = event->trigger_time;
         }
+        event_remove(es, slot);  // Free the slot before the handler re-arms
+        handler(data);
     }
+    if (now > es->current_time) {
+        es->current_time = now;
+    }
+}
+
+void process_events(EventSystem* es) {
+    advance_events(es, es->current_time + 1);
 }
 
 // Timer handler
 void timer_handler(void* data) {
     Unikernel* uk = (Unikernel*)data;
     const char* heartbeat = "heartbeat";
-    network_send_packet(&uk->net_queue, heartbeat, strlen(heartbeat));
+    network_send_packet(&uk->net_queue, heartbeat, strlen(heartbeat), NULL);
     add_event(&uk->events, timer_handler, uk, 10);
 }
 
-// HTTP handling
+// HTTP handling: an incremental parser in the style of picohttpparser.
+// Requests are parsed where they lie, as views into the packet buffer,
+// and nothing is allocated or cleared per request. Only a request split
+// across TCP segments is copied, into its connection's buffer.
 #define MAX_REQUEST_SIZE 2048
-#define MAX_RESPONSE_SIZE 4096
+#define HTTP_MAX_HEADERS 16
+#define HTTP_MAX_PIPELINE 16
+#define HTTP_INCOMPLETE -2
+#define HTTP_ERROR -1
 
 typedef struct {
-    char method[16];
-    char path[256];
-    char version[16];
-    char headers[1024];
-    char body[MAX_REQUEST_SIZE];
+    const char* ptr;
+    size_t len;
+} StrView;
+
+typedef struct {
+    StrView method;
+    StrView path;
+    int minor_version;
+    StrView header_names[HTTP_MAX_HEADERS];
+    StrView header_values[HTTP_MAX_HEADERS];
+    size_t num_headers;
+    size_t content_length;
+    bool keep_alive;
 } HTTPRequest;
 
+// Case-insensitive match against a lowercase ASCII literal
+static inline bool view_ieq(StrView v, const char* lit, size_t len) {
+    if (v.len != len) return false;
+    for (size_t i = 0; i < len; i++) {
+        if ((v.ptr[i] | 0x20) != lit[i]) return false;
+    }
+    return true;
+}
+
+// End of the line starting at p, with p advanced to the next line; NULL
+// if there is no complete line yet
+static const char* http_next_line(const char** p, const char* end) {
+    const char* eol = memchr(*p, '\n', (size_t)(end - *p));
+    if (!eol) return NULL;
+    const char* line_end = eol > *p && eol[-1] == '\r' ? eol - 1 : eol;
+    *p = eol + 1;
+    return line_end;
+}
+
+// Parse one request from buf. Returns the bytes it spans, HTTP_INCOMPLETE
+// if more data is needed, or HTTP_ERROR.
+int http_parse_request(const char* buf, size_t len, HTTPRequest* req) {
+    const char* p = buf;
+    const char* end = buf + len;
+    int incomplete = len >= MAX_REQUEST_SIZE ? HTTP_ERROR : HTTP_INCOMPLETE;
+
+    // Request line: METHOD SP PATH SP HTTP/1.x
+    const char* line = p;
+    const char* line_end = http_next_line(&p, end);
+    if (!line_end) return incomplete;
+    const char* sp = memchr(line, ' ', (size_t)(line_end - line));
+    if (!sp || sp == line) return HTTP_ERROR;
+    req->method = (StrView){ line, (size_t)(sp - line) };
+    const char* path = sp + 1;
+    sp = memchr(path, ' ', (size_t)(line_end - path));
+    if (!sp || sp == path) return HTTP_ERROR;
+    req->path = (StrView){ path, (size_t)(sp - path) };
+    const char* version = sp + 1;
+    if (line_end - version != 8 || memcmp(version, "HTTP/1.", 7) != 0 ||
+        !isdigit((unsigned char)version[7])) {
+        return HTTP_ERROR;
+    }
+    req->minor_version = version[7] - '0';
+    req->keep_alive = req->minor_version >= 1;
+    req->content_length = 0;
+    req->num_headers = 0;
+
+    // Headers, up to the blank line
+    for (;;) {
+        line = p;
+        line_end = http_next_line(&p, end);
+        if (!line_end) return incomplete;
+        if (line_end == line) break;
+
+        const char* colon = memchr(line, ':', (size_t)(line_end - line));
+        if (!colon || req->num_headers == HTTP_MAX_HEADERS) return HTTP_ERROR;
+        const char* value = colon + 1;
+        const char* value_end = line_end;
+        while (value < value_end && (*value == ' ' || *value == '\t')) value++;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) value_end--;
+
+        StrView name = { line, (size_t)(colon - line) };
+        StrView val = { value, (size_t)(value_end - value) };
+        req->header_names[req->num_headers] = name;
+        req->header_values[req->num_headers++] = val;
+
+        if (view_ieq(name, "content-length", 14)) {
+            size_t n = 0;
+            for (size_t i = 0; i < val.len; i++) {
+                if (!isdigit((unsigned char)val.ptr[i])) return HTTP_ERROR;
+                n = n * 10 + (size_t)(val.ptr[i] - '0');
+                if (n > MAX_REQUEST_SIZE) return HTTP_ERROR;
+            }
+            req->content_length = n;
+        } else if (view_ieq(name, "connection", 10)) {
+            if (view_ieq(val, "close", 5)) req->keep_alive = false;
+            else if (view_ieq(val, "keep-alive", 10)) req->keep_alive = true;
+        }
+    }
+
+    size_t header_len = (size_t)(p - buf);
+    if (len - header_len < req->content_length) return incomplete;
+    return (int)(header_len + req->content_length);
+}
+
+// Routing table. Static responses are formatted once at boot, in a
+// keep-alive and a Connection: close flavour, and copied out as is.
+// Dynamic routes render their body into the per-request arena.
 typedef struct {
-    char version[16];
+    const char* path;
     int status_code;
-    char status_text[32];
-    char headers[1024];
-    char body[MAX_RESPONSE_SIZE];
-} HTTPResponse;
-
-void handle_http_request(NetworkQueue* nq, const char* request_data, size_t length) {
-    HTTPRequest req;
-    HTTPResponse resp;
-    memset(&req, 0, sizeof(req));
-    memset(&resp, 0, sizeof(resp));
-    
-    sscanf(request_data, "%s %s %s", req.method, req.path, req.version);
+    const char* status_text;
+    const char* body;
+    const char* (*render)(Arena* arena, size_t* len);
+    char response[2][256];
+    uint16_t response_len[2];
+} HTTPRoute;
+
+static MemoryManager* http_mm;
+static Arena http_arena;  // Reset after every response
+
+static const char* render_stats(Arena* arena, size_t* len) {
+    const MemoryManager* mm = arena->mm;
+    char* body = arena_alloc(arena, 256);
+    if (!body) return NULL;
+    int n = snprintf(body, 256, "live %zu\npeak %zu\npages %u\npeak_pages %u\n",
+                     mm->live_bytes, mm->peak_bytes, mm->pages_in_use, mm->peak_pages);
+    *len = n < 0 ? 0 : (size_t)n;
+    return body;
+}
+
+static HTTPRoute http_routes[] = {
+    { .path = "/", .status_code = 200, .status_text = "OK",
+      .body = "Welcome to Unikernel Web Server!" },
+    { .path = "/stats", .status_code = 200, .status_text = "OK", .render = render_stats },
+};
+static HTTPRoute http_not_found = {
+    .status_code = 404, .status_text = "Not Found", .body = "Page not found"
+};
+static HTTPRoute http_bad_request = {
+    .status_code = 400, .status_text = "Bad Request", .body = "Bad request"
+};
+
+static void http_format_route(HTTPRoute* route) {
+    if (route->render) return;
+    for (int close = 0; close < 2; close++) {
+        int len = snprintf(route->response[close], sizeof(route->response[close]),
+                           "HTTP/1.1 %d %s\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "Content-Length: %zu\r\n"
+                           "%s"
+                           "\r\n"
+                           "%s",
+                           route->status_code, route->status_text, strlen(route->body),
+                           close ? "Connection: close\r\n" : "", route->body);
+        route->response_len[close] = (uint16_t)len;
+    }
+}
+
+// Connections holding the start of a request split across segments.
+// The buffer comes from the heap only while the connection needs one.
+typedef struct {
+    int fd;  // -1 when the slot is free
+    size_t len;
+    char* buf;  // MAX_REQUEST_SIZE bytes
+} HTTPConn;
+
+static HTTPConn http_conns[NET_MAX_FDS];
+
+void init_http(MemoryManager* mm) {
+    http_mm = mm;
+    arena_init(&http_arena, mm);
+    for (size_t i = 0; i < sizeof(http_routes) / sizeof(http_routes[0]); i++) {
+        http_format_route(&http_routes[i]);
+    }
+    http_format_route(&http_not_found);
+    http_format_route(&http_bad_request);
+    for (int i = 0; i < NET_MAX_FDS; i++) {
+        http_conns[i].fd = -1;
+    }
+}
+
+static const HTTPRoute* http_route(const HTTPRequest* req) {
+    for (size_t i = 0; i < sizeof(http_routes) / sizeof(http_routes[0]); i++) {
+        const char* path = http_routes[i].path;
+        if (strlen(path) == req->path.len && memcmp(path, req->path.ptr, req->path.len) == 0) {
+            return &http_routes[i];
+        }
+    }
+    return &http_not_found;
+}
+
+// Only stream connections have an entry; a datagram's fd is -1, the
+// same as a free slot's
+static HTTPConn* http_conn_find(int fd, bool create) {
+    HTTPConn* free_slot = NULL;
+    if (fd < 0) return NULL;
+    for (int i = 0; i < NET_MAX_FDS; i++) {
+        if (http_conns[i].fd == fd) return &http_conns[i];
+        if (http_conns[i].fd < 0 && !free_slot) free_slot = &http_conns[i];
+    }
+    if (create && free_slot) {
+        free_slot->buf = allocate(http_mm, MAX_REQUEST_SIZE);
+        if (!free_slot->buf) return NULL;
+        free_slot->fd = fd;
+        free_slot->len = 0;
+        return free_slot;
+    }
+    return NULL;
+}
+
+static void http_conn_forget(HTTPConn* conn) {
+    deallocate(http_mm, conn->buf);
+    conn->buf = NULL;
+    conn->fd = -1;
+}
+
+// Append a response to the outgoing buffer, sending it and starting a
+// new one from the pool once it is full
+static void http_emit(NetworkQueue* nq, PacketDesc* out, const PacketPeer* peer,
+                      const char* data, size_t len) {
+    size_t header_space = nq->driver->header_space;
+    if (out->buf && out->length + len > PACKET_SIZE) {
+        network_send_buffer(nq, out);
+        out->buf = NULL;
+    }
+    if (!out->buf) {
+        out->buf = pkt_alloc(nq);
+        if (!out->buf) {
+            nq->driver->dropped++;
+            return;
+        }
+        out->buf->peer = *peer;
+        out->offset = out->length = (uint16_t)header_space;
+        out->flags = 0;
+    }
+    memcpy(out->buf->data + out->length, data, len);
+    out->length += (uint16_t)len;
+}
+
+// Emit one response, rendering dynamic routes into the request arena
+static void http_respond(NetworkQueue* nq, PacketDesc* out, const PacketPeer* peer,
+                         const HTTPRoute* route, bool close) {
+    if (!route->render) {
+        http_emit(nq, out, peer, route->response[close], route->response_len[close]);
+        return;
+    }
+
+    size_t body_len = 0;
+    const char* body = route->render(&http_arena, &body_len);
+    char* header = arena_alloc(&http_arena, 128);
+    if (body && header) {
+        int n = snprintf(header, 128,
+                         "HTTP/1.1 %d %s\r\n"
+                         "Content-Type: text/plain\r\n"
+                         "Content-Length: %zu\r\n"
+                         "%s"
+                         "\r\n",
+                         route->status_code, route->status_text, body_len,
+                         close ? "Connection: close\r\n" : "");
+        http_emit(nq, out, peer, header, (size_t)n);
+        http_emit(nq, out, peer, body, body_len);
+    }
+    arena_reset(&http_arena);
+}
+
+// Request handling metrics
+TRACE_COUNTER_DEFINE(packet_counter, "packets_handled");
+TRACE_COUNTER_DEFINE(request_counter, "http_requests");
+TRACE_HISTOGRAM_DEFINE(packet_hist, "packet_handling");
+
+// Serve every complete request in a packet. Once the packet is consumed
+// the responses overwrite it and go out in its buffer; a trailing partial
+// request is kept for the connection's next segment. A datagram has no
+// connection, so requests beyond a full pipeline are parsed where they
+// lie and answered from a fresh buffer.
+void handle_http_request(NetworkQueue* nq, PacketDesc* pkt) {
+    PacketPeer peer = pkt->buf->peer;
+    bool stream = peer.conn_fd >= 0;
+    const char* data = (const char*)pkt->buf->data + pkt->offset;
+    size_t len = (size_t)(pkt->length - pkt->offset);
+
+    HTTPConn* conn = stream ? http_conn_find(peer.conn_fd, false) : NULL;
+    if (conn && conn->len > 0) {
+        // Continuation of a split request: append and parse from there
+        if (conn->len + len > MAX_REQUEST_SIZE) {
+            len = 0;  // Too large: answered with 400 below
+        } else {
+            memcpy(conn->buf + conn->len, data, len);
+            len += conn->len;
+        }
+        data = conn->buf;
+        conn->len = 0;
+    }
+
+    PacketDesc out = *pkt;
+    out.buf = NULL;  // Response space is claimed once the input is consumed
+    bool close = false;
+
+    for (;;) {
+        const HTTPRoute* routes[HTTP_MAX_PIPELINE];
+        size_t count = 0, consumed = 0;
+
+        while (consumed < len && count < HTTP_MAX_PIPELINE && !close) {
+            HTTPRequest req;
+            int n = http_parse_request(data + consumed, len - consumed, &req);
+            if (n == HTTP_INCOMPLETE && stream) break;
+            if (n < 0) {
+                routes[count++] = &http_bad_request;
+                close = true;
+                break;
+            }
+            TRACE_COUNT(request_counter, 1);
+            if (nq->driver->trace) {
+                printf("Received HTTP Request: %.*s %.*s HTTP/1.%d\n",
+                       (int)req.method.len, req.method.ptr,
+                       (int)req.path.len, req.path.ptr, req.minor_version);
+            }
+            routes[count++] = http_route(&req);
+            close = !req.keep_alive;
+            consumed += (size_t)n;
+        }
+        if (len == 0 && count == 0) {
+            routes[count++] = &http_bad_request;
+            close = true;
+        }
+
+        // Keep what is left over before the packet is overwritten
+        size_t rest = close ? 0 : len - consumed;
+        if (rest > 0 && stream) {
+            if (!conn) conn = http_conn_find(peer.conn_fd, true);
+            if (!conn) {
+                routes[count++] = &http_bad_request;
+                close = true;
+            } else {
+                memmove(conn->buf, data + consumed, rest);
+                conn->len = rest;
+            }
+        }
+
+        if (count > 0 && !out.buf && pkt->buf && (stream || rest == 0)) {
+            out.buf = pkt->buf;  // Input consumed: reuse its buffer
+            pkt->buf = NULL;
+            out.offset = out.length = (uint16_t)nq->driver->header_space;
+            out.flags = 0;
+        }
+        for (size_t i = 0; i < count; i++) {
+            bool last = close && i + 1 == count;
+            http_respond(nq, &out, &peer, routes[i], last);
+        }
+
+        // A full pipeline may leave complete requests behind; go again
+        if (count < HTTP_MAX_PIPELINE || rest == 0 || close) break;
+        if (stream) {
+            data = conn->buf;
+            len = conn->len;
+            conn->len = 0;
+        } else {
+            data += consumed;
+            len = rest;
+        }
+    }
+
+    if (close && conn) http_conn_forget(conn);
+    if (pkt->buf) network_release(nq, pkt);
+    if (out.buf) {
+        if (close && stream) out.flags |= PKT_CLOSE;
+        network_send_buffer(nq, &out);
+    }
+}
+
+// Network processing
+void process_network(NetworkQueue* nq) {
+    PacketDesc pkt;
     
-    printf("Received HTTP Request: %s %s %s\n", req.method, req.path, req.version);
+    while (network_receive_packet(nq, &pkt)) {
+        if (pkt.length == pkt.offset) {
+            // Empty packet: the stream backend saw the peer close
+            HTTPConn* conn = http_conn_find(pkt.buf->peer.conn_fd, false);
+            if (conn) http_conn_forget(conn);
+            network_release(nq, &pkt);
+            continue;
+        }
+        TRACE_COUNT(packet_counter, 1);
+        TRACE_BEGIN("http packet");
+        TRACE_TIMED(packet_hist, handle_http_request(nq, &pkt));
+        TRACE_END("http packet");
+    }
+}
+
+// Initialize unikernel
+void init_unikernel(Unikernel* uk, NetDriver* driver) {
+    init_memory_manager(&uk->mm);
+    if (!init_network_queue(&uk->net_queue, driver, &uk->mm)) {
+        printf("Failed to allocate packet buffers\n");
+        uk->running = false;
+        return;
+    }
+    init_event_system(&uk->events);
+    init_http(&uk->mm);
+    uk->running = true;
     
+    add_event(&uk->events, timer_handler, uk, 10);
+}
+
+#define TICK_NS 100000000ull  // One event-system tick: 100ms
+#define SIM_PIPELINED (HTTP_MAX_PIPELINE + 1)  // Requests in the sim's pipelined datagram
+
+#define MAX_POLL_MS 1000  // Longest sleep with no event pending
+
+// One pass of the main loop: sleep until the device is readable or the
+// next event is due, skipping idle ticks, then move a batch in, serve
+// it, and move the replies out
+static void run_once(Unikernel* uk, uint64_t boot_ns) {
+    NetDriver* drv = &uk->driver;
+    uint64_t now = trace_clock_ns();
+    int timeout_ms = 0;
+    if (!drv->busy_poll) {
+        uint64_t deadline = next_event_deadline(&uk->events);
+        uint64_t wake = deadline == NO_DEADLINE ? now + MAX_POLL_MS * 1000000ull
+                                                : boot_ns + deadline * TICK_NS;
+        if (wake > now) {
+            uint64_t ms = (wake - now + 999999) / 1000000;
+            timeout_ms = ms > MAX_POLL_MS ? MAX_POLL_MS : (int)ms;
+        }
+    }
+    poll(drv->pfds, drv->npfds, timeout_ms);
+
+    advance_events(&uk->events, (trace_clock_ns() - boot_ns) / TICK_NS);
+    drv->rx_batch(drv, &uk->net_queue);
+    process_network(&uk->net_queue);
+    drv->tx_batch(drv, &uk->net_queue);
+}
+
+// UDP load generator: keeps a window of GET requests in flight against
+// a udp backend and reports requests per second
+static int run_loadgen(uint16_t port, int seconds) {
+    enum { WINDOW = 256 };
+    static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+                                .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("loadgen");
+        return 1;
+    }
+
+    struct mmsghdr msgs[NET_BATCH];
+    struct iovec iov[NET_BATCH];
+    static char replies[NET_BATCH][PACKET_SIZE];
+    uint64_t sent = 0, received = 0;
+    uint64_t start = trace_clock_ns(), end = start + (uint64_t)seconds * 1000000000ull;
+    uint64_t last_progress = start;
+
+    while (trace_clock_ns() < end) {
+        uint64_t room = WINDOW - (sent - received);
+        if (room > NET_BATCH) room = NET_BATCH;
+        for (uint64_t i = 0; i < room; i++) {
+            iov[i] = (struct iovec){ (void*)request, sizeof(request) - 1 };
+            msgs[i].msg_hdr = (struct msghdr){ .msg_iov = &iov[i], .msg_iovlen = 1 };
+        }
+        if (room > 0) {
+            int n = sendmmsg(fd, msgs, (unsigned)room, 0);
+            if (n > 0) sent += n;
+        }
+
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, 10) > 0) {
+            for (int i = 0; i < NET_BATCH; i++) {
+                iov[i] = (struct iovec){ replies[i], PACKET_SIZE };
+                msgs[i].msg_hdr = (struct msghdr){ .msg_iov = &iov[i], .msg_iovlen = 1 };
+            }
+            int n = recvmmsg(fd, msgs, NET_BATCH, MSG_DONTWAIT, NULL);
+            if (n > 0) {
+                received += n;
+                last_progress = trace_clock_ns();
+            }
+        } else if (trace_clock_ns() - last_progress > 200000000ull) {
+            received = sent;  // Window lost to drops: reopen it
+            last_progress = trace_clock_ns();
+        }
+    }
+
+    double elapsed = (double)(trace_clock_ns() - start) / 1e9;
+    printf("loadgen: %llu requests, %llu responses, %.0f responses/s\n",
+           (unsigned long long)sent, (unsigned long long)received,
+           received / elapsed);
+    close(fd);
+    return 0;
+}
+
+// HTTP benchmark: the original handler (cleared request/response
+// structs, sscanf, snprintf into a stack buffer) against the streaming
+// parser with route templates, and a memchr over the request as a floor
+#define HTTP_BENCH_ROUNDS 1000000
+
+static size_t legacy_http_response(const char* request_data, char* out, size_t room) {
+    struct {
+        char method[16];
+        char path[256];
+        char version[16];
+        char headers[1024];
+        char body[MAX_REQUEST_SIZE];
+    } req;
+    struct {
+        char version[16];
+        int status_code;
+        char status_text[32];
+        char headers[1024];
+        char body[4096];
+    } resp;
+    memset(&req, 0, sizeof(req));
+    memset(&resp, 0, sizeof(resp));
+
+    sscanf(request_data, "%15s %255s %15s", req.method, req.path, req.version);
     strcpy(resp.version, "HTTP/1.1");
     if (strcmp(req.path, "/") == 0) {
         resp.status_code = 200;
@@ -214,69 +1757,255 @@ void handle_http_request(NetworkQueue* nq, const char* request_data, size_t leng
         strcpy(resp.status_text, "Not Found");
         strcpy(resp.body, "Page not found");
     }
-    
-    char response_str[MAX_RESPONSE_SIZE];
-    int response_len = snprintf(response_str, sizeof(response_str),
-             "%s %d %s\r\n"
-             "Content-Type: text/plain\r\n"
-             "Content-Length: %zu\r\n"
-             "\r\n"
-             "%s",
-             resp.version, resp.status_code, resp.status_text,
-             strlen(resp.body), resp.body);
-    
-    if (response_len > 0 && (size_t)response_len < sizeof(response_str)) {
-        network_send_packet(nq, response_str, response_len);
+
+    char response_str[4096];
+    int len = snprintf(response_str, sizeof(response_str),
+                       "%s %d %s\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: %zu\r\n"
+                       "\r\n"
+                       "%s",
+                       resp.version, resp.status_code, resp.status_text,
+                       strlen(resp.body), resp.body);
+    if (len < 0 || (size_t)len >= room) return 0;
+    memcpy(out, response_str, (size_t)len);
+    return (size_t)len;
+}
+
+static int run_http_bench(void) {
+    static const char request[] =
+        "GET / HTTP/1.1\r\nHost: localhost\r\nUser-Agent: bench/1.0\r\n"
+        "Accept: */*\r\nConnection: keep-alive\r\n\r\n";
+    const char* volatile input = request;  // Keep the work inside the loop
+    static char out[PACKET_SIZE];
+    volatile size_t sink = 0;
+    static MemoryManager mm;
+    init_memory_manager(&mm);
+    init_http(&mm);
+
+    uint64_t start = trace_clock_ns();
+    for (int i = 0; i < HTTP_BENCH_ROUNDS; i++) {
+        sink += legacy_http_response(input, out, sizeof(out));
     }
+    double legacy_ns = (double)(trace_clock_ns() - start) / HTTP_BENCH_ROUNDS;
+
+    start = trace_clock_ns();
+    for (int i = 0; i < HTTP_BENCH_ROUNDS; i++) {
+        HTTPRequest req;
+        if (http_parse_request(input, sizeof(request) - 1, &req) > 0) {
+            const HTTPRoute* route = http_route(&req);
+            bool close = !req.keep_alive;
+            memcpy(out, route->response[close], route->response_len[close]);
+            sink += route->response_len[close];
+        }
+    }
+    double parser_ns = (double)(trace_clock_ns() - start) / HTTP_BENCH_ROUNDS;
+
+    start = trace_clock_ns();
+    for (int i = 0; i < HTTP_BENCH_ROUNDS; i++) {
+        sink += memchr(input, '\0', sizeof(request) - 1) == NULL;
+    }
+    double memchr_ns = (double)(trace_clock_ns() - start) / HTTP_BENCH_ROUNDS;
+
+    printf("%zu-byte request, ns per request:\n", sizeof(request) - 1);
+    printf("  sscanf/snprintf handler: %7.1f\n", legacy_ns);
+    printf("  parser + templates:      %7.1f\n", parser_ns);
+    printf("  memchr over request:     %7.1f\n", memchr_ns);
+    (void)sink;
+    return 0;
 }
 
-// Network processing
-void process_network(NetworkQueue* nq) {
-    char packet_data[PACKET_SIZE];
-    size_t packet_length;
-    
-    while (network_receive_packet(nq, packet_data, &packet_length)) {
-        if (strstr(packet_data, "GET ") == packet_data ||
-            strstr(packet_data, "POST ") == packet_data) {
-            handle_http_request(nq, packet_data, packet_length);
+// Allocator benchmark: random allocations and frees over a working set
+// of mixed small and large blocks, then a check that freeing it all gives
+// every page back
+#define ALLOC_BENCH_OPS 4000000
+#define ALLOC_BENCH_SLOTS 2048
+
+static int run_alloc_bench(void) {
+    static MemoryManager mm;
+    static void* slots[ALLOC_BENCH_SLOTS];
+    init_memory_manager(&mm);
+    uint32_t seed = 12345;
+
+    uint64_t start = trace_clock_ns();
+    for (int i = 0; i < ALLOC_BENCH_OPS; i++) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t slot = (seed >> 8) % ALLOC_BENCH_SLOTS;
+        if (slots[slot]) {
+            deallocate(&mm, slots[slot]);
+            slots[slot] = NULL;
+        } else {
+            // Mostly small objects, one in 64 a multi-page block
+            size_t size = (seed >> 20) % 64 == 0 ? 4096 + (seed >> 4) % 16384
+                                                 : 8 + (seed >> 12) % 1024;
+            slots[slot] = allocate(&mm, size);
         }
     }
+    double ns = (double)(trace_clock_ns() - start) / ALLOC_BENCH_OPS;
+    printf("%d mixed ops: %.1f ns per allocate/deallocate\n", ALLOC_BENCH_OPS, ns);
+    print_memory_stats(&mm);
+
+    for (int i = 0; i < ALLOC_BENCH_SLOTS; i++) {
+        deallocate(&mm, slots[i]);
+        slots[i] = NULL;
+    }
+    print_memory_stats(&mm);
+    return 0;
 }
 
-// Initialize unikernel
-void init_unikernel(Unikernel* uk) {
-    init_memory_manager(&uk->mm);
-    init_network_queue(&uk->net_queue);
-    init_event_system(&uk->events);
-    uk->running = true;
-    
-    add_event(&uk->events, timer_handler, uk, 10);
+// Cross-model benchmark suite (bench.h). Kernel services are plain
+// function calls here, so a timer request stands in for a system call.
+static uint64_t bench_page(void* ctx, uint32_t n) {
+    MemoryManager* mm = ctx;
+    for (uint32_t i = 0; i < n; i++) {
+        void* page = allocate(mm, PAGE_SIZE);
+        if (!page) return 0;
+        deallocate(mm, page);
+    }
+    return n;
 }
 
-int main(void) {
-    Unikernel uk;
-    init_unikernel(&uk);
+static uint64_t bench_timer_call(void* ctx, uint32_t n) {
+    EventSystem* es = ctx;
+    for (uint32_t i = 0; i < n; i++) {
+        EventHandle handle = add_event(es, timer_handler, NULL, 1000 + i % 64);
+        if (!cancel_event(es, handle)) return 0;
+    }
+    return 2ull * n;
+}
+
+static int run_benchmark_suite(void) {
+    static MemoryManager mm;
+    static EventSystem es;
+    init_memory_manager(&mm);
+    init_event_system(&es);
+
+    bench_begin("unikernel");
+    bench_run(BENCH_PAGE_ALLOC_FREE, "page_span", bench_page, &mm, 0);
+    bench_run(BENCH_SYSCALL_DISPATCH, "direct_call", bench_timer_call, &es, 0);
+    return bench_end();
+}
+
+static void usage(const char* prog) {
+    printf("usage: %s [sim | udp PORT | tcp PORT | packet IFNAME[:PORT] | tap IFNAME[:PORT]]\n"
+           "          [--busy-poll] [--seconds N] [--trace]\n"
+           "       %s loadgen PORT SECONDS\n"
+           "       %s bench | bench-http | bench-alloc\n", prog, prog, prog);
+}
+
+int main(int argc, char** argv) {
+    const char* backend = "sim";
+    const char* backend_arg = NULL;
+    bool busy_poll = false, trace = false;
+    int seconds = 10;
+
+    int arg = 1;
+    if (arg < argc && argv[arg][0] != '-') {
+        backend = argv[arg++];
+        if (arg < argc && argv[arg][0] != '-') backend_arg = argv[arg++];
+    }
+    if (strcmp(backend, "bench") == 0) {
+        return run_benchmark_suite();
+    }
+    if (strcmp(backend, "bench-http") == 0) {
+        return run_http_bench();
+    }
+    if (strcmp(backend, "bench-alloc") == 0) {
+        return run_alloc_bench();
+    }
+    if (strcmp(backend, "loadgen") == 0) {
+        return run_loadgen((uint16_t)atoi(backend_arg ? backend_arg : "8080"),
+                           arg < argc ? atoi(argv[arg]) : 5);
+    }
+    for (; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--busy-poll") == 0) {
+            busy_poll = true;
+        } else if (strcmp(argv[arg], "--trace") == 0) {
+            trace = true;
+        } else if (strcmp(argv[arg], "--seconds") == 0 && arg + 1 < argc) {
+            seconds = atoi(argv[++arg]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const NetDriver* proto = find_net_driver(backend);
+    if (!proto) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static Unikernel uk;
+    uk.driver = *proto;
+    uk.driver.busy_poll = busy_poll;
+    uk.driver.trace = trace || strcmp(backend, "sim") == 0;
+    if (uk.driver.open(&uk.driver, backend_arg) != 0) {
+        printf("Failed to open %s backend: %s\n", backend, strerror(errno));
+        return 1;
+    }
+    init_unikernel(&uk, &uk.driver);
     
-    printf("Unikernel initialized\n");
+    printf("Unikernel initialized (%s backend)\n", uk.driver.name);
     
     const char* test_requests[] = {
         "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n",
         "GET /nonexistent HTTP/1.1\r\nHost: localhost\r\n\r\n"
     };
     
-    int iterations = 0;
-    while (uk.running && iterations < 50) {
-        if (iterations % 20 == 0) {
-            simulate_receive_packet(&uk.net_queue, test_requests[iterations / 20 % 2]);
-        }
-        
-        process_events(&uk.events);
-        process_network(&uk.net_queue);
-        
-        usleep(100000);  // Sleep for 100ms
-        iterations++;
+    uint64_t start = trace_clock_ns();
+    uint64_t end = start + (uint64_t)seconds * 1000000000ull;
+    int iterations = 0, status = 0;
+    while (uk.running) {
+        if (proto->open == sim_open) {
+            // Simulated traffic, one step per tick
+            if (iterations >= 50) break;
+            if (iterations % 20 == 0) {
+                simulate_receive_packet(&uk.net_queue, test_requests[iterations / 20 % 2]);
+            }
+            if (iterations == 45) {
+                // More pipelined requests in one datagram than one pass parses
+                char pipelined[PACKET_SIZE] = "";
+                for (int i = 0; i < SIM_PIPELINED; i++) {
+                    strcat(pipelined, "GET / HTTP/1.1\r\n\r\n");
+                }
+                simulate_receive_packet(&uk.net_queue, pipelined);
+            }
+            process_events(&uk.events);
+            process_network(&uk.net_queue);
+            if (iterations == 45) {
+                int responses = sim_count_responses(&uk.net_queue);
+                printf("Pipelined datagram: %d requests, %d responses\n",
+                       SIM_PIPELINED, responses);
+                if (responses != SIM_PIPELINED) status = 1;
+            }
+            uk.driver.tx_batch(&uk.driver, &uk.net_queue);
+            
+            poll(NULL, 0, (int)(TICK_NS / 1000000));  // Wait for the next tick
+            iterations++;
+            continue;
+        }
+        if (trace_clock_ns() >= end) break;
+        run_once(&uk, start);
     }
     
+    if (proto->open != sim_open) {
+        double elapsed = (double)(trace_clock_ns() - start) / 1e9;
+        NetDriver* d = &uk.driver;
+        printf("RX %llu packets in %llu syscalls, TX %llu packets in %llu syscalls, "
+               "%llu dropped\n",
+               (unsigned long long)d->rx_packets, (unsigned long long)d->rx_calls,
+               (unsigned long long)d->tx_packets, (unsigned long long)d->tx_calls,
+               (unsigned long long)d->dropped);
+        printf("%.0f RX packets/s, %.1f packets per RX syscall, "
+               "%llu payload copies\n",
+               d->rx_packets / elapsed,
+               d->rx_calls ? (double)d->rx_packets / d->rx_calls : 0.0,
+               (unsigned long long)uk.net_queue.copies);
+        print_memory_stats(&uk.mm);
+    }
+    uk.driver.close(&uk.driver);
+    trace_report();
     printf("Unikernel simulation completed\n");
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
@@ -5,93 +5,2723 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <stdint.h>  // Added for uint64_t and uint8_t types
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "trace.h"
+#include "bench.h"
 
-// Structure to represent a virtual CPU
+// Hot blocks are compiled to host code on x86-64; elsewhere every block
+// stays in the threaded interpreter
+#ifndef VM_JIT
+#if defined(__x86_64__)
+#define VM_JIT 1
+#else
+#define VM_JIT 0
+#endif
+#endif
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1ull << PAGE_SHIFT)
+#define PAGE_MASK (PAGE_SIZE - 1)
+#define HUGE_PAGE_SIZE (2ull << 20)
+#define TLB_SIZE 256            // Software TLB entries per vCPU, power of two
+#define TLB_INVALID 1           // Never equals a page-aligned tag
+#define BLOCK_MAX_OPS 64        // Longer straight-line runs are split
+#define BLOCK_HASH_SIZE 4096    // Decode cache buckets, power of two
+#define JIT_HOT_THRESHOLD 32    // Block executions before it is compiled
+#define JIT_BUFFER_SIZE (4u << 20)
+#define JIT_CACHE_SIZE 1024     // Indirect branch cache, power of two
+#define VM_MAX_VCPUS 8
+#define VCPU_STACK_SIZE (64u << 10)  // Each vCPU starts below the previous one's stack
+#define VM_VECTORS 32           // Interrupt vectors
+#define IPI_PORT 0xE0           // OUT here sends an IPI: eax = vector << 8 | target
+#define IPI_ALL_BUT_SELF 0xFF
+#define PAUSE_YIELD_MASK 63     // Every 64th PAUSE yields the host thread
+
+// Guest page table entry bits, as on x86-64
+#define PTE_PRESENT (1ull << 0)
+#define PTE_WRITABLE (1ull << 1)
+#define PTE_LARGE (1ull << 7)           // 1 GB in a PDPTE, 2 MB in a PDE
+#define PTE_ADDR 0x000FFFFFFFFFF000ull
+
+// vm_create_smp flags
+#define VM_HUGE_PAGES (1u << 0)  // Back guest RAM with huge pages where possible
+
+// Guest register numbers, in x86-64 encoding order
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// How the last flag-setting instruction left RFLAGS; the flags are only
+// computed when a Jcc or vm_get_rflags needs them
+typedef enum {
+    FLAGS_ADD,    // result = a + b
+    FLAGS_SUB,    // result = a - b
+    FLAGS_LOGIC,  // result = a, CF = OF = 0
+    FLAGS_RAW     // a holds RFLAGS itself, restored by IRETQ
+} FlagsOp;
+
+#define RFLAGS_STATUS 0x8D5ull  // CF, PF, AF, ZF, SF, OF
+
+// Predecoded operations. A guest instruction decodes to one of these;
+// OP_END is synthetic and falls through to the next block.
+typedef enum {
+    OP_NOP,
+    OP_MOV_RI, OP_MOV_RR, OP_LOAD, OP_STORE,
+    OP_ADD_RR, OP_ADD_RI, OP_SUB_RR, OP_SUB_RI, OP_CMP_RR, OP_CMP_RI,
+    OP_AND_RR, OP_AND_RI, OP_OR_RR, OP_OR_RI, OP_XOR_RR, OP_XOR_RI,
+    OP_PUSH, OP_POP,
+    OP_XCHG, OP_XADD, OP_CMPXCHG, OP_PAUSE, OP_MOV_FROM_CR3,
+    OP_JMP, OP_JCC, OP_CALL, OP_RET, OP_IRET, OP_OUT, OP_MOV_TO_CR3, OP_HLT, OP_UD, OP_END,
+    OP_COUNT
+} VmOp;
+
+static const char* vm_op_names[OP_COUNT] = {
+    "NOP", "MOV", "MOV", "MOV", "MOV",
+    "ADD", "ADD", "SUB", "SUB", "CMP", "CMP",
+    "AND", "AND", "OR", "OR", "XOR", "XOR",
+    "PUSH", "POP",
+    "XCHG", "XADD", "CMPXCHG", "PAUSE", "MOV",
+    "JMP", "Jcc", "CALL", "RET", "IRETQ", "OUT", "MOV", "HLT", "UD", "END"
+};
+
+// One predecoded instruction. Memory operands are [dst + imm] for
+// stores and the atomics, and [src + imm] for loads.
+typedef struct {
+    const void* handler;    // Threaded dispatch target in vm_execute
+    uint8_t opcode;         // VmOp
+    uint8_t dst;
+    uint8_t src;
+    uint8_t cc;             // Condition for OP_JCC, x86 numbering
+    uint8_t length;         // Guest instruction length in bytes
+    uint8_t raw;            // First opcode byte, for OP_UD reports
+    int64_t imm;
+    uint64_t rip;
+    uint64_t target;        // Branch target, or next rip for OP_END
+} DecodedOp;
+
+// A basic block of predecoded ops, found by its start address and
+// listed on every guest page it was decoded from
+typedef struct TranslatedBlock {
+    uint64_t start;
+    uint64_t pages[2];
+    uint32_t page_count;
+    uint32_t op_count;
+    bool invalid;
+    bool jit_failed;           // Not compilable; stays interpreted
+    uint32_t exec_count;       // Interpreted runs, for tiering
+    uint8_t* jit_code;         // Compiled entry point, if hot
+    struct TranslatedBlock* hash_next;
+    struct TranslatedBlock* page_next[2];
+    DecodedOp* ops;
+} TranslatedBlock;
+
+// Software TLB entry for one 4 KB guest virtual page. A tag is the page
+// address, or TLB_INVALID; addend turns a guest address into a host one.
+typedef struct {
+    uint64_t read_tag;
+    uint64_t write_tag;      // TLB_INVALID unless the page is writable
+    uintptr_t addend;
+    uint64_t unused;         // Pads entries to 32 bytes for compiled lookups
+} TlbEntry;
+
+// Indirect branch cache entry, probed by compiled code on RET
 typedef struct {
+    uint64_t rip;
+    uint8_t* code;
+} JitCacheEntry;
+
+struct VirtualMachine;
+
+// Structure to represent a virtual CPU. Everything past the
+// architectural registers belongs to the vCPU's host thread, apart from
+// the fields other vCPUs use to interrupt it.
+typedef struct VirtualCPU {
     uint64_t registers[16];  // General purpose registers
     uint64_t rip;           // Instruction pointer
     uint64_t rflags;        // CPU flags
     uint64_t cr3;           // Page table base register
+    uint64_t flags_a;       // Lazy flags operands
+    uint64_t flags_b;
+    FlagsOp flags_op;
+    uint64_t instructions;  // Retired instruction count
+
+    struct VirtualMachine* vm;
+    uint32_t id;
+    void* memory;           // The VM's guest memory, shared by all vCPUs
+    size_t memory_size;
+    uint32_t* code_pages;   // The VM's per-page masks of vCPUs with blocks there
+    bool running;
+    bool halted;            // In HLT, waiting for an interrupt
+    bool in_interrupt;      // Interrupts held off until IRETQ
+    uint64_t stack_top;     // RET with RSP here returns to the host
+    uint64_t pauses;
+    uint64_t ipis_received;
+    pthread_t thread;
+
+    // Set by other vCPUs and the host
+    uint8_t exit_request;            // Makes the vCPU return to its run loop
+    uint8_t stop_request;
+    uint8_t flush_request;           // Another vCPU wrote code we translated
+    uint32_t pending_ipis;           // One bit per vector
+    uint32_t wake_seq;               // Futex word for HLT
+
+    // Soft-MMU, used while cr3 is nonzero
+    TlbEntry tlb[TLB_SIZE];
+    uint64_t tlb_lookups;
+    uint64_t tlb_misses;             // Each one walks the page tables
+
+    // Decode cache
+    TranslatedBlock* block_hash[BLOCK_HASH_SIZE];
+    TranslatedBlock** page_blocks;   // Blocks decoded from each page
+    TranslatedBlock* retired;        // Invalidated, freed at a block boundary
+    uint64_t blocks_translated;
+    uint64_t blocks_invalidated;
+
+    // JIT tier
+    uint32_t jit_threshold;          // 0 keeps everything interpreted
+    bool jit_chain;                  // Patch block exits to jump to their successor
+    bool jit_flush_pending;          // A compiled block's code was written
+    uint8_t* jit_buffer;
+    size_t jit_used;
+    uint64_t jit_epoch;              // Bumped by every flush
+    uint64_t blocks_compiled;
+    JitCacheEntry jit_cache[JIT_CACHE_SIZE];
 } VirtualCPU;
 
 // Structure to represent a virtual machine
-typedef struct {
-    VirtualCPU vcpu;
-    void* memory;           // Guest physical memory
+typedef struct VirtualMachine {
+    VirtualCPU* vcpus[VM_MAX_VCPUS];
+    uint32_t vcpu_count;
+    void* memory;           // Guest physical memory, faulted in on first touch
     size_t memory_size;
-    bool running;
+    size_t mapped_size;     // Of the memory mapping, rounded for huge pages
+    const char* backing;    // How guest memory is backed
+    bool trace;             // Single-step with a line per instruction
+    uint32_t* code_pages;   // Bit i set: vCPU i has blocks decoded from the page
+    uint64_t ivt[VM_VECTORS];        // Interrupt handler addresses
+    uint32_t ivt_mask;               // Vectors with a handler
 } VirtualMachine;
 
-// Initialize a new virtual machine
-VirtualMachine* vm_create(size_t memory_size) {
-    VirtualMachine* vm = (VirtualMachine*)malloc(sizeof(VirtualMachine));
+TRACE_HISTOGRAM_DEFINE(translate_hist, "block_translate");
+TRACE_HISTOGRAM_DEFINE(compile_hist, "jit_compile");
+TRACE_COUNTER_DEFINE(invalidate_counter, "code_pages_invalidated");
+TRACE_COUNTER_DEFINE(ipi_counter, "ipis_raised");
+
+static bool jit_init(VirtualCPU* cpu);
+void vm_destroy(VirtualMachine* vm);
+
+// Anonymous memory that costs neither RSS nor commit charge until it is
+// touched, so per-page tables can cover gigabytes of guest memory
+static void* vm_map_lazy(size_t size) {
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static inline size_t vm_page_count(size_t memory_size) {
+    return (memory_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+}
+
+// Map guest RAM. With VM_HUGE_PAGES it comes from hugetlbfs when the
+// host has huge pages reserved, else from a 2 MB aligned mapping
+// advised for transparent huge pages.
+static bool vm_map_memory(VirtualMachine* vm, size_t size, uint32_t flags) {
+    size_t rounded = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (flags & VM_HUGE_PAGES) {
+#ifdef MAP_HUGETLB
+        void* p = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            vm->memory = p;
+            vm->mapped_size = rounded;
+            vm->backing = "hugetlbfs";
+            return true;
+        }
+#endif
+#ifdef MADV_HUGEPAGE
+        // Over-map by one huge page so the region can start on a boundary
+        uint8_t* raw = vm_map_lazy(rounded + HUGE_PAGE_SIZE);
+        if (raw) {
+            uint8_t* aligned = (uint8_t*)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) &
+                                          ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+            if (aligned > raw) munmap(raw, aligned - raw);
+            munmap(aligned + rounded, raw + HUGE_PAGE_SIZE - aligned);
+            madvise(aligned, rounded, MADV_HUGEPAGE);
+            vm->memory = aligned;
+            vm->mapped_size = rounded;
+            vm->backing = "transparent huge pages";
+            return true;
+        }
+#endif
+    }
+    vm->memory = vm_map_lazy(size);
+    vm->mapped_size = size;
+    vm->backing = "4 KB pages";
+    return vm->memory != NULL;
+}
+
+static VirtualCPU* vcpu_create(VirtualMachine* vm, uint32_t id) {
+    VirtualCPU* cpu = calloc(1, sizeof(VirtualCPU));
+    if (!cpu) return NULL;
+    cpu->page_blocks = vm_map_lazy(vm_page_count(vm->memory_size) * sizeof(TranslatedBlock*));
+    if (!cpu->page_blocks) {
+        free(cpu);
+        return NULL;
+    }
+    cpu->vm = vm;
+    cpu->id = id;
+    cpu->memory = vm->memory;
+    cpu->memory_size = vm->memory_size;
+    cpu->code_pages = vm->code_pages;
+    memset(cpu->tlb, 0xFF, sizeof(cpu->tlb));  // All tags odd, so all invalid
+    jit_init(cpu);  // Without a code buffer the vCPU only interprets
+    return cpu;
+}
+
+// Code page tracking and the vCPUs, once guest memory is mapped. The VM
+// is destroyed on failure.
+static bool vm_init_vcpus(VirtualMachine* vm, uint32_t vcpu_count) {
+    vm->code_pages = vm_map_lazy(vm_page_count(vm->memory_size) * sizeof(uint32_t));
+    if (!vm->code_pages) {
+        vm_destroy(vm);
+        return false;
+    }
+    for (uint32_t i = 0; i < vcpu_count; i++) {
+        if (!(vm->vcpus[i] = vcpu_create(vm, i))) {
+            vm_destroy(vm);
+            return false;
+        }
+        vm->vcpu_count++;
+    }
+    return true;
+}
+
+// Initialize a new virtual machine with vcpu_count vCPUs over one guest
+// memory. Guest memory is only backed as the guest touches it, so it can
+// be far larger than the host's RAM.
+VirtualMachine* vm_create_smp(size_t memory_size, uint32_t vcpu_count, uint32_t flags) {
+    if (vcpu_count == 0 || vcpu_count > VM_MAX_VCPUS) return NULL;
+    VirtualMachine* vm = (VirtualMachine*)calloc(1, sizeof(VirtualMachine));
     if (!vm) return NULL;
 
     // Allocate guest physical memory
-    vm->memory = mmap(NULL, memory_size, PROT_READ | PROT_WRITE,
-                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (vm->memory == MAP_FAILED) {
+    if (!vm_map_memory(vm, memory_size, flags)) {
         free(vm);
         return NULL;
     }
-
     vm->memory_size = memory_size;
-    vm->running = false;
+    return vm_init_vcpus(vm, vcpu_count) ? vm : NULL;
+}
 
-    // Initialize virtual CPU
-    memset(&vm->vcpu, 0, sizeof(VirtualCPU));
-    
-    return vm;
+VirtualMachine* vm_create(size_t memory_size) {
+    return vm_create_smp(memory_size, 1, 0);
+}
+
+/* Soft-MMU */
+
+// Physical memory access: a host pointer for [addr, addr + size), or
+// NULL if any of it lies outside guest memory
+static inline uint8_t* guest_phys_ptr(VirtualCPU* cpu, uint64_t addr, size_t size) {
+    if (addr > cpu->memory_size || cpu->memory_size - addr < size) return NULL;
+    return (uint8_t*)cpu->memory + addr;
+}
+
+static inline uint64_t guest_phys(VirtualCPU* cpu, const uint8_t* p) {
+    return p - (const uint8_t*)cpu->memory;
+}
+
+// 8-byte guest accesses. Aligned ones are single-copy atomic, as on x86,
+// so a vCPU can spin on a word the others update with locked operations.
+static inline uint64_t guest_load64(const uint8_t* p) {
+    uint64_t value;
+    if (((uintptr_t)p & 7) == 0) return __atomic_load_n((const uint64_t*)p, __ATOMIC_RELAXED);
+    memcpy(&value, p, 8);
+    return value;
+}
+
+static inline void guest_store64(uint8_t* p, uint64_t value) {
+    if (((uintptr_t)p & 7) == 0) {
+        __atomic_store_n((uint64_t*)p, value, __ATOMIC_RELAXED);
+    } else {
+        memcpy(p, &value, 8);
+    }
+}
+
+// Walk the four-level page tables at cr3. Returns the access the
+// mapping allows (PTE_PRESENT, PTE_WRITABLE), or 0 if addr is not mapped,
+// and sets *phys. 1 GB and 2 MB pages end the walk early. Accessed and
+// dirty bits are not maintained.
+static uint64_t mmu_walk(VirtualCPU* cpu, uint64_t addr, uint64_t* phys) {
+    if ((uint64_t)(((int64_t)addr >> 47) + 1) > 1) return 0;  // Non-canonical
+    uint64_t entry = cpu->cr3, perms = PTE_PRESENT | PTE_WRITABLE;
+    for (int level = 3; level >= 0; level--) {
+        uint32_t shift = PAGE_SHIFT + 9 * level;
+        uint8_t* pte = guest_phys_ptr(cpu, (entry & PTE_ADDR) + ((addr >> shift) & 511) * 8, 8);
+        if (!pte) return 0;
+        entry = guest_load64(pte);
+        if (!(entry & PTE_PRESENT)) return 0;
+        perms &= entry;
+        if ((level == 1 || level == 2) && (entry & PTE_LARGE)) {
+            uint64_t size = 1ull << shift;
+            *phys = (entry & PTE_ADDR & ~(size - 1)) | (addr & (size - 1));
+            return perms;
+        }
+    }
+    *phys = (entry & PTE_ADDR) | (addr & PAGE_MASK);
+    return perms;
+}
+
+// Guest virtual to physical, through the page tables when paging is on
+static inline uint64_t mmu_translate(VirtualCPU* cpu, uint64_t addr, uint64_t* phys) {
+    if (!cpu->cr3) {
+        *phys = addr;
+        return PTE_PRESENT | PTE_WRITABLE;
+    }
+    return mmu_walk(cpu, addr, phys);
+}
+
+static void mmu_flush(VirtualCPU* cpu) {
+    memset(cpu->tlb, 0xFF, sizeof(cpu->tlb));
+}
+
+// TLB miss, or an access that crosses into the next page: walk the page
+// tables and refill the entry. The pages of a crossing access have to be
+// physically adjacent, since callers get one host pointer.
+static uint8_t* mmu_slow(VirtualCPU* cpu, uint64_t addr, size_t size, bool write) {
+    uint64_t page = addr & ~PAGE_MASK, phys, next;
+    uint64_t perms = mmu_walk(cpu, addr, &phys);
+    cpu->tlb_misses++;
+    if (!perms || (write && !(perms & PTE_WRITABLE))) return NULL;
+    uint64_t frame = phys & ~PAGE_MASK;
+    if (frame + PAGE_SIZE <= cpu->memory_size) {
+        TlbEntry* e = &cpu->tlb[(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+        e->read_tag = page;
+        e->write_tag = perms & PTE_WRITABLE ? page : TLB_INVALID;
+        e->addend = (uintptr_t)cpu->memory + frame - page;
+    }
+    if ((addr & PAGE_MASK) + size > PAGE_SIZE) {
+        perms = mmu_walk(cpu, page + PAGE_SIZE, &next);
+        if (!perms || (write && !(perms & PTE_WRITABLE)) || next != frame + PAGE_SIZE) return NULL;
+    }
+    return guest_phys_ptr(cpu, phys, size);
+}
+
+// Guest memory access: a host pointer for [addr, addr + size), or NULL
+// if any of it is unmapped, read-only for a write, or outside guest
+// memory. Without paging addresses are physical.
+static inline uint8_t* guest_ptr(VirtualCPU* cpu, uint64_t addr, size_t size, bool write) {
+    if (!cpu->cr3) return guest_phys_ptr(cpu, addr, size);
+    TlbEntry* e = &cpu->tlb[(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+    cpu->tlb_lookups++;
+    if ((write ? e->write_tag : e->read_tag) == (addr & ~PAGE_MASK) &&
+        (addr & PAGE_MASK) <= PAGE_SIZE - size) {
+        return (uint8_t*)(uintptr_t)(addr + e->addend);
+    }
+    return mmu_slow(cpu, addr, size, write);
+}
+
+// Copy up to n instruction bytes from rip, stopping at the first page
+// that is not mapped. Returns the number copied.
+static size_t vm_fetch(VirtualCPU* cpu, uint64_t rip, uint8_t* buf, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        uint64_t addr = rip + got, phys;
+        size_t chunk = PAGE_SIZE - (addr & PAGE_MASK);
+        if (chunk > n - got) chunk = n - got;
+        if (!mmu_translate(cpu, addr, &phys) || phys >= cpu->memory_size) break;
+        if (chunk > cpu->memory_size - phys) chunk = cpu->memory_size - phys;
+        memcpy(buf + got, (uint8_t*)cpu->memory + phys, chunk);
+        got += chunk;
+    }
+    return got;
+}
+
+/* Decode Cache */
+
+static inline uint32_t block_hash(uint64_t rip) {
+    return (uint32_t)((rip * 0x9E3779B97F4A7C15ull) >> 52) & (BLOCK_HASH_SIZE - 1);
+}
+
+static TranslatedBlock* vm_lookup_block(VirtualCPU* cpu, uint64_t rip) {
+    TranslatedBlock* block = cpu->block_hash[block_hash(rip)];
+    while (block && block->start != rip) block = block->hash_next;
+    return block;
+}
+
+// Drop every block decoded from the given page. Blocks are only retired
+// here, since the caller may be executing one of them.
+static void vm_invalidate_page(VirtualCPU* cpu, uint64_t page) {
+    TranslatedBlock* block = cpu->page_blocks[page];
+    TRACE_COUNT(invalidate_counter, 1);
+    TRACE_INSTANT("invalidate_page", page);
+    cpu->page_blocks[page] = NULL;
+    __atomic_fetch_and(&cpu->code_pages[page], ~(1u << cpu->id), __ATOMIC_RELAXED);
+    while (block) {
+        uint32_t slot = block->pages[0] == page ? 0 : 1;
+        TranslatedBlock* next = block->page_next[slot];
+        if (!block->invalid) {
+            block->invalid = true;
+            if (block->jit_code) cpu->jit_flush_pending = true;
+            TranslatedBlock** link = &cpu->block_hash[block_hash(block->start)];
+            while (*link != block) link = &(*link)->hash_next;
+            *link = block->hash_next;
+
+            // Unlink from the other page it spans, if any
+            if (block->page_count == 2) {
+                uint64_t other = block->pages[1 - slot];
+                TranslatedBlock** plink = &cpu->page_blocks[other];
+                while (*plink != block) {
+                    TranslatedBlock* b = *plink;
+                    plink = &b->page_next[b->pages[0] == other ? 0 : 1];
+                }
+                *plink = block->page_next[1 - slot];
+                if (!cpu->page_blocks[other]) {
+                    __atomic_fetch_and(&cpu->code_pages[other], ~(1u << cpu->id),
+                                       __ATOMIC_RELAXED);
+                }
+            }
+            block->hash_next = cpu->retired;
+            cpu->retired = block;
+            cpu->blocks_invalidated++;
+        }
+        block = next;
+    }
+}
+
+// A write hit a page some vCPU has blocks on. Our own translations go
+// now; other vCPUs drop theirs at their next block boundary, which is as
+// much as x86 promises for cross-modifying code without serialization.
+static void vm_code_modified(VirtualCPU* cpu, uint64_t page, uint32_t mask) {
+    if (mask & (1u << cpu->id)) vm_invalidate_page(cpu, page);
+    mask &= ~(1u << cpu->id);
+    while (mask) {
+        VirtualCPU* other = cpu->vm->vcpus[__builtin_ctz(mask)];
+        mask &= mask - 1;
+        __atomic_store_n(&other->flush_request, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&other->exit_request, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Called after every guest write: invalidate translations of the pages
+// it touched
+static inline void vm_code_write(VirtualCPU* cpu, uint64_t addr, size_t size) {
+    uint64_t first = addr >> PAGE_SHIFT, last = (addr + size - 1) >> PAGE_SHIFT;
+    for (uint64_t page = first; page <= last; page++) {
+        uint32_t mask = __atomic_load_n(&cpu->code_pages[page], __ATOMIC_RELAXED);
+        if (mask) vm_code_modified(cpu, page, mask);
+    }
+}
+
+static void vm_free_retired(VirtualCPU* cpu) {
+    while (cpu->retired) {
+        TranslatedBlock* next = cpu->retired->hash_next;
+        free(cpu->retired);
+        cpu->retired = next;
+    }
+}
+
+// Retire every block, visiting only pages that have some. Safe while a
+// block is running.
+static void vm_drop_blocks(VirtualCPU* cpu) {
+    for (uint32_t i = 0; i < BLOCK_HASH_SIZE; i++) {
+        while (cpu->block_hash[i]) vm_invalidate_page(cpu, cpu->block_hash[i]->pages[0]);
+    }
+}
+
+static void vm_flush_blocks(VirtualCPU* cpu) {
+    vm_drop_blocks(cpu);
+    vm_free_retired(cpu);
 }
 
 // Load binary into VM memory
-bool vm_load_binary(VirtualMachine* vm, const char* binary, size_t size, uint64_t address) {
+bool vm_load_binary(VirtualMachine* vm, const uint8_t* binary, size_t size, uint64_t address) {
     if (address + size > vm->memory_size) return false;
     memcpy((uint8_t*)vm->memory + address, binary, size);
+    if (size) vm_code_write(vm->vcpus[0], address, size);
     return true;
 }
 
-// Simple instruction emulation
-void vm_emulate_instruction(VirtualMachine* vm) {
-    uint8_t* code = (uint8_t*)vm->memory + vm->vcpu.rip;
-    
-    // Very basic instruction decoder
-    switch (*code) {
-        case 0x90:  // NOP
-            printf("Executing NOP instruction at RIP: 0x%lx\n", vm->vcpu.rip);
-            vm->vcpu.rip++;
+/* Decoder */
+
+// Decode a ModRM operand. Registers need mod == 3; memory operands take
+// [base], [base + disp8] and [base + disp32], including a SIB byte with
+// no index so RSP and R12 can be the base.
+static int decode_modrm(const uint8_t* code, size_t avail, uint8_t rex,
+                        uint8_t* reg, uint8_t* rm, bool* is_mem, int64_t* disp) {
+    if (avail < 1) return -1;
+    uint8_t modrm = code[0];
+    uint8_t mod = modrm >> 6;
+    int len = 1;
+    *reg = ((modrm >> 3) & 7) | ((rex & 0x4) << 1);
+    *rm = (modrm & 7) | ((rex & 0x1) << 3);
+    *is_mem = mod != 3;
+    *disp = 0;
+    if (mod == 3) return len;
+
+    if ((modrm & 7) == 4) {
+        if (avail < 2) return -1;
+        uint8_t sib = code[1];
+        if (((sib >> 3) & 7) != 4 || (rex & 0x2)) return -1;  // Indexed
+        if ((sib & 7) == 5 && mod == 0) return -1;             // No base
+        *rm = (sib & 7) | ((rex & 0x1) << 3);
+        len++;
+    } else if ((modrm & 7) == 5 && mod == 0) {
+        return -1;  // RIP-relative
+    }
+    if (mod == 1) {
+        if (avail < (size_t)len + 1) return -1;
+        *disp = (int8_t)code[len];
+        len += 1;
+    } else if (mod == 2) {
+        if (avail < (size_t)len + 4) return -1;
+        int32_t d;
+        memcpy(&d, code + len, 4);
+        *disp = d;
+        len += 4;
+    }
+    return len;
+}
+
+// Decode the instruction at rip. Anything outside the supported subset
+// becomes OP_UD, which stops the vCPU when executed.
+static void vm_decode(VirtualCPU* cpu, uint64_t rip, DecodedOp* op) {
+    memset(op, 0, sizeof(*op));
+    op->rip = rip;
+    op->opcode = OP_UD;
+    op->length = 1;
+    uint8_t code[16];
+    size_t avail = vm_fetch(cpu, rip, code, sizeof(code));
+    if (!avail) return;
+    size_t i = 0;
+    uint8_t rex = 0;
+    bool lock = false, rep = false;
+
+    if (code[0] == 0xF0 || code[0] == 0xF3) {
+        lock = code[0] == 0xF0;
+        rep = !lock;
+        i++;
+        if (avail < 2) return;
+    }
+    if ((code[i] & 0xF0) == 0x40) {
+        rex = code[i];
+        i++;
+        if (avail < i + 1) return;
+    }
+    bool wide = rex & 0x8;
+    uint8_t b = code[i++];
+    if (rep && (b != 0x90 || rex)) return;
+    if (lock && b != 0x87 && !(b == 0x0F && avail > i && (code[i] == 0xC1 || code[i] == 0xB1))) {
+        return;  // LOCK on anything else is #UD
+    }
+    op->raw = b;
+    uint8_t reg, rm;
+    bool is_mem;
+    int64_t disp;
+    int n;
+
+    switch (b) {
+        case 0x90:  // NOP, PAUSE
+            op->opcode = rep ? OP_PAUSE : OP_NOP;
             break;
         case 0xC3:  // RET
-            printf("Executing RET instruction at RIP: 0x%lx\n", vm->vcpu.rip);
-            vm->running = false;
+            op->opcode = OP_RET;
+            break;
+        case 0xCF:  // IRETQ
+            if (!wide) return;
+            op->opcode = OP_IRET;
+            break;
+        case 0xE7:  // OUT imm8, eax
+            if (avail < i + 1) return;
+            op->opcode = OP_OUT;
+            op->imm = code[i++];
+            break;
+        case 0x87:  // XCHG m64, r64 (locked with or without the prefix)
+            if (!wide) return;
+            n = decode_modrm(code + i, avail - i, rex, &reg, &rm, &is_mem, &disp);
+            if (n < 0 || !is_mem) return;
+            i += n;
+            op->opcode = OP_XCHG;
+            op->dst = rm;
+            op->src = reg;
+            op->imm = disp;
+            break;
+        case 0xF4:  // HLT
+            op->opcode = OP_HLT;
+            break;
+        case 0x50 ... 0x57:  // PUSH r64
+            op->opcode = OP_PUSH;
+            op->src = (b & 7) | ((rex & 0x1) << 3);
+            break;
+        case 0x58 ... 0x5F:  // POP r64
+            op->opcode = OP_POP;
+            op->dst = (b & 7) | ((rex & 0x1) << 3);
+            break;
+        case 0xB8 ... 0xBF: {  // MOV r32, imm32 / MOV r64, imm64
+            op->opcode = OP_MOV_RI;
+            op->dst = (b & 7) | ((rex & 0x1) << 3);
+            size_t width = wide ? 8 : 4;
+            if (avail < i + width) return;
+            uint64_t imm = 0;
+            memcpy(&imm, code + i, width);
+            op->imm = (int64_t)imm;
+            i += width;
+            break;
+        }
+        case 0x01: case 0x29: case 0x39: case 0x21: case 0x09: case 0x31:
+        case 0x89: case 0x8B:  // ALU r/m64, r64 and MOV
+            if (!wide) return;
+            n = decode_modrm(code + i, avail - i, rex, &reg, &rm, &is_mem, &disp);
+            if (n < 0) return;
+            i += n;
+            if (b == 0x89 || b == 0x8B) {
+                bool load = b == 0x8B;
+                op->opcode = is_mem ? (load ? OP_LOAD : OP_STORE) : OP_MOV_RR;
+                op->dst = load ? reg : rm;
+                op->src = load ? rm : reg;
+                op->imm = disp;
+                break;
+            }
+            if (is_mem) return;
+            op->dst = rm;
+            op->src = reg;
+            op->opcode = b == 0x01 ? OP_ADD_RR : b == 0x29 ? OP_SUB_RR :
+                         b == 0x39 ? OP_CMP_RR : b == 0x21 ? OP_AND_RR :
+                         b == 0x09 ? OP_OR_RR : OP_XOR_RR;
+            break;
+        case 0x81: case 0x83: {  // ALU r/m64, imm32 / imm8
+            static const int8_t group1[8] = {
+                OP_ADD_RI, OP_OR_RI, -1, -1, OP_AND_RI, OP_SUB_RI, OP_XOR_RI, OP_CMP_RI
+            };
+            if (!wide) return;
+            n = decode_modrm(code + i, avail - i, rex, &reg, &rm, &is_mem, &disp);
+            if (n < 0 || is_mem || group1[reg & 7] < 0) return;
+            i += n;
+            if (b == 0x83) {
+                if (avail < i + 1) return;
+                op->imm = (int8_t)code[i++];
+            } else {
+                if (avail < i + 4) return;
+                int32_t imm;
+                memcpy(&imm, code + i, 4);
+                op->imm = imm;
+                i += 4;
+            }
+            op->opcode = group1[reg & 7];
+            op->dst = rm;
+            break;
+        }
+        case 0xEB: case 0x70 ... 0x7F:  // JMP rel8, Jcc rel8
+            if (avail < i + 1) return;
+            op->opcode = b == 0xEB ? OP_JMP : OP_JCC;
+            op->cc = b & 0xF;
+            op->imm = (int8_t)code[i++];
+            break;
+        case 0xE9: case 0xE8: {  // JMP rel32, CALL rel32
+            if (avail < i + 4) return;
+            int32_t rel;
+            memcpy(&rel, code + i, 4);
+            op->opcode = b == 0xE9 ? OP_JMP : OP_CALL;
+            op->imm = rel;
+            i += 4;
+            break;
+        }
+        case 0x0F: {  // Jcc rel32, LOCK XADD / CMPXCHG m64, r64, MOV to and from CR3
+            if (avail > i && (code[i] == 0x20 || code[i] == 0x22)) {
+                uint8_t b2 = code[i++];
+                n = decode_modrm(code + i, avail - i, rex, &reg, &rm, &is_mem, &disp);
+                if (n < 0 || is_mem || reg != 3) return;
+                i += n;
+                op->opcode = b2 == 0x20 ? OP_MOV_FROM_CR3 : OP_MOV_TO_CR3;
+                op->dst = op->src = rm;
+                break;
+            }
+            if (avail > i && (code[i] == 0xC1 || code[i] == 0xB1)) {
+                if (!wide || !lock) return;
+                uint8_t b2 = code[i++];
+                n = decode_modrm(code + i, avail - i, rex, &reg, &rm, &is_mem, &disp);
+                if (n < 0 || !is_mem) return;
+                i += n;
+                op->opcode = b2 == 0xC1 ? OP_XADD : OP_CMPXCHG;
+                op->dst = rm;
+                op->src = reg;
+                op->imm = disp;
+                break;
+            }
+            if (avail < i + 5 || (code[i] & 0xF0) != 0x80) return;
+            int32_t rel;
+            memcpy(&rel, code + i + 1, 4);
+            op->opcode = OP_JCC;
+            op->cc = code[i] & 0xF;
+            op->imm = rel;
+            i += 5;
+            break;
+        }
+        default:
+            return;
+    }
+    op->length = (uint8_t)i;
+    if (op->opcode == OP_JMP || op->opcode == OP_JCC || op->opcode == OP_CALL) {
+        op->target = rip + i + op->imm;
+    }
+}
+
+static inline bool op_ends_block(uint8_t opcode) {
+    return opcode >= OP_JMP;
+}
+
+/* Execution */
+
+// Materialize RFLAGS (CF, PF, ZF, SF, OF) from the lazy flags state
+uint64_t vm_get_rflags(const VirtualCPU* cpu) {
+    uint64_t a = cpu->flags_a, b = cpu->flags_b, r;
+    bool cf, of;
+    if (cpu->flags_op == FLAGS_RAW) return (a & RFLAGS_STATUS) | 0x2;
+    switch (cpu->flags_op) {
+        case FLAGS_ADD:
+            r = a + b;
+            cf = r < a;
+            of = ((a ^ r) & (b ^ r)) >> 63;
+            break;
+        case FLAGS_SUB:
+            r = a - b;
+            cf = a < b;
+            of = ((a ^ b) & (a ^ r)) >> 63;
             break;
         default:
-            printf("Unknown instruction: 0x%02X at RIP: 0x%lx\n", *code, vm->vcpu.rip);
-            vm->running = false;
+            r = a;
+            cf = of = false;
+    }
+    uint64_t flags = 0x2;  // Reserved bit 1 reads as one
+    if (cf) flags |= 1 << 0;
+    if (!__builtin_parity(r & 0xFF)) flags |= 1 << 2;
+    if (r == 0) flags |= 1 << 6;
+    if (r >> 63) flags |= 1 << 7;
+    if (of) flags |= 1 << 11;
+    return flags;
+}
+
+// Evaluate an x86 condition code against the lazy flags
+static inline bool vm_condition(const VirtualCPU* cpu, uint8_t cc) {
+    uint64_t a = cpu->flags_a, b = cpu->flags_b;
+    bool result;
+    if (cpu->flags_op == FLAGS_SUB) {
+        // Compare-style conditions straight from the operands
+        switch (cc >> 1) {
+            case 1: result = a < b; break;                       // B
+            case 2: result = a == b; break;                      // E
+            case 3: result = a <= b; break;                      // BE
+            case 6: result = (int64_t)a < (int64_t)b; break;     // L
+            case 7: result = (int64_t)a <= (int64_t)b; break;    // LE
+            default: goto from_flags;
+        }
+        return result ^ (cc & 1);
+    }
+from_flags: {
+        uint64_t f = vm_get_rflags(cpu);
+        bool cf = f & 1, pf = f & 4, zf = f & 64, sf = f & 128, of = f & 2048;
+        switch (cc >> 1) {
+            case 0: result = of; break;
+            case 1: result = cf; break;
+            case 2: result = zf; break;
+            case 3: result = cf || zf; break;
+            case 4: result = sf; break;
+            case 5: result = pf; break;
+            case 6: result = sf != of; break;
+            default: result = zf || sf != of; break;
+        }
+        return result ^ (cc & 1);
+    }
+}
+
+static void vm_execute(VirtualCPU* cpu, TranslatedBlock* block, bool chain);
+static const void* const* vm_handlers;
+
+// Decode a basic block starting at rip: up to a branch, BLOCK_MAX_OPS
+// ops, or the end of the second page it touches
+static TranslatedBlock* vm_translate(VirtualCPU* cpu, uint64_t rip) {
+    DecodedOp ops[BLOCK_MAX_OPS + 1];
+    uint32_t count = 0;
+    uint64_t pc = rip;
+    uint64_t first_page = rip >> PAGE_SHIFT;
+
+    if (!vm_handlers) vm_execute(NULL, NULL, false);
+    for (;;) {
+        DecodedOp* op = &ops[count];
+        vm_decode(cpu, pc, op);
+        uint64_t last_page = (pc + op->length - 1) >> PAGE_SHIFT;
+        if (count > 0 && last_page > first_page + 1) break;  // Keep to two pages
+        count++;
+        pc += op->length;
+        if (op_ends_block(op->opcode) || count == BLOCK_MAX_OPS) break;
+    }
+    if (!op_ends_block(ops[count - 1].opcode)) {
+        ops[count] = (DecodedOp){ .opcode = OP_END, .rip = pc, .target = pc };
+        count++;
+    }
+
+    TranslatedBlock* block = malloc(sizeof(TranslatedBlock) + count * sizeof(DecodedOp));
+    if (!block) return NULL;
+    block->start = rip;
+    block->op_count = count;
+    block->invalid = false;
+    block->jit_failed = false;
+    block->exec_count = 0;
+    block->jit_code = NULL;
+    block->ops = (DecodedOp*)(block + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        block->ops[i] = ops[i];
+        block->ops[i].handler = vm_handlers[ops[i].opcode];
+    }
+
+    // The last byte decoded decides whether a second page is involved.
+    // Blocks are found by virtual address but listed on the physical
+    // pages their bytes came from, which is what stores invalidate.
+    uint64_t end = ops[count - 1].opcode == OP_END ? pc - 1 :
+                   ops[count - 1].rip + ops[count - 1].length - 1;
+    uint64_t phys_first, phys_last;
+    if (!mmu_translate(cpu, rip, &phys_first)) phys_first = 0;
+    if (!mmu_translate(cpu, end, &phys_last)) phys_last = phys_first;
+    phys_first >>= PAGE_SHIFT;
+    phys_last >>= PAGE_SHIFT;
+    uint64_t pages = cpu->memory_size >> PAGE_SHIFT;
+    if (phys_first >= pages) phys_first = 0;
+    if (phys_last >= pages) phys_last = phys_first;
+    block->page_count = phys_last == phys_first ? 1 : 2;
+    block->pages[0] = phys_first;
+    block->pages[1] = phys_last;
+    for (uint32_t i = 0; i < block->page_count; i++) {
+        uint64_t page = block->pages[i];
+        block->page_next[i] = cpu->page_blocks[page];
+        cpu->page_blocks[page] = block;
+        if (!(__atomic_load_n(&cpu->code_pages[page], __ATOMIC_RELAXED) & (1u << cpu->id))) {
+            __atomic_fetch_or(&cpu->code_pages[page], 1u << cpu->id, __ATOMIC_RELAXED);
+        }
+    }
+
+    uint32_t h = block_hash(rip);
+    block->hash_next = cpu->block_hash[h];
+    cpu->block_hash[h] = block;
+    cpu->blocks_translated++;
+    return block;
+}
+
+static inline TranslatedBlock* vm_find_block(VirtualCPU* cpu, uint64_t rip) {
+    TranslatedBlock* block = vm_lookup_block(cpu, rip);
+    if (block) return block;
+    TRACE_TIMED(translate_hist, block = vm_translate(cpu, rip));
+    return block;
+}
+
+static bool vm_tier_up(VirtualCPU* cpu, TranslatedBlock* block);
+static void vm_raise_ipi(VirtualMachine* vm, uint32_t source, uint32_t target, uint32_t vector);
+
+// Run predecoded ops with direct-threaded dispatch: every handler jumps
+// straight to the next op's handler. With chain set, block exits look up
+// the next block and keep going until the guest stops or another vCPU
+// asks for attention. Called with a NULL cpu, it only publishes the
+// handler table for vm_translate.
+static void vm_execute(VirtualCPU* cpu, TranslatedBlock* block, bool chain) {
+    static const void* const handlers[OP_COUNT] = {
+        [OP_NOP] = &&op_nop,
+        [OP_MOV_RI] = &&op_mov_ri, [OP_MOV_RR] = &&op_mov_rr,
+        [OP_LOAD] = &&op_load, [OP_STORE] = &&op_store,
+        [OP_ADD_RR] = &&op_add_rr, [OP_ADD_RI] = &&op_add_ri,
+        [OP_SUB_RR] = &&op_sub_rr, [OP_SUB_RI] = &&op_sub_ri,
+        [OP_CMP_RR] = &&op_cmp_rr, [OP_CMP_RI] = &&op_cmp_ri,
+        [OP_AND_RR] = &&op_and_rr, [OP_AND_RI] = &&op_and_ri,
+        [OP_OR_RR] = &&op_or_rr, [OP_OR_RI] = &&op_or_ri,
+        [OP_XOR_RR] = &&op_xor_rr, [OP_XOR_RI] = &&op_xor_ri,
+        [OP_PUSH] = &&op_push, [OP_POP] = &&op_pop,
+        [OP_XCHG] = &&op_xchg, [OP_XADD] = &&op_xadd,
+        [OP_CMPXCHG] = &&op_cmpxchg, [OP_PAUSE] = &&op_pause,
+        [OP_MOV_FROM_CR3] = &&op_mov_from_cr3, [OP_MOV_TO_CR3] = &&op_mov_to_cr3,
+        [OP_JMP] = &&op_jmp, [OP_JCC] = &&op_jcc, [OP_CALL] = &&op_call,
+        [OP_RET] = &&op_ret, [OP_IRET] = &&op_iret, [OP_OUT] = &&op_out,
+        [OP_HLT] = &&op_hlt, [OP_UD] = &&op_ud, [OP_END] = &&op_end
+    };
+    if (!cpu) {
+        vm_handlers = handlers;
+        return;
+    }
+
+    uint64_t* regs = cpu->registers;
+    const DecodedOp* op = block->ops;
+    uint64_t addr, value;
+    uint8_t* p;
+
+#define NEXT() goto *(++op)->handler
+#define ALU_FLAGS(kind, x, y) \
+    (cpu->flags_op = (kind), cpu->flags_a = (x), cpu->flags_b = (y))
+#define EXIT_TO(next_rip) do { \
+        cpu->rip = (next_rip); \
+        goto block_done; \
+    } while (0)
+
+    goto *op->handler;
+
+op_nop:
+    NEXT();
+op_mov_ri:
+    regs[op->dst] = op->imm;
+    NEXT();
+op_mov_rr:
+    regs[op->dst] = regs[op->src];
+    NEXT();
+op_load:
+    addr = regs[op->src] + op->imm;
+    if (!(p = guest_ptr(cpu, addr, 8, false))) goto fault;
+    regs[op->dst] = guest_load64(p);
+    NEXT();
+op_store:
+    addr = regs[op->dst] + op->imm;
+    if (!(p = guest_ptr(cpu, addr, 8, true))) goto fault;
+    guest_store64(p, regs[op->src]);
+    vm_code_write(cpu, guest_phys(cpu, p), 8);
+    if (block->invalid) goto self_modified;
+    NEXT();
+op_add_rr:
+    ALU_FLAGS(FLAGS_ADD, regs[op->dst], regs[op->src]);
+    regs[op->dst] += regs[op->src];
+    NEXT();
+op_add_ri:
+    ALU_FLAGS(FLAGS_ADD, regs[op->dst], op->imm);
+    regs[op->dst] += op->imm;
+    NEXT();
+op_sub_rr:
+    ALU_FLAGS(FLAGS_SUB, regs[op->dst], regs[op->src]);
+    regs[op->dst] -= regs[op->src];
+    NEXT();
+op_sub_ri:
+    ALU_FLAGS(FLAGS_SUB, regs[op->dst], op->imm);
+    regs[op->dst] -= op->imm;
+    NEXT();
+op_cmp_rr:
+    ALU_FLAGS(FLAGS_SUB, regs[op->dst], regs[op->src]);
+    NEXT();
+op_cmp_ri:
+    ALU_FLAGS(FLAGS_SUB, regs[op->dst], op->imm);
+    NEXT();
+op_and_rr:
+    regs[op->dst] &= regs[op->src];
+    ALU_FLAGS(FLAGS_LOGIC, regs[op->dst], 0);
+    NEXT();
+op_and_ri:
+    regs[op->dst] &= op->imm;
+    ALU_FLAGS(FLAGS_LOGIC, regs[op->dst], 0);
+    NEXT();
+op_or_rr:
+    regs[op->dst] |= regs[op->src];
+    ALU_FLAGS(FLAGS_LOGIC, regs[op->dst], 0);
+    NEXT();
+op_or_ri:
+    regs[op->dst] |= op->imm;
+    ALU_FLAGS(FLAGS_LOGIC, regs[op->dst], 0);
+    NEXT();
+op_xor_rr:
+    regs[op->dst] ^= regs[op->src];
+    ALU_FLAGS(FLAGS_LOGIC, regs[op->dst], 0);
+    NEXT();
+op_xor_ri:
+    regs[op->dst] ^= op->imm;
+    ALU_FLAGS(FLAGS_LOGIC, regs[op->dst], 0);
+    NEXT();
+op_push:
+    addr = regs[RSP] - 8;
+    if (!(p = guest_ptr(cpu, addr, 8, true))) goto fault;
+    guest_store64(p, regs[op->src]);
+    regs[RSP] = addr;
+    vm_code_write(cpu, guest_phys(cpu, p), 8);
+    if (block->invalid) goto self_modified;
+    NEXT();
+op_pop:
+    addr = regs[RSP];
+    if (!(p = guest_ptr(cpu, addr, 8, false))) goto fault;
+    regs[RSP] = addr + 8;
+    regs[op->dst] = guest_load64(p);
+    NEXT();
+op_xchg:
+    addr = regs[op->dst] + op->imm;
+    if (!(p = guest_ptr(cpu, addr, 8, true))) goto fault;
+    regs[op->src] = __atomic_exchange_n((uint64_t*)p, regs[op->src], __ATOMIC_SEQ_CST);
+    vm_code_write(cpu, guest_phys(cpu, p), 8);
+    if (block->invalid) goto self_modified;
+    NEXT();
+op_xadd:
+    addr = regs[op->dst] + op->imm;
+    if (!(p = guest_ptr(cpu, addr, 8, true))) goto fault;
+    value = regs[op->src];
+    regs[op->src] = __atomic_fetch_add((uint64_t*)p, value, __ATOMIC_SEQ_CST);
+    ALU_FLAGS(FLAGS_ADD, regs[op->src], value);
+    vm_code_write(cpu, guest_phys(cpu, p), 8);
+    if (block->invalid) goto self_modified;
+    NEXT();
+op_cmpxchg:
+    addr = regs[op->dst] + op->imm;
+    if (!(p = guest_ptr(cpu, addr, 8, true))) goto fault;
+    value = regs[RAX];
+    __atomic_compare_exchange_n((uint64_t*)p, &regs[RAX], regs[op->src], false,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    ALU_FLAGS(FLAGS_SUB, value, regs[RAX]);  // RAX now holds the old value
+    vm_code_write(cpu, guest_phys(cpu, p), 8);
+    if (block->invalid) goto self_modified;
+    NEXT();
+op_pause:
+    // A spinning guest gives its host CPU to whoever it is waiting for
+    if ((++cpu->pauses & PAUSE_YIELD_MASK) == 0) sched_yield();
+    NEXT();
+op_mov_from_cr3:
+    regs[op->dst] = cpu->cr3;
+    NEXT();
+op_mov_to_cr3:
+    // A new address space: every translation and decoded block is stale
+    cpu->cr3 = regs[op->src] & PTE_ADDR;
+    mmu_flush(cpu);
+    vm_drop_blocks(cpu);
+    EXIT_TO(op->rip + op->length);
+op_jmp:
+    EXIT_TO(op->target);
+op_jcc:
+    EXIT_TO(vm_condition(cpu, op->cc) ? op->target : op->rip + op->length);
+op_call:
+    addr = regs[RSP] - 8;
+    if (!(p = guest_ptr(cpu, addr, 8, true))) goto fault;
+    uint64_t ret = op->rip + op->length;
+    guest_store64(p, ret);
+    regs[RSP] = addr;
+    vm_code_write(cpu, guest_phys(cpu, p), 8);
+    EXIT_TO(op->target);
+op_ret:
+    if (regs[RSP] == cpu->stack_top) {
+        // Returning from the entry point hands control back to the host
+        cpu->running = false;
+        EXIT_TO(op->rip);
+    }
+    addr = regs[RSP];
+    if (!(p = guest_ptr(cpu, addr, 8, false))) goto fault;
+    regs[RSP] = addr + 8;
+    cpu->rip = guest_load64(p);
+    goto block_done;
+op_iret:
+    // The frame interrupt delivery pushed: RIP, then RFLAGS above it
+    addr = regs[RSP];
+    if (!(p = guest_ptr(cpu, addr, 16, false))) goto fault;
+    regs[RSP] = addr + 16;
+    cpu->rip = guest_load64(p);
+    cpu->flags_a = guest_load64(p + 8);
+    cpu->flags_op = FLAGS_RAW;
+    cpu->in_interrupt = false;
+    if (__atomic_load_n(&cpu->pending_ipis, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&cpu->exit_request, 1, __ATOMIC_RELAXED);
+    }
+    goto block_done;
+op_out:
+    if (op->imm == IPI_PORT) {
+        value = (uint32_t)regs[RAX];
+        vm_raise_ipi(cpu->vm, cpu->id, value & 0xFF, (value >> 8) % VM_VECTORS);
+    }
+    EXIT_TO(op->rip + op->length);
+op_hlt:
+    // With interrupt handlers installed HLT waits for one; otherwise
+    // nothing could wake the vCPU, so it stops
+    if (cpu->vm->ivt_mask) {
+        cpu->halted = true;
+        __atomic_store_n(&cpu->exit_request, 1, __ATOMIC_RELAXED);
+    } else {
+        cpu->running = false;
+    }
+    EXIT_TO(op->rip + op->length);
+op_ud:
+    printf("Unknown instruction: 0x%02X at RIP: 0x%lx\n", op->raw, op->rip);
+    cpu->running = false;
+    cpu->rip = op->rip;
+    cpu->instructions += op - block->ops;
+    return;
+op_end:
+    cpu->rip = op->target;
+    cpu->instructions += op - block->ops;  // OP_END is not an instruction
+    goto next_block;
+
+fault:
+    printf("Memory fault at 0x%lx (RIP: 0x%lx)\n", addr, op->rip);
+    cpu->running = false;
+    cpu->rip = op->rip;
+    cpu->instructions += op - block->ops;
+    return;
+
+self_modified:
+    // The store hit this block's own code: resume after it with a fresh
+    // translation
+    cpu->rip = op->rip + op->length;
+    cpu->instructions += op - block->ops + 1;
+    goto next_block;
+
+block_done:
+    cpu->instructions += op - block->ops + 1;
+next_block:
+    if (!chain || !cpu->running || __atomic_load_n(&cpu->exit_request, __ATOMIC_ACQUIRE)) return;
+    if (cpu->retired) vm_free_retired(cpu);
+    block = vm_find_block(cpu, cpu->rip);
+    if (!block) {
+        printf("Out of memory translating RIP: 0x%lx\n", cpu->rip);
+        cpu->running = false;
+        return;
+    }
+    if (cpu->jit_threshold && vm_tier_up(cpu, block)) return;  // Hot: run compiled
+    op = block->ops;
+    goto *op->handler;
+
+#undef NEXT
+#undef ALU_FLAGS
+#undef EXIT_TO
+}
+
+// Simple instruction emulation: decode and execute one instruction
+void vm_emulate_instruction(VirtualCPU* cpu) {
+    TranslatedBlock step;
+    DecodedOp ops[2];
+
+    if (!vm_handlers) vm_execute(NULL, NULL, false);
+    vm_decode(cpu, cpu->rip, &ops[0]);
+    ops[1] = (DecodedOp){ .opcode = OP_END, .target = cpu->rip + ops[0].length };
+    ops[0].handler = vm_handlers[ops[0].opcode];
+    ops[1].handler = vm_handlers[OP_END];
+    step.ops = ops;
+    step.invalid = false;
+
+    if (cpu->vm->trace && ops[0].opcode != OP_UD) {
+        printf("Executing %s instruction at RIP: 0x%lx\n",
+               vm_op_names[ops[0].opcode], cpu->rip);
+    }
+    vm_execute(cpu, &step, false);
+    vm_free_retired(cpu);
+}
+
+/* JIT Tier */
+
+#if VM_JIT
+
+// Compiled blocks run with the vCPU in r15 and guest memory in r13. Each
+// vCPU compiles into its own buffer, so no code is shared between
+// threads. rax, rcx and rdx are scratch; the remaining host registers
+// hold the guest registers a block touches, loaded on entry and written
+// back on every exit. Host registers use the guest numbering.
+#define JIT_CPU R15
+#define JIT_MEM R13
+#define JIT_POOL_SIZE 10
+#define JIT_EXIT_DYNAMIC 0    // cpu->rip is set, no patchable exit
+#define JIT_EXIT_INTERPRET 1  // Run the instruction at cpu->rip in the interpreter
+#define CPU_OFF(field) ((int32_t)offsetof(VirtualCPU, field))
+
+static const uint8_t jit_pool[JIT_POOL_SIZE] = {
+    RBX, RBP, RSI, RDI, R8, R9, R10, R11, R12, R14
+};
+
+typedef uintptr_t (*JitEntry)(VirtualCPU* cpu, const uint8_t* code, void* memory);
+
+typedef struct {
+    uint8_t* p;
+} JitAsm;
+
+static inline void jit_byte(JitAsm* a, uint8_t b) { *a->p++ = b; }
+static inline void jit_u32(JitAsm* a, uint32_t v) { memcpy(a->p, &v, 4); a->p += 4; }
+static inline void jit_u64(JitAsm* a, uint64_t v) { memcpy(a->p, &v, 8); a->p += 8; }
+
+// REX.W op /r with two register operands
+static void jit_rr(JitAsm* a, uint8_t op, int reg, int rm) {
+    jit_byte(a, 0x48 | (reg >> 3) << 2 | (rm >> 3));
+    jit_byte(a, op);
+    jit_byte(a, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op /r with a [base + (index << scale) + disp32] operand; index < 0 for
+// none. Opcodes above 0xFF are two bytes, 0x0F first.
+static void jit_mem(JitAsm* a, bool wide, uint16_t op, int reg, int base,
+                    int index, int scale, int32_t disp) {
+    uint8_t rex = (wide ? 0x48 : 0x40) | (reg >> 3) << 2 | (base >> 3);
+    if (index >= 0) rex |= (index >> 3) << 1;
+    if (rex != 0x40) jit_byte(a, rex);
+    if (op > 0xFF) jit_byte(a, op >> 8);
+    jit_byte(a, op & 0xFF);
+    if (index >= 0 || (base & 7) == RSP) {
+        jit_byte(a, 0x84 | (reg & 7) << 3);
+        jit_byte(a, (index >= 0 ? scale << 6 | (index & 7) << 3 : RSP << 3) | (base & 7));
+    } else {
+        jit_byte(a, 0x80 | (reg & 7) << 3 | (base & 7));
+    }
+    jit_u32(a, (uint32_t)disp);
+}
+
+static void jit_mov_imm(JitAsm* a, int reg, uint64_t imm) {
+    if (imm <= UINT32_MAX) {
+        if (reg >= 8) jit_byte(a, 0x41);
+        jit_byte(a, 0xB8 + (reg & 7));
+        jit_u32(a, (uint32_t)imm);
+    } else if ((int64_t)imm == (int32_t)imm) {
+        jit_rr(a, 0xC7, 0, reg);
+        jit_u32(a, (uint32_t)imm);
+    } else {
+        jit_byte(a, 0x48 | (reg >> 3));
+        jit_byte(a, 0xB8 + (reg & 7));
+        jit_u64(a, imm);
+    }
+}
+
+// Group 1 ALU op with imm32: digit is 0 add, 1 or, 4 and, 5 sub, 6 xor, 7 cmp
+static void jit_alu_imm(JitAsm* a, int digit, int reg, int32_t imm) {
+    jit_rr(a, 0x81, digit, reg);
+    jit_u32(a, (uint32_t)imm);
+}
+
+static uint8_t* jit_jcc(JitAsm* a, uint8_t cc) {
+    jit_byte(a, 0x0F);
+    jit_byte(a, 0x80 | cc);
+    a->p += 4;
+    return a->p - 4;
+}
+
+static uint8_t* jit_jmp(JitAsm* a) {
+    jit_byte(a, 0xE9);
+    a->p += 4;
+    return a->p - 4;
+}
+
+static inline void jit_patch(uint8_t* rel32, const uint8_t* target) {
+    int32_t rel = (int32_t)(target - (rel32 + 4));
+    memcpy(rel32, &rel, 4);
+}
+
+static void jit_protect(VirtualCPU* cpu, bool writable) {
+    mprotect(cpu->jit_buffer, JIT_BUFFER_SIZE,
+             PROT_READ | (writable ? PROT_WRITE : PROT_EXEC));
+}
+
+// Buffer head: the entry trampoline, then the shared epilogue
+static void jit_emit_trampoline(VirtualCPU* cpu) {
+    JitAsm a = { cpu->jit_buffer };
+    static const uint8_t enter[] = {
+        0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,  // push rbx..r15
+        0x49, 0x89, 0xFF,                                            // mov r15, rdi
+        0x49, 0x89, 0xD5,                                            // mov r13, rdx
+        0xFF, 0xE6                                                   // jmp rsi
+    };
+    static const uint8_t leave[] = {
+        0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B,  // pop r15..rbx
+        0xC3                                                         // ret
+    };
+    memcpy(a.p, enter, sizeof(enter));
+    a.p += sizeof(enter);
+    memcpy(a.p, leave, sizeof(leave));
+    a.p += sizeof(leave);
+    cpu->jit_used = a.p - cpu->jit_buffer;
+}
+
+static inline uint8_t* jit_epilogue(VirtualCPU* cpu) {
+    return cpu->jit_buffer + 18;
+}
+
+// Drop all compiled code. Blocks fall back to the interpreter and tier
+// up again once they are hot.
+static void jit_flush(VirtualCPU* cpu) {
+    for (uint32_t i = 0; i < BLOCK_HASH_SIZE; i++) {
+        for (TranslatedBlock* b = cpu->block_hash[i]; b; b = b->hash_next) {
+            b->jit_code = NULL;
+            b->exec_count = 0;
+        }
+    }
+    for (TranslatedBlock* b = cpu->retired; b; b = b->hash_next) b->jit_code = NULL;
+    memset(cpu->jit_cache, 0, sizeof(cpu->jit_cache));
+    jit_protect(cpu, true);
+    jit_emit_trampoline(cpu);
+    jit_protect(cpu, false);
+    cpu->jit_epoch++;
+    cpu->jit_flush_pending = false;
+}
+
+// Guest registers an op reads or writes
+static uint16_t op_reg_mask(const DecodedOp* op, uint16_t* written) {
+    uint16_t use = 0, def = 0;
+    switch (op->opcode) {
+        case OP_MOV_RI: def = 1 << op->dst; break;
+        case OP_MOV_RR: case OP_LOAD: use = 1 << op->src; def = 1 << op->dst; break;
+        case OP_STORE: use = 1 << op->dst | 1 << op->src; break;
+        case OP_CMP_RR: use = 1 << op->dst | 1 << op->src; break;
+        case OP_CMP_RI: use = 1 << op->dst; break;
+        case OP_ADD_RR: case OP_SUB_RR: case OP_AND_RR: case OP_OR_RR: case OP_XOR_RR:
+            use = 1 << op->dst | 1 << op->src; def = 1 << op->dst; break;
+        case OP_ADD_RI: case OP_SUB_RI: case OP_AND_RI: case OP_OR_RI: case OP_XOR_RI:
+            use = def = 1 << op->dst; break;
+        case OP_PUSH: use = 1 << op->src | 1 << RSP; def = 1 << RSP; break;
+        case OP_POP: use = 1 << RSP; def = 1 << op->dst | 1 << RSP; break;
+        case OP_XCHG: case OP_XADD: use = 1 << op->dst | 1 << op->src; def = 1 << op->src; break;
+        case OP_CMPXCHG: use = 1 << op->dst | 1 << op->src | 1 << RAX; def = 1 << RAX; break;
+        case OP_CALL: case OP_RET: use = def = 1 << RSP; break;
+        case OP_MOV_FROM_CR3: def = 1 << op->dst; break;
+        default: break;
+    }
+    *written |= def;
+    return use | def;
+}
+
+static inline bool op_accesses_memory(uint8_t opcode) {
+    return opcode == OP_LOAD || opcode == OP_STORE || opcode == OP_PUSH || opcode == OP_POP ||
+           opcode == OP_XCHG || opcode == OP_XADD || opcode == OP_CMPXCHG ||
+           opcode == OP_CALL || opcode == OP_RET;
+}
+
+static inline bool op_sets_flags(uint8_t opcode) {
+    return (opcode >= OP_ADD_RR && opcode <= OP_XOR_RI) ||
+           opcode == OP_XADD || opcode == OP_CMPXCHG;
+}
+
+typedef struct {
+    JitAsm a;
+    VirtualCPU* cpu;
+    TranslatedBlock* block;
+    int8_t host[16];       // Host register of each pinned guest register
+    uint16_t written;
+    bool paged;            // Compiled with paging on; a CR3 write flushes it
+    uint32_t accesses[BLOCK_MAX_OPS + 2];  // Memory ops before each op
+    uint8_t* side_exits[BLOCK_MAX_OPS + 1][4];  // Jumps to each op's side exit
+    uint8_t side_count[BLOCK_MAX_OPS + 1];
+} JitCompiler;
+
+static void jit_spill(JitCompiler* c) {
+    for (int g = 0; g < 16; g++) {
+        if (c->written & (1 << g)) {
+            jit_mem(&c->a, true, 0x89, c->host[g], JIT_CPU, -1, 0, CPU_OFF(registers[g]));
+        }
+    }
+}
+
+// Exit to a known guest address. The jump is patched to the target's code
+// once that is compiled; until then the stub returns its address.
+static void jit_exit_to(JitCompiler* c, uint8_t* rel32, uint64_t target) {
+    jit_patch(rel32, c->a.p);
+    jit_mov_imm(&c->a, RAX, target);
+    jit_mem(&c->a, true, 0x89, RAX, JIT_CPU, -1, 0, CPU_OFF(rip));
+    jit_byte(&c->a, 0x48);
+    jit_byte(&c->a, 0xB8);
+    jit_u64(&c->a, (uint64_t)(uintptr_t)rel32);  // mov rax, patch site
+    jit_patch(jit_jmp(&c->a), jit_epilogue(c->cpu));
+}
+
+// Branch to the side exit of op i: back to the interpreter at its rip
+static void jit_side_exit(JitCompiler* c, uint32_t i, uint8_t cc) {
+    uint8_t* rel = cc == 0xFF ? jit_jmp(&c->a) : jit_jcc(&c->a, cc);
+    c->side_exits[i][c->side_count[i]++] = rel;
+}
+
+// Bounds check rax against guest memory for an 8-byte access
+static void jit_check_bounds(JitCompiler* c, uint32_t i) {
+    uint64_t limit = c->cpu->memory_size - 8;
+    if (limit <= INT32_MAX) {
+        jit_byte(&c->a, 0x48);
+        jit_byte(&c->a, 0x3D);
+        jit_u32(&c->a, (uint32_t)limit);        // cmp rax, limit
+    } else {
+        jit_mov_imm(&c->a, RDX, limit);
+        jit_rr(&c->a, 0x39, RDX, RAX);          // cmp rax, rdx
+    }
+    jit_side_exit(c, i, 0x7);                   // ja
+}
+
+// Turn the guest address in rax into a host address for an 8-byte
+// access, or leave through op i's side exit. Without paging that is a
+// bounds check; with it, an inline TLB probe, where misses and page
+// crossings go to the interpreter to walk the page tables.
+static void jit_host_addr(JitCompiler* c, uint32_t i, bool write) {
+    JitAsm* a = &c->a;
+    if (!c->paged) {
+        jit_check_bounds(c, i);
+        jit_rr(a, 0x01, JIT_MEM, RAX);                                 // add rax, r13
+        return;
+    }
+    int32_t tlb = CPU_OFF(tlb);
+    int32_t tag = tlb + (int32_t)(write ? offsetof(TlbEntry, write_tag) : offsetof(TlbEntry, read_tag));
+    jit_rr(a, 0x89, RAX, RCX);                                         // mov rcx, rax
+    jit_rr(a, 0xC1, 5, RCX);                                           // shr rcx, 12
+    jit_byte(a, PAGE_SHIFT);
+    jit_alu_imm(a, 4, RCX, TLB_SIZE - 1);                              // and rcx, mask
+    jit_rr(a, 0xC1, 4, RCX);                                           // shl rcx, 5
+    jit_byte(a, 5);
+    jit_rr(a, 0x89, RAX, RDX);                                         // mov rdx, rax
+    jit_alu_imm(a, 4, RDX, -(int32_t)PAGE_SIZE);                       // and rdx, ~0xfff
+    jit_mem(a, true, 0x3B, RDX, JIT_CPU, RCX, 0, tag);                 // cmp rdx, tag
+    jit_side_exit(c, i, 0x5);                                          // jne
+    jit_rr(a, 0x89, RAX, RDX);                                         // mov rdx, rax
+    jit_alu_imm(a, 4, RDX, PAGE_MASK);                                 // and rdx, 0xfff
+    jit_alu_imm(a, 7, RDX, PAGE_SIZE - 8);                             // cmp rdx, 0xff8
+    jit_side_exit(c, i, 0x7);                                          // ja
+    jit_mem(a, true, 0x03, RAX, JIT_CPU, RCX, 0, tlb + (int32_t)offsetof(TlbEntry, addend));
+}
+
+// Stores that touch any vCPU's translated code, or straddle a page, are
+// left to the interpreter so it can invalidate the blocks. Takes the host
+// address in rax.
+static void jit_check_code_write(JitCompiler* c, uint32_t i) {
+    jit_mem(&c->a, true, 0x8D, RCX, RAX, -1, 0, 7);               // lea rcx, [rax+7]
+    jit_rr(&c->a, 0x31, RAX, RCX);                                 // xor rcx, rax
+    jit_rr(&c->a, 0xC1, 5, RCX);                                   // shr rcx, 12
+    jit_byte(&c->a, PAGE_SHIFT);
+    jit_side_exit(c, i, 0x5);                                      // jnz
+    jit_rr(&c->a, 0x89, RAX, RCX);                                 // mov rcx, rax
+    jit_rr(&c->a, 0x29, JIT_MEM, RCX);                             // sub rcx, r13
+    jit_rr(&c->a, 0xC1, 5, RCX);                                   // shr rcx, 12
+    jit_byte(&c->a, PAGE_SHIFT);
+    jit_mem(&c->a, true, 0x8B, RDX, JIT_CPU, -1, 0, CPU_OFF(code_pages));
+    jit_mem(&c->a, false, 0x83, 7, RDX, RCX, 2, 0);                // cmp [rdx+rcx*4], 0
+    jit_byte(&c->a, 0);
+    jit_side_exit(c, i, 0x5);                                      // jnz
+}
+
+// Recreate host flags from the lazy flags state. kind < 0 means the
+// flag-setting op ran in an earlier block, so dispatch at run time.
+static void jit_load_flags(JitCompiler* c, int kind) {
+    JitAsm* a = &c->a;
+    jit_mem(a, true, 0x8B, RAX, JIT_CPU, -1, 0, CPU_OFF(flags_a));
+    if (kind == FLAGS_ADD) {
+        jit_mem(a, true, 0x03, RAX, JIT_CPU, -1, 0, CPU_OFF(flags_b));  // add rax, b
+    } else if (kind == FLAGS_SUB) {
+        jit_mem(a, true, 0x3B, RAX, JIT_CPU, -1, 0, CPU_OFF(flags_b));  // cmp rax, b
+    } else if (kind == FLAGS_LOGIC) {
+        jit_rr(a, 0x85, RAX, RAX);                                          // test rax, rax
+    } else {
+        jit_mem(a, false, 0x83, 7, JIT_CPU, -1, 0, CPU_OFF(flags_op));   // cmp op, SUB
+        jit_byte(a, FLAGS_SUB);
+        uint8_t* to_sub = jit_jcc(a, 0x4);
+        jit_mem(a, false, 0x83, 7, JIT_CPU, -1, 0, CPU_OFF(flags_op));   // cmp op, ADD
+        jit_byte(a, FLAGS_ADD);
+        uint8_t* to_add = jit_jcc(a, 0x4);
+        jit_mem(a, false, 0x83, 7, JIT_CPU, -1, 0, CPU_OFF(flags_op));   // cmp op, RAW
+        jit_byte(a, FLAGS_RAW);
+        uint8_t* to_raw = jit_jcc(a, 0x4);
+        jit_rr(a, 0x85, RAX, RAX);
+        uint8_t* done1 = jit_jmp(a);
+        jit_patch(to_raw, a->p);
+        jit_mem(a, false, 0xFF, 6, JIT_CPU, -1, 0, CPU_OFF(flags_a));    // push a
+        jit_byte(a, 0x81);
+        jit_byte(a, 0x24);
+        jit_byte(a, 0x24);
+        jit_u32(a, RFLAGS_STATUS);                                          // and [rsp], status
+        jit_byte(a, 0x9D);                                                  // popfq
+        uint8_t* done3 = jit_jmp(a);
+        jit_patch(to_add, a->p);
+        jit_mem(a, true, 0x03, RAX, JIT_CPU, -1, 0, CPU_OFF(flags_b));
+        uint8_t* done2 = jit_jmp(a);
+        jit_patch(to_sub, a->p);
+        jit_mem(a, true, 0x3B, RAX, JIT_CPU, -1, 0, CPU_OFF(flags_b));
+        jit_patch(done1, a->p);
+        jit_patch(done2, a->p);
+        jit_patch(done3, a->p);
+    }
+}
+
+// One flag-setting ALU op. Only the last one in the block records the
+// lazy flags state, for whatever runs after the block.
+static void jit_alu(JitCompiler* c, const DecodedOp* op, bool record) {
+    static const uint8_t rr_opcode[] = {
+        [OP_ADD_RR] = 0x01, [OP_SUB_RR] = 0x29, [OP_CMP_RR] = 0x39,
+        [OP_AND_RR] = 0x21, [OP_OR_RR] = 0x09, [OP_XOR_RR] = 0x31
+    };
+    static const uint8_t ri_digit[] = {
+        [OP_ADD_RI] = 0, [OP_SUB_RI] = 5, [OP_CMP_RI] = 7,
+        [OP_AND_RI] = 4, [OP_OR_RI] = 1, [OP_XOR_RI] = 6
+    };
+    JitAsm* a = &c->a;
+    int d = c->host[op->dst];
+    bool imm = op->opcode == OP_ADD_RI || op->opcode == OP_SUB_RI || op->opcode == OP_CMP_RI ||
+               op->opcode == OP_AND_RI || op->opcode == OP_OR_RI || op->opcode == OP_XOR_RI;
+    uint8_t base = imm ? op->opcode - 1 : op->opcode;  // The matching _RR op
+    FlagsOp kind = base == OP_ADD_RR ? FLAGS_ADD :
+                   base == OP_SUB_RR || base == OP_CMP_RR ? FLAGS_SUB : FLAGS_LOGIC;
+
+    if (record && kind != FLAGS_LOGIC) {
+        if (imm) {
+            jit_mem(a, true, 0xC7, 0, JIT_CPU, -1, 0, CPU_OFF(flags_b));
+            jit_u32(a, (uint32_t)op->imm);
+        } else {
+            jit_mem(a, true, 0x89, c->host[op->src], JIT_CPU, -1, 0, CPU_OFF(flags_b));
+        }
+        jit_mem(a, true, 0x89, d, JIT_CPU, -1, 0, CPU_OFF(flags_a));
+    }
+    if (imm) jit_alu_imm(a, ri_digit[op->opcode], d, (int32_t)op->imm);
+    else jit_rr(a, rr_opcode[op->opcode], c->host[op->src], d);
+    if (record) {
+        if (kind == FLAGS_LOGIC) {
+            jit_mem(a, true, 0x89, d, JIT_CPU, -1, 0, CPU_OFF(flags_a));
+            jit_mem(a, true, 0xC7, 0, JIT_CPU, -1, 0, CPU_OFF(flags_b));
+            jit_u32(a, 0);
+        }
+        jit_mem(a, false, 0xC7, 0, JIT_CPU, -1, 0, CPU_OFF(flags_op));
+        jit_u32(a, kind);
+    }
+}
+
+// Compile a block to host code. Fails for blocks that touch more guest
+// registers than the pool holds.
+static bool jit_compile(VirtualCPU* cpu, TranslatedBlock* block) {
+    JitCompiler c = { .cpu = cpu, .block = block, .paged = cpu->cr3 != 0 };
+    uint16_t used = 0;
+    int last_setter = -1;
+    for (uint32_t i = 0; i < block->op_count; i++) {
+        used |= op_reg_mask(&block->ops[i], &c.written);
+        if (op_sets_flags(block->ops[i].opcode)) last_setter = i;
+        c.accesses[i + 1] = c.accesses[i] + op_accesses_memory(block->ops[i].opcode);
+    }
+    uint32_t accesses = c.paged ? c.accesses[block->op_count] : 0;
+    if (__builtin_popcount(used) > JIT_POOL_SIZE || cpu->memory_size < 8) {
+        block->jit_failed = true;
+        return false;
+    }
+    memset(c.host, -1, sizeof(c.host));
+    for (int g = 0, n = 0; g < 16; g++) {
+        if (used & (1 << g)) c.host[g] = jit_pool[n++];
+    }
+
+    size_t worst = 512 + block->op_count * 384;
+    if (cpu->jit_used + worst > JIT_BUFFER_SIZE) jit_flush(cpu);
+    jit_protect(cpu, true);
+    c.a.p = cpu->jit_buffer + cpu->jit_used;
+    uint8_t* entry = c.a.p;
+    uint32_t instructions = block->op_count;
+    if (block->ops[block->op_count - 1].opcode == OP_END) instructions--;
+
+    // Entry: leave if the run loop wants control back, count the block's
+    // instructions and TLB lookups, load the pinned guest registers
+    jit_mem(&c.a, false, 0x80, 7, JIT_CPU, -1, 0, CPU_OFF(exit_request));
+    jit_byte(&c.a, 0);
+    uint8_t* to_request = jit_jcc(&c.a, 0x5);
+    jit_mem(&c.a, true, 0x81, 0, JIT_CPU, -1, 0, CPU_OFF(instructions));
+    jit_u32(&c.a, instructions);
+    if (accesses) {
+        jit_mem(&c.a, true, 0x81, 0, JIT_CPU, -1, 0, CPU_OFF(tlb_lookups));
+        jit_u32(&c.a, accesses);
+    }
+    for (int g = 0; g < 16; g++) {
+        if (c.host[g] >= 0) {
+            jit_mem(&c.a, true, 0x8B, c.host[g], JIT_CPU, -1, 0, CPU_OFF(registers[g]));
+        }
+    }
+
+    bool flags_live = false;  // Host flags match the guest's
+    int flags_kind = -1;
+    for (uint32_t i = 0; i < block->op_count; i++) {
+        const DecodedOp* op = &block->ops[i];
+        int d = op->dst < 16 ? c.host[op->dst] : -1;
+        int s = op->src < 16 ? c.host[op->src] : -1;
+        switch (op->opcode) {
+            case OP_NOP:
+                break;
+            case OP_MOV_RI:
+                jit_mov_imm(&c.a, d, (uint64_t)op->imm);
+                break;
+            case OP_MOV_RR:
+                jit_rr(&c.a, 0x89, s, d);
+                break;
+            case OP_LOAD:
+                jit_mem(&c.a, true, 0x8D, RAX, s, -1, 0, (int32_t)op->imm);
+                jit_host_addr(&c, i, false);
+                jit_mem(&c.a, true, 0x8B, d, RAX, -1, 0, 0);
+                flags_live = false;
+                break;
+            case OP_STORE:
+                jit_mem(&c.a, true, 0x8D, RAX, d, -1, 0, (int32_t)op->imm);
+                jit_host_addr(&c, i, true);
+                jit_check_code_write(&c, i);
+                jit_mem(&c.a, true, 0x89, s, RAX, -1, 0, 0);
+                flags_live = false;
+                break;
+            case OP_PUSH:
+                jit_mem(&c.a, true, 0x8D, RAX, c.host[RSP], -1, 0, -8);
+                jit_host_addr(&c, i, true);
+                jit_check_code_write(&c, i);
+                jit_mem(&c.a, true, 0x89, s, RAX, -1, 0, 0);
+                jit_mem(&c.a, true, 0x8D, c.host[RSP], c.host[RSP], -1, 0, -8);
+                flags_live = false;
+                break;
+            case OP_POP:
+                jit_rr(&c.a, 0x89, c.host[RSP], RAX);
+                jit_host_addr(&c, i, false);
+                jit_mem(&c.a, true, 0x8D, c.host[RSP], c.host[RSP], -1, 0, 8);
+                jit_mem(&c.a, true, 0x8B, d, RAX, -1, 0, 0);
+                flags_live = false;
+                break;
+            case OP_XCHG:
+                jit_mem(&c.a, true, 0x8D, RAX, d, -1, 0, (int32_t)op->imm);
+                jit_host_addr(&c, i, true);
+                jit_check_code_write(&c, i);
+                jit_mem(&c.a, true, 0x87, s, RAX, -1, 0, 0);          // xchg [rax], s
+                flags_live = false;
+                break;
+            case OP_XADD: {
+                bool record = (int)i == last_setter;
+                jit_mem(&c.a, true, 0x8D, RAX, d, -1, 0, (int32_t)op->imm);
+                jit_host_addr(&c, i, true);
+                jit_check_code_write(&c, i);
+                if (record) jit_mem(&c.a, true, 0x89, s, JIT_CPU, -1, 0, CPU_OFF(flags_b));
+                jit_byte(&c.a, 0xF0);
+                jit_mem(&c.a, true, 0x0FC1, s, RAX, -1, 0, 0);        // lock xadd [rax], s
+                if (record) {
+                    jit_mem(&c.a, true, 0x89, s, JIT_CPU, -1, 0, CPU_OFF(flags_a));
+                    jit_mem(&c.a, false, 0xC7, 0, JIT_CPU, -1, 0, CPU_OFF(flags_op));
+                    jit_u32(&c.a, FLAGS_ADD);
+                }
+                flags_live = true;
+                flags_kind = FLAGS_ADD;
+                break;
+            }
+            case OP_CMPXCHG: {
+                // The host's own cmpxchg compares against rax, which is scratch
+                bool record = (int)i == last_setter;
+                jit_mem(&c.a, true, 0x8D, RAX, d, -1, 0, (int32_t)op->imm);
+                jit_host_addr(&c, i, true);
+                jit_check_code_write(&c, i);
+                jit_rr(&c.a, 0x89, RAX, RCX);                              // mov rcx, rax
+                jit_rr(&c.a, 0x89, c.host[RAX], RAX);                      // mov rax, guest rax
+                if (record) jit_mem(&c.a, true, 0x89, RAX, JIT_CPU, -1, 0, CPU_OFF(flags_a));
+                jit_byte(&c.a, 0xF0);
+                jit_mem(&c.a, true, 0x0FB1, s, RCX, -1, 0, 0);        // lock cmpxchg [rcx], s
+                jit_rr(&c.a, 0x89, RAX, c.host[RAX]);                      // mov guest rax, rax
+                if (record) {
+                    jit_mem(&c.a, true, 0x89, RAX, JIT_CPU, -1, 0, CPU_OFF(flags_b));
+                    jit_mem(&c.a, false, 0xC7, 0, JIT_CPU, -1, 0, CPU_OFF(flags_op));
+                    jit_u32(&c.a, FLAGS_SUB);
+                }
+                flags_live = true;
+                flags_kind = FLAGS_SUB;
+                break;
+            }
+            case OP_PAUSE:
+                jit_side_exit(&c, i, 0xFF);  // May yield the host thread
+                break;
+            case OP_MOV_FROM_CR3:
+                jit_mem(&c.a, true, 0x8B, d, JIT_CPU, -1, 0, CPU_OFF(cr3));
+                break;
+            case OP_CALL:
+                jit_mem(&c.a, true, 0x8D, RAX, c.host[RSP], -1, 0, -8);
+                jit_host_addr(&c, i, true);
+                jit_check_code_write(&c, i);
+                jit_mov_imm(&c.a, RDX, op->rip + op->length);
+                jit_mem(&c.a, true, 0x89, RDX, RAX, -1, 0, 0);
+                jit_mem(&c.a, true, 0x8D, c.host[RSP], c.host[RSP], -1, 0, -8);
+                jit_spill(&c);
+                jit_exit_to(&c, jit_jmp(&c.a), op->target);
+                break;
+            case OP_RET: {
+                // Returning to the host goes through the interpreter
+                jit_rr(&c.a, 0x89, c.host[RSP], RAX);
+                jit_mov_imm(&c.a, RDX, cpu->stack_top);
+                jit_rr(&c.a, 0x39, RDX, RAX);
+                jit_side_exit(&c, i, 0x4);
+                jit_host_addr(&c, i, false);
+                jit_mem(&c.a, true, 0x8B, RDX, RAX, -1, 0, 0);
+                jit_mem(&c.a, true, 0x8D, c.host[RSP], c.host[RSP], -1, 0, 8);
+                jit_spill(&c);
+                jit_mem(&c.a, true, 0x89, RDX, JIT_CPU, -1, 0, CPU_OFF(rip));
+                // Probe the indirect branch cache, else back to the run loop
+                static const uint8_t probe[] = {
+                    0x89, 0xD1,                                                // mov ecx, edx
+                    0x81, 0xE1, (JIT_CACHE_SIZE - 1) & 0xFF,
+                    (JIT_CACHE_SIZE - 1) >> 8, 0x00, 0x00,                     // and ecx, mask
+                    0x01, 0xC9                                                 // add ecx, ecx
+                };
+                memcpy(c.a.p, probe, sizeof(probe));
+                c.a.p += sizeof(probe);
+                jit_mem(&c.a, true, 0x39, RDX, JIT_CPU, RCX, 3, CPU_OFF(jit_cache));
+                uint8_t* miss = jit_jcc(&c.a, 0x5);
+                jit_mem(&c.a, false, 0xFF, 4, JIT_CPU, RCX, 3, CPU_OFF(jit_cache) + 8);
+                jit_patch(miss, c.a.p);
+                jit_mov_imm(&c.a, RAX, JIT_EXIT_DYNAMIC);
+                jit_patch(jit_jmp(&c.a), jit_epilogue(cpu));
+                break;
+            }
+            case OP_JMP:
+            case OP_END:
+                jit_spill(&c);
+                jit_exit_to(&c, jit_jmp(&c.a), op->target);
+                break;
+            case OP_JCC: {
+                jit_spill(&c);
+                if (!flags_live) jit_load_flags(&c, flags_kind);
+                uint8_t* taken = jit_jcc(&c.a, op->cc);
+                uint8_t* fallthrough = jit_jmp(&c.a);
+                jit_exit_to(&c, taken, op->target);
+                jit_exit_to(&c, fallthrough, op->rip + op->length);
+                break;
+            }
+            case OP_IRET:
+            case OP_OUT:
+            case OP_MOV_TO_CR3:
+            case OP_HLT:
+            case OP_UD:
+                jit_side_exit(&c, i, 0xFF);
+                break;
+            default:
+                jit_alu(&c, op, (int)i == last_setter);
+                flags_live = true;
+                flags_kind = op->opcode == OP_ADD_RR || op->opcode == OP_ADD_RI ? FLAGS_ADD :
+                             op->opcode >= OP_SUB_RR && op->opcode <= OP_CMP_RI ? FLAGS_SUB :
+                             FLAGS_LOGIC;
+                break;
+        }
+    }
+
+    // Side exits: write back, uncount the ops not run, hand the op to the
+    // interpreter
+    for (uint32_t i = 0; i < block->op_count; i++) {
+        if (!c.side_count[i]) continue;
+        for (uint32_t k = 0; k < c.side_count[i]; k++) jit_patch(c.side_exits[i][k], c.a.p);
+        jit_spill(&c);
+        jit_mem(&c.a, true, 0x81, 5, JIT_CPU, -1, 0, CPU_OFF(instructions));
+        jit_u32(&c.a, instructions - i);
+        if (accesses) {
+            jit_mem(&c.a, true, 0x81, 5, JIT_CPU, -1, 0, CPU_OFF(tlb_lookups));
+            jit_u32(&c.a, accesses - c.accesses[i]);
+        }
+        jit_mov_imm(&c.a, RAX, block->ops[i].rip);
+        jit_mem(&c.a, true, 0x89, RAX, JIT_CPU, -1, 0, CPU_OFF(rip));
+        jit_mov_imm(&c.a, RAX, JIT_EXIT_INTERPRET);
+        jit_patch(jit_jmp(&c.a), jit_epilogue(cpu));
+    }
+    jit_patch(to_request, c.a.p);
+    jit_mov_imm(&c.a, RAX, block->start);
+    jit_mem(&c.a, true, 0x89, RAX, JIT_CPU, -1, 0, CPU_OFF(rip));
+    jit_mov_imm(&c.a, RAX, JIT_EXIT_DYNAMIC);
+    jit_patch(jit_jmp(&c.a), jit_epilogue(cpu));
+
+    jit_protect(cpu, false);
+    cpu->jit_used = c.a.p - cpu->jit_buffer;
+    block->jit_code = entry;
+    cpu->blocks_compiled++;
+    return true;
+}
+
+// Tiering: count interpreted runs of a block and compile it once hot.
+// True when the block has compiled code to run.
+static bool vm_tier_up(VirtualCPU* cpu, TranslatedBlock* block) {
+    if (cpu->jit_flush_pending) jit_flush(cpu);
+    if (block->jit_code) return true;
+    if (block->jit_failed || ++block->exec_count < cpu->jit_threshold) return false;
+    bool compiled;
+    TRACE_TIMED(compile_hist, compiled = jit_compile(cpu, block));
+    return compiled;
+}
+
+// Run compiled code from block until it needs the interpreter or stops.
+// Exits to a compiled successor are patched into direct jumps.
+static void jit_run(VirtualCPU* cpu, TranslatedBlock* block) {
+    JitEntry enter = (JitEntry)(void*)cpu->jit_buffer;
+    const uint8_t* code = block->jit_code;
+    for (;;) {
+        uintptr_t exit = enter(cpu, code, cpu->memory);
+        if (exit == JIT_EXIT_INTERPRET) {
+            vm_emulate_instruction(cpu);
+            return;
+        }
+        if (__atomic_load_n(&cpu->exit_request, __ATOMIC_ACQUIRE) || !cpu->running) return;
+
+        uint64_t epoch = cpu->jit_epoch;
+        TranslatedBlock* next = vm_find_block(cpu, cpu->rip);
+        if (!next || !vm_tier_up(cpu, next)) return;
+        if (cpu->jit_epoch != epoch) return;  // The exit's code is gone
+        if (exit == JIT_EXIT_DYNAMIC) {
+            JitCacheEntry* e = &cpu->jit_cache[next->start & (JIT_CACHE_SIZE - 1)];
+            e->rip = next->start;
+            e->code = next->jit_code;
+        } else if (cpu->jit_chain) {
+            jit_protect(cpu, true);
+            jit_patch((uint8_t*)exit, next->jit_code);
+            jit_protect(cpu, false);
+        }
+        code = next->jit_code;
+    }
+}
+
+static bool jit_init(VirtualCPU* cpu) {
+    void* buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) return false;
+    cpu->jit_buffer = buffer;
+    jit_emit_trampoline(cpu);
+    jit_protect(cpu, false);
+    cpu->jit_threshold = JIT_HOT_THRESHOLD;
+    cpu->jit_chain = true;
+    return true;
+}
+
+#else
+
+static bool vm_tier_up(VirtualCPU* cpu, TranslatedBlock* block) {
+    (void)cpu;
+    (void)block;
+    return false;
+}
+
+static void jit_run(VirtualCPU* cpu, TranslatedBlock* block) {
+    vm_execute(cpu, block, true);
+}
+
+static bool jit_init(VirtualCPU* cpu) {
+    (void)cpu;
+    return false;
+}
+
+#endif
+
+/* vCPUs and Interrupts */
+
+// Futex-style wait/wake on a 32-bit word, with a polling fallback
+static void vcpu_wait(uint32_t* word, uint32_t expected) {
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#else
+    while (__atomic_load_n(word, __ATOMIC_ACQUIRE) == expected) sched_yield();
+#endif
+}
+
+static void vcpu_kick(VirtualCPU* cpu) {
+    __atomic_store_n(&cpu->exit_request, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&cpu->wake_seq, 1, __ATOMIC_RELEASE);
+#ifdef __linux__
+    syscall(SYS_futex, &cpu->wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+// Post vector to target, or to every vCPU but the source for
+// IPI_ALL_BUT_SELF. It is taken at the target's next block boundary.
+static void vm_raise_ipi(VirtualMachine* vm, uint32_t source, uint32_t target, uint32_t vector) {
+    for (uint32_t i = 0; i < vm->vcpu_count; i++) {
+        if (target == IPI_ALL_BUT_SELF ? i == source : i != target) continue;
+        __atomic_fetch_or(&vm->vcpus[i]->pending_ipis, 1u << vector, __ATOMIC_RELEASE);
+        vcpu_kick(vm->vcpus[i]);
+        TRACE_COUNT(ipi_counter, 1);
     }
 }
 
-// Main VM execution loop
+// Interrupt a vCPU from the host
+void vm_send_ipi(VirtualMachine* vm, uint32_t target, uint32_t vector) {
+    if (vector < VM_VECTORS) vm_raise_ipi(vm, UINT32_MAX, target, vector);
+}
+
+void vm_set_interrupt_handler(VirtualMachine* vm, uint32_t vector, uint64_t handler) {
+    if (vector >= VM_VECTORS) return;
+    vm->ivt[vector] = handler;
+    vm->ivt_mask |= 1u << vector;
+}
+
+// Enter the handler for vector: push RFLAGS and RIP, as a flat model of
+// the 64-bit interrupt frame, and hold off further interrupts until
+// IRETQ. False if the vector has no handler and was dropped.
+static bool vcpu_deliver(VirtualCPU* cpu, uint32_t vector) {
+    __atomic_fetch_and(&cpu->pending_ipis, ~(1u << vector), __ATOMIC_ACQ_REL);
+    if (!(cpu->vm->ivt_mask & (1u << vector))) return false;
+
+    uint64_t frame[2] = { cpu->rip, vm_get_rflags(cpu) };
+    uint64_t sp = cpu->registers[RSP] - sizeof(frame);
+    uint8_t* p = guest_ptr(cpu, sp, sizeof(frame), true);
+    if (!p) {
+        printf("Memory fault at 0x%lx delivering vector %u on vCPU %u\n", sp, vector, cpu->id);
+        cpu->running = false;
+        return true;
+    }
+    memcpy(p, frame, sizeof(frame));
+    vm_code_write(cpu, guest_phys(cpu, p), sizeof(frame));
+    cpu->registers[RSP] = sp;
+    cpu->rip = cpu->vm->ivt[vector];
+    cpu->in_interrupt = true;
+    cpu->halted = false;
+    cpu->ipis_received++;
+    TRACE_INSTANT("deliver_ipi", vector);
+    return true;
+}
+
+// Handle whatever raised exit_request: a stop, a code flush another vCPU
+// asked for, a pending interrupt, or HLT waiting for one
+static void vcpu_service(VirtualCPU* cpu) {
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&cpu->wake_seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&cpu->exit_request, 0, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&cpu->stop_request, __ATOMIC_ACQUIRE)) {
+            cpu->running = false;
+            return;
+        }
+        if (__atomic_exchange_n(&cpu->flush_request, 0, __ATOMIC_ACQ_REL)) {
+            vm_flush_blocks(cpu);
+        }
+        uint32_t pending = __atomic_load_n(&cpu->pending_ipis, __ATOMIC_ACQUIRE);
+        if (pending && !cpu->in_interrupt) {
+            if (vcpu_deliver(cpu, __builtin_ctz(pending))) return;
+            continue;  // No handler, so it was dropped
+        }
+        if (!cpu->halted) return;
+        vcpu_wait(&cpu->wake_seq, seq);
+    }
+}
+
+// Run one vCPU until it stops. Interpret until a block is hot, then run
+// compiled code until it needs the interpreter again.
+static void vcpu_loop(VirtualCPU* cpu) {
+    bool trace = cpu->vm->trace;
+    TRACE_BEGIN("vcpu_run");
+    while (cpu->running) {
+        if (__atomic_load_n(&cpu->exit_request, __ATOMIC_ACQUIRE)) {
+            vcpu_service(cpu);
+            continue;
+        }
+        if (trace) {
+            vm_emulate_instruction(cpu);
+            continue;
+        }
+        if (cpu->retired) vm_free_retired(cpu);
+        TranslatedBlock* block = vm_find_block(cpu, cpu->rip);
+        if (!block) {
+            printf("Out of memory translating RIP: 0x%lx\n", cpu->rip);
+            break;
+        }
+        if (cpu->jit_threshold && vm_tier_up(cpu, block)) jit_run(cpu, block);
+        else vm_execute(cpu, block, true);
+    }
+    cpu->running = false;
+    vm_free_retired(cpu);
+    cpu->rflags = vm_get_rflags(cpu);
+    TRACE_END("vcpu_run");
+}
+
+static void* vcpu_thread(void* arg) {
+    trace_thread_name("vcpu");
+    vcpu_loop(arg);
+    return NULL;
+}
+
+// Run the VM from its vCPUs' current state. vCPU 0 runs on the calling
+// thread and the rest on their own threads; the VM is done when vCPU 0 is.
+void vm_resume(VirtualMachine* vm) {
+    bool started[VM_MAX_VCPUS] = { false };
+    for (uint32_t i = 0; i < vm->vcpu_count; i++) {
+        VirtualCPU* cpu = vm->vcpus[i];
+        cpu->running = true;
+        cpu->halted = cpu->in_interrupt = false;
+        cpu->stop_request = 0;
+        cpu->stack_top = vm->memory_size - (uint64_t)i * VCPU_STACK_SIZE;
+    }
+
+    if (vm->trace) printf("Starting VM execution...\n");
+    for (uint32_t i = 1; i < vm->vcpu_count; i++) {
+        VirtualCPU* cpu = vm->vcpus[i];
+        started[i] = pthread_create(&cpu->thread, NULL, vcpu_thread, cpu) == 0;
+        if (!started[i]) {
+            printf("Failed to start vCPU %u\n", i);
+            cpu->running = false;
+        }
+    }
+    vcpu_loop(vm->vcpus[0]);
+    for (uint32_t i = 1; i < vm->vcpu_count; i++) {
+        VirtualCPU* cpu = vm->vcpus[i];
+        __atomic_store_n(&cpu->stop_request, 1, __ATOMIC_RELEASE);
+        vcpu_kick(cpu);
+    }
+    for (uint32_t i = 1; i < vm->vcpu_count; i++) {
+        if (started[i]) pthread_join(vm->vcpus[i]->thread, NULL);
+    }
+    if (vm->trace) printf("VM execution completed.\n");
+}
+
+// Main VM execution loop. Every vCPU starts at address 0 with its id in
+// RDI and the vCPU count in RSI.
 void vm_run(VirtualMachine* vm) {
-    vm->running = true;
-    vm->vcpu.rip = 0;  // Start execution from address 0
+    for (uint32_t i = 0; i < vm->vcpu_count; i++) {
+        VirtualCPU* cpu = vm->vcpus[i];
+        cpu->rip = 0;  // Start execution from address 0
+        cpu->registers[RSP] = vm->memory_size - (uint64_t)i * VCPU_STACK_SIZE;
+        cpu->registers[RDI] = i;
+        cpu->registers[RSI] = vm->vcpu_count;
+    }
+    vm_resume(vm);
+}
 
-    printf("Starting VM execution...\n");
-    while (vm->running) {
-        vm_emulate_instruction(vm);
+// Point every vCPU at the page tables rooted at cr3, or turn paging off
+// with 0
+void vm_set_cr3(VirtualMachine* vm, uint64_t cr3) {
+    for (uint32_t i = 0; i < vm->vcpu_count; i++) {
+        VirtualCPU* cpu = vm->vcpus[i];
+        cpu->cr3 = cr3 & PTE_ADDR;
+        mmu_flush(cpu);
+        vm_flush_blocks(cpu);
+    }
+}
+
+// Per-vCPU counters
+void vm_print_vcpu_stats(VirtualMachine* vm) {
+    printf("%-5s %12s %8s %9s %6s %8s\n", "vCPU", "instructions", "blocks", "compiled", "IPIs", "pauses");
+    for (uint32_t i = 0; i < vm->vcpu_count; i++) {
+        VirtualCPU* cpu = vm->vcpus[i];
+        printf("%-5u %12lu %8lu %9lu %6lu %8lu\n", i, cpu->instructions,
+               cpu->blocks_translated, cpu->blocks_compiled, cpu->ipis_received, cpu->pauses);
     }
-    printf("VM execution completed.\n");
 }
 
 // Clean up VM resources
 void vm_destroy(VirtualMachine* vm) {
     if (vm) {
-        if (vm->memory) munmap(vm->memory, vm->memory_size);
+        size_t pages = vm_page_count(vm->memory_size);
+        for (uint32_t i = 0; i < vm->vcpu_count; i++) {
+            VirtualCPU* cpu = vm->vcpus[i];
+            vm_flush_blocks(cpu);
+            munmap(cpu->page_blocks, pages * sizeof(TranslatedBlock*));
+            if (cpu->jit_buffer) munmap(cpu->jit_buffer, JIT_BUFFER_SIZE);
+            free(cpu);
+        }
+        if (vm->code_pages) munmap(vm->code_pages, pages * sizeof(uint32_t));
+        if (vm->memory) munmap(vm->memory, vm->mapped_size);
         free(vm);
     }
 }
 
-int main() {
+/* Snapshots */
+
+// A snapshot file is a page of header followed by guest memory, page for
+// page, so the memory can be mapped straight from the file. Pages the
+// guest never touched or left zero are holes and take no disk space.
+#define SNAPSHOT_MAGIC "VMSNAP01"
+#define SNAPSHOT_MEMORY_OFFSET PAGE_SIZE
+
+typedef struct {
+    uint64_t registers[16];
+    uint64_t rip;
+    uint64_t rflags;
+    uint64_t cr3;
+    uint64_t instructions;
+} VcpuState;
+
+typedef struct {
+    char magic[8];
+    uint64_t memory_size;
+    uint32_t vcpu_count;
+    uint32_t ivt_mask;
+    uint64_t ivt[VM_VECTORS];
+    VcpuState vcpus[VM_MAX_VCPUS];
+} VmSnapshotHeader;
+
+_Static_assert(sizeof(VmSnapshotHeader) <= SNAPSHOT_MEMORY_OFFSET, "header overlaps guest memory");
+
+// An open snapshot that VMs are cloned from
+typedef struct {
+    int fd;
+    VmSnapshotHeader header;
+} VmSnapshot;
+
+static bool vm_write_all(int fd, const uint8_t* p, size_t size, off_t offset) {
+    while (size) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool vm_page_is_zero(const uint8_t* page) {
+    const uint64_t* q = (const uint64_t*)page;
+    for (size_t i = 0; i < PAGE_SIZE / 8; i++) {
+        if (q[i]) return false;
+    }
+    return true;
+}
+
+// Save a stopped VM to path. Decoded blocks and compiled code are host
+// state, so they are not saved; clones rebuild their own.
+bool vm_snapshot(VirtualMachine* vm, const char* path) {
+    VmSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.memory_size = vm->memory_size;
+    header.vcpu_count = vm->vcpu_count;
+    header.ivt_mask = vm->ivt_mask;
+    memcpy(header.ivt, vm->ivt, sizeof(header.ivt));
+    for (uint32_t i = 0; i < vm->vcpu_count; i++) {
+        const VirtualCPU* cpu = vm->vcpus[i];
+        VcpuState* state = &header.vcpus[i];
+        memcpy(state->registers, cpu->registers, sizeof(state->registers));
+        state->rip = cpu->rip;
+        state->rflags = vm_get_rflags(cpu);
+        state->cr3 = cpu->cr3;
+        state->instructions = cpu->instructions;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return false;
+    size_t pages = vm_page_count(vm->memory_size);
+    unsigned char* resident = malloc(pages);
+    bool ok = resident && ftruncate(fd, SNAPSHOT_MEMORY_OFFSET + vm->memory_size) == 0 &&
+              vm_write_all(fd, (const uint8_t*)&header, sizeof(header), 0);
+    // Pages the host never backed are zero, so only resident ones are read
+    if (ok && mincore(vm->memory, pages * PAGE_SIZE, resident) != 0) memset(resident, 1, pages);
+
+    // Write each run of nonzero pages with one call
+    const uint8_t* memory = vm->memory;
+    for (size_t i = 0; ok && i < pages; ) {
+        if (!(resident[i] & 1) || vm_page_is_zero(memory + i * PAGE_SIZE)) {
+            i++;
+            continue;
+        }
+        size_t end = i + 1;
+        while (end < pages && (resident[end] & 1) && !vm_page_is_zero(memory + end * PAGE_SIZE)) end++;
+        size_t bytes = (end == pages ? vm->memory_size : end * PAGE_SIZE) - i * PAGE_SIZE;
+        ok = vm_write_all(fd, memory + i * PAGE_SIZE, bytes, SNAPSHOT_MEMORY_OFFSET + i * PAGE_SIZE);
+        i = end;
+    }
+    free(resident);
+    if (close(fd) != 0) ok = false;
+    if (!ok) unlink(path);
+    return ok;
+}
+
+void vm_snapshot_close(VmSnapshot* snap) {
+    if (snap) {
+        if (snap->fd >= 0) close(snap->fd);
+        free(snap);
+    }
+}
+
+VmSnapshot* vm_snapshot_open(const char* path) {
+    VmSnapshot* snap = calloc(1, sizeof(VmSnapshot));
+    if (!snap) return NULL;
+    snap->fd = open(path, O_RDONLY);
+    const VmSnapshotHeader* h = &snap->header;
+    struct stat st;
+    // Clones map memory_size bytes of the file, so all of them must be
+    // there: an access past the end of the file would SIGBUS the host
+    if (snap->fd < 0 || pread(snap->fd, &snap->header, sizeof(snap->header), 0) != sizeof(snap->header) ||
+        memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->vcpu_count == 0 || h->vcpu_count > VM_MAX_VCPUS ||
+        h->memory_size == 0 || (h->memory_size & PAGE_MASK) != 0 || h->memory_size > SIZE_MAX ||
+        fstat(snap->fd, &st) != 0 || (uint64_t)st.st_size < SNAPSHOT_MEMORY_OFFSET ||
+        (uint64_t)st.st_size - SNAPSHOT_MEMORY_OFFSET < h->memory_size) {
+        vm_snapshot_close(snap);
+        return NULL;
+    }
+    return snap;
+}
+
+// A new VM in the snapshot's state; vm_resume continues it. Guest memory
+// maps the file copy-on-write, so clones share the host's page cache copy
+// of every page until they write to it, and nothing is read in until the
+// guest touches it.
+VirtualMachine* vm_clone(const VmSnapshot* snap) {
+    const VmSnapshotHeader* h = &snap->header;
+    VirtualMachine* vm = calloc(1, sizeof(VirtualMachine));
+    if (!vm) return NULL;
+    void* memory = mmap(NULL, h->memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE,
+                        snap->fd, SNAPSHOT_MEMORY_OFFSET);
+    if (memory == MAP_FAILED) {
+        free(vm);
+        return NULL;
+    }
+    vm->memory = memory;
+    vm->memory_size = vm->mapped_size = h->memory_size;
+    vm->backing = "snapshot, copy-on-write";
+    if (!vm_init_vcpus(vm, h->vcpu_count)) return NULL;
+
+    memcpy(vm->ivt, h->ivt, sizeof(vm->ivt));
+    vm->ivt_mask = h->ivt_mask;
+    for (uint32_t i = 0; i < vm->vcpu_count; i++) {
+        VirtualCPU* cpu = vm->vcpus[i];
+        const VcpuState* state = &h->vcpus[i];
+        memcpy(cpu->registers, state->registers, sizeof(cpu->registers));
+        cpu->rip = state->rip;
+        cpu->rflags = cpu->flags_a = state->rflags;
+        cpu->flags_op = FLAGS_RAW;
+        cpu->cr3 = state->cr3;
+        cpu->instructions = state->instructions;
+    }
+    return vm;
+}
+
+/* Benchmarks */
+
+// Loop-heavy guest: per iteration an add, a store and load through the
+// stack, a call with push/pop and a Jcc inside, then the loop branch.
+//   mov ecx, N; xor rax, rax
+//   loop: add rax, rcx; mov [rsp-8], rax; mov rdx, [rsp-8]; call f
+//         sub rcx, 1; jne loop; ret
+//   f: push rbx; mov rbx, rdx; and rbx, 0xff; cmp rbx, 0x10; jb 1f
+//      add rdx, rbx
+//   1: pop rbx; ret
+static const uint8_t bench_program[] = {
+    0xb9, 0x00, 0x00, 0x00, 0x00,               // mov ecx, N (patched)
+    0x48, 0x31, 0xc0,                           // xor rax, rax
+    0x48, 0x01, 0xc8,                           // add rax, rcx
+    0x48, 0x89, 0x44, 0x24, 0xf8,               // mov [rsp-8], rax
+    0x48, 0x8b, 0x54, 0x24, 0xf8,               // mov rdx, [rsp-8]
+    0xe8, 0x07, 0x00, 0x00, 0x00,               // call f
+    0x48, 0x83, 0xe9, 0x01,                     // sub rcx, 1
+    0x75, 0xe8,                                 // jne loop
+    0xc3,                                       // ret
+    0x53,                                       // f: push rbx
+    0x48, 0x89, 0xd3,                           // mov rbx, rdx
+    0x48, 0x81, 0xe3, 0xff, 0x00, 0x00, 0x00,   // and rbx, 0xff
+    0x48, 0x83, 0xfb, 0x10,                     // cmp rbx, 0x10
+    0x72, 0x03,                                 // jb 1f
+    0x48, 0x01, 0xda,                           // add rdx, rbx
+    0x5b,                                       // 1: pop rbx
+    0xc3                                        // ret
+};
+
+static uint64_t bench_expected(uint32_t n) {
+    uint64_t rax = 0;
+    for (uint64_t rcx = n; rcx != 0; rcx--) rax += rcx;
+    return rax;
+}
+
+// Guest MIPS of the single-step decoder, the decode cache and the JIT
+void vm_benchmark_dispatch(void) {
+    const uint32_t iterations = 2000000;
+    uint8_t program[sizeof(bench_program)];
+    memcpy(program, bench_program, sizeof(program));
+    memcpy(program + 1, &iterations, 4);
+
+    static const char* engines[] = { "single-step", "threaded", "jit-unchained", "jit" };
+    printf("%-14s %12s %10s %8s %9s\n", "engine", "instructions", "MIPS", "blocks", "compiled");
+    for (int engine = 0; engine < 4; engine++) {
+        VirtualMachine* vm = vm_create(1024 * 1024);
+        if (!vm) return;
+        VirtualCPU* cpu = vm->vcpus[0];
+        vm_load_binary(vm, program, sizeof(program), 0);
+        if (engine >= 2 && !cpu->jit_buffer) {
+            vm_destroy(vm);
+            continue;  // No JIT on this host
+        }
+        if (engine < 2) cpu->jit_threshold = 0;
+        if (engine == 2) cpu->jit_chain = false;
+        uint64_t t0 = trace_clock_ns();
+        if (engine > 0) {
+            vm_run(vm);
+        } else {
+            // The old loop: decode every instruction every time it runs
+            cpu->running = true;
+            cpu->stack_top = cpu->registers[RSP] = vm->memory_size;
+            while (cpu->running) vm_emulate_instruction(cpu);
+        }
+        uint64_t t1 = trace_clock_ns();
+        printf("%-14s %12lu %10.1f %8lu %9lu\n", engines[engine],
+               cpu->instructions, cpu->instructions * 1e3 / (t1 - t0),
+               cpu->blocks_translated, cpu->blocks_compiled);
+        if (cpu->registers[RAX] != bench_expected(iterations)) {
+            printf("Benchmark result mismatch: 0x%lx\n", cpu->registers[RAX]);
+        }
+        vm_destroy(vm);
+    }
+}
+
+// SMP guest, run by every vCPU. Each counts down its own loop; every
+// 16th iteration it bumps a shared counter with LOCK XADD and another
+// under a CMPXCHG spinlock. Done, the APs HLT and vCPU 0 waits for
+// them, IPIs them all, and returns once every handler has acked.
+//   mov ebp, 0x8000; mov ecx, N; xor r8, r8
+//   loop: add r8, rcx; mov rax, rcx; and rax, 15; jne skip
+//         mov edx, 1; lock xadd [rbp+16], rdx
+//   spin: xor rax, rax; mov edx, 1; lock cmpxchg [rbp+24], rdx; je got
+//         pause; jmp spin
+//   got:  mov rax, [rbp+32]; add rax, 1; mov [rbp+32], rax
+//         xor rax, rax; xchg [rbp+24], rax
+//   skip: sub rcx, 1; jne loop
+//   mov edx, 1; lock xadd [rbp], rdx; cmp rdi, 0; jne idle
+//   wait_done: pause; mov rax, [rbp]; cmp rax, rsi; jne wait_done
+//   mov eax, 0x1ff; out 0xe0, eax; mov rbx, rsi; sub rbx, 1
+//   wait_ack: pause; mov rax, [rbp+8]; cmp rax, rbx; jne wait_ack; ret
+//   idle: hlt; jmp idle
+//   handler: push rdx; mov edx, 1; lock xadd [rbp+8], rdx; pop rdx; iretq
+#define SMP_DATA 0x8000
+#define SMP_HANDLER 0x8a
+#define SMP_IPI_VECTOR 1
+static const uint8_t smp_program[] = {
+    0xbd, 0x00, 0x80, 0x00, 0x00,               // mov ebp, 0x8000
+    0xb9, 0x00, 0x00, 0x00, 0x00,               // mov ecx, N (patched)
+    0x4d, 0x31, 0xc0,                           // xor r8, r8
+    0x49, 0x01, 0xc8,                           // loop: add r8, rcx
+    0x48, 0x89, 0xc8,                           // mov rax, rcx
+    0x48, 0x83, 0xe0, 0x0f,                     // and rax, 15
+    0x75, 0x32,                                 // jne skip
+    0xba, 0x01, 0x00, 0x00, 0x00,               // mov edx, 1
+    0xf0, 0x48, 0x0f, 0xc1, 0x55, 0x10,         // lock xadd [rbp+16], rdx
+    0x48, 0x31, 0xc0,                           // spin: xor rax, rax
+    0xba, 0x01, 0x00, 0x00, 0x00,               // mov edx, 1
+    0xf0, 0x48, 0x0f, 0xb1, 0x55, 0x18,         // lock cmpxchg [rbp+24], rdx
+    0x74, 0x04,                                 // je got
+    0xf3, 0x90,                                 // pause
+    0xeb, 0xec,                                 // jmp spin
+    0x48, 0x8b, 0x45, 0x20,                     // got: mov rax, [rbp+32]
+    0x48, 0x83, 0xc0, 0x01,                     // add rax, 1
+    0x48, 0x89, 0x45, 0x20,                     // mov [rbp+32], rax
+    0x48, 0x31, 0xc0,                           // xor rax, rax
+    0x48, 0x87, 0x45, 0x18,                     // xchg [rbp+24], rax
+    0x48, 0x83, 0xe9, 0x01,                     // skip: sub rcx, 1
+    0x75, 0xbc,                                 // jne loop
+    0xba, 0x01, 0x00, 0x00, 0x00,               // mov edx, 1
+    0xf0, 0x48, 0x0f, 0xc1, 0x55, 0x00,         // lock xadd [rbp], rdx
+    0x48, 0x83, 0xff, 0x00,                     // cmp rdi, 0
+    0x75, 0x25,                                 // jne idle
+    0xf3, 0x90,                                 // wait_done: pause
+    0x48, 0x8b, 0x45, 0x00,                     // mov rax, [rbp]
+    0x48, 0x39, 0xf0,                           // cmp rax, rsi
+    0x75, 0xf5,                                 // jne wait_done
+    0xb8, 0xff, 0x01, 0x00, 0x00,               // mov eax, 0x1ff
+    0xe7, 0xe0,                                 // out 0xe0, eax
+    0x48, 0x89, 0xf3,                           // mov rbx, rsi
+    0x48, 0x83, 0xeb, 0x01,                     // sub rbx, 1
+    0xf3, 0x90,                                 // wait_ack: pause
+    0x48, 0x8b, 0x45, 0x08,                     // mov rax, [rbp+8]
+    0x48, 0x39, 0xd8,                           // cmp rax, rbx
+    0x75, 0xf5,                                 // jne wait_ack
+    0xc3,                                       // ret
+    0xf4,                                       // idle: hlt
+    0xeb, 0xfd,                                 // jmp idle
+    0x52,                                       // handler: push rdx
+    0xba, 0x01, 0x00, 0x00, 0x00,               // mov edx, 1
+    0xf0, 0x48, 0x0f, 0xc1, 0x55, 0x08,         // lock xadd [rbp+8], rdx
+    0x5a,                                       // pop rdx
+    0x48, 0xcf                                  // iretq
+};
+
+// Run smp_program on vcpus vCPUs; false if the shared counters are off
+static bool vm_run_smp(uint32_t vcpus, uint32_t iterations, bool stats, uint64_t* instructions) {
+    uint8_t program[sizeof(smp_program)];
+    memcpy(program, smp_program, sizeof(program));
+    memcpy(program + 6, &iterations, 4);
+
+    VirtualMachine* vm = vm_create_smp(1024 * 1024, vcpus, 0);
+    if (!vm) return false;
+    vm_load_binary(vm, program, sizeof(program), 0);
+    vm_set_interrupt_handler(vm, SMP_IPI_VECTOR, SMP_HANDLER);
+    vm_run(vm);
+
+    uint64_t data[5];
+    memcpy(data, (uint8_t*)vm->memory + SMP_DATA, sizeof(data));
+    uint64_t expected = (uint64_t)vcpus * (iterations / 16);
+    bool ok = data[0] == vcpus && data[1] == vcpus - 1 && data[2] == expected && data[4] == expected;
+    if (!ok) {
+        printf("SMP counters off: done %lu, acks %lu, xadd %lu, locked %lu (expected %lu)\n",
+               data[0], data[1], data[2], data[4], expected);
+    }
+    if (stats) vm_print_vcpu_stats(vm);
+    *instructions = 0;
+    for (uint32_t i = 0; i < vcpus; i++) *instructions += vm->vcpus[i]->instructions;
+    vm_destroy(vm);
+    return ok;
+}
+
+static void vm_demo_smp(void) {
+    uint64_t instructions;
+    printf("SMP guest on 4 vCPUs:\n");
+    if (vm_run_smp(4, 100000, true, &instructions)) {
+        printf("Shared counters consistent, %lu instructions in total\n", instructions);
+    }
+}
+
+// Aggregate guest MIPS as vCPUs are added, each with the same work.
+// Scaling is bounded by the host CPUs the threads can actually use.
+void vm_benchmark_smp(void) {
+    const uint32_t iterations = 2000000;
+    printf("Host CPUs online: %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-6s %12s %10s %10s %8s\n", "vCPUs", "instructions", "ms", "MIPS", "speedup");
+    double base = 0;
+    for (uint32_t vcpus = 1; vcpus <= 4; vcpus *= 2) {
+        uint64_t instructions;
+        uint64_t t0 = trace_clock_ns();
+        vm_run_smp(vcpus, iterations, false, &instructions);
+        uint64_t t1 = trace_clock_ns();
+        double mips = instructions * 1e3 / (t1 - t0);
+        if (vcpus == 1) base = mips;
+        printf("%-6u %12lu %10.1f %10.1f %7.2fx\n", vcpus, instructions,
+               (t1 - t0) / 1e6, mips, mips / base);
+    }
+}
+
+// Paged guest in a 16 GB VM. The page tables map the code read-only at
+// 0, a 1 GB page of data at 1 GB and a 2 MB stack page just below 16 GB.
+// The guest adds into 64 pages of the data page, 68 KB apart so they
+// share no TLB slot, 1000 times over.
+//   mov ebx, 0x40000000; mov r9d, 1000
+//   outer: mov rdx, rbx; mov ecx, 64
+//   inner: mov rax, [rdx]; add rax, rcx; mov [rdx], rax
+//          add rdx, 0x11000; sub rcx, 1; jne inner
+//   sub r9, 1; jne outer; mov rax, cr3; ret
+#define PAGING_MEMORY (16ull << 30)
+#define PAGING_PASSES 1000
+#define PAGING_STRIDE 0x11000
+static const uint8_t paging_program[] = {
+    0xbb, 0x00, 0x00, 0x00, 0x40,               // mov ebx, 0x40000000
+    0x41, 0xb9, 0xe8, 0x03, 0x00, 0x00,         // mov r9d, 1000
+    0x48, 0x89, 0xda,                           // outer: mov rdx, rbx
+    0xb9, 0x40, 0x00, 0x00, 0x00,               // mov ecx, 64
+    0x48, 0x8b, 0x02,                           // inner: mov rax, [rdx]
+    0x48, 0x01, 0xc8,                           // add rax, rcx
+    0x48, 0x89, 0x02,                           // mov [rdx], rax
+    0x48, 0x81, 0xc2, 0x00, 0x10, 0x01, 0x00,   // add rdx, 0x11000
+    0x48, 0x83, 0xe9, 0x01,                     // sub rcx, 1
+    0x75, 0xea,                                 // jne inner
+    0x49, 0x83, 0xe9, 0x01,                     // sub r9, 1
+    0x75, 0xdc,                                 // jne outer
+    0x0f, 0x20, 0xd8,                           // mov rax, cr3
+    0xc3                                        // ret
+};
+
+static void vm_set_pte(VirtualMachine* vm, uint64_t table, uint32_t index, uint64_t entry) {
+    memcpy((uint8_t*)vm->memory + table + index * 8, &entry, 8);
+}
+
+// Resident bytes of guest memory, by asking the host which pages it has
+static size_t vm_resident_bytes(VirtualMachine* vm) {
+    size_t pages = vm->mapped_size / PAGE_SIZE, resident = 0;
+    unsigned char* vec = malloc(pages);
+    if (!vec) return 0;
+    if (mincore(vm->memory, vm->mapped_size, vec) == 0) {
+        for (size_t i = 0; i < pages; i++) resident += vec[i] & 1;
+    }
+    free(vec);
+    return resident * PAGE_SIZE;
+}
+
+static void vm_demo_paging(uint32_t flags) {
+    VirtualMachine* vm = vm_create_smp(PAGING_MEMORY, 1, flags);
+    if (!vm) {
+        printf("Failed to create a %llu MB VM\n", PAGING_MEMORY >> 20);
+        return;
+    }
+    VirtualCPU* cpu = vm->vcpus[0];
+    vm_load_binary(vm, paging_program, sizeof(paging_program), 0);
+
+    // PML4 at 0x1000, PDPT at 0x2000, then a PD and PT for the code and
+    // a PD for the stack
+    const uint64_t pml4 = 0x1000, pdpt = 0x2000, pd_low = 0x3000, pt_low = 0x4000, pd_top = 0x5000;
+    const uint64_t rw = PTE_PRESENT | PTE_WRITABLE;
+    vm_set_pte(vm, pml4, 0, pdpt | rw);
+    vm_set_pte(vm, pdpt, 0, pd_low | rw);
+    vm_set_pte(vm, pd_low, 0, pt_low | rw);
+    vm_set_pte(vm, pt_low, 0, 0 | PTE_PRESENT);                         // Code, read-only
+    vm_set_pte(vm, pdpt, 1, (1ull << 30) | rw | PTE_LARGE);             // 1 GB data page
+    vm_set_pte(vm, pdpt, 15, pd_top | rw);
+    vm_set_pte(vm, pd_top, 511, HUGE_PAGE_SIZE | rw | PTE_LARGE);       // 2 MB stack page
+    vm_set_cr3(vm, pml4);
+    vm_run(vm);
+
+    bool ok = cpu->registers[RAX] == pml4;
+    for (uint64_t k = 0; k < 64; k++) {
+        uint64_t value;
+        memcpy(&value, (uint8_t*)vm->memory + (1ull << 30) + k * PAGING_STRIDE, 8);
+        ok &= value == PAGING_PASSES * (64 - k);
+    }
+    printf("Paged guest: %llu MB of guest memory on %s, %zu KB resident, results %s\n",
+           PAGING_MEMORY >> 20, vm->backing, vm_resident_bytes(vm) >> 10, ok ? "correct" : "WRONG");
+    printf("TLB: %lu lookups, %lu misses, %.2f%% hit rate\n", cpu->tlb_lookups, cpu->tlb_misses,
+           cpu->tlb_lookups ? 100.0 * (cpu->tlb_lookups - cpu->tlb_misses) / cpu->tlb_lookups : 0.0);
+    vm_destroy(vm);
+}
+
+// Self-modifying guest: the store rewrites the immediate of the mov
+// that follows it in the same block, so the block must be retranslated.
+//   mov ebx, 19; mov rcx, 0xc300000002; mov [rbx], rcx
+//   mov eax, 1 (patched to mov eax, 2; ret)
+//   ret
+static void vm_demo_self_modifying(void) {
+    static const uint8_t program[] = {
+        0xbb, 0x13, 0x00, 0x00, 0x00,                                // mov ebx, 19
+        0x48, 0xb9, 0x02, 0x00, 0x00, 0x00, 0xc3, 0x00, 0x00, 0x00,  // mov rcx, imm64
+        0x48, 0x89, 0x0b,                                            // mov [rbx], rcx
+        0xb8, 0x01, 0x00, 0x00, 0x00,                                // mov eax, 1
+        0xc3                                                         // ret
+    };
+
+    VirtualMachine* vm = vm_create(1024 * 1024);
+    if (!vm) return;
+    vm_load_binary(vm, program, sizeof(program), 0);
+    vm_run(vm);
+    printf("Self-modifying code: RAX = %lu (expected 2), %lu blocks invalidated\n",
+           vm->vcpus[0]->registers[RAX], vm->vcpus[0]->blocks_invalidated);
+    vm_destroy(vm);
+}
+
+// Guest with a slow start: it fills a 1 MB table and halts, which is
+// where it is snapshotted. Clones resume after the HLT, sum the table
+// and store the sum, so each one reads every table page and writes one.
+//   mov ebx, 0x100000; mov ecx, 0x20000
+//   fill: mov [rbx], rcx; add rbx, 8; sub rcx, 1; jne fill
+//   hlt
+//   mov ebx, 0x100000; mov ecx, 0x20000; xor rax, rax
+//   sum: mov rdx, [rbx]; add rax, rdx; add rbx, 8; sub rcx, 1; jne sum
+//   mov ebx, 0x300000; mov [rbx], rax; ret
+#define SNAPSHOT_VM_MEMORY (64u << 20)
+#define SNAPSHOT_CLONES 32
+#define SNAPSHOT_RESULT 0x300000
+static const uint8_t snapshot_program[] = {
+    0xbb, 0x00, 0x00, 0x10, 0x00,               // mov ebx, 0x100000
+    0xb9, 0x00, 0x00, 0x02, 0x00,               // mov ecx, 0x20000
+    0x48, 0x89, 0x0b,                           // fill: mov [rbx], rcx
+    0x48, 0x83, 0xc3, 0x08,                     // add rbx, 8
+    0x48, 0x83, 0xe9, 0x01,                     // sub rcx, 1
+    0x75, 0xf3,                                 // jne fill
+    0xf4,                                       // hlt
+    0xbb, 0x00, 0x00, 0x10, 0x00,               // mov ebx, 0x100000
+    0xb9, 0x00, 0x00, 0x02, 0x00,               // mov ecx, 0x20000
+    0x48, 0x31, 0xc0,                           // xor rax, rax
+    0x48, 0x8b, 0x13,                           // sum: mov rdx, [rbx]
+    0x48, 0x01, 0xd0,                           // add rax, rdx
+    0x48, 0x83, 0xc3, 0x08,                     // add rbx, 8
+    0x48, 0x83, 0xe9, 0x01,                     // sub rcx, 1
+    0x75, 0xf0,                                 // jne sum
+    0xbb, 0x00, 0x00, 0x30, 0x00,               // mov ebx, 0x300000
+    0x48, 0x89, 0x03,                           // mov [rbx], rax
+    0xc3                                        // ret
+};
+
+// Resident KB of guest memory, and how much of it is this VM's own copy
+// rather than shared with the page cache and other clones
+static bool vm_memory_usage(VirtualMachine* vm, size_t* resident_kb, size_t* private_kb) {
+    FILE* f = fopen("/proc/self/smaps", "r");
+    if (!f) return false;
+    char line[256];
+    bool in_vm = false, found = false;
+    *resident_kb = *private_kb = 0;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long start, end;
+        size_t kb;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            in_vm = start == (uintptr_t)vm->memory;
+            found |= in_vm;
+        } else if (in_vm && sscanf(line, "Rss: %zu", &kb) == 1) {
+            *resident_kb = kb;
+        } else if (in_vm && sscanf(line, "Private_Dirty: %zu", &kb) == 1) {
+            *private_kb = kb;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+static void vm_demo_snapshot(void) {
+    const uint64_t expected = 0x20000ull * (0x20000 + 1) / 2;
+    char path[] = "/tmp/vm-snapshot-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Failed to create a snapshot file\n");
+        return;
+    }
+    close(fd);
+
+    // Cold start: boot a VM and run it to the point it is snapshotted
+    uint64_t start = trace_clock_ns();
+    VirtualMachine* vm = vm_create(SNAPSHOT_VM_MEMORY);
+    if (!vm) {
+        unlink(path);
+        return;
+    }
+    vm_load_binary(vm, snapshot_program, sizeof(snapshot_program), 0);
+    vm_run(vm);
+    uint64_t boot_ns = trace_clock_ns() - start;
+    bool saved = vm_snapshot(vm, path);
+    vm_destroy(vm);
+    VmSnapshot* snap = saved ? vm_snapshot_open(path) : NULL;
+    unlink(path);  // Clones keep the file alive through their mappings
+    if (!snap) {
+        printf("Failed to save the snapshot\n");
+        return;
+    }
+    struct stat st;
+    fstat(snap->fd, &st);
+
+    VirtualMachine* clones[SNAPSHOT_CLONES];
+    uint64_t total_ns = 0, min_ns = UINT64_MAX;
+    uint32_t count = 0, correct = 0;
+    for (; count < SNAPSHOT_CLONES; count++) {
+        start = trace_clock_ns();
+        clones[count] = vm_clone(snap);
+        uint64_t ns = trace_clock_ns() - start;
+        if (!clones[count]) break;
+        total_ns += ns;
+        if (ns < min_ns) min_ns = ns;
+        vm_resume(clones[count]);
+        uint64_t stored;
+        memcpy(&stored, (uint8_t*)clones[count]->memory + SNAPSHOT_RESULT, 8);
+        correct += clones[count]->vcpus[0]->registers[RAX] == expected && stored == expected;
+    }
+
+    // Measured with every clone alive, so the pages they share are mapped
+    // by all of them
+    size_t resident_kb = 0, private_kb = 0;
+    bool usage = count && vm_memory_usage(clones[count - 1], &resident_kb, &private_kb);
+    printf("Snapshot: %u MB guest, %lld KB on disk; cold start %.1f us\n",
+           SNAPSHOT_VM_MEMORY >> 20, (long long)st.st_blocks * 512 / 1024, boot_ns / 1e3);
+    if (count) {
+        printf("Clones: %u, %u correct, clone latency %.1f us average, %.1f us best\n",
+               count, correct, total_ns / 1e3 / count, min_ns / 1e3);
+    }
+    if (usage) {
+        printf("Per clone: %zu KB of guest memory resident, %zu KB shared, %zu KB private\n",
+               resident_kb, resident_kb - private_kb, private_kb);
+    }
+    for (uint32_t i = 0; i < count; i++) vm_destroy(clones[i]);
+    vm_snapshot_close(snap);
+}
+
+// Cross-model benchmark suite (bench.h). A context switch is a world
+// switch: entering the guest and coming back out of it. A system call is
+// a guest OUT, which leaves compiled code for the emulator every time.
+//   loop: out 0x80, eax; sub rcx, 1; jne loop; ret
+static const uint8_t bench_exit_program[] = {
+    0xe7, 0x80,                                 // loop: out 0x80, eax
+    0x48, 0x83, 0xe9, 0x01,                     // sub rcx, 1
+    0x75, 0xf8,                                 // jne loop
+    0xc3                                        // ret
+};
+
+static uint64_t bench_world_switch(void* ctx, uint32_t n) {
+    VirtualMachine* vm = ctx;
+    for (uint32_t i = 0; i < n; i++) vm_run(vm);
+    return 2ull * n;
+}
+
+static uint64_t bench_guest_exit(void* ctx, uint32_t n) {
+    VirtualMachine* vm = ctx;
+    vm->vcpus[0]->registers[RCX] = n;
+    vm_run(vm);
+    return vm->vcpus[0]->registers[RCX] == 0 ? n : 0;
+}
+
+int run_benchmark_suite(void) {
+    static const uint8_t ret_program[] = { 0xc3 };
+    VirtualMachine* entry = vm_create(1024 * 1024);
+    VirtualMachine* exits = vm_create(1024 * 1024);
+    if (!entry || !exits ||
+        !vm_load_binary(entry, ret_program, sizeof(ret_program), 0) ||
+        !vm_load_binary(exits, bench_exit_program, sizeof(bench_exit_program), 0)) {
+        if (entry) vm_destroy(entry);
+        if (exits) vm_destroy(exits);
+        return 1;
+    }
+
+    bench_begin("vm");
+    bench_run(BENCH_CONTEXT_SWITCH, "vm_entry_exit", bench_world_switch, entry, 0);
+    bench_run(BENCH_SYSCALL_DISPATCH, "guest_out_exit", bench_guest_exit, exits, 0);
+    vm_destroy(entry);
+    vm_destroy(exits);
+    return bench_end();
+}
+
+// "bench" runs only the benchmark suite
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) return run_benchmark_suite();
+
     // Create a VM with 1MB of memory
     VirtualMachine* vm = vm_create(1024 * 1024);
     if (!vm) {
@@ -108,9 +2738,22 @@ int main() {
     }
 
     // Run the VM
+    vm->trace = true;
     vm_run(vm);
 
     // Clean up
     vm_destroy(vm);
+
+    vm_demo_self_modifying();
+    vm_demo_smp();
+    vm_demo_paging(0);
+    vm_demo_paging(VM_HUGE_PAGES);
+    vm_demo_snapshot();
+    printf("\nRunning dispatch benchmark...\n");
+    vm_benchmark_dispatch();
+    printf("\nRunning SMP scaling benchmark...\n");
+    vm_benchmark_smp();
+    printf("\n=== Trace Metrics ===\n");
+    trace_report();
     return 0;
-}
\ No newline at end of file
+}